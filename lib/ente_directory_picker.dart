@@ -1,6 +1,11 @@
 
+import 'dart:typed_data';
+
 import 'ente_directory_picker_platform_interface.dart';
 
+export 'ente_directory_picker_platform_interface.dart'
+    show DirectoryEntryType, DirectorySortKey, WriteDurability;
+
 class EnteDirectoryPicker {
   Future<String?> getPlatformVersion() {
     return EnteDirectoryPickerPlatform.instance.getPlatformVersion();
@@ -18,6 +23,12 @@ class EnteDirectoryPicker {
     return EnteDirectoryPickerPlatform.instance.hasPermission(directoryPath);
   }
 
+  /// Check write permission for several directories in one call (Linux)
+  /// Returns a map from each path to whether it is a writable directory
+  Future<Map<String, bool>> hasPermissions(List<String> directoryPaths) {
+    return EnteDirectoryPickerPlatform.instance.hasPermissions(directoryPaths);
+  }
+
   /// Request permission to write to a directory (Android specific)
   /// Returns true if permission is granted, false otherwise
   Future<bool> requestPermission(String directoryPath) {
@@ -26,8 +37,91 @@ class EnteDirectoryPicker {
 
   /// Write content to a file in the specified directory
   /// Returns true if successful, false otherwise
-  Future<bool> writeFile(String directoryPath, String fileName, String content) {
-    return EnteDirectoryPickerPlatform.instance.writeFile(directoryPath, fileName, content);
+  /// Use [durability] to trade write throughput against crash safety (Linux)
+  /// With [writeBehind] the write is queued natively and the call returns
+  /// immediately, or once the queue has caught up when it is full; use
+  /// [flush] to wait for it and observe failures (Linux)
+  /// [expectedSize] reserves disk space for a file that will grow to that size,
+  /// and [sparse] stores runs of zero blocks as holes (Linux)
+  Future<bool> writeFile(String directoryPath, String fileName, String content,
+      {WriteDurability durability = WriteDurability.data,
+      bool writeBehind = false,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.writeFile(directoryPath, fileName, content,
+        durability: durability, writeBehind: writeBehind, expectedSize: expectedSize, sparse: sparse,
+        requestId: requestId);
+  }
+
+  /// Write binary content, such as an exported video, to a file (Linux)
+  /// Large files are preallocated so they are laid out contiguously and a full
+  /// disk is reported up front as an INSUFFICIENT_SPACE PlatformException
+  /// Returns true if successful, false otherwise
+  Future<bool> writeFileBytes(String directoryPath, String fileName, Uint8List bytes,
+      {WriteDurability durability = WriteDurability.data,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.writeFileBytes(directoryPath, fileName, bytes,
+        durability: durability, expectedSize: expectedSize, sparse: sparse, requestId: requestId);
+  }
+
+  /// Append data to the end of a file, creating it if needed (Linux)
+  /// The file stays open natively, so repeated appends to a log cost a
+  /// single write each instead of reading and rewriting the whole file
+  /// Returns true if successful, false otherwise
+  Future<bool> appendToFile(String directoryPath, String fileName, String data,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) {
+    return EnteDirectoryPickerPlatform.instance.appendToFile(directoryPath, fileName, data,
+        durability: durability, expectedSize: expectedSize);
+  }
+
+  /// Append several records to the end of a file with one vectored write (Linux)
+  /// Records are written as-is and in order; include separators such as '\n'
+  /// Returns true if successful, false otherwise
+  Future<bool> appendRecords(String directoryPath, String fileName, List<String> records,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) {
+    return EnteDirectoryPickerPlatform.instance.appendRecords(directoryPath, fileName, records,
+        durability: durability, expectedSize: expectedSize);
+  }
+
+  /// Wait until all write-behind writes have reached the file system
+  /// Returns true if they all succeeded, throws a PlatformException otherwise
+  Future<bool> flush() {
+    return EnteDirectoryPickerPlatform.instance.flush();
+  }
+
+  /// Write several files (file name to content) to the specified directory
+  /// The batch is flushed to disk once rather than once per file (Linux)
+  /// Returns true if all files were written, false otherwise
+  Future<bool> writeFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.writeFiles(directoryPath, files,
+        durability: durability, requestId: requestId);
+  }
+
+  /// Copy the file at [sourcePath] into [directoryPath] as [fileName] (Linux)
+  /// The copy shares blocks with the source on file systems with reflinks and
+  /// is done in the kernel where possible. Readers see either the old file or
+  /// the complete copy. Returns true if successful, false otherwise
+  Future<bool> copyFile(String sourcePath, String directoryPath, String fileName,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.copyFile(sourcePath, directoryPath, fileName,
+        durability: durability, requestId: requestId);
+  }
+
+  /// Copy each source path in [files] into [directoryPath] under its file
+  /// name, skipping files the directory already holds (Linux)
+  /// A manifest kept in the directory records the size, mtime and content hash
+  /// of every file exported there, so exporting the same library again only
+  /// copies what was added or changed. Sources whose size and mtime are
+  /// unchanged are skipped without being read. Returns a map with 'copied'
+  /// and 'skipped'
+  Future<Map<String, int>> exportFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.exportFiles(directoryPath, files,
+        durability: durability, requestId: requestId);
   }
 
   /// Generate a timestamp-based filename
@@ -40,24 +134,74 @@ class EnteDirectoryPicker {
 
   /// Convenience method to write a timestamped file with current time as content
   /// Returns true if successful, false otherwise
-  Future<bool> writeTimestampFile(String directoryPath) async {
+  /// Set [writeBehind] to keep the write off the caller's critical path
+  Future<bool> writeTimestampFile(String directoryPath, {bool writeBehind = false}) async {
     final now = DateTime.now();
     final fileName = generateTimestampFilename();
     final content = now.toString();
-    return await writeFile(directoryPath, fileName, content);
+    return await writeFile(directoryPath, fileName, content, writeBehind: writeBehind);
   }
 
   /// List contents of a directory
   /// Returns a list of file and directory names
   /// Set recursive to true to include subdirectory contents
-  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false}) {
-    return EnteDirectoryPickerPlatform.instance.listDirectory(directoryPath, recursive: recursive);
+  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.listDirectory(directoryPath,
+        recursive: recursive, requestId: requestId);
+  }
+
+  /// Find files under [root] matching any of the glob [patterns] (Linux)
+  /// Patterns containing '/' match the path relative to [root], others the
+  /// file name; '*' and '?' are the supported wildcards. Directories matching
+  /// [excludes] are skipped without being read. [maxDepth] limits how many
+  /// levels below [root] are searched (1 means only the entries directly in [root])
+  /// Returns sorted full paths of matching files, null if root is not a directory
+  Future<List<String>?> findFiles(String root, List<String> patterns,
+      {List<String> excludes = const [], int? maxDepth, bool includeDirectories = false,
+      String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.findFiles(root, patterns,
+        excludes: excludes, maxDepth: maxDepth, includeDirectories: includeDirectories,
+        requestId: requestId);
+  }
+
+  /// Search the contents of files under [root] for [query] (Linux)
+  /// Files are scanned natively in parallel and binary files are skipped.
+  /// [patterns] and [excludes] select files as in [findFiles]. Returns at most
+  /// [maxResults] maps with 'path', 'line' (1-based), 'offset' (byte offset of
+  /// the match) and 'text' (the matching line), null if root is not a directory
+  Future<List<Map<String, dynamic>>?> searchContent(String root, String query,
+      {List<String> patterns = const [], List<String> excludes = const [], int? maxDepth,
+      int maxResults = 1000, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.searchContent(root, query,
+        patterns: patterns, excludes: excludes, maxDepth: maxDepth, maxResults: maxResults,
+        requestId: requestId);
+  }
+
+  /// Build or refresh an on-disk index of every entry under [root] (Linux)
+  /// Later calls only re-read directories whose mtime has changed. The index is
+  /// kept in the user cache directory unless [indexPath] is given. Returns a map
+  /// with 'indexPath', 'entries', 'directories' and 'reusedDirectories', null if
+  /// root is not a directory
+  Future<Map<String, dynamic>?> indexDirectory(String root, {String? indexPath, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.indexDirectory(root,
+        indexPath: indexPath, requestId: requestId);
+  }
+
+  /// Find entries whose name starts with (or, with [substring], contains)
+  /// [query], ignoring case, using the index built by [indexDirectory] (Linux)
+  /// The tree itself is not touched. Returns up to [limit] maps with 'name',
+  /// 'path', 'isDirectory', 'size' and 'lastModified', null if root has no index
+  Future<List<Map<String, dynamic>>?> queryIndex(String root, String query,
+      {bool substring = false, int limit = 100, String? indexPath}) {
+    return EnteDirectoryPickerPlatform.instance.queryIndex(root, query,
+        substring: substring, limit: limit, indexPath: indexPath);
   }
 
   /// Read content from a file
   /// Returns file content as string, null if error or file not found
-  Future<String?> readFile(String filePath) {
-    return EnteDirectoryPickerPlatform.instance.readFile(filePath);
+  /// A read started with a [requestId] can be abandoned with [cancel] (Linux)
+  Future<String?> readFile(String filePath, {String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.readFile(filePath, requestId: requestId);
   }
 
   /// Get detailed information about directory contents including file sizes, types, etc.
@@ -67,12 +211,178 @@ class EnteDirectoryPicker {
   /// - 'isDirectory': true if it's a directory
   /// - 'size': file size in bytes (directories have size 0)
   /// - 'lastModified': last modification timestamp
-  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath, {bool recursive = false}) {
-    return EnteDirectoryPickerPlatform.instance.getDirectoryDetails(directoryPath, recursive: recursive);
+  /// A listing started with a [requestId] can be abandoned with [cancel] (Linux)
+  /// On Linux the listing can be filtered, sorted and cut short before it is
+  /// sent back, so that only the entries to be shown cross the channel:
+  /// - [entryType] keeps only files or only directories
+  /// - [extensions] (such as 'jpg', any case), [minSize] and [maxSize] keep
+  ///   the files that match; directories are kept regardless
+  /// - [modifiedAfter] and [modifiedBefore] keep entries modified within
+  ///   that range, both ends included
+  /// - [sortBy] orders what is left, in [descending] order if set
+  /// - [limit] keeps the first entries after sorting, such as the 100
+  ///   largest files with sortBy size and descending; only those are sorted
+  /// - [sortKeys] adds 'sortKey' to each entry, an integer giving its place
+  ///   in [DirectorySortKey.naturalName] order, so a view can re-sort the
+  ///   entries itself by comparing integers. Keys are only comparable within
+  ///   one result
+  /// Natural order needs a collation key per name; the keys of recently
+  /// listed directories are cached, and recomputed only once a new name
+  /// appears in them
+  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath,
+      {bool recursive = false,
+      String? requestId,
+      DirectorySortKey? sortBy,
+      bool descending = false,
+      DirectoryEntryType? entryType,
+      List<String>? extensions,
+      int? minSize,
+      int? maxSize,
+      DateTime? modifiedAfter,
+      DateTime? modifiedBefore,
+      int? limit,
+      bool sortKeys = false}) {
+    return EnteDirectoryPickerPlatform.instance.getDirectoryDetails(directoryPath,
+        recursive: recursive,
+        requestId: requestId,
+        sortBy: sortBy,
+        descending: descending,
+        entryType: entryType,
+        extensions: extensions,
+        minSize: minSize,
+        maxSize: maxSize,
+        modifiedAfter: modifiedAfter,
+        modifiedBefore: modifiedBefore,
+        limit: limit,
+        sortKeys: sortKeys);
+  }
+
+  /// Read the tree under [directoryPath] down to [depth] levels below it (Linux)
+  /// Returns the root node, a map with 'name', 'path', 'isDirectory', 'size',
+  /// 'childCount', 'handle' and 'children'. 'children' lists the nodes one
+  /// level down, sorted by name, and is null for files and for directories at
+  /// the last level, whose entries are counted in 'childCount' but not read.
+  /// Pass a directory's 'handle' to [expandTreeNode] to read below it later,
+  /// so a tree view opens after reading one or two levels of a huge folder.
+  /// 'size' is the file size; for a directory it is null, or with
+  /// [aggregateSizes] the total size of the files anywhere below it, which
+  /// walks the whole tree. Symbolic links are listed but not followed.
+  /// Returns null if directoryPath is not a directory. A call started with a
+  /// [requestId] can be abandoned with [cancel]
+  Future<Map<String, dynamic>?> getTreeNodes(String directoryPath,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.getTreeNodes(directoryPath,
+        depth: depth, aggregateSizes: aggregateSizes, requestId: requestId);
+  }
+
+  /// Read the tree below a directory node from [getTreeNodes] (Linux)
+  /// [handle] is the node's 'handle'; the result is that node, read afresh
+  /// as by getTreeNodes with the same [depth] and [aggregateSizes]. Handles
+  /// stay valid across calls and restarts, but not once the directory is
+  /// deleted or replaced, which returns null
+  Future<Map<String, dynamic>?> expandTreeNode(String handle,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.expandTreeNode(handle,
+        depth: depth, aggregateSizes: aggregateSizes, requestId: requestId);
+  }
+
+  /// Start loading [paths] into the page cache, so that reading them later,
+  /// such as the next photos in a gallery, does not wait on the disk (Linux)
+  /// The reads run at idle I/O priority, and the call completes once they are
+  /// queued rather than done, so there is no need to await it. Returns the
+  /// number of files that could be opened
+  Future<int> prefetchFiles(List<String> paths) {
+    return EnteDirectoryPickerPlatform.instance.prefetchFiles(paths);
+  }
+
+  /// Drop [paths] from the page cache, such as files just exported, so they
+  /// stop pushing out data that will be read again (Linux)
+  /// Unwritten changes to the files are written first. Returns the number of
+  /// files that could be opened
+  Future<int> evictFiles(List<String> paths) {
+    return EnteDirectoryPickerPlatform.instance.evictFiles(paths);
+  }
+
+  /// Read the metadata of the images at [paths] from their headers (Linux)
+  /// Only the first few KB of each file are read, many files at a time, so a
+  /// gallery can lay out and date photos before decoding any. JPEG, PNG, WebP,
+  /// HEIF and AVIF are understood. Returns a map from path to a map with
+  /// 'format' (such as 'jpeg' or 'heif'), 'width' and 'height' (as stored),
+  /// 'orientation' (the EXIF value, 1 to 8) and 'captureTime' (ISO 8601, with
+  /// the UTC offset when the camera recorded one); fields the file does not
+  /// record are null. Paths that cannot be read or are not images are left out.
+  /// A call started with a [requestId] can be abandoned with [cancel]
+  Future<Map<String, Map<String, dynamic>>> getMediaMetadata(List<String> paths,
+      {String? requestId}) {
+    return EnteDirectoryPickerPlatform.instance.getMediaMetadata(paths, requestId: requestId);
+  }
+
+  /// Describe the file system holding [path] (Linux)
+  /// Each mount is probed once; the plugin uses the same profile to pick how it
+  /// writes, copies and scans. Returns a map with 'fileSystem' (such as 'ext4'
+  /// or 'nfs'), 'isNetwork', 'isFuse', 'supportsTmpfile', 'supportsReflink',
+  /// 'supportsCopyFileRange', 'supportsFallocate', 'supportsIoUring',
+  /// 'freeBytes' and 'totalBytes', null if path does not exist
+  Future<Map<String, dynamic>?> getFilesystemCapabilities(String path) {
+    return EnteDirectoryPickerPlatform.instance.getFilesystemCapabilities(path);
+  }
+
+  /// Get performance counters for each method called on the plugin (Linux)
+  /// Returns a map from method name to a map with 'calls', 'errors', the
+  /// latency percentiles 'p50Us', 'p95Us' and 'p99Us' and the maximum 'maxUs'
+  /// (in microseconds), 'bytesRead', 'bytesWritten' and 'entries' (directory
+  /// entries enumerated). Counters cover the whole process since the last reset
+  Future<Map<String, Map<String, int>>> getStats() {
+    return EnteDirectoryPickerPlatform.instance.getStats();
+  }
+
+  /// Reset the counters returned by [getStats] (Linux)
+  /// Returns true if successful
+  Future<bool> resetStats() {
+    return EnteDirectoryPickerPlatform.instance.resetStats();
+  }
+
+  /// Start writing a trace of each method call to [path] (Linux)
+  /// The file holds Chrome trace events, which Perfetto and chrome://tracing
+  /// open. Each call is split into phases such as 'validate', 'filesystem'
+  /// and 'respond', tagged with the native thread that ran them. Tracing can
+  /// also be turned on at startup with the ENTE_DIRECTORY_PICKER_TRACE
+  /// environment variable. Returns true if successful
+  Future<bool> startTracing(String path) {
+    return EnteDirectoryPickerPlatform.instance.startTracing(path);
+  }
+
+  /// Stop tracing and finish the trace file (Linux)
+  /// Returns true if successful
+  Future<bool> stopTracing() {
+    return EnteDirectoryPickerPlatform.instance.stopTracing();
+  }
+
+  /// Stop the running call that was started with [requestId] (Linux)
+  /// readFile, getDirectoryDetails, getTreeNodes, expandTreeNode,
+  /// listDirectory, findFiles, searchContent, indexDirectory, getMediaMetadata,
+  /// writeFile, writeFileBytes, writeFiles, copyFile and exportFiles accept a
+  /// requestId. The cancelled call stops within milliseconds and fails with a
+  /// CANCELLED PlatformException; writes that are cancelled leave their
+  /// targets untouched. Returns true if a running call had that id
+  Future<bool> cancel(String requestId) {
+    return EnteDirectoryPickerPlatform.instance.cancel(requestId);
+  }
+
+  /// Progress of running calls that were made with a requestId (Linux)
+  /// Only calls started while the stream has a listener report progress.
+  /// Events are maps with 'requestId', 'method', 'itemsDone', 'itemsTotal',
+  /// 'bytesDone', 'bytesTotal' (totals are 0 while unknown, as during a scan),
+  /// 'currentPath' and 'done'. They arrive at most 10 times a second per call,
+  /// and a final event with 'done' set comes just before the call returns
+  Stream<Map<String, dynamic>> get progress {
+    return EnteDirectoryPickerPlatform.instance.progress;
   }
 
   /// Convenience method to explore a directory and get a tree-like structure
   /// Returns a nested map representing the directory tree
+  /// The whole tree is read before this returns; on Linux, [getTreeNodes]
+  /// reads only the levels being shown
   Future<Map<String, dynamic>?> getDirectoryTree(String directoryPath) async {
     final details = await getDirectoryDetails(directoryPath, recursive: true);
     if (details == null) return null;
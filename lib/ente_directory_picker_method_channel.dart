@@ -9,6 +9,14 @@ class MethodChannelEnteDirectoryPicker extends EnteDirectoryPickerPlatform {
   @visibleForTesting
   final methodChannel = const MethodChannel('ente_directory_picker');
 
+  /// The event channel on which the native side reports progress.
+  @visibleForTesting
+  final progressChannel = const EventChannel('ente_directory_picker/progress');
+
+  late final Stream<Map<String, dynamic>> _progress = progressChannel
+      .receiveBroadcastStream()
+      .map((event) => Map<String, dynamic>.from(event as Map));
+
   @override
   Future<String?> getPlatformVersion() async {
     final version = await methodChannel.invokeMethod<String>('getPlatformVersion');
@@ -30,6 +38,15 @@ class MethodChannelEnteDirectoryPicker extends EnteDirectoryPickerPlatform {
     return result ?? false;
   }
 
+  @override
+  Future<Map<String, bool>> hasPermissions(List<String> directoryPaths) async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'hasPermissions',
+      {'directoryPaths': directoryPaths},
+    );
+    return result?.cast<String, bool>() ?? {};
+  }
+
   @override
   Future<bool> requestPermission(String directoryPath) async {
     final result = await methodChannel.invokeMethod<bool>(
@@ -40,48 +57,379 @@ class MethodChannelEnteDirectoryPicker extends EnteDirectoryPickerPlatform {
   }
 
   @override
-  Future<bool> writeFile(String directoryPath, String fileName, String content) async {
+  Future<bool> writeFile(String directoryPath, String fileName, String content,
+      {WriteDurability durability = WriteDurability.data,
+      bool writeBehind = false,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) async {
     final result = await methodChannel.invokeMethod<bool>(
       'writeFile',
       {
         'directoryPath': directoryPath,
         'fileName': fileName,
         'content': content,
+        'durability': durability.name,
+        'writeBehind': writeBehind,
+        'expectedSize': expectedSize,
+        'sparse': sparse,
+        'requestId': requestId,
+      },
+    );
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> writeFileBytes(String directoryPath, String fileName, Uint8List bytes,
+      {WriteDurability durability = WriteDurability.data,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) async {
+    final result = await methodChannel.invokeMethod<bool>(
+      'writeFileBytes',
+      {
+        'directoryPath': directoryPath,
+        'fileName': fileName,
+        'content': bytes,
+        'durability': durability.name,
+        'expectedSize': expectedSize,
+        'sparse': sparse,
+        'requestId': requestId,
+      },
+    );
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> appendToFile(String directoryPath, String fileName, String data,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) async {
+    final result = await methodChannel.invokeMethod<bool>(
+      'appendToFile',
+      {
+        'directoryPath': directoryPath,
+        'fileName': fileName,
+        'data': data,
+        'durability': durability.name,
+        'expectedSize': expectedSize,
+      },
+    );
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> appendRecords(String directoryPath, String fileName, List<String> records,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) async {
+    final result = await methodChannel.invokeMethod<bool>(
+      'appendRecords',
+      {
+        'directoryPath': directoryPath,
+        'fileName': fileName,
+        'records': records,
+        'durability': durability.name,
+        'expectedSize': expectedSize,
       },
     );
     return result ?? false;
   }
 
   @override
-  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false}) async {
+  Future<bool> flush() async {
+    final result = await methodChannel.invokeMethod<bool>('flush');
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> writeFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) async {
+    final result = await methodChannel.invokeMethod<bool>(
+      'writeFiles',
+      {
+        'directoryPath': directoryPath,
+        'files': files,
+        'durability': durability.name,
+        'requestId': requestId,
+      },
+    );
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> copyFile(String sourcePath, String directoryPath, String fileName,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) async {
+    final result = await methodChannel.invokeMethod<bool>(
+      'copyFile',
+      {
+        'sourcePath': sourcePath,
+        'directoryPath': directoryPath,
+        'fileName': fileName,
+        'durability': durability.name,
+        'requestId': requestId,
+      },
+    );
+    return result ?? false;
+  }
+
+  @override
+  Future<Map<String, int>> exportFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'exportFiles',
+      {
+        'directoryPath': directoryPath,
+        'files': files,
+        'durability': durability.name,
+        'requestId': requestId,
+      },
+    );
+    return Map<String, int>.from(result ?? {});
+  }
+
+  @override
+  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false, String? requestId}) async {
     final result = await methodChannel.invokeMethod<List<dynamic>>(
       'listDirectory',
       {
         'directoryPath': directoryPath,
         'recursive': recursive,
+        'requestId': requestId,
       },
     );
     return result?.cast<String>();
   }
 
   @override
-  Future<String?> readFile(String filePath) async {
+  Future<List<String>?> findFiles(String root, List<String> patterns,
+      {List<String> excludes = const [], int? maxDepth, bool includeDirectories = false,
+      String? requestId}) async {
+    final result = await methodChannel.invokeMethod<List<dynamic>>(
+      'findFiles',
+      {
+        'root': root,
+        'patterns': patterns,
+        'excludes': excludes,
+        'maxDepth': maxDepth,
+        'includeDirectories': includeDirectories,
+        'requestId': requestId,
+      },
+    );
+    return result?.cast<String>();
+  }
+
+  @override
+  Future<List<Map<String, dynamic>>?> searchContent(String root, String query,
+      {List<String> patterns = const [], List<String> excludes = const [], int? maxDepth,
+      int maxResults = 1000, String? requestId}) async {
+    final result = await methodChannel.invokeMethod<List<dynamic>>(
+      'searchContent',
+      {
+        'root': root,
+        'query': query,
+        'patterns': patterns,
+        'excludes': excludes,
+        'maxDepth': maxDepth,
+        'maxResults': maxResults,
+        'requestId': requestId,
+      },
+    );
+    return result?.map((item) => Map<String, dynamic>.from(item as Map)).toList();
+  }
+
+  @override
+  Future<Map<String, dynamic>?> indexDirectory(String root, {String? indexPath, String? requestId}) async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'indexDirectory',
+      {
+        'root': root,
+        'indexPath': indexPath,
+        'requestId': requestId,
+      },
+    );
+    return result == null ? null : Map<String, dynamic>.from(result);
+  }
+
+  @override
+  Future<List<Map<String, dynamic>>?> queryIndex(String root, String query,
+      {bool substring = false, int limit = 100, String? indexPath}) async {
+    final result = await methodChannel.invokeMethod<List<dynamic>>(
+      'queryIndex',
+      {
+        'root': root,
+        'query': query,
+        'substring': substring,
+        'limit': limit,
+        'indexPath': indexPath,
+      },
+    );
+    return result?.map((item) => Map<String, dynamic>.from(item as Map)).toList();
+  }
+
+  @override
+  Future<String?> readFile(String filePath, {String? requestId}) async {
     final result = await methodChannel.invokeMethod<String>(
       'readFile',
-      {'filePath': filePath},
+      {
+        'filePath': filePath,
+        'requestId': requestId,
+      },
     );
     return result;
   }
 
   @override
-  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath, {bool recursive = false}) async {
+  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath,
+      {bool recursive = false,
+      String? requestId,
+      DirectorySortKey? sortBy,
+      bool descending = false,
+      DirectoryEntryType? entryType,
+      List<String>? extensions,
+      int? minSize,
+      int? maxSize,
+      DateTime? modifiedAfter,
+      DateTime? modifiedBefore,
+      int? limit,
+      bool sortKeys = false}) async {
     final result = await methodChannel.invokeMethod<List<dynamic>>(
       'getDirectoryDetails',
       {
         'directoryPath': directoryPath,
         'recursive': recursive,
+        'requestId': requestId,
+        'sortBy': sortBy?.name,
+        'descending': descending,
+        'entryType': entryType?.name,
+        'extensions': extensions,
+        'minSize': minSize,
+        'maxSize': maxSize,
+        'modifiedAfter': modifiedAfter?.millisecondsSinceEpoch,
+        'modifiedBefore': modifiedBefore?.millisecondsSinceEpoch,
+        'limit': limit,
+        'sortKeys': sortKeys,
       },
     );
     return result?.map((item) => Map<String, dynamic>.from(item as Map)).toList();
   }
+
+  @override
+  Future<Map<String, dynamic>?> getTreeNodes(String directoryPath,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'getTreeNodes',
+      {
+        'directoryPath': directoryPath,
+        'depth': depth,
+        'aggregateSizes': aggregateSizes,
+        'requestId': requestId,
+      },
+    );
+    return result == null ? null : _treeNode(result);
+  }
+
+  @override
+  Future<Map<String, dynamic>?> expandTreeNode(String handle,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'expandTreeNode',
+      {
+        'handle': handle,
+        'depth': depth,
+        'aggregateSizes': aggregateSizes,
+        'requestId': requestId,
+      },
+    );
+    return result == null ? null : _treeNode(result);
+  }
+
+  Map<String, dynamic> _treeNode(Map<dynamic, dynamic> node) {
+    final children = node['children'] as List<dynamic>?;
+    return {
+      ...Map<String, dynamic>.from(node),
+      'children': children?.map((child) => _treeNode(child as Map)).toList(),
+    };
+  }
+
+  @override
+  Future<int> prefetchFiles(List<String> paths) async {
+    final result = await methodChannel.invokeMethod<int>(
+      'prefetchFiles',
+      {'paths': paths},
+    );
+    return result ?? 0;
+  }
+
+  @override
+  Future<int> evictFiles(List<String> paths) async {
+    final result = await methodChannel.invokeMethod<int>(
+      'evictFiles',
+      {'paths': paths},
+    );
+    return result ?? 0;
+  }
+
+  @override
+  Future<Map<String, Map<String, dynamic>>> getMediaMetadata(List<String> paths,
+      {String? requestId}) async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'getMediaMetadata',
+      {
+        'paths': paths,
+        'requestId': requestId,
+      },
+    );
+    return {
+      for (final entry in (result ?? {}).entries)
+        entry.key as String: Map<String, dynamic>.from(entry.value as Map),
+    };
+  }
+
+  @override
+  Future<Map<String, dynamic>?> getFilesystemCapabilities(String path) async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'getFilesystemCapabilities',
+      {'path': path},
+    );
+    return result == null ? null : Map<String, dynamic>.from(result);
+  }
+
+  @override
+  Future<Map<String, Map<String, int>>> getStats() async {
+    final result = await methodChannel.invokeMethod<Map<dynamic, dynamic>>('getStats');
+    return {
+      for (final entry in (result ?? {}).entries)
+        entry.key as String: Map<String, int>.from(entry.value as Map),
+    };
+  }
+
+  @override
+  Future<bool> resetStats() async {
+    final result = await methodChannel.invokeMethod<bool>('resetStats');
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> startTracing(String path) async {
+    final result = await methodChannel.invokeMethod<bool>(
+      'startTracing',
+      {'path': path},
+    );
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> stopTracing() async {
+    final result = await methodChannel.invokeMethod<bool>('stopTracing');
+    return result ?? false;
+  }
+
+  @override
+  Future<bool> cancel(String requestId) async {
+    final result = await methodChannel.invokeMethod<bool>(
+      'cancel',
+      {'requestId': requestId},
+    );
+    return result ?? false;
+  }
+
+  @override
+  Stream<Map<String, dynamic>> get progress => _progress;
 }
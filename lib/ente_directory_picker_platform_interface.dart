@@ -1,7 +1,49 @@
+import 'dart:typed_data';
+
 import 'package:plugin_platform_interface/plugin_platform_interface.dart';
 
 import 'ente_directory_picker_method_channel.dart';
 
+/// How hard a write pushes data to stable storage before it completes.
+///
+/// Only honoured on Linux; other platforms use their native defaults.
+enum WriteDurability {
+  /// Leave flushing to the operating system. Fastest, but recent writes can
+  /// be lost on power failure.
+  none,
+
+  /// Flush the file contents (`fdatasync`) before replacing the target.
+  data,
+
+  /// Flush the file and its parent directory so the new name survives a crash.
+  full,
+}
+
+/// What getDirectoryDetails sorts entries by.
+///
+/// Only honoured on Linux; other platforms return entries unsorted.
+enum DirectorySortKey {
+  /// File name, compared byte by byte.
+  name,
+
+  /// File name in natural order, as file managers show it: by the rules of
+  /// the user's locale, with numbers compared by value so "IMG_2" comes
+  /// before "IMG_10".
+  naturalName,
+
+  /// File size; entries of the same size are ordered by name.
+  size,
+
+  /// Last modification time; entries modified together are ordered by name.
+  lastModified,
+}
+
+/// The kind of entry getDirectoryDetails keeps when filtering by type.
+enum DirectoryEntryType {
+  file,
+  directory,
+}
+
 abstract class EnteDirectoryPickerPlatform extends PlatformInterface {
   /// Constructs a EnteDirectoryPickerPlatform.
   EnteDirectoryPickerPlatform() : super(token: _token);
@@ -39,6 +81,12 @@ abstract class EnteDirectoryPickerPlatform extends PlatformInterface {
     throw UnimplementedError('hasPermission() has not been implemented.');
   }
 
+  /// Check write permission for several directories in one call
+  /// Returns a map from each path to whether it is writable
+  Future<Map<String, bool>> hasPermissions(List<String> directoryPaths) {
+    throw UnimplementedError('hasPermissions() has not been implemented.');
+  }
+
   /// Request permission to write to a directory (Android specific)
   /// Returns true if permission is granted, false otherwise
   Future<bool> requestPermission(String directoryPath) {
@@ -47,25 +95,197 @@ abstract class EnteDirectoryPickerPlatform extends PlatformInterface {
 
   /// Write content to a file in the specified directory
   /// Returns true if successful, false otherwise
-  Future<bool> writeFile(String directoryPath, String fileName, String content) {
+  Future<bool> writeFile(String directoryPath, String fileName, String content,
+      {WriteDurability durability = WriteDurability.data,
+      bool writeBehind = false,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) {
     throw UnimplementedError('writeFile() has not been implemented.');
   }
 
+  /// Write binary content to a file in the specified directory
+  /// Returns true if successful, false otherwise
+  Future<bool> writeFileBytes(String directoryPath, String fileName, Uint8List bytes,
+      {WriteDurability durability = WriteDurability.data,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) {
+    throw UnimplementedError('writeFileBytes() has not been implemented.');
+  }
+
+  /// Append data to the end of a file, creating it if needed
+  /// Returns true if successful, false otherwise
+  Future<bool> appendToFile(String directoryPath, String fileName, String data,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) {
+    throw UnimplementedError('appendToFile() has not been implemented.');
+  }
+
+  /// Append several records to the end of a file in one write
+  /// Returns true if successful, false otherwise
+  Future<bool> appendRecords(String directoryPath, String fileName, List<String> records,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) {
+    throw UnimplementedError('appendRecords() has not been implemented.');
+  }
+
+  /// Wait until all write-behind writes have reached the file system
+  /// Returns true if they all succeeded, throws otherwise
+  Future<bool> flush() {
+    throw UnimplementedError('flush() has not been implemented.');
+  }
+
+  /// Write several files to the specified directory as one batch
+  /// Returns true if all files were written, false otherwise
+  Future<bool> writeFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) {
+    throw UnimplementedError('writeFiles() has not been implemented.');
+  }
+
+  /// Copy a file into the specified directory, replacing any file of that name
+  /// Returns true if successful, false otherwise
+  Future<bool> copyFile(String sourcePath, String directoryPath, String fileName,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) {
+    throw UnimplementedError('copyFile() has not been implemented.');
+  }
+
+  /// Copy files into a directory, skipping those it already holds
+  /// Returns a map with the number of files copied and skipped
+  Future<Map<String, int>> exportFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) {
+    throw UnimplementedError('exportFiles() has not been implemented.');
+  }
+
   /// List contents of a directory
   /// Returns a list of file and directory names, null if error
-  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false}) {
+  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false, String? requestId}) {
     throw UnimplementedError('listDirectory() has not been implemented.');
   }
 
+  /// Find files under a directory tree matching glob patterns
+  /// Returns full paths of matching entries, null if root is not a directory
+  Future<List<String>?> findFiles(String root, List<String> patterns,
+      {List<String> excludes = const [], int? maxDepth, bool includeDirectories = false,
+      String? requestId}) {
+    throw UnimplementedError('findFiles() has not been implemented.');
+  }
+
+  /// Search the contents of files under a directory tree for a string
+  /// Returns one map per matching line, null if root is not a directory
+  Future<List<Map<String, dynamic>>?> searchContent(String root, String query,
+      {List<String> patterns = const [], List<String> excludes = const [], int? maxDepth,
+      int maxResults = 1000, String? requestId}) {
+    throw UnimplementedError('searchContent() has not been implemented.');
+  }
+
+  /// Build or refresh the persistent filename index for a directory tree
+  /// Returns index statistics, null if root is not a directory
+  Future<Map<String, dynamic>?> indexDirectory(String root, {String? indexPath, String? requestId}) {
+    throw UnimplementedError('indexDirectory() has not been implemented.');
+  }
+
+  /// Look up entries by name in the index built by indexDirectory
+  /// Returns a list of entry maps, null if root has no index
+  Future<List<Map<String, dynamic>>?> queryIndex(String root, String query,
+      {bool substring = false, int limit = 100, String? indexPath}) {
+    throw UnimplementedError('queryIndex() has not been implemented.');
+  }
+
   /// Read content from a file
   /// Returns file content as string, null if error or file not found
-  Future<String?> readFile(String filePath) {
+  Future<String?> readFile(String filePath, {String? requestId}) {
     throw UnimplementedError('readFile() has not been implemented.');
   }
 
   /// Get detailed information about directory contents
   /// Returns a list of maps with file/directory details
-  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath, {bool recursive = false}) {
+  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath,
+      {bool recursive = false,
+      String? requestId,
+      DirectorySortKey? sortBy,
+      bool descending = false,
+      DirectoryEntryType? entryType,
+      List<String>? extensions,
+      int? minSize,
+      int? maxSize,
+      DateTime? modifiedAfter,
+      DateTime? modifiedBefore,
+      int? limit,
+      bool sortKeys = false}) {
     throw UnimplementedError('getDirectoryDetails() has not been implemented.');
   }
+
+  /// Read a directory tree down to a depth, with child counts and handles
+  /// Returns the root node, null if directoryPath is not a directory
+  Future<Map<String, dynamic>?> getTreeNodes(String directoryPath,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) {
+    throw UnimplementedError('getTreeNodes() has not been implemented.');
+  }
+
+  /// Read the tree below a directory node returned by getTreeNodes
+  /// Returns that node, null if its directory no longer exists
+  Future<Map<String, dynamic>?> expandTreeNode(String handle,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) {
+    throw UnimplementedError('expandTreeNode() has not been implemented.');
+  }
+
+  /// Start reading files into memory ahead of use
+  /// Returns the number of files that could be opened
+  Future<int> prefetchFiles(List<String> paths) {
+    throw UnimplementedError('prefetchFiles() has not been implemented.');
+  }
+
+  /// Drop files from memory that will not be read again soon
+  /// Returns the number of files that could be opened
+  Future<int> evictFiles(List<String> paths) {
+    throw UnimplementedError('evictFiles() has not been implemented.');
+  }
+
+  /// Read the size, orientation and capture time of images from their headers
+  /// Returns a map from path to that image's metadata
+  Future<Map<String, Map<String, dynamic>>> getMediaMetadata(List<String> paths,
+      {String? requestId}) {
+    throw UnimplementedError('getMediaMetadata() has not been implemented.');
+  }
+
+  /// Describe the file system holding a path
+  /// Returns a map of capabilities and space, null if path does not exist
+  Future<Map<String, dynamic>?> getFilesystemCapabilities(String path) {
+    throw UnimplementedError('getFilesystemCapabilities() has not been implemented.');
+  }
+
+  /// Get per-method call counts, latencies and I/O totals
+  /// Returns a map from method name to that method's counters
+  Future<Map<String, Map<String, int>>> getStats() {
+    throw UnimplementedError('getStats() has not been implemented.');
+  }
+
+  /// Reset the counters returned by getStats
+  /// Returns true if successful
+  Future<bool> resetStats() {
+    throw UnimplementedError('resetStats() has not been implemented.');
+  }
+
+  /// Start writing trace events for each method call to a file
+  /// Returns true if successful
+  Future<bool> startTracing(String path) {
+    throw UnimplementedError('startTracing() has not been implemented.');
+  }
+
+  /// Stop tracing and finish the trace file
+  /// Returns true if successful
+  Future<bool> stopTracing() {
+    throw UnimplementedError('stopTracing() has not been implemented.');
+  }
+
+  /// Cancel the running call that was made with a requestId
+  /// Returns true if a running call had that id
+  Future<bool> cancel(String requestId) {
+    throw UnimplementedError('cancel() has not been implemented.');
+  }
+
+  /// Progress of running calls that were made with a requestId
+  /// Each event is a map describing one call's progress
+  Stream<Map<String, dynamic>> get progress {
+    throw UnimplementedError('progress has not been implemented.');
+  }
 }
@@ -0,0 +1,340 @@
+#include <benchmark/benchmark.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <flutter_linux/flutter_linux.h>
+#include <glib/gstdio.h>
+#include <malloc.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ente_directory_picker_plugin_private.h"
+
+// Benchmarks for the method call handlers, called directly as the method
+// channel would. Trees and files are generated once per size in a temporary
+// directory (under $TMPDIR, so point it at the file system you want to
+// measure) and reused across runs. The largest sizes need about 3 GB of free
+// space; pass --benchmark_filter to run a subset.
+//
+// Allocation counts come from the malloc wrappers below, which see GLib's and
+// the Flutter engine's allocations as well as the plugin's own.
+
+namespace ente_directory_picker {
+namespace bench {
+
+static const char* const kDurabilities[] = {"none", "data", "full"};
+
+// Root of everything the benchmarks generate; removed on exit.
+static gchar* fixture_root;
+
+// Maps an entry count or file size to the directory or file generated for it.
+static GHashTable* trees;
+static GHashTable* files;
+
+static const gchar* get_fixture_root() {
+  if (!fixture_root) {
+    g_autoptr(GError) error = nullptr;
+    fixture_root = g_dir_make_tmp("ente_directory_picker_bench_XXXXXX", &error);
+    if (!fixture_root) {
+      g_error("%s", error->message);
+    }
+  }
+  return fixture_root;
+}
+
+// Returns a directory holding n_entries empty files.
+static const gchar* get_tree(gint64 n_entries) {
+  if (!trees) {
+    trees = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
+  }
+  const gchar* cached = static_cast<const gchar*>(g_hash_table_lookup(trees, &n_entries));
+  if (cached) {
+    return cached;
+  }
+
+  g_autofree gchar* name = g_strdup_printf("tree_%" G_GINT64_FORMAT, n_entries);
+  gchar* path = g_build_filename(get_fixture_root(), name, nullptr);
+  if (g_mkdir(path, 0755) != 0) {
+    g_error("Failed to create %s: %s", path, g_strerror(errno));
+  }
+  for (gint64 i = 0; i < n_entries; i++) {
+    g_autofree gchar* entry_name = g_strdup_printf("entry_%08" G_GINT64_FORMAT ".txt", i);
+    g_autofree gchar* entry_path = g_build_filename(path, entry_name, nullptr);
+    int fd = open(entry_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      g_error("Failed to create %s: %s", entry_path, g_strerror(errno));
+    }
+    close(fd);
+  }
+  g_hash_table_insert(trees, g_memdup2(&n_entries, sizeof(n_entries)), path);
+  return path;
+}
+
+// Returns a file of size bytes of text.
+static const gchar* get_file(gint64 size) {
+  if (!files) {
+    files = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
+  }
+  const gchar* cached = static_cast<const gchar*>(g_hash_table_lookup(files, &size));
+  if (cached) {
+    return cached;
+  }
+
+  g_autofree gchar* name = g_strdup_printf("file_%" G_GINT64_FORMAT ".txt", size);
+  gchar* path = g_build_filename(get_fixture_root(), name, nullptr);
+  FILE* file = fopen(path, "we");
+  if (!file) {
+    g_error("Failed to create %s: %s", path, g_strerror(errno));
+  }
+  gchar chunk[64 * 1024];
+  memset(chunk, 'a', sizeof(chunk));
+  gboolean written_all = TRUE;
+  for (gint64 written = 0; written < size && written_all; written += sizeof(chunk)) {
+    written_all = fwrite(chunk, MIN(static_cast<gint64>(sizeof(chunk)), size - written), 1, file) == 1;
+  }
+  if (fclose(file) != 0 || !written_all) {
+    g_error("Failed to write %s", path);
+  }
+  g_hash_table_insert(files, g_memdup2(&size, sizeof(size)), path);
+  return path;
+}
+
+static void remove_tree(const gchar* path) {
+  GDir* dir = g_dir_open(path, 0, nullptr);
+  if (dir) {
+    const gchar* name;
+    while ((name = g_dir_read_name(dir)) != nullptr) {
+      g_autofree gchar* child = g_build_filename(path, name, nullptr);
+      remove_tree(child);
+    }
+    g_dir_close(dir);
+    g_rmdir(path);
+  } else {
+    g_unlink(path);
+  }
+}
+
+// Runs handler on args and stops the benchmark if it fails.
+static gboolean call_handler(benchmark::State& state, FlMethodResponse* (*handler)(FlValue*),
+                             FlValue* args) {
+  g_autoptr(FlMethodResponse) response = handler(args);
+  if (FL_IS_METHOD_ERROR_RESPONSE(response)) {
+    state.SkipWithError(
+        fl_method_error_response_get_message(FL_METHOD_ERROR_RESPONSE(response)));
+    return FALSE;
+  }
+  benchmark::DoNotOptimize(fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response)));
+  return TRUE;
+}
+
+static void BM_WriteFile(benchmark::State& state) {
+  gint64 size = state.range(0);
+  const char* durability = kDurabilities[state.range(1)];
+  g_autofree gchar* directory = g_build_filename(get_fixture_root(), "writes", nullptr);
+  g_mkdir(directory, 0755);
+
+  // Built once, like a Uint8List the codec has already decoded.
+  g_autofree guint8* content = static_cast<guint8*>(g_malloc(size));
+  memset(content, 'a', size);
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "fileName", fl_value_new_string("write.bin"));
+  fl_value_set_string_take(args, "content", fl_value_new_uint8_list(content, size));
+  fl_value_set_string_take(args, "durability", fl_value_new_string(durability));
+
+  for (auto _ : state) {
+    if (!call_handler(state, write_file, args)) {
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+
+  g_autofree gchar* written = g_build_filename(directory, "write.bin", nullptr);
+  g_unlink(written);
+}
+
+static void BM_ReadFile(benchmark::State& state) {
+  gint64 size = state.range(0);
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "filePath", fl_value_new_string(get_file(size)));
+
+  for (auto _ : state) {
+    if (!call_handler(state, read_file, args)) {
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+
+static void BM_ListDirectory(benchmark::State& state) {
+  gint64 n_entries = state.range(0);
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(get_tree(n_entries)));
+
+  for (auto _ : state) {
+    if (!call_handler(state, list_directory, args)) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * n_entries);
+}
+
+static void BM_GetDirectoryDetails(benchmark::State& state) {
+  gint64 n_entries = state.range(0);
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(get_tree(n_entries)));
+
+  for (auto _ : state) {
+    if (!call_handler(state, get_directory_details, args)) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * n_entries);
+}
+
+// File sizes from 1 KiB to 1 GiB and trees from 10 to 1M entries. Wall time
+// is used throughout, since most of the cost is waiting on the disk.
+BENCHMARK(BM_WriteFile)
+    ->ArgsProduct({benchmark::CreateRange(1 << 10, 1 << 30, 32), {0, 1, 2}})
+    ->ArgNames({"bytes", "durability"})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ReadFile)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 30)
+    ->ArgName("bytes")
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ListDirectory)
+    ->RangeMultiplier(10)
+    ->Range(10, 1000000)
+    ->ArgName("entries")
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_GetDirectoryDetails)
+    ->RangeMultiplier(10)
+    ->Range(10, 1000000)
+    ->ArgName("entries")
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// Allocation counters, updated by the malloc wrappers while counting is on.
+static gint counting;
+static gint64 allocations;
+static gint64 allocated_bytes;
+static gint64 live_bytes;
+static gint64 peak_live_bytes;
+
+static void count_allocation(void* pointer) {
+  if (!pointer || !__atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+    return;
+  }
+  gint64 size = malloc_usable_size(pointer);
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&allocated_bytes, size, __ATOMIC_RELAXED);
+  gint64 live = __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+  gint64 peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+  while (live > peak && !__atomic_compare_exchange_n(&peak_live_bytes, &peak, live, TRUE,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void count_free(void* pointer) {
+  if (pointer && __atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+    __atomic_fetch_sub(&live_bytes, static_cast<gint64>(malloc_usable_size(pointer)),
+                       __ATOMIC_RELAXED);
+  }
+}
+
+// Reports the allocations made during the extra run Google Benchmark does
+// for each benchmark once it has been timed.
+class AllocationCounter : public benchmark::MemoryManager {
+ public:
+  void Start() override {
+    __atomic_store_n(&allocations, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&allocated_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&live_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&peak_live_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counting, TRUE, __ATOMIC_SEQ_CST);
+  }
+
+  void Stop(Result& result) override {
+    __atomic_store_n(&counting, FALSE, __ATOMIC_SEQ_CST);
+    result.num_allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    result.total_allocated_bytes = __atomic_load_n(&allocated_bytes, __ATOMIC_RELAXED);
+    result.max_bytes_used = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+    result.net_heap_growth = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+  }
+};
+
+}  // namespace bench
+}  // namespace ente_directory_picker
+
+// Wrap glibc's allocator so that allocations from every library are seen.
+// Memory freed while counting was off is not subtracted, so net heap growth
+// is only approximate for memory that outlives a run.
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+
+void* malloc(size_t size) {
+  void* pointer = __libc_malloc(size);
+  ente_directory_picker::bench::count_allocation(pointer);
+  return pointer;
+}
+
+void* calloc(size_t count, size_t size) {
+  void* pointer = __libc_calloc(count, size);
+  ente_directory_picker::bench::count_allocation(pointer);
+  return pointer;
+}
+
+void* realloc(void* pointer, size_t size) {
+  ente_directory_picker::bench::count_free(pointer);
+  void* new_pointer = __libc_realloc(pointer, size);
+  ente_directory_picker::bench::count_allocation(new_pointer);
+  return new_pointer;
+}
+
+void* memalign(size_t alignment, size_t size) {
+  void* pointer = __libc_memalign(alignment, size);
+  ente_directory_picker::bench::count_allocation(pointer);
+  return pointer;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) {
+  *pointer = memalign(alignment, size);
+  return *pointer ? 0 : ENOMEM;
+}
+
+void free(void* pointer) {
+  ente_directory_picker::bench::count_free(pointer);
+  __libc_free(pointer);
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ente_directory_picker::bench::AllocationCounter allocation_counter;
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RegisterMemoryManager(&allocation_counter);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::RegisterMemoryManager(nullptr);
+  benchmark::Shutdown();
+
+  if (ente_directory_picker::bench::fixture_root) {
+    ente_directory_picker::bench::remove_tree(ente_directory_picker::bench::fixture_root);
+  }
+  return 0;
+}
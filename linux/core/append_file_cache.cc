@@ -0,0 +1,199 @@
+#include "append_file_cache.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "method_stats.h"
+
+typedef struct {
+  int fd;
+  guint64 last_used;
+} CachedFile;
+
+struct _AppendFileCache {
+  // Held for the whole append so records from concurrent callers are never
+  // interleaved within a batch.
+  GMutex mutex;
+  // Path -> CachedFile*.
+  GHashTable* files;
+  guint max_open_files;
+  guint64 clock;
+};
+
+static void cached_file_free(gpointer data) {
+  CachedFile* file = static_cast<CachedFile*>(data);
+  close(file->fd);
+  g_free(file);
+}
+
+static void evict_least_recently_used(AppendFileCache* cache) {
+  gpointer oldest_path = nullptr;
+  guint64 oldest_use = G_MAXUINT64;
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, cache->files);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    CachedFile* file = static_cast<CachedFile*>(value);
+    if (file->last_used < oldest_use) {
+      oldest_use = file->last_used;
+      oldest_path = key;
+    }
+  }
+  if (oldest_path) {
+    g_hash_table_remove(cache->files, oldest_path);
+  }
+}
+
+// Returns the descriptor for path, opening it if it is not cached yet. A
+// cached descriptor whose file is no longer the one at path, because it was
+// deleted, replaced by a writeFile to the same name or rotated away by a
+// rename, is reopened so appends always land in the file the path names.
+static CachedFile* lookup_or_open(AppendFileCache* cache,
+                                  const gchar* path,
+                                  guint64 expected_size,
+                                  gboolean* created,
+                                  GError** error) {
+  *created = FALSE;
+  CachedFile* file = static_cast<CachedFile*>(g_hash_table_lookup(cache->files, path));
+  if (file) {
+    struct stat open_st, path_st;
+    if (fstat(file->fd, &open_st) == 0 && stat(path, &path_st) == 0 &&
+        open_st.st_dev == path_st.st_dev && open_st.st_ino == path_st.st_ino) {
+      return file;
+    }
+    g_hash_table_remove(cache->files, path);
+  }
+
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  if (fd >= 0) {
+    *created = TRUE;
+  } else if (errno == EEXIST) {
+    fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  }
+  if (fd < 0) {
+    set_file_error_from_errno(error, errno, "open file", path);
+    return nullptr;
+  }
+
+  struct stat st;
+  if (expected_size > 0 && fstat(fd, &st) == 0 && (guint64)st.st_size < expected_size) {
+    gboolean allocated;
+    int preallocate_errno = preallocate_file(fd, expected_size, &allocated);
+    if (preallocate_errno != 0) {
+      close(fd);
+      set_file_error_from_errno(error, preallocate_errno, "reserve space for", path);
+      return nullptr;
+    }
+  }
+
+  if (g_hash_table_size(cache->files) >= cache->max_open_files) {
+    evict_least_recently_used(cache);
+  }
+  file = g_new0(CachedFile, 1);
+  file->fd = fd;
+  g_hash_table_insert(cache->files, g_strdup(path), file);
+  return file;
+}
+
+// Writes all records, at most IOV_MAX per writev() call, picking up where a
+// short write left off.
+static gboolean writev_all(int fd, const struct iovec* records, gsize n_records) {
+  g_autofree struct iovec* iov = g_new(struct iovec, n_records);
+  memcpy(iov, records, n_records * sizeof(struct iovec));
+
+  gsize index = 0;
+  while (index < n_records && iov[index].iov_len == 0) {
+    index++;
+  }
+  while (index < n_records) {
+    int count = static_cast<int>(MIN(n_records - index, (gsize)IOV_MAX));
+    ssize_t written = writev(fd, iov + index, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return FALSE;
+    }
+
+    gsize remaining = written;
+    while (index < n_records && remaining >= iov[index].iov_len) {
+      remaining -= iov[index].iov_len;
+      index++;
+    }
+    if (remaining > 0) {
+      iov[index].iov_base = static_cast<gchar*>(iov[index].iov_base) + remaining;
+      iov[index].iov_len -= remaining;
+    }
+  }
+  return TRUE;
+}
+
+AppendFileCache* append_file_cache_new(guint max_open_files) {
+  AppendFileCache* cache = g_new0(AppendFileCache, 1);
+  g_mutex_init(&cache->mutex);
+  cache->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, cached_file_free);
+  cache->max_open_files = MAX(max_open_files, 1u);
+  return cache;
+}
+
+gboolean append_file_cache_append(AppendFileCache* cache,
+                                  const gchar* path,
+                                  const struct iovec* records,
+                                  gsize n_records,
+                                  WriteDurability durability,
+                                  guint64 expected_size,
+                                  GError** error) {
+  g_mutex_lock(&cache->mutex);
+
+  gboolean created;
+  CachedFile* file = lookup_or_open(cache, path, expected_size, &created, error);
+  if (!file) {
+    g_mutex_unlock(&cache->mutex);
+    return FALSE;
+  }
+  file->last_used = ++cache->clock;
+
+  gboolean success = writev_all(file->fd, records, n_records);
+  if (success) {
+    guint64 length = 0;
+    for (gsize i = 0; i < n_records; i++) {
+      length += records[i].iov_len;
+    }
+    method_stats_add_bytes_written(method_stats_get_current(), length);
+  }
+  if (success && durability == WRITE_DURABILITY_DATA) {
+    success = fdatasync(file->fd) == 0;
+  } else if (success && durability == WRITE_DURABILITY_FULL) {
+    success = fsync(file->fd) == 0;
+  }
+  if (!success) {
+    set_file_error_from_errno(error, errno, "append to file", path);
+    g_hash_table_remove(cache->files, path);
+  }
+  g_mutex_unlock(&cache->mutex);
+
+  // A newly created file is only durable once its directory entry is.
+  if (success && created && durability == WRITE_DURABILITY_FULL) {
+    g_autofree gchar* directory_path = g_path_get_dirname(path);
+    int dir_fd = open(directory_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0 || fsync(dir_fd) != 0) {
+      set_file_error_from_errno(error, errno, "sync directory", directory_path);
+      success = FALSE;
+    }
+    if (dir_fd >= 0) {
+      close(dir_fd);
+    }
+  }
+  return success;
+}
+
+void append_file_cache_free(AppendFileCache* cache) {
+  g_hash_table_unref(cache->files);
+  g_mutex_clear(&cache->mutex);
+  g_free(cache);
+}
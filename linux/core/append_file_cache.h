@@ -0,0 +1,31 @@
+#ifndef ENTE_DIRECTORY_PICKER_APPEND_FILE_CACHE_H_
+#define ENTE_DIRECTORY_PICKER_APPEND_FILE_CACHE_H_
+
+#include <glib.h>
+#include <sys/uio.h>
+
+#include "file_writer.h"
+
+// Keeps recently used files open with O_APPEND so that repeated appends to the
+// same log cost a single writev() instead of an open/write/close cycle, or a
+// full read and rewrite of the file.
+typedef struct _AppendFileCache AppendFileCache;
+
+// Creates a cache holding at most max_open_files descriptors.
+AppendFileCache* append_file_cache_new(guint max_open_files);
+
+// Appends the records to path in order with as few writev() calls as
+// possible, creating the file if needed. If expected_size is larger than the
+// file, its blocks are reserved when the file is opened.
+gboolean append_file_cache_append(AppendFileCache* cache,
+                                  const gchar* path,
+                                  const struct iovec* records,
+                                  gsize n_records,
+                                  WriteDurability durability,
+                                  guint64 expected_size,
+                                  GError** error);
+
+// Closes every cached descriptor and frees the cache.
+void append_file_cache_free(AppendFileCache* cache);
+
+#endif  // ENTE_DIRECTORY_PICKER_APPEND_FILE_CACHE_H_
@@ -0,0 +1,147 @@
+#include "collation_cache.h"
+
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Directories whose ranks are kept; the least recently used goes first.
+static const guint kCollationCacheMaxDirectories = 16;
+
+typedef struct {
+  // LC_COLLATE when the ranks were computed.
+  gchar* locale;
+  // Name to rank + 1.
+  GHashTable* ranks;
+  guint64 last_used;
+} CollationSnapshot;
+
+typedef struct {
+  gchar* key;
+  const gchar* name;
+} CollationKey;
+
+static GMutex cache_mutex;
+// Directory path to CollationSnapshot.
+static GHashTable* cache_snapshots;
+static guint64 cache_clock;
+
+static void collation_snapshot_free(gpointer data) {
+  CollationSnapshot* snapshot = static_cast<CollationSnapshot*>(data);
+  g_free(snapshot->locale);
+  g_hash_table_unref(snapshot->ranks);
+  g_free(snapshot);
+}
+
+// Must be called with cache_mutex held.
+static void ensure_cache() {
+  if (!cache_snapshots) {
+    cache_snapshots = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            collation_snapshot_free);
+  }
+}
+
+static gchar* current_collation_locale() {
+  const gchar* locale = setlocale(LC_COLLATE, nullptr);
+  return g_strdup(locale ? locale : "");
+}
+
+// Takes ownership of ranks.
+static void store_ranks(const gchar* directory_path, const gchar* locale, GHashTable* ranks) {
+  CollationSnapshot* snapshot = g_new0(CollationSnapshot, 1);
+  snapshot->locale = g_strdup(locale);
+  snapshot->ranks = ranks;
+
+  g_mutex_lock(&cache_mutex);
+  ensure_cache();
+  if (!g_hash_table_contains(cache_snapshots, directory_path) &&
+      g_hash_table_size(cache_snapshots) >= kCollationCacheMaxDirectories) {
+    GHashTableIter iter;
+    gpointer path, value;
+    const gchar* oldest_path = nullptr;
+    guint64 oldest_use = G_MAXUINT64;
+    g_hash_table_iter_init(&iter, cache_snapshots);
+    while (g_hash_table_iter_next(&iter, &path, &value)) {
+      if (static_cast<CollationSnapshot*>(value)->last_used < oldest_use) {
+        oldest_use = static_cast<CollationSnapshot*>(value)->last_used;
+        oldest_path = static_cast<const gchar*>(path);
+      }
+    }
+    g_hash_table_remove(cache_snapshots, oldest_path);
+  }
+  snapshot->last_used = ++cache_clock;
+  g_hash_table_replace(cache_snapshots, g_strdup(directory_path), snapshot);
+  g_mutex_unlock(&cache_mutex);
+}
+
+static int compare_collation_keys(const void* a, const void* b) {
+  const CollationKey* first = static_cast<const CollationKey*>(a);
+  const CollationKey* second = static_cast<const CollationKey*>(b);
+  return strcmp(first->key, second->key);
+}
+
+// Computes the rank of every name in entries.
+static GHashTable* build_ranks(GArray* entries) {
+  CollationKey* keys = g_new(CollationKey, entries->len);
+  for (guint i = 0; i < entries->len; i++) {
+    const gchar* name = g_array_index(entries, FileDetails, i).name;
+    keys[i].name = name;
+    if (g_utf8_validate(name, -1, nullptr)) {
+      keys[i].key = g_utf8_collate_key_for_filename(name, -1);
+    } else {
+      g_autofree gchar* valid_name = g_utf8_make_valid(name, -1);
+      keys[i].key = g_utf8_collate_key_for_filename(valid_name, -1);
+    }
+  }
+  // Comparing the keys is a plain byte comparison.
+  qsort(keys, entries->len, sizeof(CollationKey), compare_collation_keys);
+
+  GHashTable* ranks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, nullptr);
+  guint rank = 0;
+  for (guint i = 0; i < entries->len; i++) {
+    if (i > 0 && strcmp(keys[i - 1].key, keys[i].key) != 0) {
+      rank++;
+    }
+    g_hash_table_insert(ranks, g_strdup(keys[i].name), GUINT_TO_POINTER(rank + 1));
+  }
+  for (guint i = 0; i < entries->len; i++) {
+    g_free(keys[i].key);
+  }
+  g_free(keys);
+  return ranks;
+}
+
+// Sets the rank of each entry from ranks. Returns FALSE if ranks lacks any
+// of the names.
+static gboolean apply_ranks(GHashTable* ranks, GArray* entries) {
+  for (guint i = 0; i < entries->len; i++) {
+    FileDetails* details = &g_array_index(entries, FileDetails, i);
+    guint rank = GPOINTER_TO_UINT(g_hash_table_lookup(ranks, details->name));
+    if (rank == 0) {
+      return FALSE;
+    }
+    details->name_rank = rank - 1;
+  }
+  return TRUE;
+}
+
+void collation_cache_rank_details(const gchar* directory_path, GArray* entries) {
+  g_autofree gchar* locale = current_collation_locale();
+
+  g_mutex_lock(&cache_mutex);
+  ensure_cache();
+  CollationSnapshot* snapshot =
+      static_cast<CollationSnapshot*>(g_hash_table_lookup(cache_snapshots, directory_path));
+  // Names removed since the snapshot do no harm; the others keep their
+  // order relative to each other.
+  if (snapshot && strcmp(snapshot->locale, locale) == 0 &&
+      apply_ranks(snapshot->ranks, entries)) {
+    snapshot->last_used = ++cache_clock;
+    g_mutex_unlock(&cache_mutex);
+    return;
+  }
+  g_mutex_unlock(&cache_mutex);
+
+  GHashTable* ranks = build_ranks(entries);
+  apply_ranks(ranks, entries);
+  store_ranks(directory_path, locale, ranks);
+}
@@ -0,0 +1,22 @@
+#ifndef ENTE_DIRECTORY_PICKER_COLLATION_CACHE_H_
+#define ENTE_DIRECTORY_PICKER_COLLATION_CACHE_H_
+
+#include <gio/gio.h>
+
+#include "file_operations.h"
+
+// Sets the name_rank of each of the FileDetails in entries, as returned by
+// file_operations_get_details() for directory_path, to the position of its
+// name in the natural order of the directory: the order of
+// g_utf8_collate_key_for_filename(), which follows the collation rules of the
+// current locale and compares runs of digits by value, so "IMG_2" comes
+// before "IMG_10". Names that collate the same share a rank.
+//
+// Computing collation keys is costly, so the ranks of each directory are
+// kept as a snapshot and reused as long as it covers every name listed and
+// the locale is unchanged; a name added since gives a new snapshot. Ranks
+// are only meaningful relative to each other within one call. The cache is
+// shared by the whole process and holds a bounded number of directories.
+void collation_cache_rank_details(const gchar* directory_path, GArray* entries);
+
+#endif  // ENTE_DIRECTORY_PICKER_COLLATION_CACHE_H_
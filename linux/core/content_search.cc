@@ -0,0 +1,337 @@
+#include "content_search.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "directory_walker.h"
+#include "method_stats.h"
+#include "progress_reporter.h"
+
+// A NUL byte within this many leading bytes marks a file as binary.
+static const gsize kBinaryProbeBytes = 8192;
+
+// Bytes read from a file per pread(). Files are read rather than mapped, so
+// one truncated while it is searched just ends early instead of raising
+// SIGBUS, and cancellation is checked after each chunk.
+static const gsize kSearchChunkBytes = 1024 * 1024;
+
+// Longest unfinished line carried over from one chunk into the next. The tail
+// of a longer line is carried only as far as a match could reach back.
+static const gsize kMaxCarriedLineBytes = 64 * 1024;
+
+// Longest line text returned with a match.
+static const gsize kMaxMatchTextBytes = 512;
+
+typedef struct {
+  const gchar* query;
+  gsize query_length;
+  const GlobSet* patterns;
+  const GlobSet* excludes;
+  guint max_results;
+  GCancellable* cancellable;
+
+  // Matches claimed by the walker threads so far, never fewer than have
+  // been found; see take_result_slot().
+  gint claimed_results;
+
+  GMutex mutex;
+  GPtrArray* matches;
+  gint stopped;
+} SearchContext;
+
+// Where scanning a file has got to, carried from one chunk to the next.
+typedef struct {
+  // 1-based number of the line being scanned.
+  guint64 line;
+  // Set once the line has matched, so the rest of it is skipped.
+  gboolean skip_line;
+  // Start of the line, saved once it is no longer carried over. One byte
+  // longer than the text reported, so a '\r' there is not taken for the end
+  // of the line.
+  gchar* line_head;
+  gsize line_head_length;
+} ScanState;
+
+void content_match_free(ContentMatch* match) {
+  g_free(match->path);
+  g_free(match->text);
+  g_free(match);
+}
+
+static ContentMatch* content_match_new(const gchar* path,
+                                       guint64 line,
+                                       guint64 offset,
+                                       const gchar* line_start,
+                                       const gchar* line_end) {
+  if (line_end > line_start && line_end[-1] == '\r') {
+    line_end--;
+  }
+  gsize length = MIN(static_cast<gsize>(line_end - line_start), kMaxMatchTextBytes);
+
+  ContentMatch* match = g_new0(ContentMatch, 1);
+  match->path = g_strdup(path);
+  match->line = line;
+  match->offset = offset;
+  // Files are not guaranteed to be UTF-8, and truncation may split a character.
+  match->text = g_utf8_make_valid(line_start, length);
+  return match;
+}
+
+// Claims room for one more match among max_results, so walker threads stop
+// scanning as soon as the results are complete rather than after the file
+// they are in. Returns FALSE, and stops the search, once there is none left.
+static gboolean take_result_slot(SearchContext* context) {
+  guint claimed = static_cast<guint>(g_atomic_int_add(&context->claimed_results, 1));
+  if (claimed + 1 >= context->max_results) {
+    g_atomic_int_set(&context->stopped, 1);
+  }
+  return claimed < context->max_results;
+}
+
+static void start_next_line(ScanState* state) {
+  state->line++;
+  state->skip_line = FALSE;
+  g_clear_pointer(&state->line_head, g_free);
+}
+
+// Scans a chunk of a file, adding a match for each line containing the
+// query. The chunk starts at file offset offset, either at the start of the
+// line state describes or within it when its start has been saved in
+// state->line_head. Returns how many bytes at the end of the chunk belong to
+// an unfinished line and have to be scanned again with the next chunk.
+// memmem() and memchr() are vectorised in glibc, so only bytes near a match
+// are looked at one at a time.
+static gsize search_buffer(SearchContext* context,
+                           const gchar* path,
+                           const gchar* data,
+                           gsize size,
+                           guint64 offset,
+                           gboolean at_end,
+                           ScanState* state,
+                           GPtrArray* matches) {
+  const gchar* end = data + size;
+  const gchar* position = data;
+  // Newlines before counted have been added to the line number.
+  const gchar* counted = data;
+  // NULL while the start of the line lies in an earlier chunk.
+  const gchar* line_start = state->line_head ? nullptr : data;
+  const gchar* newline;
+
+  while (position < end && !g_atomic_int_get(&context->stopped)) {
+    if (state->skip_line) {
+      // The rest of a line that has already matched.
+      newline = static_cast<const gchar*>(memchr(position, '\n', end - position));
+      if (!newline) {
+        return 0;
+      }
+      position = counted = line_start = newline + 1;
+      start_next_line(state);
+      continue;
+    }
+
+    const gchar* hit = static_cast<const gchar*>(
+        memmem(position, end - position, context->query, context->query_length));
+    if (!hit) {
+      break;
+    }
+
+    while ((newline = static_cast<const gchar*>(memchr(counted, '\n', hit - counted)))) {
+      counted = line_start = newline + 1;
+      start_next_line(state);
+    }
+
+    const gchar* line_end = static_cast<const gchar*>(memchr(hit, '\n', end - hit));
+    if (!line_end && !at_end && line_start &&
+        static_cast<gsize>(end - line_start) <= kMaxMatchTextBytes) {
+      // Not all of the text to report has been read yet; the line is carried
+      // over and the match found again in the next chunk.
+      position = hit;
+      break;
+    }
+    if (!take_result_slot(context)) {
+      return 0;
+    }
+    guint64 match_offset = offset + (hit - data);
+    g_ptr_array_add(matches, line_start
+        ? content_match_new(path, state->line, match_offset, line_start, line_end ? line_end : end)
+        : content_match_new(path, state->line, match_offset, state->line_head,
+                            state->line_head + state->line_head_length));
+
+    // Report each line once: resume at the start of the next one.
+    if (!line_end) {
+      state->skip_line = TRUE;
+      return 0;
+    }
+    counted = line_end;
+    position = line_end;
+    state->skip_line = TRUE;
+  }
+
+  if (at_end || g_atomic_int_get(&context->stopped)) {
+    return 0;
+  }
+
+  while ((newline = static_cast<const gchar*>(memchr(counted, '\n', end - counted)))) {
+    counted = line_start = newline + 1;
+    start_next_line(state);
+  }
+
+  // The unfinished line has not matched yet. A short one is carried over
+  // whole; of a longer one only as much as a match could reach back into,
+  // with its start saved for the text of a later match.
+  gsize unfinished = line_start ? end - line_start : size;
+  if (line_start && unfinished <= kMaxCarriedLineBytes) {
+    return unfinished;
+  }
+  if (line_start) {
+    state->line_head_length = MIN(unfinished, kMaxMatchTextBytes + 1);
+    state->line_head = static_cast<gchar*>(g_memdup2(line_start, state->line_head_length));
+  }
+  return MIN(unfinished, context->query_length - 1);
+}
+
+// Reads up to length bytes at offset, fewer only at the end of the file.
+// Returns -1 on failure.
+static gssize read_chunk(int fd, gchar* data, gsize length, guint64 offset) {
+  gsize done = 0;
+  while (done < length) {
+    ssize_t n = pread(fd, data + done, length - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+static void search_file(SearchContext* context, const gchar* path, GPtrArray* matches) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      static_cast<guint64>(st.st_size) < context->query_length) {
+    close(fd);
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  gsize capacity = kSearchChunkBytes + MAX(kMaxCarriedLineBytes, context->query_length);
+  g_autofree gchar* data = static_cast<gchar*>(g_malloc(capacity));
+  ScanState state = { 1, FALSE, nullptr, 0 };
+  // Bytes at the start of data carried over from the previous chunk, which
+  // sit just before file offset next_offset.
+  gsize carried = 0;
+  guint64 next_offset = 0;
+
+  while (!g_atomic_int_get(&context->stopped) &&
+         !g_cancellable_is_cancelled(context->cancellable)) {
+    gssize n = read_chunk(fd, data + carried, kSearchChunkBytes, next_offset);
+    if (n < 0) {
+      break;
+    }
+    // Walker threads charge the caller's method, so this lands on searchContent.
+    method_stats_add_bytes_read(method_stats_get_current(), n);
+    progress_reporter_advance(progress_reporter_get_current(), 0, n, nullptr);
+    if (next_offset == 0 && memchr(data, '\0', MIN(static_cast<gsize>(n), kBinaryProbeBytes))) {
+      break;
+    }
+
+    gsize size = carried + n;
+    gboolean at_end = static_cast<gsize>(n) < kSearchChunkBytes;
+    carried = search_buffer(context, path, data, size, next_offset - carried, at_end, &state,
+                            matches);
+    next_offset += n;
+    if (at_end) {
+      break;
+    }
+    memmove(data, data + size - carried, carried);
+  }
+
+  g_free(state.line_head);
+  close(fd);
+}
+
+static WalkAction search_visit(const WalkEntry* entry, gpointer user_data) {
+  SearchContext* context = static_cast<SearchContext*>(user_data);
+
+  if (glob_set_matches(context->excludes, entry->name, entry->relative_path)) {
+    return WALK_SKIP;
+  }
+  if (entry->type != DT_REG) {
+    return WALK_CONTINUE;
+  }
+  if (!glob_set_is_empty(context->patterns) &&
+      !glob_set_matches(context->patterns, entry->name, entry->relative_path)) {
+    return WALK_CONTINUE;
+  }
+
+  GPtrArray* matches = g_ptr_array_new();
+  search_file(context, entry->path, matches);
+
+  // Every match took a result slot, so they all fit.
+  g_mutex_lock(&context->mutex);
+  for (guint i = 0; i < matches->len; i++) {
+    g_ptr_array_add(context->matches, g_ptr_array_index(matches, i));
+  }
+  g_mutex_unlock(&context->mutex);
+  g_ptr_array_unref(matches);
+
+  return g_atomic_int_get(&context->stopped) ? WALK_STOP : WALK_CONTINUE;
+}
+
+static gint compare_matches(gconstpointer a, gconstpointer b) {
+  const ContentMatch* first = *static_cast<const ContentMatch* const*>(a);
+  const ContentMatch* second = *static_cast<const ContentMatch* const*>(b);
+  int result = strcmp(first->path, second->path);
+  if (result != 0) {
+    return result;
+  }
+  return first->offset < second->offset ? -1 : first->offset > second->offset;
+}
+
+GPtrArray* search_file_contents(const gchar* root,
+                                const gchar* query,
+                                const GlobSet* patterns,
+                                const GlobSet* excludes,
+                                gint max_depth,
+                                guint max_results,
+                                GCancellable* cancellable,
+                                GError** error) {
+  g_return_val_if_fail(query[0] != '\0', nullptr);
+
+  SearchContext context = {};
+  context.query = query;
+  context.query_length = strlen(query);
+  context.patterns = patterns;
+  context.excludes = excludes;
+  context.max_results = max_results;
+  context.cancellable = cancellable;
+  context.matches = g_ptr_array_new_with_free_func(
+      reinterpret_cast<GDestroyNotify>(content_match_free));
+  g_mutex_init(&context.mutex);
+
+  gboolean success = max_results == 0 ||
+      walk_directory(root, max_depth, walk_thread_count_for(root),
+                     search_visit, &context, cancellable, error);
+  g_mutex_clear(&context.mutex);
+  if (!success) {
+    g_ptr_array_unref(context.matches);
+    return nullptr;
+  }
+
+  g_ptr_array_sort(context.matches, compare_matches);
+  return context.matches;
+}
@@ -0,0 +1,38 @@
+#ifndef ENTE_DIRECTORY_PICKER_CONTENT_SEARCH_H_
+#define ENTE_DIRECTORY_PICKER_CONTENT_SEARCH_H_
+
+#include <gio/gio.h>
+
+#include "file_finder.h"
+
+// A line containing the search query.
+typedef struct {
+  gchar* path;
+  // 1-based line number.
+  guint64 line;
+  // Byte offset of the match from the start of the file.
+  guint64 offset;
+  // The matching line without its terminator, truncated to a sane length.
+  gchar* text;
+} ContentMatch;
+
+void content_match_free(ContentMatch* match);
+
+// Searches the regular files under root whose name or relative path matches
+// patterns (every file when empty) and none of excludes for the bytes of query,
+// which must not be empty. Files are read in chunks and scanned concurrently on
+// the walker threads; files with a NUL byte near the start are treated as
+// binary and skipped. Each line is reported at most once. Stops as soon as
+// max_results matches have been found, even partway through a file. Returns
+// ContentMatch entries sorted by path and offset, or NULL with error set if
+// root cannot be read or cancellable is cancelled.
+GPtrArray* search_file_contents(const gchar* root,
+                                const gchar* query,
+                                const GlobSet* patterns,
+                                const GlobSet* excludes,
+                                gint max_depth,
+                                guint max_results,
+                                GCancellable* cancellable,
+                                GError** error);
+
+#endif  // ENTE_DIRECTORY_PICKER_CONTENT_SEARCH_H_
@@ -0,0 +1,99 @@
+#include "details_query.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+void details_query_init(DetailsQuery* query) {
+  memset(query, 0, sizeof(*query));
+  query->sort_by = DETAILS_SORT_NONE;
+  query->entry_type = DETAILS_TYPE_ANY;
+  query->min_size = G_MININT64;
+  query->max_size = G_MAXINT64;
+  query->min_modified_ms = G_MININT64;
+  query->max_modified_ms = G_MAXINT64;
+}
+
+static gboolean has_extension(const gchar* name, const gchar* const* extensions) {
+  const gchar* dot = strrchr(name, '.');
+  // A leading dot marks a hidden file rather than an extension.
+  if (!dot || dot == name) {
+    return FALSE;
+  }
+  for (const gchar* const* extension = extensions; *extension; extension++) {
+    const gchar* wanted = **extension == '.' ? *extension + 1 : *extension;
+    if (g_ascii_strcasecmp(dot + 1, wanted) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static gboolean matches(const DetailsQuery* query, const FileDetails* details) {
+  const IoFileInfo* info = &details->info;
+  if ((query->entry_type == DETAILS_TYPE_FILE && info->is_directory) ||
+      (query->entry_type == DETAILS_TYPE_DIRECTORY && !info->is_directory)) {
+    return FALSE;
+  }
+  if (info->modified_ms < query->min_modified_ms || info->modified_ms > query->max_modified_ms) {
+    return FALSE;
+  }
+  if (info->is_directory) {
+    return TRUE;
+  }
+  if (info->size < query->min_size || info->size > query->max_size) {
+    return FALSE;
+  }
+  return !query->extensions || !*query->extensions ||
+         has_extension(details->name, query->extensions);
+}
+
+static gint compare_details(const FileDetails* a, const FileDetails* b,
+                            const DetailsQuery* query) {
+  gint order = 0;
+  if (query->sort_by == DETAILS_SORT_NATURAL_NAME) {
+    order = a->name_rank < b->name_rank ? -1 : a->name_rank > b->name_rank;
+  } else if (query->sort_by == DETAILS_SORT_SIZE) {
+    order = a->info.size < b->info.size ? -1 : a->info.size > b->info.size;
+  } else if (query->sort_by == DETAILS_SORT_MODIFIED) {
+    order = a->info.modified_ms < b->info.modified_ms ? -1
+                                                      : a->info.modified_ms > b->info.modified_ms;
+  }
+  if (order == 0) {
+    order = strcmp(a->name, b->name);
+  }
+  return query->descending ? -order : order;
+}
+
+// Adapts compare_details() to the std sorting algorithms.
+struct DetailsOrder {
+  const DetailsQuery* query;
+
+  bool operator()(const FileDetails& a, const FileDetails& b) const {
+    return compare_details(&a, &b, query) < 0;
+  }
+};
+
+void details_query_apply(const DetailsQuery* query, GArray* entries) {
+  FileDetails* begin = reinterpret_cast<FileDetails*>(entries->data);
+  // Entries that are kept move to the front in their order; those filtered
+  // out end up behind them, where shrinking the array frees them.
+  guint kept = 0;
+  for (guint i = 0; i < entries->len; i++) {
+    if (matches(query, &begin[i])) {
+      std::swap(begin[kept], begin[i]);
+      kept++;
+    }
+  }
+  guint limit = query->limit > 0 ? MIN(query->limit, kept) : kept;
+
+  if (query->sort_by != DETAILS_SORT_NONE) {
+    DetailsOrder order = {query};
+    if (limit < kept) {
+      std::partial_sort(begin, begin + limit, begin + kept, order);
+    } else {
+      std::sort(begin, begin + kept, order);
+    }
+  }
+  g_array_set_size(entries, limit);
+}
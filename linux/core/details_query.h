@@ -0,0 +1,52 @@
+#ifndef ENTE_DIRECTORY_PICKER_DETAILS_QUERY_H_
+#define ENTE_DIRECTORY_PICKER_DETAILS_QUERY_H_
+
+#include <gio/gio.h>
+
+#include "file_operations.h"
+
+typedef enum {
+  // Leave entries in the order the directory listed them.
+  DETAILS_SORT_NONE,
+  DETAILS_SORT_NAME,
+  // Natural order, by the name_rank that collation_cache_rank_details() set.
+  DETAILS_SORT_NATURAL_NAME,
+  DETAILS_SORT_SIZE,
+  DETAILS_SORT_MODIFIED,
+} DetailsSortKey;
+
+typedef enum {
+  DETAILS_TYPE_ANY,
+  DETAILS_TYPE_FILE,
+  DETAILS_TYPE_DIRECTORY,
+} DetailsEntryType;
+
+// What details_query_apply() keeps of a listing, and in what order. Bounds
+// are inclusive. The extension and size filters only apply to files, so a
+// filtered listing can still be navigated through its directories.
+typedef struct {
+  DetailsSortKey sort_by;
+  gboolean descending;
+  DetailsEntryType entry_type;
+  // NULL-terminated extensions, with or without the leading dot, compared
+  // case-insensitively; NULL or empty keeps files of any extension.
+  const gchar* const* extensions;
+  gint64 min_size;
+  gint64 max_size;
+  gint64 min_modified_ms;
+  gint64 max_modified_ms;
+  // Entries to keep at most, or 0 for all of them.
+  guint limit;
+} DetailsQuery;
+
+// Sets query to keep every entry in listing order.
+void details_query_init(DetailsQuery* query);
+
+// Drops the entries of a GArray of FileDetails from
+// file_operations_get_details() that query filters out, then sorts the rest
+// and keeps the first limit of them. Entries that tie on natural order, size
+// or modification time are ordered by name. When only the first few of many
+// entries are kept, only those are fully sorted.
+void details_query_apply(const DetailsQuery* query, GArray* entries);
+
+#endif  // ENTE_DIRECTORY_PICKER_DETAILS_QUERY_H_
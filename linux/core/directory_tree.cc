@@ -0,0 +1,200 @@
+#include "directory_tree.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+
+#include "directory_walker.h"
+#include "file_writer.h"
+
+typedef struct {
+  GMutex mutex;
+  guint depth;
+  gboolean aggregate_sizes;
+  // Directory nodes by relative path, the root being "". A directory is
+  // visited before anything inside it, so an entry's parent is always here.
+  GHashTable* directories;
+} TreeBuilder;
+
+void tree_node_free(TreeNode* node) {
+  if (!node) {
+    return;
+  }
+  g_clear_pointer(&node->children, g_ptr_array_unref);
+  g_free(node->name);
+  g_free(node->path);
+  g_free(node->relative_path);
+  g_free(node);
+}
+
+static TreeNode* tree_node_new(const gchar* name, const gchar* path, const gchar* relative_path,
+                               const struct stat* st) {
+  TreeNode* node = g_new0(TreeNode, 1);
+  node->name = g_strdup(name);
+  node->path = g_strdup(path);
+  node->relative_path = g_strdup(relative_path);
+  node->is_directory = S_ISDIR(st->st_mode);
+  node->size = S_ISREG(st->st_mode) ? st->st_size : 0;
+  node->device = st->st_dev;
+  node->inode = st->st_ino;
+  return node;
+}
+
+// Returns the first n_components components of relative_path.
+static gchar* truncate_relative_path(const gchar* relative_path, guint n_components) {
+  const gchar* end = relative_path;
+  for (guint i = 0; i < n_components; i++) {
+    end = strchr(end, '/');
+    if (!end) {
+      return g_strdup(relative_path);
+    }
+    if (i + 1 < n_components) {
+      end++;
+    }
+  }
+  return g_strndup(relative_path, end - relative_path);
+}
+
+static WalkAction visit_tree_entry(const WalkEntry* entry, gpointer user_data) {
+  TreeBuilder* builder = static_cast<TreeBuilder*>(user_data);
+  gboolean is_node = entry->depth <= builder->depth;
+  gboolean is_counted_file = builder->aggregate_sizes && entry->type == DT_REG;
+
+  struct stat st;
+  gboolean has_stat = (is_node || is_counted_file) &&
+                      lstat(entry->path, &st) == 0;
+  if (is_node && !has_stat) {
+    return WALK_SKIP;
+  }
+
+  g_autofree gchar* parent_key = truncate_relative_path(entry->relative_path, entry->depth - 1);
+  g_mutex_lock(&builder->mutex);
+  if (entry->depth <= builder->depth + 1) {
+    TreeNode* parent = static_cast<TreeNode*>(g_hash_table_lookup(builder->directories,
+                                                                  parent_key));
+    if (parent) {
+      parent->child_count++;
+      if (is_node) {
+        TreeNode* node = tree_node_new(entry->name, entry->path, entry->relative_path, &st);
+        g_ptr_array_add(parent->children, node);
+        if (node->is_directory) {
+          if (entry->depth < builder->depth) {
+            node->children = g_ptr_array_new_with_free_func(
+                reinterpret_cast<GDestroyNotify>(tree_node_free));
+          }
+          g_hash_table_insert(builder->directories, node->relative_path, node);
+        }
+      }
+    }
+  }
+  if (is_counted_file && has_stat) {
+    // Charged to the deepest directory returned; totals are summed up the
+    // tree once the walk is over.
+    g_autofree gchar* owner_key = entry->depth - 1 > builder->depth
+        ? truncate_relative_path(entry->relative_path, builder->depth)
+        : g_strdup(parent_key);
+    TreeNode* owner = static_cast<TreeNode*>(g_hash_table_lookup(builder->directories, owner_key));
+    if (owner) {
+      owner->size += st.st_size;
+    }
+  }
+  g_mutex_unlock(&builder->mutex);
+  return WALK_CONTINUE;
+}
+
+static gint compare_node_names(gconstpointer a, gconstpointer b) {
+  const TreeNode* first = *static_cast<const TreeNode* const*>(a);
+  const TreeNode* second = *static_cast<const TreeNode* const*>(b);
+  return strcmp(first->name, second->name);
+}
+
+// Sorts children by name and adds each directory's total to its parent's.
+static void finish_node(TreeNode* node) {
+  if (!node->children) {
+    return;
+  }
+  g_ptr_array_sort(node->children, compare_node_names);
+  for (guint i = 0; i < node->children->len; i++) {
+    TreeNode* child = static_cast<TreeNode*>(g_ptr_array_index(node->children, i));
+    if (child->is_directory) {
+      finish_node(child);
+      node->size += child->size;
+    }
+  }
+}
+
+TreeNode* directory_tree_read(const gchar* path,
+                              guint depth,
+                              gboolean aggregate_sizes,
+                              GCancellable* cancellable,
+                              GError** error) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    set_file_error_from_errno(error, errno, "read directory", path);
+    return nullptr;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    set_file_error_from_errno(error, ENOTDIR, "read directory", path);
+    return nullptr;
+  }
+
+  g_autofree gchar* name = g_path_get_basename(path);
+  TreeNode* root = tree_node_new(name, path, "", &st);
+  if (depth > 0) {
+    root->children = g_ptr_array_new_with_free_func(
+        reinterpret_cast<GDestroyNotify>(tree_node_free));
+  }
+
+  TreeBuilder builder = {};
+  g_mutex_init(&builder.mutex);
+  builder.depth = depth;
+  builder.aggregate_sizes = aggregate_sizes;
+  builder.directories = g_hash_table_new(g_str_hash, g_str_equal);
+  g_hash_table_insert(builder.directories, root->relative_path, root);
+
+  // The level below the last one returned is read only to count entries.
+  gint max_depth = aggregate_sizes ? -1 : static_cast<gint>(depth) + 1;
+  gboolean walked = walk_directory(path, max_depth, walk_thread_count_for(path),
+                                   visit_tree_entry, &builder, cancellable, error);
+  g_hash_table_unref(builder.directories);
+  g_mutex_clear(&builder.mutex);
+  if (!walked) {
+    tree_node_free(root);
+    return nullptr;
+  }
+
+  finish_node(root);
+  return root;
+}
+
+gchar* directory_tree_get_handle(const TreeNode* node) {
+  g_autofree gchar* identity = g_strdup_printf("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%s",
+                                               node->device, node->inode, node->path);
+  return g_base64_encode(reinterpret_cast<const guchar*>(identity), strlen(identity));
+}
+
+gchar* directory_tree_resolve_handle(const gchar* handle) {
+  gsize length = 0;
+  g_autofree guchar* decoded = g_base64_decode(handle, &length);
+  g_autofree gchar* identity = g_strndup(reinterpret_cast<const gchar*>(decoded), length);
+
+  gchar* end = nullptr;
+  guint64 device = g_ascii_strtoull(identity, &end, 10);
+  if (end == identity || *end != ':') {
+    return nullptr;
+  }
+  const gchar* inode_start = end + 1;
+  guint64 inode = g_ascii_strtoull(inode_start, &end, 10);
+  if (end == inode_start || *end != ':') {
+    return nullptr;
+  }
+  const gchar* path = end + 1;
+
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode) ||
+      static_cast<guint64>(st.st_dev) != device || static_cast<guint64>(st.st_ino) != inode) {
+    return nullptr;
+  }
+  return g_strdup(path);
+}
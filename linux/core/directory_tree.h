@@ -0,0 +1,53 @@
+#ifndef ENTE_DIRECTORY_PICKER_DIRECTORY_TREE_H_
+#define ENTE_DIRECTORY_PICKER_DIRECTORY_TREE_H_
+
+#include <gio/gio.h>
+
+// A file or directory in a tree read by directory_tree_read().
+typedef struct _TreeNode TreeNode;
+struct _TreeNode {
+  gchar* name;
+  gchar* path;
+  // Path relative to the root of the read, using '/' separators.
+  gchar* relative_path;
+  gboolean is_directory;
+  // Size of a regular file. For a directory, the total size of the regular
+  // files anywhere below it when sizes were aggregated, and 0 otherwise.
+  guint64 size;
+  // Entries directly inside a directory, including for directories whose
+  // children were not returned.
+  guint64 child_count;
+  // Identity of a directory, which its handle is checked against.
+  guint64 device;
+  guint64 inode;
+  // Children sorted by name, or NULL for files and for directories at the
+  // requested depth.
+  GPtrArray* children;
+};
+
+void tree_node_free(TreeNode* node);
+
+// Reads the directory at path and its descendants down to depth levels below
+// it, in parallel. Directories at the last level have their entries counted
+// but not returned, so they can be expanded later. With aggregate_sizes, the
+// whole subtree is walked to total the file sizes under each directory; this
+// costs a walk of everything below path, where otherwise only the requested
+// levels and the one after them are read. Symbolic links are reported but
+// not followed. Returns NULL and sets error if path is not a readable
+// directory or cancellable is cancelled.
+TreeNode* directory_tree_read(const gchar* path,
+                              guint depth,
+                              gboolean aggregate_sizes,
+                              GCancellable* cancellable,
+                              GError** error);
+
+// Returns an opaque string identifying the directory node, from which
+// directory_tree_resolve_handle() gets its path back.
+gchar* directory_tree_get_handle(const TreeNode* node);
+
+// Returns the path of the directory handle refers to, or NULL if the handle
+// is malformed or that path no longer holds the same directory, such as after
+// it was deleted or replaced. Free the result with g_free().
+gchar* directory_tree_resolve_handle(const gchar* handle);
+
+#endif  // ENTE_DIRECTORY_PICKER_DIRECTORY_TREE_H_
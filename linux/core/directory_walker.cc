@@ -0,0 +1,233 @@
+#include "directory_walker.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "fs_capabilities.h"
+#include "method_stats.h"
+#include "progress_reporter.h"
+
+// Upper bound on walker threads; beyond this a single disk rarely keeps up.
+static const guint kMaxWalkThreads = 8;
+
+typedef struct {
+  gchar* path;
+  gchar* relative_path;
+  guint depth;
+} WalkDirectory;
+
+typedef struct {
+  GMutex mutex;
+  // Signalled when directories are queued or the walk is over.
+  GCond cond;
+  // Directories waiting to be read. Taken from the tail so the walk stays
+  // roughly depth-first and the queue does not grow with the tree's width.
+  GQueue directories;
+  // Threads currently reading a directory, and so possibly about to queue more.
+  guint busy;
+  gint stopped;
+
+  gint max_depth;
+  WalkVisitFunc visit;
+  gpointer user_data;
+  GCancellable* cancellable;
+  // The caller's record and progress, which every walker thread charges.
+  MethodStats* stats;
+  ProgressReporter* progress;
+} Walk;
+
+static WalkDirectory* walk_directory_new(gchar* path, gchar* relative_path, guint depth) {
+  WalkDirectory* directory = g_new0(WalkDirectory, 1);
+  directory->path = path;
+  directory->relative_path = relative_path;
+  directory->depth = depth;
+  return directory;
+}
+
+static void walk_directory_free(gpointer data) {
+  WalkDirectory* directory = static_cast<WalkDirectory*>(data);
+  g_free(directory->path);
+  g_free(directory->relative_path);
+  g_free(directory);
+}
+
+// Returns whether the walk should end, either because a callback asked for it
+// or because it was cancelled.
+static gboolean is_stopped(Walk* walk) {
+  if (g_atomic_int_get(&walk->stopped)) {
+    return TRUE;
+  }
+  if (g_cancellable_is_cancelled(walk->cancellable)) {
+    g_atomic_int_set(&walk->stopped, TRUE);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static void read_directory(Walk* walk, WalkDirectory* directory) {
+  int fd = open(directory->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  DIR* dir = fdopendir(fd);
+  if (!dir) {
+    close(fd);
+    return;
+  }
+
+  guint depth = directory->depth + 1;
+  gboolean descend = walk->max_depth < 0 || depth < static_cast<guint>(walk->max_depth);
+  GQueue subdirectories = G_QUEUE_INIT;
+  guint64 n_entries = 0;
+
+  struct dirent* dent;
+  while ((dent = readdir(dir)) != nullptr) {
+    const gchar* name = dent->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    if (is_stopped(walk)) {
+      break;
+    }
+    n_entries++;
+
+    guint8 type = dent->d_type;
+    if (type == DT_UNKNOWN) {
+      // Some file systems do not fill in d_type.
+      struct stat st;
+      if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        continue;
+      }
+      type = IFTODT(st.st_mode);
+    }
+
+    gchar* path = g_build_filename(directory->path, name, nullptr);
+    gchar* relative_path = directory->relative_path[0] != '\0'
+        ? g_strconcat(directory->relative_path, "/", name, nullptr)
+        : g_strdup(name);
+    WalkEntry entry = { path, relative_path, name, depth, type };
+    progress_reporter_advance(walk->progress, 1, 0, path);
+
+    WalkAction action = walk->visit(&entry, walk->user_data);
+    if (action == WALK_STOP) {
+      g_atomic_int_set(&walk->stopped, TRUE);
+    }
+    if (action == WALK_CONTINUE && type == DT_DIR && descend) {
+      g_queue_push_tail(&subdirectories, walk_directory_new(path, relative_path, depth));
+    } else {
+      g_free(path);
+      g_free(relative_path);
+    }
+  }
+  closedir(dir);
+  method_stats_add_entries(walk->stats, n_entries);
+
+  if (!g_queue_is_empty(&subdirectories)) {
+    g_mutex_lock(&walk->mutex);
+    while (!g_queue_is_empty(&subdirectories)) {
+      g_queue_push_tail(&walk->directories, g_queue_pop_head(&subdirectories));
+    }
+    g_cond_broadcast(&walk->cond);
+    g_mutex_unlock(&walk->mutex);
+  }
+}
+
+static gpointer walk_thread(gpointer user_data) {
+  Walk* walk = static_cast<Walk*>(user_data);
+  MethodStats* previous_stats = method_stats_set_current(walk->stats);
+  ProgressReporter* previous_progress = progress_reporter_set_current(walk->progress);
+
+  g_mutex_lock(&walk->mutex);
+  for (;;) {
+    while (g_queue_is_empty(&walk->directories) && walk->busy > 0 && !is_stopped(walk)) {
+      g_cond_wait(&walk->cond, &walk->mutex);
+    }
+    if (is_stopped(walk) || g_queue_is_empty(&walk->directories)) {
+      // Either stopped, or nothing is queued and nobody can queue more.
+      break;
+    }
+
+    WalkDirectory* directory = static_cast<WalkDirectory*>(g_queue_pop_tail(&walk->directories));
+    walk->busy++;
+    g_mutex_unlock(&walk->mutex);
+
+    read_directory(walk, directory);
+    walk_directory_free(directory);
+
+    g_mutex_lock(&walk->mutex);
+    walk->busy--;
+  }
+  g_cond_broadcast(&walk->cond);
+  g_mutex_unlock(&walk->mutex);
+
+  progress_reporter_set_current(previous_progress);
+  method_stats_set_current(previous_stats);
+  return nullptr;
+}
+
+// Many FUSE daemons serve one request at a time, so extra threads only queue.
+static const guint kFuseWalkThreads = 2;
+
+guint walk_thread_count_for(const gchar* root) {
+  FsCapabilities capabilities;
+  if (fs_capabilities_get(root, &capabilities, nullptr)) {
+    // Network walks wait on round trips rather than the CPU or a disk, so
+    // they use every thread allowed even on small machines.
+    if (capabilities.is_network) {
+      return kMaxWalkThreads;
+    }
+    if (capabilities.is_fuse) {
+      return kFuseWalkThreads;
+    }
+  }
+  return CLAMP(g_get_num_processors(), 1u, kMaxWalkThreads);
+}
+
+gboolean walk_directory(const gchar* root,
+                        gint max_depth,
+                        guint n_threads,
+                        WalkVisitFunc visit,
+                        gpointer user_data,
+                        GCancellable* cancellable,
+                        GError** error) {
+  struct stat st;
+  if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode) || access(root, R_OK | X_OK) != 0) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOTDIR,
+                "Cannot read directory “%s”", root);
+    return FALSE;
+  }
+  if (max_depth == 0) {
+    return TRUE;
+  }
+
+  Walk walk = {};
+  g_mutex_init(&walk.mutex);
+  g_cond_init(&walk.cond);
+  g_queue_init(&walk.directories);
+  walk.max_depth = max_depth;
+  walk.visit = visit;
+  walk.user_data = user_data;
+  walk.cancellable = cancellable;
+  walk.stats = method_stats_get_current();
+  walk.progress = progress_reporter_get_current();
+  g_queue_push_tail(&walk.directories, walk_directory_new(g_strdup(root), g_strdup(""), 0));
+
+  // The calling thread takes part in the walk as well.
+  n_threads = CLAMP(n_threads, 1u, kMaxWalkThreads);
+  GThread* threads[kMaxWalkThreads];
+  for (guint i = 1; i < n_threads; i++) {
+    threads[i] = g_thread_new("ente-walk", walk_thread, &walk);
+  }
+  walk_thread(&walk);
+  for (guint i = 1; i < n_threads; i++) {
+    g_thread_join(threads[i]);
+  }
+
+  g_queue_clear_full(&walk.directories, walk_directory_free);
+  g_cond_clear(&walk.cond);
+  g_mutex_clear(&walk.mutex);
+  return !g_cancellable_set_error_if_cancelled(cancellable, error);
+}
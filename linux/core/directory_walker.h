@@ -0,0 +1,51 @@
+#ifndef ENTE_DIRECTORY_PICKER_DIRECTORY_WALKER_H_
+#define ENTE_DIRECTORY_PICKER_DIRECTORY_WALKER_H_
+
+#include <gio/gio.h>
+
+// An entry found while walking a directory tree.
+typedef struct {
+  // Full path of the entry.
+  const gchar* path;
+  // Path relative to the root of the walk, using '/' separators.
+  const gchar* relative_path;
+  // Final component of path.
+  const gchar* name;
+  // 1 for entries directly inside the root.
+  guint depth;
+  // DT_REG, DT_DIR, DT_LNK, ... Never DT_UNKNOWN.
+  guint8 type;
+} WalkEntry;
+
+typedef enum {
+  WALK_CONTINUE,
+  // Do not descend into this directory.
+  WALK_SKIP,
+  // Abandon the whole walk as soon as possible.
+  WALK_STOP,
+} WalkAction;
+
+// Called for every entry. Runs concurrently on the walker threads, so the
+// callback must synchronise access to anything it shares.
+typedef WalkAction (*WalkVisitFunc)(const WalkEntry* entry, gpointer user_data);
+
+// Walks root with up to n_threads threads, each reading whole directories
+// with readdir() and using d_type to avoid a stat() per entry. Symbolic links
+// are reported but never followed. max_depth limits how many levels below
+// root are visited; a negative value means no limit. Directories that cannot
+// be read are skipped; only failing to open root is an error. Cancelling
+// cancellable stops the walk within an entry on every thread, and makes it
+// fail with G_IO_ERROR_CANCELLED.
+gboolean walk_directory(const gchar* root,
+                        gint max_depth,
+                        guint n_threads,
+                        WalkVisitFunc visit,
+                        gpointer user_data,
+                        GCancellable* cancellable,
+                        GError** error);
+
+// Number of threads to use for a walk of root when the caller has no better
+// idea, according to the kind of file system root is on.
+guint walk_thread_count_for(const gchar* root);
+
+#endif  // ENTE_DIRECTORY_PICKER_DIRECTORY_WALKER_H_
@@ -0,0 +1,295 @@
+#include "export_manifest.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "method_stats.h"
+#include "progress_reporter.h"
+
+static const gchar kManifestName[] = ".ente_export_manifest";
+
+// Identifies the file format; bump the version when the layout changes.
+static const gchar kManifestMagic[8] = {'E', 'D', 'P', 'E', 'X', 'P', 'R', 'T'};
+static const guint32 kManifestVersion = 1;
+
+static const gsize kHashBufferSize = 1024 * 1024;
+static const gsize kDigestSize = 32;
+
+// The file is the header followed by the records, sorted by name, and the
+// string pool holding the names.
+typedef struct {
+  gchar magic[8];
+  guint32 version;
+  guint32 record_count;
+  guint64 strings_size;
+} ManifestHeader;
+
+// Describes the source a file was last exported from.
+typedef struct {
+  // Pool offset of the file name; unused in memory, where the name is the key.
+  guint32 name;
+  guint32 reserved;
+  guint64 size;
+  // Modification time in nanoseconds since the epoch.
+  gint64 mtime_ns;
+  guint8 sha256[kDigestSize];
+} ManifestRecord;
+
+static gint64 stat_mtime_ns(const struct stat* st) {
+  return static_cast<gint64>(st->st_mtim.tv_sec) * G_GINT64_CONSTANT(1000000000) +
+         st->st_mtim.tv_nsec;
+}
+
+gboolean export_manifest_is_reserved_name(const gchar* file_name) {
+  return strcmp(file_name, kManifestName) == 0;
+}
+
+// Reads the manifest in directory_path into a table from file name to
+// ManifestRecord. A missing, corrupt or newer manifest gives an empty table,
+// which just means every file is copied.
+static GHashTable* load_manifest(const gchar* directory_path) {
+  GHashTable* records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  g_autofree gchar* path = g_build_filename(directory_path, kManifestName, nullptr);
+  g_autofree gchar* data = nullptr;
+  gsize size = 0;
+  if (!g_file_get_contents(path, &data, &size, nullptr) || size < sizeof(ManifestHeader)) {
+    return records;
+  }
+
+  ManifestHeader header;
+  memcpy(&header, data, sizeof(header));
+  gsize records_size = size - sizeof(ManifestHeader);
+  if (memcmp(header.magic, kManifestMagic, sizeof(kManifestMagic)) != 0 ||
+      header.version != kManifestVersion ||
+      header.record_count > records_size / sizeof(ManifestRecord) ||
+      header.strings_size != records_size - header.record_count * sizeof(ManifestRecord)) {
+    return records;
+  }
+
+  const gchar* strings = data + sizeof(ManifestHeader) +
+                         header.record_count * sizeof(ManifestRecord);
+  for (guint32 i = 0; i < header.record_count; i++) {
+    ManifestRecord* record = g_new(ManifestRecord, 1);
+    memcpy(record, data + sizeof(ManifestHeader) + i * sizeof(ManifestRecord),
+           sizeof(ManifestRecord));
+    // Names are NUL-terminated within the pool.
+    if (record->name >= header.strings_size ||
+        !memchr(strings + record->name, '\0', header.strings_size - record->name)) {
+      g_free(record);
+      continue;
+    }
+    g_hash_table_replace(records, g_strdup(strings + record->name), record);
+  }
+  return records;
+}
+
+static GByteArray* serialize_manifest(GHashTable* records) {
+  GList* names = g_list_sort(g_hash_table_get_keys(records),
+                             reinterpret_cast<GCompareFunc>(strcmp));
+  GString* strings = g_string_new(nullptr);
+  GArray* table = g_array_sized_new(FALSE, FALSE, sizeof(ManifestRecord),
+                                    g_hash_table_size(records));
+  for (GList* name = names; name; name = name->next) {
+    ManifestRecord record = *static_cast<ManifestRecord*>(g_hash_table_lookup(records, name->data));
+    record.name = static_cast<guint32>(strings->len);
+    record.reserved = 0;
+    g_string_append(strings, static_cast<const gchar*>(name->data));
+    g_string_append_c(strings, '\0');
+    g_array_append_val(table, record);
+  }
+  g_list_free(names);
+
+  ManifestHeader header = {};
+  memcpy(header.magic, kManifestMagic, sizeof(header.magic));
+  header.version = kManifestVersion;
+  header.record_count = table->len;
+  header.strings_size = strings->len;
+
+  GByteArray* bytes = g_byte_array_sized_new(
+      sizeof(header) + sizeof(ManifestRecord) * table->len + strings->len);
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(&header), sizeof(header));
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(table->data),
+                      sizeof(ManifestRecord) * table->len);
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(strings->str), strings->len);
+  g_array_unref(table);
+  g_string_free(strings, TRUE);
+  return bytes;
+}
+
+static gboolean save_manifest(const gchar* directory_path, GHashTable* records,
+                              WriteDurability durability, GError** error) {
+  GByteArray* bytes = serialize_manifest(records);
+  PendingWrite write = {};
+  write.file_name = kManifestName;
+  write.data = reinterpret_cast<const gchar*>(bytes->data);
+  write.length = bytes->len;
+  // Not cancellable: the manifest has to describe the files already copied.
+  gboolean success = write_files_durably(directory_path, &write, 1, durability, nullptr, error);
+  g_byte_array_unref(bytes);
+  return success;
+}
+
+// Computes the SHA-256 of the file at path, which is read in full.
+static gboolean hash_file(const gchar* path, guint8* digest, GCancellable* cancellable,
+                          GError** error) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (fd < 0) {
+    set_file_error_from_errno(error, errno, "open file", path);
+    return FALSE;
+  }
+  // The source is read once, start to end, and not needed again afterwards.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+
+  ProgressReporter* progress = progress_reporter_get_current();
+  GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  g_autofree guint8* buffer = static_cast<guint8*>(g_malloc(kHashBufferSize));
+  guint64 total = 0;
+  gboolean success = TRUE;
+  for (;;) {
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+      success = FALSE;
+      break;
+    }
+    ssize_t n = read(fd, buffer, kHashBufferSize);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      set_file_error_from_errno(error, errno, "read file", path);
+      success = FALSE;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    g_checksum_update(checksum, buffer, n);
+    total += n;
+    progress_reporter_advance(progress, 0, n, nullptr);
+  }
+  close(fd);
+  method_stats_add_bytes_read(method_stats_get_current(), total);
+
+  if (success) {
+    gsize digest_size = kDigestSize;
+    g_checksum_get_digest(checksum, digest, &digest_size);
+  }
+  g_checksum_free(checksum);
+  return success;
+}
+
+// Returns whether the file exported as file_name is still as recorded. Only
+// its size is compared, as copying does not carry the mtime over.
+static gboolean is_target_intact(const gchar* directory_path, const gchar* file_name,
+                                 const ManifestRecord* record) {
+  g_autofree gchar* path = g_build_filename(directory_path, file_name, nullptr);
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+         static_cast<guint64>(st.st_size) == record->size;
+}
+
+gboolean export_files_incrementally(const gchar* directory_path,
+                                    const ExportItem* items,
+                                    gsize n_items,
+                                    WriteDurability durability,
+                                    ExportStats* stats,
+                                    GCancellable* cancellable,
+                                    GError** error) {
+  GHashTable* records = load_manifest(directory_path);
+  ProgressReporter* progress = progress_reporter_get_current();
+  ExportStats counts = {};
+  gboolean changed = FALSE;
+  GError* export_error = nullptr;
+
+  for (gsize i = 0; i < n_items; i++) {
+    const ExportItem* item = &items[i];
+    if (g_cancellable_set_error_if_cancelled(cancellable, &export_error)) {
+      break;
+    }
+    struct stat source_st;
+    int stat_errno = stat(item->source_path, &source_st) != 0 ? errno
+                     : S_ISREG(source_st.st_mode) ? 0 : EINVAL;
+    if (stat_errno != 0) {
+      set_file_error_from_errno(&export_error, stat_errno, "copy file", item->source_path);
+      break;
+    }
+    guint64 size = source_st.st_size;
+    gint64 mtime_ns = stat_mtime_ns(&source_st);
+
+    ManifestRecord* record =
+        static_cast<ManifestRecord*>(g_hash_table_lookup(records, item->file_name));
+    gboolean target_intact = record && record->size == size &&
+                             is_target_intact(directory_path, item->file_name, record);
+    if (target_intact && record->mtime_ns == mtime_ns) {
+      counts.skipped++;
+      progress_reporter_add_totals(progress, 1, 0);
+      progress_reporter_advance(progress, 1, 0, item->source_path);
+      continue;
+    }
+
+    // The size and mtime are taken before hashing, so a source that changes
+    // while it is read is hashed again next time.
+    guint8 digest[kDigestSize];
+    gboolean hashed = FALSE;
+    if (target_intact) {
+      // Only the mtime differs, so the hash decides whether to copy at all.
+      progress_reporter_add_totals(progress, 0, size);
+      progress_reporter_set_path(progress, item->source_path);
+      if (!hash_file(item->source_path, digest, cancellable, &export_error)) {
+        break;
+      }
+      hashed = TRUE;
+      if (memcmp(record->sha256, digest, kDigestSize) == 0) {
+        // Touched, or replaced with the same contents.
+        record->mtime_ns = mtime_ns;
+        changed = TRUE;
+        counts.skipped++;
+        progress_reporter_add_totals(progress, 1, 0);
+        progress_reporter_advance(progress, 1, 0, nullptr);
+        continue;
+      }
+    }
+
+    // Anything else is copied, and hashed on the way unless it already was.
+    GChecksum* checksum = hashed ? nullptr : g_checksum_new(G_CHECKSUM_SHA256);
+    gboolean copied_ok = copy_file_durably_with_checksum(
+        item->source_path, directory_path, item->file_name, durability, checksum, cancellable,
+        &export_error);
+    if (checksum) {
+      if (copied_ok) {
+        gsize digest_size = kDigestSize;
+        g_checksum_get_digest(checksum, digest, &digest_size);
+      }
+      g_checksum_free(checksum);
+    }
+    if (!copied_ok) {
+      break;
+    }
+    ManifestRecord* copied = g_new0(ManifestRecord, 1);
+    copied->size = size;
+    copied->mtime_ns = mtime_ns;
+    memcpy(copied->sha256, digest, kDigestSize);
+    g_hash_table_replace(records, g_strdup(item->file_name), copied);
+    changed = TRUE;
+    counts.copied++;
+  }
+
+  gboolean success = export_error == nullptr;
+  if (changed) {
+    // After a failure the manifest is still worth saving, but the failure is
+    // what gets reported.
+    success = save_manifest(directory_path, records, durability,
+                            export_error ? nullptr : &export_error) && success;
+  }
+  g_hash_table_unref(records);
+  if (export_error) {
+    g_propagate_error(error, export_error);
+  }
+  if (stats) {
+    *stats = counts;
+  }
+  return success;
+}
@@ -0,0 +1,43 @@
+#ifndef ENTE_DIRECTORY_PICKER_EXPORT_MANIFEST_H_
+#define ENTE_DIRECTORY_PICKER_EXPORT_MANIFEST_H_
+
+#include <gio/gio.h>
+
+#include "file_writer.h"
+
+// A file to be placed in an export directory by export_files_incrementally().
+typedef struct {
+  const gchar* source_path;
+  const gchar* file_name;
+} ExportItem;
+
+typedef struct {
+  guint copied;
+  // Files left alone because the directory already held their contents.
+  guint skipped;
+} ExportStats;
+
+// Returns whether file_name is the name of the manifest kept in export
+// directories, which no exported file may take.
+gboolean export_manifest_is_reserved_name(const gchar* file_name);
+
+// Copies each item's source into directory_path as its file name with
+// copy_file_durably(), skipping those the directory already holds. A manifest
+// in the directory records the name, size, mtime and SHA-256 of the source of
+// every file exported there. A file is skipped without being read when its
+// source has the recorded size and mtime, and after hashing it when only the
+// mtime changed but the hash still matches, as long as the exported file is
+// still there at the recorded size. Any other file is hashed while it is
+// copied, so it is read only once. The manifest is replaced atomically once
+// the items are done, and also after a failure or cancellation so the files
+// copied so far are skipped next time. Returns FALSE and sets error at the
+// first item that cannot be copied; stats counts the items before it.
+gboolean export_files_incrementally(const gchar* directory_path,
+                                    const ExportItem* items,
+                                    gsize n_items,
+                                    WriteDurability durability,
+                                    ExportStats* stats,
+                                    GCancellable* cancellable,
+                                    GError** error);
+
+#endif  // ENTE_DIRECTORY_PICKER_EXPORT_MANIFEST_H_
@@ -0,0 +1,114 @@
+#include "file_finder.h"
+
+#include <dirent.h>
+#include <string.h>
+
+#include "directory_walker.h"
+
+typedef struct {
+  GPatternSpec* spec;
+  gboolean match_path;
+} CompiledGlob;
+
+struct _GlobSet {
+  CompiledGlob* globs;
+  guint n_globs;
+};
+
+typedef struct {
+  const GlobSet* patterns;
+  const GlobSet* excludes;
+  gboolean include_directories;
+  GMutex mutex;
+  GPtrArray* matches;
+} FindContext;
+
+static gboolean pattern_matches(GPatternSpec* spec, const gchar* text) {
+#if GLIB_CHECK_VERSION(2, 70, 0)
+  return g_pattern_spec_match_string(spec, text);
+#else
+  return g_pattern_match_string(spec, text);
+#endif
+}
+
+GlobSet* glob_set_new(const gchar* const* patterns) {
+  GlobSet* set = g_new0(GlobSet, 1);
+  guint n_patterns = patterns ? g_strv_length(const_cast<gchar**>(patterns)) : 0;
+  set->globs = g_new0(CompiledGlob, n_patterns);
+  for (guint i = 0; i < n_patterns; i++) {
+    set->globs[i].spec = g_pattern_spec_new(patterns[i]);
+    set->globs[i].match_path = strchr(patterns[i], '/') != nullptr;
+  }
+  set->n_globs = n_patterns;
+  return set;
+}
+
+gboolean glob_set_matches(const GlobSet* set, const gchar* name, const gchar* relative_path) {
+  for (guint i = 0; i < set->n_globs; i++) {
+    const CompiledGlob* glob = &set->globs[i];
+    if (pattern_matches(glob->spec, glob->match_path ? relative_path : name)) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+gboolean glob_set_is_empty(const GlobSet* set) {
+  return set->n_globs == 0;
+}
+
+void glob_set_free(GlobSet* set) {
+  for (guint i = 0; i < set->n_globs; i++) {
+    g_pattern_spec_free(set->globs[i].spec);
+  }
+  g_free(set->globs);
+  g_free(set);
+}
+
+static WalkAction find_visit(const WalkEntry* entry, gpointer user_data) {
+  FindContext* context = static_cast<FindContext*>(user_data);
+
+  if (glob_set_matches(context->excludes, entry->name, entry->relative_path)) {
+    return WALK_SKIP;
+  }
+
+  gboolean wanted = entry->type == DT_DIR ? context->include_directories : TRUE;
+  if (wanted && (glob_set_is_empty(context->patterns) ||
+                 glob_set_matches(context->patterns, entry->name, entry->relative_path))) {
+    g_mutex_lock(&context->mutex);
+    g_ptr_array_add(context->matches, g_strdup(entry->path));
+    g_mutex_unlock(&context->mutex);
+  }
+  return WALK_CONTINUE;
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+  return strcmp(*static_cast<const gchar* const*>(a), *static_cast<const gchar* const*>(b));
+}
+
+GPtrArray* find_matching_files(const gchar* root,
+                               const GlobSet* patterns,
+                               const GlobSet* excludes,
+                               gint max_depth,
+                               gboolean include_directories,
+                               GCancellable* cancellable,
+                               GError** error) {
+  FindContext context = {};
+  context.patterns = patterns;
+  context.excludes = excludes;
+  context.include_directories = include_directories;
+  context.matches = g_ptr_array_new_with_free_func(g_free);
+  g_mutex_init(&context.mutex);
+
+  gboolean success = walk_directory(root, max_depth, walk_thread_count_for(root),
+                                    find_visit, &context, cancellable, error);
+  g_mutex_clear(&context.mutex);
+  if (!success) {
+    g_ptr_array_unref(context.matches);
+    return nullptr;
+  }
+
+  // Threads finish directories in no particular order.
+  g_ptr_array_sort(context.matches, compare_paths);
+  return context.matches;
+}
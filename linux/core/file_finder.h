@@ -0,0 +1,35 @@
+#ifndef ENTE_DIRECTORY_PICKER_FILE_FINDER_H_
+#define ENTE_DIRECTORY_PICKER_FILE_FINDER_H_
+
+#include <gio/gio.h>
+
+// A set of compiled glob patterns. A pattern containing '/' is matched against
+// an entry's path relative to the search root, any other pattern against its
+// name. '*' and '?' are the only wildcards, and '*' also matches '/'.
+typedef struct _GlobSet GlobSet;
+
+// Compiles patterns, a NULL-terminated array.
+GlobSet* glob_set_new(const gchar* const* patterns);
+
+// Returns TRUE if any pattern in the set matches.
+gboolean glob_set_matches(const GlobSet* set, const gchar* name, const gchar* relative_path);
+
+// Returns TRUE if the set holds no patterns.
+gboolean glob_set_is_empty(const GlobSet* set);
+
+void glob_set_free(GlobSet* set);
+
+// Finds entries under root whose name or relative path matches one of
+// patterns and none of excludes, walking the tree in parallel. Directories
+// matching excludes are pruned without being read. Returns full paths in
+// sorted order, or NULL with error set if root cannot be read or cancellable
+// is cancelled.
+GPtrArray* find_matching_files(const gchar* root,
+                               const GlobSet* patterns,
+                               const GlobSet* excludes,
+                               gint max_depth,
+                               gboolean include_directories,
+                               GCancellable* cancellable,
+                               GError** error);
+
+#endif  // ENTE_DIRECTORY_PICKER_FILE_FINDER_H_
@@ -0,0 +1,542 @@
+#include "file_index.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "file_writer.h"
+#include "method_stats.h"
+#include "progress_reporter.h"
+
+// Identifies the file format; bump the version when the layout changes.
+static const gchar kIndexMagic[8] = {'E', 'D', 'P', 'I', 'N', 'D', 'E', 'X'};
+static const guint32 kIndexVersion = 1;
+
+static const guint32 kEntryFile = 0;
+static const guint32 kEntryDirectory = 1;
+static const guint32 kEntrySymlink = 2;
+static const guint32 kEntryOther = 3;
+
+// The file is the header followed by the entry, sorted-name and directory
+// tables and finally the string pool. All offsets are in bytes from the start
+// of the file except string offsets, which are relative to the pool.
+typedef struct {
+  gchar magic[8];
+  guint32 version;
+  guint32 entry_count;
+  guint32 directory_count;
+  // Pool offset of the root path.
+  guint32 root;
+  guint64 entries_offset;
+  guint64 sorted_offset;
+  guint64 directories_offset;
+  guint64 strings_offset;
+  guint64 strings_size;
+  // The folded names of all entries, in entry order, are stored contiguously
+  // in the pool starting here so substring lookups can scan them in one pass.
+  guint64 folded_offset;
+  guint64 folded_size;
+} IndexHeader;
+
+typedef struct {
+  guint32 path;
+  guint32 name;
+  guint32 folded_name;
+  guint32 type;
+  guint64 size;
+  gint64 mtime_ns;
+} IndexEntry;
+
+// Directories list their children as a contiguous run of entries.
+typedef struct {
+  guint32 path;
+  guint32 first_child;
+  guint32 child_count;
+  guint32 reserved;
+  gint64 mtime_ns;
+} IndexDirectory;
+
+struct _FileIndex {
+  guint8* data;
+  gsize size;
+  const IndexHeader* header;
+  const IndexEntry* entries;
+  const guint32* sorted;
+  const IndexDirectory* directories;
+  const gchar* strings;
+};
+
+typedef struct {
+  GString* paths;
+  // Entries' folded-name offsets are relative to this until the index is
+  // written, when it is appended to paths to form the pool.
+  GString* folded;
+  GArray* entries;
+  GArray* directories;
+  const FileIndex* previous;
+  // Maps a relative path to its directory in previous.
+  GHashTable* previous_directories;
+  guint reused_directories;
+  GCancellable* cancellable;
+  ProgressReporter* progress;
+} IndexBuilder;
+
+static gint64 stat_mtime_ns(const struct stat* st) {
+  return static_cast<gint64>(st->st_mtim.tv_sec) * G_GINT64_CONSTANT(1000000000) +
+         st->st_mtim.tv_nsec;
+}
+
+static guint32 entry_type_from_mode(mode_t mode) {
+  if (S_ISREG(mode)) return kEntryFile;
+  if (S_ISDIR(mode)) return kEntryDirectory;
+  if (S_ISLNK(mode)) return kEntrySymlink;
+  return kEntryOther;
+}
+
+// Names are folded with Unicode case folding when they are valid UTF-8 and
+// with ASCII lowering otherwise, so lookups are case-insensitive.
+static gchar* fold_name(const gchar* name) {
+  if (g_utf8_validate(name, -1, nullptr)) {
+    return g_utf8_casefold(name, -1);
+  }
+  return g_ascii_strdown(name, -1);
+}
+
+static guint32 pool_add(GString* pool, const gchar* string) {
+  guint32 offset = static_cast<guint32>(pool->len);
+  g_string_append(pool, string);
+  g_string_append_c(pool, '\0');
+  return offset;
+}
+
+static const gchar* index_string(const FileIndex* index, guint32 offset) {
+  return offset < index->header->strings_size ? index->strings + offset : "";
+}
+
+gchar* file_index_default_path(const gchar* root) {
+  g_autofree gchar* digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, root, -1);
+  g_autofree gchar* file_name = g_strconcat(digest, ".index", nullptr);
+  return g_build_filename(g_get_user_cache_dir(), "ente_directory_picker", "indexes",
+                          file_name, nullptr);
+}
+
+static void builder_add_entry(IndexBuilder* builder,
+                              const gchar* relative_path,
+                              const gchar* name,
+                              guint32 type,
+                              guint64 size,
+                              gint64 mtime_ns) {
+  IndexEntry entry = {};
+  entry.path = pool_add(builder->paths, relative_path);
+  entry.name = entry.path + static_cast<guint32>(strlen(relative_path) - strlen(name));
+  g_autofree gchar* folded = fold_name(name);
+  entry.folded_name = pool_add(builder->folded, folded);
+  entry.type = type;
+  entry.size = size;
+  entry.mtime_ns = mtime_ns;
+  g_array_append_val(builder->entries, entry);
+}
+
+static gchar* child_relative_path(const gchar* relative_path, const gchar* name) {
+  return relative_path[0] ? g_strconcat(relative_path, "/", name, nullptr) : g_strdup(name);
+}
+
+// Copies a directory's children from the previous index. Returns FALSE if
+// the directory is not in it or has changed since.
+static gboolean reuse_directory(IndexBuilder* builder, const gchar* relative_path, gint64 mtime_ns) {
+  if (!builder->previous) {
+    return FALSE;
+  }
+  gpointer value;
+  if (!g_hash_table_lookup_extended(builder->previous_directories, relative_path, nullptr, &value)) {
+    return FALSE;
+  }
+
+  const FileIndex* previous = builder->previous;
+  const IndexDirectory* directory = &previous->directories[GPOINTER_TO_UINT(value)];
+  if (directory->mtime_ns != mtime_ns ||
+      directory->first_child > previous->header->entry_count ||
+      directory->child_count > previous->header->entry_count - directory->first_child) {
+    return FALSE;
+  }
+
+  for (guint32 i = 0; i < directory->child_count; i++) {
+    const IndexEntry* entry = &previous->entries[directory->first_child + i];
+    const gchar* name = index_string(previous, entry->name);
+    g_autofree gchar* child_path = child_relative_path(relative_path, name);
+    builder_add_entry(builder, child_path, name, entry->type, entry->size, entry->mtime_ns);
+  }
+  return TRUE;
+}
+
+static void read_directory(IndexBuilder* builder, const gchar* path, const gchar* relative_path) {
+  DIR* dir = opendir(path);
+  if (!dir) {
+    return;
+  }
+
+  guint64 n_entries = 0;
+  struct dirent* dirent;
+  while ((dirent = readdir(dir)) != nullptr) {
+    if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+      continue;
+    }
+    if (g_cancellable_is_cancelled(builder->cancellable)) {
+      break;
+    }
+    n_entries++;
+    progress_reporter_advance(builder->progress, 1, 0, path);
+    struct stat st;
+    if (fstatat(dirfd(dir), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      continue;
+    }
+    g_autofree gchar* child_path = child_relative_path(relative_path, dirent->d_name);
+    builder_add_entry(builder, child_path, dirent->d_name, entry_type_from_mode(st.st_mode),
+                      S_ISREG(st.st_mode) ? st.st_size : 0, stat_mtime_ns(&st));
+  }
+  closedir(dir);
+  method_stats_add_entries(method_stats_get_current(), n_entries);
+}
+
+static void scan_directory(IndexBuilder* builder,
+                           const gchar* path,
+                           const gchar* relative_path,
+                           gint64 mtime_ns) {
+  guint32 directory_index = builder->directories->len;
+  IndexDirectory directory = {};
+  directory.path = pool_add(builder->paths, relative_path);
+  directory.first_child = builder->entries->len;
+  directory.mtime_ns = mtime_ns;
+  g_array_append_val(builder->directories, directory);
+
+  if (reuse_directory(builder, relative_path, mtime_ns)) {
+    builder->reused_directories++;
+    progress_reporter_advance(builder->progress, builder->entries->len - directory.first_child, 0,
+                              path);
+  } else {
+    read_directory(builder, path, relative_path);
+  }
+
+  guint32 first_child = directory.first_child;
+  guint32 child_count = builder->entries->len - first_child;
+  g_array_index(builder->directories, IndexDirectory, directory_index).child_count = child_count;
+
+  // Children are laid out before descending so each directory's run stays
+  // contiguous. A subdirectory's mtime must be checked even when its parent
+  // was reused, because changes inside it do not touch the parent.
+  for (guint32 i = first_child; i < first_child + child_count; i++) {
+    const IndexEntry* entry = &g_array_index(builder->entries, IndexEntry, i);
+    if (g_cancellable_is_cancelled(builder->cancellable)) {
+      return;
+    }
+    if (entry->type != kEntryDirectory) {
+      continue;
+    }
+    g_autofree gchar* child_relative = g_strdup(builder->paths->str + entry->path);
+    g_autofree gchar* child_path = g_build_filename(path, builder->paths->str + entry->name, nullptr);
+    struct stat st;
+    if (lstat(child_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+      continue;
+    }
+    scan_directory(builder, child_path, child_relative, stat_mtime_ns(&st));
+  }
+}
+
+static gint compare_folded_names(gconstpointer a, gconstpointer b, gpointer user_data) {
+  IndexBuilder* builder = static_cast<IndexBuilder*>(user_data);
+  guint32 first = *static_cast<const guint32*>(a);
+  guint32 second = *static_cast<const guint32*>(b);
+  int result = strcmp(
+      builder->folded->str + g_array_index(builder->entries, IndexEntry, first).folded_name,
+      builder->folded->str + g_array_index(builder->entries, IndexEntry, second).folded_name);
+  if (result != 0) {
+    return result;
+  }
+  return first < second ? -1 : first > second;
+}
+
+static GByteArray* serialize_index(IndexBuilder* builder, const gchar* root) {
+  GArray* sorted = g_array_sized_new(FALSE, FALSE, sizeof(guint32), builder->entries->len);
+  for (guint32 i = 0; i < builder->entries->len; i++) {
+    g_array_append_val(sorted, i);
+  }
+  g_array_sort_with_data(sorted, compare_folded_names, builder);
+
+  guint32 root_offset = pool_add(builder->paths, root);
+  guint32 folded_base = static_cast<guint32>(builder->paths->len);
+  for (guint i = 0; i < builder->entries->len; i++) {
+    g_array_index(builder->entries, IndexEntry, i).folded_name += folded_base;
+  }
+
+  IndexHeader header = {};
+  memcpy(header.magic, kIndexMagic, sizeof(header.magic));
+  header.version = kIndexVersion;
+  header.entry_count = builder->entries->len;
+  header.directory_count = builder->directories->len;
+  header.root = root_offset;
+  header.entries_offset = sizeof(IndexHeader);
+  header.sorted_offset = header.entries_offset + sizeof(IndexEntry) * builder->entries->len;
+  // Keep the directory table 8-byte aligned after the 4-byte sorted table.
+  header.directories_offset = (header.sorted_offset + sizeof(guint32) * sorted->len + 7) & ~7ULL;
+  header.strings_offset = header.directories_offset +
+                          sizeof(IndexDirectory) * builder->directories->len;
+  header.strings_size = builder->paths->len + builder->folded->len;
+  header.folded_offset = folded_base;
+  header.folded_size = builder->folded->len;
+
+  GByteArray* bytes = g_byte_array_sized_new(header.strings_offset + header.strings_size);
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(&header), sizeof(header));
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(builder->entries->data),
+                      sizeof(IndexEntry) * builder->entries->len);
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(sorted->data),
+                      sizeof(guint32) * sorted->len);
+  static const guint8 padding[8] = {};
+  g_byte_array_append(bytes, padding, header.directories_offset - bytes->len);
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(builder->directories->data),
+                      sizeof(IndexDirectory) * builder->directories->len);
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(builder->paths->str),
+                      builder->paths->len);
+  g_byte_array_append(bytes, reinterpret_cast<const guint8*>(builder->folded->str),
+                      builder->folded->len);
+
+  g_array_unref(sorted);
+  return bytes;
+}
+
+gboolean file_index_build(const gchar* root,
+                          const gchar* index_path,
+                          FileIndexStats* stats,
+                          GCancellable* cancellable,
+                          GError** error) {
+  struct stat st;
+  if (stat(root, &st) != 0) {
+    set_file_error_from_errno(error, errno, "index", root);
+    return FALSE;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    set_file_error_from_errno(error, ENOTDIR, "index", root);
+    return FALSE;
+  }
+
+  IndexBuilder builder = {};
+  builder.paths = g_string_new(nullptr);
+  builder.folded = g_string_new(nullptr);
+  builder.entries = g_array_new(FALSE, FALSE, sizeof(IndexEntry));
+  builder.directories = g_array_new(FALSE, FALSE, sizeof(IndexDirectory));
+  builder.previous_directories = g_hash_table_new(g_str_hash, g_str_equal);
+  builder.cancellable = cancellable;
+  builder.progress = progress_reporter_get_current();
+
+  // A missing, corrupt or foreign previous index just means a full scan.
+  FileIndex* previous = file_index_open(index_path, nullptr);
+  if (previous && strcmp(file_index_get_root(previous), root) == 0) {
+    builder.previous = previous;
+    for (guint32 i = 0; i < previous->header->directory_count; i++) {
+      g_hash_table_insert(builder.previous_directories,
+                          const_cast<gchar*>(index_string(previous, previous->directories[i].path)),
+                          GUINT_TO_POINTER(i));
+    }
+  }
+
+  scan_directory(&builder, root, "", stat_mtime_ns(&st));
+  // A partial scan must not replace the previous index.
+  GByteArray* bytes = g_cancellable_set_error_if_cancelled(cancellable, error)
+      ? nullptr
+      : serialize_index(&builder, root);
+
+  if (stats) {
+    stats->entries = builder.entries->len;
+    stats->directories = builder.directories->len;
+    stats->reused_directories = builder.reused_directories;
+  }
+
+  g_hash_table_unref(builder.previous_directories);
+  g_clear_pointer(&previous, file_index_close);
+  g_string_free(builder.paths, TRUE);
+  g_string_free(builder.folded, TRUE);
+  g_array_unref(builder.entries);
+  g_array_unref(builder.directories);
+
+  g_autofree gchar* index_directory_path = g_path_get_dirname(index_path);
+  g_autofree gchar* index_name = g_path_get_basename(index_path);
+  gboolean success = TRUE;
+  if (!bytes) {
+    success = FALSE;
+  } else if (g_mkdir_with_parents(index_directory_path, 0700) != 0) {
+    set_file_error_from_errno(error, errno, "create", index_directory_path);
+    success = FALSE;
+  } else {
+    PendingWrite write = {};
+    write.file_name = index_name;
+    write.data = reinterpret_cast<const gchar*>(bytes->data);
+    write.length = bytes->len;
+    success = write_files_durably(index_directory_path, &write, 1,
+                                  WRITE_DURABILITY_DATA, cancellable, error);
+  }
+  g_clear_pointer(&bytes, g_byte_array_unref);
+  return success;
+}
+
+static gboolean section_fits(gsize file_size, guint64 offset, guint64 count, gsize item_size) {
+  return offset <= file_size && count <= (file_size - offset) / item_size;
+}
+
+FileIndex* file_index_open(const gchar* index_path, GError** error) {
+  int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    set_file_error_from_errno(error, errno, "open", index_path);
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    set_file_error_from_errno(error, errno, "stat", index_path);
+    close(fd);
+    return nullptr;
+  }
+
+  gsize size = st.st_size;
+  void* data = size >= sizeof(IndexHeader)
+      ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+      : MAP_FAILED;
+  close(fd);
+  if (data == MAP_FAILED) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not a file index", index_path);
+    return nullptr;
+  }
+
+  const IndexHeader* header = static_cast<const IndexHeader*>(data);
+  const gchar* strings = static_cast<const gchar*>(data) + header->strings_offset;
+  if (memcmp(header->magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+      header->version != kIndexVersion ||
+      !section_fits(size, header->entries_offset, header->entry_count, sizeof(IndexEntry)) ||
+      !section_fits(size, header->sorted_offset, header->entry_count, sizeof(guint32)) ||
+      !section_fits(size, header->directories_offset, header->directory_count,
+                    sizeof(IndexDirectory)) ||
+      !section_fits(size, header->strings_offset, header->strings_size, 1) ||
+      header->strings_size == 0 || strings[header->strings_size - 1] != '\0' ||
+      header->folded_offset > header->strings_size ||
+      header->folded_size > header->strings_size - header->folded_offset ||
+      header->entries_offset % 8 != 0 || header->directories_offset % 8 != 0) {
+    munmap(data, size);
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not a valid file index", index_path);
+    return nullptr;
+  }
+
+  FileIndex* index = g_new0(FileIndex, 1);
+  index->data = static_cast<guint8*>(data);
+  index->size = size;
+  index->header = header;
+  index->entries = reinterpret_cast<const IndexEntry*>(index->data + header->entries_offset);
+  index->sorted = reinterpret_cast<const guint32*>(index->data + header->sorted_offset);
+  index->directories =
+      reinterpret_cast<const IndexDirectory*>(index->data + header->directories_offset);
+  index->strings = strings;
+  return index;
+}
+
+void file_index_close(FileIndex* index) {
+  munmap(index->data, index->size);
+  g_free(index);
+}
+
+const gchar* file_index_get_root(const FileIndex* index) {
+  return index_string(index, index->header->root);
+}
+
+static const gchar* entry_folded_name(const FileIndex* index, guint32 i) {
+  return index_string(index, index->entries[i].folded_name);
+}
+
+static void lookup_prefix(const FileIndex* index, const gchar* folded, guint limit, GArray* matches) {
+  gsize length = strlen(folded);
+  guint32 low = 0;
+  guint32 high = index->header->entry_count;
+  while (low < high) {
+    guint32 middle = low + (high - low) / 2;
+    guint32 entry = index->sorted[middle];
+    if (entry < index->header->entry_count && strcmp(entry_folded_name(index, entry), folded) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  for (guint32 i = low; i < index->header->entry_count && matches->len < limit; i++) {
+    guint32 entry = index->sorted[i];
+    if (entry >= index->header->entry_count ||
+        strncmp(entry_folded_name(index, entry), folded, length) != 0) {
+      break;
+    }
+    g_array_append_val(matches, entry);
+  }
+}
+
+// Finds the entry whose folded name contains pool offset, using the fact that
+// folded names are stored in entry order.
+static guint32 entry_at_folded_offset(const FileIndex* index, guint64 offset) {
+  guint32 low = 0;
+  guint32 high = index->header->entry_count;
+  while (high - low > 1) {
+    guint32 middle = low + (high - low) / 2;
+    if (index->entries[middle].folded_name <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static void lookup_substring(const FileIndex* index, const gchar* folded, guint limit, GArray* matches) {
+  gsize length = strlen(folded);
+  const gchar* start = index->strings + index->header->folded_offset;
+  const gchar* end = start + index->header->folded_size;
+  const gchar* position = start;
+
+  // Names are NUL-terminated and the query has no NUL, so a hit never spans
+  // two names.
+  while (matches->len < limit && position < end) {
+    const gchar* hit = static_cast<const gchar*>(memmem(position, end - position, folded, length));
+    if (!hit) {
+      break;
+    }
+    guint32 entry = entry_at_folded_offset(index, hit - index->strings);
+    g_array_append_val(matches, entry);
+
+    const gchar* name_end = static_cast<const gchar*>(memchr(hit, '\0', end - hit));
+    if (!name_end) {
+      break;
+    }
+    position = name_end + 1;
+  }
+}
+
+void file_index_lookup(const FileIndex* index,
+                       const gchar* query,
+                       FileIndexMatch mode,
+                       guint limit,
+                       GArray* matches) {
+  if (index->header->entry_count == 0) {
+    return;
+  }
+  g_autofree gchar* folded = fold_name(query);
+  if (mode == FILE_INDEX_MATCH_PREFIX) {
+    lookup_prefix(index, folded, limit, matches);
+  } else if (folded[0] != '\0') {
+    lookup_substring(index, folded, limit, matches);
+  }
+}
+
+void file_index_get_entry(const FileIndex* index, guint i, FileIndexEntry* entry) {
+  const IndexEntry* stored = &index->entries[i];
+  entry->relative_path = index_string(index, stored->path);
+  entry->name = index_string(index, stored->name);
+  entry->size = stored->size;
+  entry->mtime_ns = stored->mtime_ns;
+  entry->is_directory = stored->type == kEntryDirectory;
+}
@@ -0,0 +1,72 @@
+#ifndef ENTE_DIRECTORY_PICKER_FILE_INDEX_H_
+#define ENTE_DIRECTORY_PICKER_FILE_INDEX_H_
+
+#include <gio/gio.h>
+
+// An on-disk index of every entry under a directory tree, mapped read-only
+// into memory. It holds each entry's relative path, type, size and mtime, a
+// table of entries sorted by case-folded name for prefix lookups and the
+// folded names packed together for substring scans.
+typedef struct _FileIndex FileIndex;
+
+typedef enum {
+  FILE_INDEX_MATCH_PREFIX,
+  FILE_INDEX_MATCH_SUBSTRING,
+} FileIndexMatch;
+
+// An entry read back from an index. Strings point into the mapping.
+typedef struct {
+  const gchar* relative_path;
+  const gchar* name;
+  guint64 size;
+  // Modification time in nanoseconds since the epoch.
+  gint64 mtime_ns;
+  gboolean is_directory;
+} FileIndexEntry;
+
+typedef struct {
+  guint entries;
+  guint directories;
+  // Directories whose mtime was unchanged, so their listing was taken from
+  // the previous index instead of being read again.
+  guint reused_directories;
+} FileIndexStats;
+
+// Returns where the index for root is kept by default, under the user's
+// cache directory.
+gchar* file_index_default_path(const gchar* root);
+
+// Scans root and writes its index to index_path, replacing any previous index
+// atomically. When a previous index for the same root exists, directories
+// whose mtime has not changed are not read again: their entries are copied
+// from it and only their subdirectories are checked. Sizes and mtimes of
+// files in such directories are therefore as of the scan that last read them.
+// If cancellable is cancelled the scan stops and the previous index is kept.
+gboolean file_index_build(const gchar* root,
+                          const gchar* index_path,
+                          FileIndexStats* stats,
+                          GCancellable* cancellable,
+                          GError** error);
+
+// Maps the index at index_path. Returns NULL with error set if it is missing
+// or not a valid index.
+FileIndex* file_index_open(const gchar* index_path, GError** error);
+
+void file_index_close(FileIndex* index);
+
+// Returns the root the index was built from.
+const gchar* file_index_get_root(const FileIndex* index);
+
+// Adds to matches (a GArray of guint) the entries whose case-folded name
+// starts with or contains the case-folded query, up to limit in total.
+// Prefix matches come in name order, substring matches in tree order.
+void file_index_lookup(const FileIndex* index,
+                       const gchar* query,
+                       FileIndexMatch mode,
+                       guint limit,
+                       GArray* matches);
+
+// Reads entry number i, as returned by file_index_lookup().
+void file_index_get_entry(const FileIndex* index, guint i, FileIndexEntry* entry);
+
+#endif  // ENTE_DIRECTORY_PICKER_FILE_INDEX_H_
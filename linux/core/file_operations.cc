@@ -0,0 +1,101 @@
+#include "file_operations.h"
+
+#include <string.h>
+
+#include "method_stats.h"
+#include "progress_reporter.h"
+
+// Whether error means there is nothing at the path, as opposed to something
+// that could not be read.
+static gboolean is_missing(const GError* error) {
+  return g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT) ||
+         g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOTDIR);
+}
+
+static void file_details_clear(gpointer data) {
+  FileDetails* details = static_cast<FileDetails*>(data);
+  g_free(details->name);
+  g_free(details->path);
+}
+
+gboolean file_operations_is_valid_file_name(const gchar* file_name) {
+  return !(strstr(file_name, "..") || strstr(file_name, "/") || strstr(file_name, "\\"));
+}
+
+GPtrArray* file_operations_list_directory(const IoBackend* backend,
+                                          const gchar* directory_path,
+                                          GCancellable* cancellable,
+                                          GError** error) {
+  GError* list_error = nullptr;
+  GPtrArray* names = backend->list_directory(backend, directory_path, cancellable, &list_error);
+  if (!names) {
+    if (is_missing(list_error)) {
+      g_error_free(list_error);
+    } else {
+      g_propagate_error(error, list_error);
+    }
+    return nullptr;
+  }
+
+  method_stats_add_entries(method_stats_get_current(), names->len);
+  ProgressReporter* progress = progress_reporter_get_current();
+  progress_reporter_add_totals(progress, names->len, 0);
+  progress_reporter_advance(progress, names->len, 0, directory_path);
+  return names;
+}
+
+GArray* file_operations_get_details(const IoBackend* backend,
+                                    const gchar* directory_path,
+                                    GCancellable* cancellable,
+                                    GError** error) {
+  g_autoptr(GPtrArray) names =
+      file_operations_list_directory(backend, directory_path, cancellable, error);
+  if (!names) {
+    return nullptr;
+  }
+
+  GArray* entries = g_array_sized_new(FALSE, FALSE, sizeof(FileDetails), names->len);
+  g_array_set_clear_func(entries, file_details_clear);
+  // The listing counted as one pass over the entries; examining them is a
+  // second.
+  ProgressReporter* progress = progress_reporter_get_current();
+  progress_reporter_add_totals(progress, names->len, 0);
+  for (guint i = 0; i < names->len; i++) {
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+      g_array_unref(entries);
+      return nullptr;
+    }
+    const gchar* name = static_cast<const gchar*>(g_ptr_array_index(names, i));
+    FileDetails details;
+    details.path = g_build_filename(directory_path, name, nullptr);
+    progress_reporter_advance(progress, 1, 0, details.path);
+    if (!backend->query_info(backend, details.path, &details.info, nullptr)) {
+      g_free(details.path);
+      continue;
+    }
+    details.name = g_strdup(name);
+    details.name_rank = 0;
+    g_array_append_val(entries, details);
+  }
+  return entries;
+}
+
+gboolean file_operations_read_file(const IoBackend* backend,
+                                   const gchar* file_path,
+                                   gchar** contents,
+                                   gsize* length,
+                                   GCancellable* cancellable,
+                                   GError** error) {
+  GError* read_error = nullptr;
+  if (!backend->read_file(backend, file_path, contents, length, cancellable, &read_error)) {
+    if (is_missing(read_error)) {
+      g_error_free(read_error);
+    } else {
+      g_propagate_error(error, read_error);
+    }
+    return FALSE;
+  }
+
+  method_stats_add_bytes_read(method_stats_get_current(), *length);
+  return TRUE;
+}
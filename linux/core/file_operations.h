@@ -0,0 +1,56 @@
+#ifndef ENTE_DIRECTORY_PICKER_FILE_OPERATIONS_H_
+#define ENTE_DIRECTORY_PICKER_FILE_OPERATIONS_H_
+
+#include <gio/gio.h>
+
+#include "io_backend.h"
+
+// The read-side operations behind the plugin's method calls, free of Flutter
+// and GTK so they can be reused, benchmarked and profiled on their own. Each
+// takes the IoBackend to run on; pass io_backend_get_default() for the real
+// file system. I/O is charged to method_stats_get_current(). Each also takes
+// a GCancellable, which may be NULL; once it is cancelled the operation stops
+// and fails with G_IO_ERROR_CANCELLED. Writes are in
+// file_writer.h and searches in file_finder.h and content_search.h.
+
+// One entry of a directory, as returned by file_operations_get_details().
+typedef struct {
+  gchar* name;
+  gchar* path;
+  IoFileInfo info;
+  // Position of name in the natural order of the directory, once set by
+  // collation_cache_rank_details(); 0 until then.
+  guint name_rank;
+} FileDetails;
+
+// Returns whether file_name names a file directly inside a directory, not
+// one elsewhere through ".." or a separator.
+gboolean file_operations_is_valid_file_name(const gchar* file_name);
+
+// Returns the names of the entries in directory_path as a GPtrArray of
+// strings. Returns NULL without setting error if there is no directory at
+// directory_path, and NULL with error set if it cannot be read.
+GPtrArray* file_operations_list_directory(const IoBackend* backend,
+                                          const gchar* directory_path,
+                                          GCancellable* cancellable,
+                                          GError** error);
+
+// Like file_operations_list_directory(), but returns a GArray of FileDetails
+// that frees their strings. Entries that vanish before they can be examined
+// are left out.
+GArray* file_operations_get_details(const IoBackend* backend,
+                                    const gchar* directory_path,
+                                    GCancellable* cancellable,
+                                    GError** error);
+
+// Reads the file at file_path into contents, which is NUL-terminated and must
+// be freed with g_free(). Returns FALSE without setting error if there is no
+// file at file_path, and FALSE with error set if it cannot be read.
+gboolean file_operations_read_file(const IoBackend* backend,
+                                   const gchar* file_path,
+                                   gchar** contents,
+                                   gsize* length,
+                                   GCancellable* cancellable,
+                                   GError** error);
+
+#endif  // ENTE_DIRECTORY_PICKER_FILE_OPERATIONS_H_
@@ -0,0 +1,517 @@
+#include "file_writer.h"
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fs_capabilities.h"
+#include "method_stats.h"
+#include "progress_reporter.h"
+
+void set_file_error_from_errno(GError** error, int saved_errno,
+                               const gchar* action, const gchar* path) {
+  g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+              "Failed to %s “%s”: %s", action, path, g_strerror(saved_errno));
+}
+
+// Writes and copies go at most this many bytes at a time, so a cancelled one
+// stops after one more chunk.
+static const gsize kWriteChunkSize = 8 * 1024 * 1024;
+
+// Returns whether cancellable was cancelled, setting errno to ECANCELED if so.
+static gboolean check_cancelled(GCancellable* cancellable) {
+  if (g_cancellable_is_cancelled(cancellable)) {
+    errno = ECANCELED;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Sets error for a failed action on path, or to G_IO_ERROR_CANCELLED if it
+// failed because cancellable was cancelled.
+static void set_write_error(GError** error, GCancellable* cancellable, int saved_errno,
+                            const gchar* action, const gchar* path) {
+  if (!g_cancellable_set_error_if_cancelled(cancellable, error)) {
+    set_file_error_from_errno(error, saved_errno, action, path);
+  }
+}
+
+// Writes all of data to fd, retrying on short writes and EINTR.
+static gboolean write_all(int fd, const gchar* data, gsize length, GCancellable* cancellable) {
+  while (length > 0) {
+    if (check_cancelled(cancellable)) {
+      return FALSE;
+    }
+    ssize_t written = write(fd, data, MIN(length, kWriteChunkSize));
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return FALSE;
+    }
+    data += written;
+    length -= written;
+    progress_reporter_advance(progress_reporter_get_current(), 0, written, nullptr);
+  }
+  return TRUE;
+}
+
+// Files at least this large are preallocated with fallocate() before writing.
+static const guint64 kPreallocateThreshold = 1024 * 1024;
+
+// posix_fallocate() is not used as a fallback because glibc emulates it by
+// writing zeros, doubling the I/O of the write it is meant to speed up.
+int preallocate_file(int fd, guint64 size, gboolean* allocated) {
+  *allocated = FALSE;
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0) {
+    *allocated = TRUE;
+    return 0;
+  }
+  if (errno == EOPNOTSUPP || errno == ENOSYS) {
+    return 0;
+  }
+  return errno;
+}
+
+static gboolean is_zero_block(const gchar* data, gsize length) {
+  return data[0] == 0 && memcmp(data, data + 1, length - 1) == 0;
+}
+
+// Writes data to a new file, skipping block-aligned runs of zeros so they
+// become holes. Preallocated runs have to be punched out explicitly.
+static gboolean write_sparse(int fd, const gchar* data, gsize length, gboolean preallocated,
+                             GCancellable* cancellable) {
+  struct stat st;
+  gsize block_size = fstat(fd, &st) == 0 && st.st_blksize > 0 ? st.st_blksize : 4096;
+
+  // Hole punching stops at the end of the file, so size it first.
+  if (preallocated && ftruncate(fd, length) != 0) {
+    return FALSE;
+  }
+
+  gsize offset = 0;
+  while (offset < length) {
+    gsize chunk = MIN(block_size, length - offset);
+    gboolean zero = chunk == block_size && is_zero_block(data + offset, chunk);
+
+    // Extend the run while blocks keep the same zero/non-zero state.
+    gsize run = chunk;
+    while (offset + run < length) {
+      gsize next = MIN(block_size, length - offset - run);
+      gboolean next_zero = next == block_size && is_zero_block(data + offset + run, next);
+      if (next_zero != zero) {
+        break;
+      }
+      run += next;
+    }
+
+    if (zero) {
+      if (preallocated &&
+          fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, run) != 0 &&
+          errno != EOPNOTSUPP) {
+        return FALSE;
+      }
+      progress_reporter_advance(progress_reporter_get_current(), 0, run, nullptr);
+    } else {
+      gsize written = 0;
+      while (written < run) {
+        if (check_cancelled(cancellable)) {
+          return FALSE;
+        }
+        ssize_t n = pwrite(fd, data + offset + written, MIN(run - written, kWriteChunkSize),
+                           offset + written);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return FALSE;
+        }
+        written += n;
+        progress_reporter_advance(progress_reporter_get_current(), 0, n, nullptr);
+      }
+    }
+    offset += run;
+  }
+
+  // Trailing holes are only reflected in the size once it is set explicitly.
+  return ftruncate(fd, length) == 0;
+}
+
+// Whether the file system's capabilities change how a batch is written,
+// which is worth a statfs() only for batches that are synced or large.
+static gboolean batch_depends_on_file_system(const PendingWrite* writes,
+                                             gsize n_writes,
+                                             WriteDurability durability) {
+  if (n_writes > 1 && durability != WRITE_DURABILITY_NONE) {
+    return TRUE;
+  }
+  for (gsize i = 0; i < n_writes; i++) {
+    if (MAX(writes[i].expected_size, (guint64)writes[i].length) >= kPreallocateThreshold) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Durability is applied once per batch rather than once per file, like a
+// group commit: a single file is fdatasync()ed directly, while a batch of
+// files is flushed with one syncfs() before any rename takes place. Full
+// durability then needs just one fsync() of the shared parent directory to
+// persist all of the renames. Where syncfs() cannot be trusted, each file of
+// the batch is synced on its own instead.
+gboolean write_files_durably(const gchar* directory_path,
+                             const PendingWrite* writes,
+                             gsize n_writes,
+                             WriteDurability durability,
+                             GCancellable* cancellable,
+                             GError** error) {
+  // Nothing to make durable; without this the batch would still sync the
+  // whole file system.
+  if (n_writes == 0) {
+    return TRUE;
+  }
+
+  gboolean sync_each_file = n_writes == 1;
+  gboolean may_preallocate = TRUE;
+  FsCapabilities capabilities;
+  if (batch_depends_on_file_system(writes, n_writes, durability) &&
+      fs_capabilities_get(directory_path, &capabilities, nullptr)) {
+    sync_each_file = sync_each_file || !fs_capabilities_has_reliable_syncfs(&capabilities);
+    may_preallocate = !capabilities.probed || capabilities.supports_fallocate;
+  }
+
+  ProgressReporter* progress = progress_reporter_get_current();
+  if (progress) {
+    guint64 total_bytes = 0;
+    for (gsize i = 0; i < n_writes; i++) {
+      total_bytes += writes[i].length;
+    }
+    progress_reporter_add_totals(progress, n_writes, total_bytes);
+  }
+
+  gboolean success = TRUE;
+  gchar** temp_paths = g_new0(gchar*, n_writes + 1);
+  gsize n_written = 0;
+
+  for (; n_written < n_writes; n_written++) {
+    const PendingWrite* pending = &writes[n_written];
+    if (progress) {
+      g_autofree gchar* file_path = g_build_filename(directory_path, pending->file_name, nullptr);
+      progress_reporter_set_path(progress, file_path);
+    }
+    g_autofree gchar* temp_name = g_strdup_printf(".%s.XXXXXX", pending->file_name);
+    gchar* temp_path = g_build_filename(directory_path, temp_name, nullptr);
+    temp_paths[n_written] = temp_path;
+
+    int fd = g_mkstemp_full(temp_path, O_RDWR | O_CLOEXEC, 0666);
+    if (fd < 0) {
+      set_file_error_from_errno(error, errno, "create file", temp_path);
+      g_clear_pointer(&temp_paths[n_written], g_free);
+      success = FALSE;
+      break;
+    }
+
+    guint64 reserve = MAX(pending->expected_size, (guint64)pending->length);
+    gboolean preallocated = FALSE;
+    if (reserve >= kPreallocateThreshold && may_preallocate) {
+      int preallocate_errno = preallocate_file(fd, reserve, &preallocated);
+      if (preallocate_errno != 0) {
+        close(fd);
+        set_file_error_from_errno(error, preallocate_errno, "reserve space for", temp_path);
+        n_written++;
+        success = FALSE;
+        break;
+      }
+    }
+
+    gboolean file_ok = pending->sparse
+        ? write_sparse(fd, pending->data, pending->length, preallocated, cancellable)
+        : write_all(fd, pending->data, pending->length, cancellable);
+    if (file_ok && sync_each_file) {
+      if (durability == WRITE_DURABILITY_DATA) {
+        file_ok = fdatasync(fd) == 0;
+      } else if (durability == WRITE_DURABILITY_FULL) {
+        file_ok = fsync(fd) == 0;
+      }
+    }
+    int saved_errno = errno;
+    if (close(fd) != 0 && file_ok) {
+      saved_errno = errno;
+      file_ok = FALSE;
+    }
+    if (!file_ok) {
+      set_write_error(error, cancellable, saved_errno, "write file", temp_path);
+      n_written++;
+      success = FALSE;
+      break;
+    }
+    method_stats_add_bytes_written(method_stats_get_current(), pending->length);
+    progress_reporter_advance(progress, 1, 0, nullptr);
+  }
+
+  int dir_fd = -1;
+  if (success && (!sync_each_file || durability == WRITE_DURABILITY_FULL) &&
+      durability != WRITE_DURABILITY_NONE) {
+    dir_fd = open(directory_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+      set_file_error_from_errno(error, errno, "open directory", directory_path);
+      success = FALSE;
+    } else if (!sync_each_file && syncfs(dir_fd) != 0) {
+      set_file_error_from_errno(error, errno, "sync file system of", directory_path);
+      success = FALSE;
+    }
+  }
+
+  // Past this point the batch is committed, so this is the last chance to
+  // abandon it without leaving some files replaced.
+  if (success && g_cancellable_set_error_if_cancelled(cancellable, error)) {
+    success = FALSE;
+  }
+
+  gsize n_renamed = 0;
+  for (; success && n_renamed < n_writes; n_renamed++) {
+    g_autofree gchar* file_path =
+        g_build_filename(directory_path, writes[n_renamed].file_name, nullptr);
+    if (rename(temp_paths[n_renamed], file_path) != 0) {
+      set_file_error_from_errno(error, errno, "rename file to", file_path);
+      success = FALSE;
+      break;
+    }
+  }
+
+  if (success && durability == WRITE_DURABILITY_FULL && fsync(dir_fd) != 0) {
+    set_file_error_from_errno(error, errno, "sync directory", directory_path);
+    success = FALSE;
+  }
+  if (dir_fd >= 0) {
+    close(dir_fd);
+  }
+
+  // Remove temporaries that never made it to their final name.
+  for (gsize i = n_renamed; i < n_written; i++) {
+    if (temp_paths[i]) {
+      unlink(temp_paths[i]);
+    }
+  }
+  g_strfreev(temp_paths);
+  return success;
+}
+
+// Buffer size for copies that fall back to read() and write().
+static const gsize kCopyBufferSize = 1024 * 1024;
+
+// copy_file_range() fails with these when it cannot handle a pair of files,
+// such as ones on different file systems with older kernels.
+static gboolean is_copy_unsupported(int saved_errno) {
+  return saved_errno == EXDEV || saved_errno == EINVAL ||
+         saved_errno == EOPNOTSUPP || saved_errno == ENOSYS;
+}
+
+// Feeds all of fd to checksum, for a copy that never passed through a buffer.
+static gboolean checksum_file(int fd, GChecksum* checksum, GCancellable* cancellable) {
+  g_autofree guchar* buffer = static_cast<guchar*>(g_malloc(kCopyBufferSize));
+  guint64 offset = 0;
+  for (;;) {
+    if (check_cancelled(cancellable)) {
+      return FALSE;
+    }
+    ssize_t n = pread(fd, buffer, kCopyBufferSize, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n == 0;
+    }
+    g_checksum_update(checksum, buffer, n);
+    offset += n;
+  }
+}
+
+// Copies length bytes between the start of two files, cheapest method first:
+// sharing the source's extents, then an in-kernel copy, then a buffer. With a
+// checksum, the in-kernel copy is skipped so the bytes can be hashed on the
+// way through.
+static gboolean copy_data(int source_fd, int target_fd, guint64 length,
+                          const FsCapabilities* capabilities, gboolean same_file_system,
+                          GChecksum* checksum, GCancellable* cancellable) {
+  ProgressReporter* progress = progress_reporter_get_current();
+  if (same_file_system && capabilities->supports_reflink &&
+      ioctl(target_fd, FICLONE, source_fd) == 0) {
+    progress_reporter_advance(progress, 0, length, nullptr);
+    return !checksum || checksum_file(source_fd, checksum, cancellable);
+  }
+
+  guint64 copied = 0;
+  if (capabilities->supports_copy_file_range && !checksum) {
+    while (copied < length) {
+      if (check_cancelled(cancellable)) {
+        return FALSE;
+      }
+      ssize_t n = copy_file_range(source_fd, nullptr, target_fd, nullptr,
+                                  MIN(length - copied, (guint64)kWriteChunkSize), 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && copied == 0 && is_copy_unsupported(errno)) {
+        break;
+      }
+      if (n < 0) {
+        return FALSE;
+      }
+      if (n == 0) {
+        // The source shrank while being copied.
+        return TRUE;
+      }
+      copied += n;
+      progress_reporter_advance(progress, 0, n, nullptr);
+    }
+    if (copied > 0 || length == 0) {
+      return TRUE;
+    }
+  }
+
+  posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  g_autofree gchar* buffer = static_cast<gchar*>(g_malloc(kCopyBufferSize));
+  for (;;) {
+    if (check_cancelled(cancellable)) {
+      return FALSE;
+    }
+    ssize_t n = read(source_fd, buffer, kCopyBufferSize);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n == 0;
+    }
+    if (checksum) {
+      g_checksum_update(checksum, reinterpret_cast<const guchar*>(buffer), n);
+    }
+    if (!write_all(target_fd, buffer, n, cancellable)) {
+      return FALSE;
+    }
+  }
+}
+
+gboolean copy_file_durably(const gchar* source_path,
+                           const gchar* directory_path,
+                           const gchar* file_name,
+                           WriteDurability durability,
+                           GCancellable* cancellable,
+                           GError** error) {
+  return copy_file_durably_with_checksum(source_path, directory_path, file_name, durability,
+                                         nullptr, cancellable, error);
+}
+
+gboolean copy_file_durably_with_checksum(const gchar* source_path,
+                                         const gchar* directory_path,
+                                         const gchar* file_name,
+                                         WriteDurability durability,
+                                         GChecksum* checksum,
+                                         GCancellable* cancellable,
+                                         GError** error) {
+  FsCapabilities capabilities;
+  if (!fs_capabilities_get(directory_path, &capabilities, error)) {
+    return FALSE;
+  }
+
+  int source_fd = open(source_path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (source_fd < 0) {
+    set_file_error_from_errno(error, errno, "open file", source_path);
+    return FALSE;
+  }
+  struct stat source_st;
+  struct stat directory_st;
+  int stat_errno = fstat(source_fd, &source_st) != 0 ? errno
+                   : S_ISREG(source_st.st_mode) ? 0 : EINVAL;
+  if (stat_errno != 0) {
+    close(source_fd);
+    set_file_error_from_errno(error, stat_errno, "copy file", source_path);
+    return FALSE;
+  }
+  gboolean same_file_system = stat(directory_path, &directory_st) == 0 &&
+                              directory_st.st_dev == source_st.st_dev;
+  // Copies are bulk work, so the source's pages should not push out pages
+  // that are in use. Kernels before 6.3 ignore the hint.
+  posix_fadvise(source_fd, 0, 0, POSIX_FADV_NOREUSE);
+  ProgressReporter* progress = progress_reporter_get_current();
+  progress_reporter_add_totals(progress, 1, source_st.st_size);
+  progress_reporter_set_path(progress, source_path);
+
+  g_autofree gchar* temp_name = g_strdup_printf(".%s.XXXXXX", file_name);
+  g_autofree gchar* temp_path = g_build_filename(directory_path, temp_name, nullptr);
+  int fd = g_mkstemp_full(temp_path, O_RDWR | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    set_file_error_from_errno(error, errno, "create file", temp_path);
+    close(source_fd);
+    return FALSE;
+  }
+
+  // A clone allocates nothing, so space is only reserved for real copies.
+  guint64 length = source_st.st_size;
+  gboolean will_clone = same_file_system && capabilities.supports_reflink;
+  gboolean preallocated = FALSE;
+  int saved_errno = 0;
+  if (!will_clone && length >= kPreallocateThreshold &&
+      (!capabilities.probed || capabilities.supports_fallocate)) {
+    saved_errno = preallocate_file(fd, length, &preallocated);
+  }
+
+  gboolean file_ok = saved_errno == 0 &&
+                     copy_data(source_fd, fd, length, &capabilities, same_file_system,
+                               checksum, cancellable);
+  if (file_ok) {
+    if (durability == WRITE_DURABILITY_DATA) {
+      file_ok = fdatasync(fd) == 0;
+    } else if (durability == WRITE_DURABILITY_FULL) {
+      file_ok = fsync(fd) == 0;
+    }
+  }
+  // Nobody is about to read the copy, and once it has been synced its pages
+  // are clean and can be dropped at once.
+  if (file_ok && durability != WRITE_DURABILITY_NONE) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  if (saved_errno == 0) {
+    saved_errno = errno;
+  }
+  if (close(fd) != 0 && file_ok) {
+    saved_errno = errno;
+    file_ok = FALSE;
+  }
+  close(source_fd);
+  if (!file_ok || g_cancellable_is_cancelled(cancellable)) {
+    set_write_error(error, cancellable, saved_errno, "write file", temp_path);
+    unlink(temp_path);
+    return FALSE;
+  }
+  // Counted as copied even when the blocks were shared, so the figures
+  // reflect what the caller asked for.
+  method_stats_add_bytes_read(method_stats_get_current(), length);
+  method_stats_add_bytes_written(method_stats_get_current(), length);
+  progress_reporter_advance(progress, 1, 0, nullptr);
+
+  g_autofree gchar* file_path = g_build_filename(directory_path, file_name, nullptr);
+  if (rename(temp_path, file_path) != 0) {
+    set_file_error_from_errno(error, errno, "rename file to", file_path);
+    unlink(temp_path);
+    return FALSE;
+  }
+
+  if (durability == WRITE_DURABILITY_FULL) {
+    int dir_fd = open(directory_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0 || fsync(dir_fd) != 0) {
+      set_file_error_from_errno(error, errno, "sync directory", directory_path);
+      if (dir_fd >= 0) {
+        close(dir_fd);
+      }
+      return FALSE;
+    }
+    close(dir_fd);
+  }
+  return TRUE;
+}
@@ -0,0 +1,75 @@
+#ifndef ENTE_DIRECTORY_PICKER_FILE_WRITER_H_
+#define ENTE_DIRECTORY_PICKER_FILE_WRITER_H_
+
+#include <gio/gio.h>
+
+// How hard a write pushes data to stable storage before reporting success.
+typedef enum {
+  WRITE_DURABILITY_NONE,  // Leave flushing to the kernel's writeback.
+  WRITE_DURABILITY_DATA,  // fdatasync the file contents before replacing the target.
+  WRITE_DURABILITY_FULL,  // fsync the file and the parent directory entry as well.
+} WriteDurability;
+
+// A single file to be written by write_files_durably().
+typedef struct {
+  const gchar* file_name;
+  const gchar* data;
+  gsize length;
+  // Size the file is expected to reach, used to reserve its blocks up front.
+  // Zero means the final size is length.
+  guint64 expected_size;
+  // Leave runs of zero blocks in data as holes instead of writing them.
+  gboolean sparse;
+} PendingWrite;
+
+// Writes each file to a temporary sibling and renames it over the target, so
+// readers only ever see the old or the new contents. Durability is applied
+// once for the whole batch. Large files are preallocated before writing so
+// they are laid out contiguously and a full disk fails the write up front with
+// G_FILE_ERROR_NOSPC. Returns FALSE and sets error on the first failure;
+// files renamed before the failure keep their new contents. Cancelling
+// cancellable before the renames start leaves every target untouched. An
+// empty batch does nothing and succeeds.
+gboolean write_files_durably(const gchar* directory_path,
+                             const PendingWrite* writes,
+                             gsize n_writes,
+                             WriteDurability durability,
+                             GCancellable* cancellable,
+                             GError** error);
+
+// Copies the regular file at source_path to file_name in directory_path
+// through a temporary sibling, replacing any existing file atomically. The
+// copy shares the source's blocks when both are on a file system with
+// reflinks, is done in the kernel with copy_file_range() when possible, and
+// falls back to reading and writing otherwise. Returns FALSE and sets error on
+// failure, including G_IO_ERROR_CANCELLED if cancellable is cancelled before
+// the rename, leaving the target untouched.
+gboolean copy_file_durably(const gchar* source_path,
+                           const gchar* directory_path,
+                           const gchar* file_name,
+                           WriteDurability durability,
+                           GCancellable* cancellable,
+                           GError** error);
+
+// Like copy_file_durably(), and also feeds the source's contents to checksum,
+// which may be NULL. A copy that passes through a buffer is hashed on the way,
+// so the source is read only once; the in-kernel copy is skipped for this.
+gboolean copy_file_durably_with_checksum(const gchar* source_path,
+                                         const gchar* directory_path,
+                                         const gchar* file_name,
+                                         WriteDurability durability,
+                                         GChecksum* checksum,
+                                         GCancellable* cancellable,
+                                         GError** error);
+
+// Reserves size bytes for fd without changing its length, so later writes and
+// appends find their extents already allocated. File systems without
+// fallocate() support are left to allocate on write. Returns 0 or an errno
+// value; allocated tells whether space was actually reserved.
+int preallocate_file(int fd, guint64 size, gboolean* allocated);
+
+// Sets error to a G_FILE_ERROR describing a failed action on path.
+void set_file_error_from_errno(GError** error, int saved_errno,
+                               const gchar* action, const gchar* path);
+
+#endif  // ENTE_DIRECTORY_PICKER_FILE_WRITER_H_
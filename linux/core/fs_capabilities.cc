@@ -0,0 +1,197 @@
+#include "fs_capabilities.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct {
+  guint64 magic;
+  const gchar* name;
+  gboolean is_network;
+} FileSystemType;
+
+// statfs() magic numbers, from linux/magic.h and the file systems that do
+// not publish theirs there.
+static const FileSystemType kFileSystemTypes[] = {
+    {0xEF53, "ext4", FALSE},
+    {0x9123683E, "btrfs", FALSE},
+    {0x58465342, "xfs", FALSE},
+    {0xF2F52010, "f2fs", FALSE},
+    {0xCA451A4E, "bcachefs", FALSE},
+    {0x2FC12FC1, "zfs", FALSE},
+    {0x52654973, "reiserfs", FALSE},
+    {0xE0F5E1E2, "erofs", FALSE},
+    {0x73717368, "squashfs", FALSE},
+    {0x794C7630, "overlay", FALSE},
+    {0x01021994, "tmpfs", FALSE},
+    {0x858458F6, "ramfs", FALSE},
+    {0x0000F15F, "ecryptfs", FALSE},
+    {0x00004D44, "vfat", FALSE},
+    {0x2011BAB0, "exfat", FALSE},
+    {0x5346544E, "ntfs", FALSE},
+    {0x0000482B, "hfsplus", FALSE},
+    {0x00009660, "iso9660", FALSE},
+    {0x15013346, "udf", FALSE},
+    {0x65735546, "fuse", FALSE},
+    {0x00006969, "nfs", TRUE},
+    {0x0000517B, "smb", TRUE},
+    {0xFE534D42, "smb2", TRUE},
+    {0xFF534D42, "cifs", TRUE},
+    {0x00C36400, "ceph", TRUE},
+    {0x01021997, "9p", TRUE},
+    {0x5346414F, "afs", TRUE},
+    {0x73757245, "coda", TRUE},
+};
+
+static const guint64 kFuseMagic = 0x65735546;
+
+static GMutex cache_mutex;
+// Maps a mount key (see mount_key()) to its FsCapabilities.
+static GHashTable* cache_entries;
+
+// st_dev alone can be reused by a different file system once a removable
+// drive is swapped, so the statfs fsid and type are part of the key.
+static gchar* mount_key(const struct stat* st, const struct statfs* fs) {
+  int fsid[2];
+  memcpy(fsid, &fs->f_fsid, sizeof(fsid));
+  return g_strdup_printf("%" G_GUINT64_FORMAT ":%x:%x:%" G_GUINT64_FORMAT,
+                         static_cast<guint64>(st->st_dev), static_cast<guint>(fsid[0]),
+                         static_cast<guint>(fsid[1]), static_cast<guint64>(fs->f_type));
+}
+
+// Creating a ring is the cheapest way to learn whether the kernel has io_uring
+// and whether a seccomp filter (as in some sandboxes) blocks it.
+static gboolean probe_io_uring() {
+#ifdef __NR_io_uring_setup
+  // struct io_uring_params; only its size matters to the kernel here.
+  guint32 params[30] = {0};
+  long fd = syscall(__NR_io_uring_setup, 1, params);
+  if (fd >= 0) {
+    close(static_cast<int>(fd));
+    return TRUE;
+  }
+#endif
+  return FALSE;
+}
+
+static gboolean io_uring_available() {
+  static gsize available = 0;
+  if (g_once_init_enter(&available)) {
+    g_once_init_leave(&available, probe_io_uring() ? 2 : 1);
+  }
+  return available == 2;
+}
+
+// Opens an anonymous file in directory_path, through O_TMPFILE when the file
+// system supports it and as a named file that is unlinked at once otherwise.
+static int open_probe_file(const gchar* directory_path, gboolean* used_tmpfile) {
+  int fd = open(directory_path, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0) {
+    *used_tmpfile = TRUE;
+    return fd;
+  }
+  *used_tmpfile = FALSE;
+  g_autofree gchar* template_path =
+      g_build_filename(directory_path, ".ente_directory_picker_probe.XXXXXX", nullptr);
+  fd = g_mkstemp_full(template_path, O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0) {
+    unlink(template_path);
+  }
+  return fd;
+}
+
+// Tries each feature on a pair of scratch files in directory_path.
+static void probe_features(const gchar* directory_path, FsCapabilities* capabilities) {
+  gboolean used_tmpfile;
+  int source_fd = open_probe_file(directory_path, &used_tmpfile);
+  if (source_fd < 0) {
+    return;
+  }
+  gboolean unused;
+  int target_fd = open_probe_file(directory_path, &unused);
+  if (target_fd < 0) {
+    close(source_fd);
+    return;
+  }
+
+  capabilities->probed = TRUE;
+  capabilities->supports_tmpfile = used_tmpfile;
+
+  // Clones work in whole blocks, so the source holds one.
+  gchar block[4096] = {1};
+  if (pwrite(source_fd, block, sizeof(block), 0) == static_cast<ssize_t>(sizeof(block))) {
+    capabilities->supports_reflink = ioctl(target_fd, FICLONE, source_fd) == 0;
+    // Neither file offset has moved yet, so both copy from the start.
+    if (ftruncate(target_fd, 0) == 0) {
+      capabilities->supports_copy_file_range =
+          copy_file_range(source_fd, nullptr, target_fd, nullptr, sizeof(block), 0) > 0;
+    }
+  }
+  capabilities->supports_fallocate = fallocate(target_fd, 0, 0, sizeof(block)) == 0;
+
+  close(target_fd);
+  close(source_fd);
+}
+
+gboolean fs_capabilities_get(const gchar* path, FsCapabilities* capabilities, GError** error) {
+  struct stat st;
+  struct statfs fs;
+  if (stat(path, &st) != 0 || statfs(path, &fs) != 0) {
+    int saved_errno = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                "Cannot examine %s: %s", path, g_strerror(saved_errno));
+    return FALSE;
+  }
+
+  g_autofree gchar* directory_path =
+      S_ISDIR(st.st_mode) ? g_strdup(path) : g_path_get_dirname(path);
+  gboolean writable = access(directory_path, W_OK) == 0;
+  gchar* key = mount_key(&st, &fs);
+
+  g_mutex_lock(&cache_mutex);
+  if (!cache_entries) {
+    cache_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+  FsCapabilities* cached = static_cast<FsCapabilities*>(g_hash_table_lookup(cache_entries, key));
+  if (cached && (cached->probed || !writable)) {
+    *capabilities = *cached;
+    g_mutex_unlock(&cache_mutex);
+    g_free(key);
+    return TRUE;
+  }
+  g_mutex_unlock(&cache_mutex);
+
+  // Probing happens outside the lock; two threads meeting a new mount at the
+  // same time both probe it, and the later result wins.
+  FsCapabilities* probed = g_new0(FsCapabilities, 1);
+  probed->type_name = "unknown";
+  probed->type_magic = static_cast<guint64>(fs.f_type) & 0xFFFFFFFF;
+  for (const FileSystemType& type : kFileSystemTypes) {
+    if (type.magic == probed->type_magic) {
+      probed->type_name = type.name;
+      probed->is_network = type.is_network;
+      break;
+    }
+  }
+  probed->is_fuse = probed->type_magic == kFuseMagic;
+  probed->supports_io_uring = io_uring_available();
+  if (writable) {
+    probe_features(directory_path, probed);
+  }
+  *capabilities = *probed;
+
+  g_mutex_lock(&cache_mutex);
+  g_hash_table_insert(cache_entries, key, probed);
+  g_mutex_unlock(&cache_mutex);
+  return TRUE;
+}
+
+gboolean fs_capabilities_has_reliable_syncfs(const FsCapabilities* capabilities) {
+  return !capabilities->is_network && !capabilities->is_fuse;
+}
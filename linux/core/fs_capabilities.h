@@ -0,0 +1,43 @@
+#ifndef ENTE_DIRECTORY_PICKER_FS_CAPABILITIES_H_
+#define ENTE_DIRECTORY_PICKER_FS_CAPABILITIES_H_
+
+#include <glib.h>
+
+// What a mounted file system supports, as far as the strategies used by the
+// write, copy and scan paths are concerned.
+typedef struct {
+  // Short name of the file system type, such as "ext4" or "fuse", or
+  // "unknown".
+  const gchar* type_name;
+  // f_type reported by statfs().
+  guint64 type_magic;
+  // Every operation is a round trip to a server.
+  gboolean is_network;
+  // Served by a FUSE daemon, like the document portal that gives Flatpak apps
+  // access to user-chosen directories.
+  gboolean is_fuse;
+  // The features below are found by trying them on temporary files, which
+  // needs a writable directory. They are all FALSE when that was not
+  // possible.
+  gboolean probed;
+  gboolean supports_tmpfile;
+  gboolean supports_reflink;
+  gboolean supports_copy_file_range;
+  gboolean supports_fallocate;
+  // io_uring is usable by this process. This depends on the kernel and
+  // seccomp policy rather than on the file system.
+  gboolean supports_io_uring;
+} FsCapabilities;
+
+// Fills capabilities for the file system holding path, which must exist.
+// Each mount is probed once and the result reused; a mount first seen through
+// a read-only directory is probed again when a writable one is seen. Returns
+// FALSE with error set if path cannot be examined.
+gboolean fs_capabilities_get(const gchar* path, FsCapabilities* capabilities, GError** error);
+
+// Whether syncfs() on the mount is known to flush file data to stable
+// storage. FUSE and network file systems may only flush to their daemon or
+// client cache, so each file has to be synced individually there.
+gboolean fs_capabilities_has_reliable_syncfs(const FsCapabilities* capabilities);
+
+#endif  // ENTE_DIRECTORY_PICKER_FS_CAPABILITIES_H_
@@ -0,0 +1,134 @@
+#include "io_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_writer.h"
+#include "progress_reporter.h"
+
+// Reads are split into chunks of this size so a cancelled read stops after at
+// most one more chunk.
+static const gsize kReadChunkSize = 1 << 20;
+
+static GPtrArray* default_list_directory(const IoBackend* backend, const gchar* path,
+                                         GCancellable* cancellable, GError** error) {
+  GDir* dir = g_dir_open(path, 0, error);
+  if (!dir) {
+    return nullptr;
+  }
+
+  GPtrArray* names = g_ptr_array_new_with_free_func(g_free);
+  const gchar* name;
+  while ((name = g_dir_read_name(dir)) != nullptr) {
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+      g_dir_close(dir);
+      g_ptr_array_unref(names);
+      return nullptr;
+    }
+    g_ptr_array_add(names, g_strdup(name));
+  }
+  g_dir_close(dir);
+  return names;
+}
+
+static gboolean default_query_info(const IoBackend* backend, const gchar* path,
+                                   IoFileInfo* info, GError** error) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    set_file_error_from_errno(error, errno, "get information about", path);
+    return FALSE;
+  }
+  info->is_directory = S_ISDIR(st.st_mode);
+  info->size = st.st_size;
+  info->modified_ms = static_cast<gint64>(st.st_mtime) * 1000;
+  return TRUE;
+}
+
+static gboolean default_read_file(const IoBackend* backend, const gchar* path, gchar** contents,
+                                  gsize* length, GCancellable* cancellable, GError** error) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    set_file_error_from_errno(error, errno, "open", path);
+    return FALSE;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    set_file_error_from_errno(error, errno, "get information about", path);
+    close(fd);
+    return FALSE;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    set_file_error_from_errno(error, EISDIR, "read", path);
+    close(fd);
+    return FALSE;
+  }
+
+  // Files in /proc and the like report a size of zero, so the buffer grows
+  // past st_size as needed.
+  gsize capacity = MAX(static_cast<gsize>(st.st_size), kReadChunkSize) + 1;
+  gchar* buffer = static_cast<gchar*>(g_try_malloc(capacity));
+  if (!buffer) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+                "Not enough memory to read “%s”", path);
+    close(fd);
+    return FALSE;
+  }
+  ProgressReporter* progress = progress_reporter_get_current();
+  progress_reporter_add_totals(progress, 1, st.st_size);
+  progress_reporter_set_path(progress, path);
+  gsize total = 0;
+  for (;;) {
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+      g_free(buffer);
+      close(fd);
+      return FALSE;
+    }
+    if (capacity - total <= 1) {
+      capacity += capacity / 2;
+      gchar* grown = static_cast<gchar*>(g_try_realloc(buffer, capacity));
+      if (!grown) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+                    "Not enough memory to read “%s”", path);
+        g_free(buffer);
+        close(fd);
+        return FALSE;
+      }
+      buffer = grown;
+    }
+    ssize_t n = read(fd, buffer + total, MIN(capacity - total - 1, kReadChunkSize));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      set_file_error_from_errno(error, errno, "read", path);
+      g_free(buffer);
+      close(fd);
+      return FALSE;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += n;
+    progress_reporter_advance(progress, 0, n, nullptr);
+  }
+  close(fd);
+  progress_reporter_advance(progress, 1, 0, nullptr);
+
+  buffer[total] = '\0';
+  *contents = buffer;
+  *length = total;
+  return TRUE;
+}
+
+static const IoBackend default_backend = {
+  default_list_directory,
+  default_query_info,
+  default_read_file,
+  nullptr,
+};
+
+const IoBackend* io_backend_get_default() {
+  return &default_backend;
+}
@@ -0,0 +1,50 @@
+#ifndef ENTE_DIRECTORY_PICKER_IO_BACKEND_H_
+#define ENTE_DIRECTORY_PICKER_IO_BACKEND_H_
+
+#include <gio/gio.h>
+
+// The file system primitives that the operations in file_operations.h are
+// built on. The default backend goes straight to the kernel; others can wrap
+// it to add caching or instrumentation, or replace it with an in-memory tree
+// so the operations can be tested and profiled without touching a disk.
+// Backends must be safe to call from several threads at once. Operations that
+// can take long check their GCancellable, which may be NULL, as they go and
+// fail with G_IO_ERROR_CANCELLED once it is cancelled.
+
+// What file_operations needs to know about one file.
+typedef struct {
+  gboolean is_directory;
+  gint64 size;
+  // Last modification time, in milliseconds since the epoch.
+  gint64 modified_ms;
+} IoFileInfo;
+
+typedef struct _IoBackend IoBackend;
+
+struct _IoBackend {
+  // Returns the names of the entries in the directory at path, in no
+  // particular order, as a GPtrArray of strings that frees them. Returns NULL
+  // and sets a G_FILE_ERROR on failure; G_FILE_ERROR_NOENT and
+  // G_FILE_ERROR_NOTDIR mean there is no directory at path.
+  GPtrArray* (*list_directory)(const IoBackend* backend, const gchar* path,
+                               GCancellable* cancellable, GError** error);
+
+  // Fills info for path, following symbolic links. Returns FALSE and sets a
+  // G_FILE_ERROR on failure.
+  gboolean (*query_info)(const IoBackend* backend, const gchar* path, IoFileInfo* info,
+                         GError** error);
+
+  // Reads the whole file at path into a newly allocated buffer with a NUL
+  // byte after the last one, like g_file_get_contents(). Returns FALSE and
+  // sets a G_FILE_ERROR on failure; G_FILE_ERROR_NOENT means there is no file.
+  gboolean (*read_file)(const IoBackend* backend, const gchar* path, gchar** contents,
+                        gsize* length, GCancellable* cancellable, GError** error);
+
+  // For the backend's own use.
+  gpointer user_data;
+};
+
+// Returns the backend that uses the calling process's file system directly.
+const IoBackend* io_backend_get_default();
+
+#endif  // ENTE_DIRECTORY_PICKER_IO_BACKEND_H_
@@ -0,0 +1,872 @@
+#include "media_metadata.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "directory_walker.h"
+#include "file_writer.h"
+#include "method_stats.h"
+#include "progress_reporter.h"
+
+// Largest EXIF block read; a JPEG segment cannot hold more.
+static const gsize kMaxExifSize = 64 * 1024;
+
+// Largest HEIF meta box read. Grids of many tiles make it a few KB, never
+// anywhere near this.
+static const gsize kMaxMetaBoxSize = 1024 * 1024;
+
+// Bounds on segments, chunks and boxes visited, so a corrupt file that
+// chains tiny headers cannot keep a thread busy.
+static const guint kMaxHeaders = 1024;
+
+typedef struct {
+  int fd;
+  guint64 size;
+  guint64 bytes_read;
+} MediaFile;
+
+// Reads exactly length bytes at offset. Returns FALSE at the end of the file
+// or on an error.
+static gboolean read_at(MediaFile* file, guint64 offset, void* buffer, gsize length) {
+  if (offset > file->size || length > file->size - offset) {
+    return FALSE;
+  }
+  gsize done = 0;
+  while (done < length) {
+    ssize_t n = pread(file->fd, static_cast<gchar*>(buffer) + done, length - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return FALSE;
+    }
+    done += n;
+  }
+  file->bytes_read += length;
+  return TRUE;
+}
+
+// Reads up to max_length bytes at offset into a new buffer. Returns NULL if
+// nothing could be read.
+static guint8* read_block(MediaFile* file, guint64 offset, guint64 length, gsize max_length,
+                          gsize* read_length) {
+  if (offset >= file->size) {
+    return nullptr;
+  }
+  gsize n = MIN(MIN(length, file->size - offset), (guint64)max_length);
+  guint8* block = static_cast<guint8*>(g_malloc(MAX(n, 1)));
+  if (!read_at(file, offset, block, n)) {
+    g_free(block);
+    return nullptr;
+  }
+  *read_length = n;
+  return block;
+}
+
+static guint16 be16(const guint8* p) {
+  return (p[0] << 8) | p[1];
+}
+
+static guint32 be32(const guint8* p) {
+  return (static_cast<guint32>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static guint64 be64(const guint8* p) {
+  return (static_cast<guint64>(be32(p)) << 32) | be32(p + 4);
+}
+
+static guint16 le16(const guint8* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static guint32 le24(const guint8* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static guint32 le32(const guint8* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<guint32>(p[3]) << 24);
+}
+
+// Reads an unsigned big-endian integer of size bytes, which may be zero.
+static guint64 be_n(const guint8* p, guint size) {
+  guint64 value = 0;
+  for (guint i = 0; i < size; i++) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+// ---- EXIF ----
+
+typedef struct {
+  const guint8* data;
+  gsize length;
+  gboolean little_endian;
+} Tiff;
+
+static gboolean tiff_u16(const Tiff* tiff, guint64 offset, guint16* value) {
+  if (offset + 2 > tiff->length) {
+    return FALSE;
+  }
+  *value = tiff->little_endian ? le16(tiff->data + offset) : be16(tiff->data + offset);
+  return TRUE;
+}
+
+static gboolean tiff_u32(const Tiff* tiff, guint64 offset, guint32* value) {
+  if (offset + 4 > tiff->length) {
+    return FALSE;
+  }
+  *value = tiff->little_endian ? le32(tiff->data + offset) : be32(tiff->data + offset);
+  return TRUE;
+}
+
+// Returns the ASCII value of the IFD entry at entry, which may be stored in
+// the entry itself or elsewhere in the block, or NULL.
+static gchar* tiff_ascii(const Tiff* tiff, guint64 entry) {
+  guint16 type = 0;
+  guint32 count = 0;
+  if (!tiff_u16(tiff, entry + 2, &type) || !tiff_u32(tiff, entry + 4, &count) ||
+      type != 2 || count == 0) {
+    return nullptr;
+  }
+  guint64 offset = entry + 8;
+  if (count > 4) {
+    guint32 value_offset = 0;
+    if (!tiff_u32(tiff, entry + 8, &value_offset)) {
+      return nullptr;
+    }
+    offset = value_offset;
+  }
+  if (offset + count > tiff->length) {
+    return nullptr;
+  }
+  return g_strndup(reinterpret_cast<const gchar*>(tiff->data + offset), count);
+}
+
+// Date and time fields of interest, from IFD0 and the EXIF IFD.
+typedef struct {
+  guint16 orientation;
+  guint32 exif_ifd;
+  gchar* date_time;
+  gchar* offset_time;
+  gchar* date_time_original;
+  gchar* offset_time_original;
+  gchar* date_time_digitized;
+  gchar* offset_time_digitized;
+} ExifFields;
+
+static void read_ifd(const Tiff* tiff, guint32 ifd, ExifFields* fields) {
+  guint16 n_entries = 0;
+  if (!tiff_u16(tiff, ifd, &n_entries)) {
+    return;
+  }
+  for (guint16 i = 0; i < n_entries; i++) {
+    guint64 entry = ifd + 2 + 12ull * i;
+    guint16 tag = 0;
+    if (!tiff_u16(tiff, entry, &tag)) {
+      return;
+    }
+    gchar** text = nullptr;
+    switch (tag) {
+      case 0x0112:
+        tiff_u16(tiff, entry + 8, &fields->orientation);
+        break;
+      case 0x8769:
+        tiff_u32(tiff, entry + 8, &fields->exif_ifd);
+        break;
+      case 0x0132: text = &fields->date_time; break;
+      case 0x9010: text = &fields->offset_time; break;
+      case 0x9003: text = &fields->date_time_original; break;
+      case 0x9011: text = &fields->offset_time_original; break;
+      case 0x9004: text = &fields->date_time_digitized; break;
+      case 0x9012: text = &fields->offset_time_digitized; break;
+    }
+    if (text && !*text) {
+      *text = tiff_ascii(tiff, entry);
+    }
+  }
+}
+
+// Turns an EXIF "YYYY:MM:DD HH:MM:SS" and optional "+HH:MM" into ISO 8601.
+// Returns NULL for anything else, including the all-zero placeholder some
+// cameras write when their clock is not set.
+static gchar* format_capture_time(const gchar* date_time, const gchar* offset_time) {
+  static const gchar kPattern[] = "dddd:dd:dd dd:dd:dd";
+  if (!date_time || strlen(date_time) < sizeof(kPattern) - 1) {
+    return nullptr;
+  }
+  gboolean all_zero = TRUE;
+  for (gsize i = 0; i < sizeof(kPattern) - 1; i++) {
+    gboolean is_digit = g_ascii_isdigit(date_time[i]);
+    if (kPattern[i] == 'd' ? !is_digit : date_time[i] != kPattern[i]) {
+      return nullptr;
+    }
+    all_zero = all_zero && (!is_digit || date_time[i] == '0');
+  }
+  if (all_zero) {
+    return nullptr;
+  }
+
+  gboolean has_offset = offset_time && strlen(offset_time) >= 6 &&
+                        (offset_time[0] == '+' || offset_time[0] == '-') &&
+                        g_ascii_isdigit(offset_time[1]) && g_ascii_isdigit(offset_time[2]) &&
+                        offset_time[3] == ':' &&
+                        g_ascii_isdigit(offset_time[4]) && g_ascii_isdigit(offset_time[5]);
+  return g_strdup_printf("%.4s-%.2s-%.2sT%.8s%.*s", date_time, date_time + 5, date_time + 8,
+                         date_time + 11, has_offset ? 6 : 0, has_offset ? offset_time : "");
+}
+
+// Reads the orientation and capture time from a TIFF-structured EXIF block.
+static void parse_exif(const guint8* data, gsize length, MediaMetadata* metadata,
+                       gboolean use_orientation) {
+  if (length < 8) {
+    return;
+  }
+  Tiff tiff = { data, length, data[0] == 'I' && data[1] == 'I' };
+  guint16 magic = 0;
+  guint32 ifd0 = 0;
+  if ((!tiff.little_endian && !(data[0] == 'M' && data[1] == 'M')) ||
+      !tiff_u16(&tiff, 2, &magic) || magic != 42 || !tiff_u32(&tiff, 4, &ifd0)) {
+    return;
+  }
+
+  ExifFields fields = {};
+  read_ifd(&tiff, ifd0, &fields);
+  if (fields.exif_ifd != 0 && fields.exif_ifd != ifd0) {
+    read_ifd(&tiff, fields.exif_ifd, &fields);
+  }
+
+  if (use_orientation && fields.orientation >= 1 && fields.orientation <= 8) {
+    metadata->orientation = fields.orientation;
+  }
+  // The moment the shutter fired, then when the image was stored, and last
+  // when the file was modified, which editors update.
+  gchar* capture_time = format_capture_time(fields.date_time_original,
+                                            fields.offset_time_original);
+  if (!capture_time) {
+    capture_time = format_capture_time(fields.date_time_digitized, fields.offset_time_digitized);
+  }
+  if (!capture_time) {
+    capture_time = format_capture_time(fields.date_time, fields.offset_time);
+  }
+  if (capture_time) {
+    g_free(metadata->capture_time);
+    metadata->capture_time = capture_time;
+  }
+
+  g_free(fields.date_time);
+  g_free(fields.offset_time);
+  g_free(fields.date_time_original);
+  g_free(fields.offset_time_original);
+  g_free(fields.date_time_digitized);
+  g_free(fields.offset_time_digitized);
+}
+
+// Parses an EXIF block that may start with the "Exif\0\0" identifier.
+static void parse_exif_block(const guint8* data, gsize length, MediaMetadata* metadata,
+                             gboolean use_orientation) {
+  if (length >= 6 && memcmp(data, "Exif\0\0", 6) == 0) {
+    data += 6;
+    length -= 6;
+  }
+  parse_exif(data, length, metadata, use_orientation);
+}
+
+static void read_exif_at(MediaFile* file, guint64 offset, guint64 length,
+                         MediaMetadata* metadata, gboolean use_orientation) {
+  gsize block_length = 0;
+  g_autofree guint8* block = read_block(file, offset, length, kMaxExifSize, &block_length);
+  if (block) {
+    parse_exif_block(block, block_length, metadata, use_orientation);
+  }
+}
+
+// ---- JPEG ----
+
+static gboolean is_start_of_frame(guint8 marker) {
+  // SOF0 to SOF15, except DHT (C4), JPG (C8) and DAC (CC).
+  return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+static void read_jpeg(MediaFile* file, MediaMetadata* metadata) {
+  guint64 offset = 2;
+  gboolean found_exif = FALSE;
+  for (guint i = 0; i < kMaxHeaders; i++) {
+    guint8 header[4];
+    if (!read_at(file, offset, header, sizeof(header)) || header[0] != 0xFF) {
+      return;
+    }
+    guint8 marker = header[1];
+    if (marker == 0xFF) {
+      // Fill byte before the marker.
+      offset++;
+      continue;
+    }
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+      // Markers without a length.
+      offset += 2;
+      continue;
+    }
+    if (marker == 0xDA || marker == 0xD9) {
+      // Start of the compressed data, or the end of the image.
+      return;
+    }
+    guint16 length = be16(header + 2);
+    if (length < 2) {
+      return;
+    }
+
+    if (marker == 0xE1 && !found_exif) {
+      // APP1 also carries XMP, which starts with its namespace instead.
+      gsize block_length = 0;
+      g_autofree guint8* block = read_block(file, offset + 4, length - 2, kMaxExifSize,
+                                            &block_length);
+      if (block && block_length >= 6 && memcmp(block, "Exif\0\0", 6) == 0) {
+        parse_exif_block(block, block_length, metadata, TRUE);
+        found_exif = TRUE;
+      }
+    } else if (is_start_of_frame(marker)) {
+      // EXIF has to come first, so there is nothing left to find.
+      guint8 frame[5];
+      if (read_at(file, offset + 4, frame, sizeof(frame))) {
+        metadata->height = be16(frame + 1);
+        metadata->width = be16(frame + 3);
+      }
+      return;
+    }
+    offset += 2 + length;
+  }
+}
+
+// ---- PNG ----
+
+static void read_png(MediaFile* file, MediaMetadata* metadata) {
+  guint64 offset = 8;
+  for (guint i = 0; i < kMaxHeaders; i++) {
+    guint8 header[8];
+    if (!read_at(file, offset, header, sizeof(header))) {
+      return;
+    }
+    guint32 length = be32(header);
+    const guint8* type = header + 4;
+    if (memcmp(type, "IHDR", 4) == 0) {
+      guint8 size[8];
+      if (read_at(file, offset + 8, size, sizeof(size))) {
+        metadata->width = be32(size);
+        metadata->height = be32(size + 4);
+      }
+    } else if (memcmp(type, "eXIf", 4) == 0) {
+      read_exif_at(file, offset + 8, length, metadata, TRUE);
+    } else if (memcmp(type, "IDAT", 4) == 0 || memcmp(type, "IEND", 4) == 0) {
+      // eXIf has to come before the image data.
+      return;
+    }
+    // Length, type, data and CRC.
+    offset += 12ull + length;
+  }
+}
+
+// ---- WebP ----
+
+static void read_webp(MediaFile* file, MediaMetadata* metadata) {
+  guint8 riff[4];
+  if (!read_at(file, 4, riff, sizeof(riff))) {
+    return;
+  }
+  guint64 end = MIN(file->size, 8ull + le32(riff));
+  guint64 offset = 12;
+  for (guint i = 0; i < kMaxHeaders && offset + 8 <= end; i++) {
+    guint8 header[8];
+    if (!read_at(file, offset, header, sizeof(header))) {
+      return;
+    }
+    const guint8* fourcc = header;
+    guint32 length = le32(header + 4);
+    guint8 data[10];
+    if (memcmp(fourcc, "VP8X", 4) == 0 && read_at(file, offset + 8, data, 10)) {
+      metadata->width = le24(data + 4) + 1;
+      metadata->height = le24(data + 7) + 1;
+    } else if (memcmp(fourcc, "VP8 ", 4) == 0 && !metadata->width &&
+               read_at(file, offset + 8, data, 10) &&
+               data[3] == 0x9D && data[4] == 0x01 && data[5] == 0x2A) {
+      metadata->width = le16(data + 6) & 0x3FFF;
+      metadata->height = le16(data + 8) & 0x3FFF;
+    } else if (memcmp(fourcc, "VP8L", 4) == 0 && !metadata->width &&
+               read_at(file, offset + 8, data, 5) && data[0] == 0x2F) {
+      guint32 bits = le32(data + 1);
+      metadata->width = (bits & 0x3FFF) + 1;
+      metadata->height = ((bits >> 14) & 0x3FFF) + 1;
+    } else if (memcmp(fourcc, "EXIF", 4) == 0) {
+      read_exif_at(file, offset + 8, length, metadata, TRUE);
+    }
+    // Chunks are padded to an even length.
+    offset += 8ull + length + (length & 1);
+  }
+}
+
+// ---- HEIF and AVIF ----
+
+typedef struct {
+  guint8 type[4];
+  const guint8* data;
+  guint64 length;
+} Box;
+
+// Iterates over the boxes packed into a buffer.
+typedef struct {
+  const guint8* data;
+  guint64 length;
+  guint64 offset;
+  guint n_boxes;
+} BoxIter;
+
+static void box_iter_init(BoxIter* iter, const guint8* data, guint64 length) {
+  iter->data = data;
+  iter->length = length;
+  iter->offset = 0;
+  iter->n_boxes = 0;
+}
+
+// Returns FALSE after the last box, or at the first malformed one.
+static gboolean box_iter_next(BoxIter* iter, Box* box) {
+  const guint8* data = iter->data + iter->offset;
+  guint64 remaining = iter->length - iter->offset;
+  if (remaining < 8 || iter->n_boxes++ >= kMaxHeaders) {
+    return FALSE;
+  }
+  guint64 size = be32(data);
+  guint64 header_size = 8;
+  if (size == 1) {
+    if (remaining < 16) {
+      return FALSE;
+    }
+    size = be64(data + 8);
+    header_size = 16;
+  } else if (size == 0) {
+    size = remaining;
+  }
+  if (size < header_size || size > remaining) {
+    return FALSE;
+  }
+  memcpy(box->type, data + 4, 4);
+  box->data = data + header_size;
+  box->length = size - header_size;
+  iter->offset += size;
+  return TRUE;
+}
+
+static gboolean is_box(const Box* box, const gchar* type) {
+  return memcmp(box->type, type, 4) == 0;
+}
+
+typedef struct {
+  guint32 primary_item;
+  guint32 exif_item;
+  guint64 exif_offset;
+  guint64 exif_length;
+  // Children of ipco, which ipma refers to by their 1-based index.
+  GArray* properties;
+  const Box* associations;
+} HeifMeta;
+
+// Finds the id of the EXIF item in an iinf box.
+static guint32 find_exif_item(const Box* iinf) {
+  if (iinf->length < 4) {
+    return 0;
+  }
+  // Version, flags and an entry count as wide as the version asks.
+  guint64 header_size = iinf->data[0] == 0 ? 6 : 8;
+  if (iinf->length < header_size) {
+    return 0;
+  }
+  BoxIter iter;
+  box_iter_init(&iter, iinf->data + header_size, iinf->length - header_size);
+  Box infe;
+  while (box_iter_next(&iter, &infe)) {
+    // Versions before 2 have no item type.
+    if (!is_box(&infe, "infe") || infe.length < 4 || infe.data[0] < 2) {
+      continue;
+    }
+    guint id_size = infe.data[0] == 2 ? 2 : 4;
+    // Version and flags, item id, protection index, then the type.
+    if (infe.length >= 4 + id_size + 2 + 4 &&
+        memcmp(infe.data + 4 + id_size + 2, "Exif", 4) == 0) {
+      return be_n(infe.data + 4, id_size);
+    }
+  }
+  return 0;
+}
+
+// Finds where in the file the EXIF item is stored, from an iloc box.
+static void find_exif_location(const Box* iloc, HeifMeta* meta) {
+  const guint8* p = iloc->data;
+  const guint8* end = iloc->data + iloc->length;
+  if (end - p < 6) {
+    return;
+  }
+  guint8 version = p[0];
+  guint offset_size = p[4] >> 4;
+  guint length_size = p[4] & 0xF;
+  guint base_offset_size = p[5] >> 4;
+  guint index_size = version >= 1 ? p[5] & 0xF : 0;
+  guint id_size = version < 2 ? 2 : 4;
+  p += 6;
+  if (end - p < id_size) {
+    return;
+  }
+  guint32 n_items = be_n(p, id_size);
+  p += id_size;
+
+  for (guint32 i = 0; i < n_items; i++) {
+    guint fixed_size = id_size + (version >= 1 ? 2 : 0) + 2 + base_offset_size + 2;
+    if (static_cast<guint64>(end - p) < fixed_size) {
+      return;
+    }
+    guint32 item_id = be_n(p, id_size);
+    p += id_size;
+    guint construction_method = 0;
+    if (version >= 1) {
+      construction_method = be16(p) & 0xF;
+      p += 2;
+    }
+    // Skip the data reference index.
+    p += 2;
+    guint64 base_offset = be_n(p, base_offset_size);
+    p += base_offset_size;
+    guint16 n_extents = be16(p);
+    p += 2;
+    guint extent_size = index_size + offset_size + length_size;
+    if (static_cast<guint64>(end - p) < static_cast<guint64>(n_extents) * extent_size) {
+      return;
+    }
+    // Only an item stored in the file in one piece is read.
+    if (item_id == meta->exif_item && construction_method == 0 && n_extents == 1) {
+      meta->exif_offset = base_offset + be_n(p + index_size, offset_size);
+      meta->exif_length = be_n(p + index_size + offset_size, length_size);
+      return;
+    }
+    p += n_extents * extent_size;
+  }
+}
+
+// Applies the ispe and irot properties associated with the primary item by
+// an ipma box.
+static void apply_primary_properties(const HeifMeta* meta, MediaMetadata* metadata) {
+  const Box* ipma = meta->associations;
+  if (ipma->length < 8) {
+    return;
+  }
+  guint id_size = ipma->data[0] >= 1 ? 4 : 2;
+  gboolean wide_indices = ipma->data[3] & 1;
+  guint index_size = wide_indices ? 2 : 1;
+  const guint8* p = ipma->data + 8;
+  const guint8* end = ipma->data + ipma->length;
+  guint32 n_entries = be32(ipma->data + 4);
+
+  for (guint32 i = 0; i < n_entries; i++) {
+    if (static_cast<guint64>(end - p) < id_size + 1u) {
+      return;
+    }
+    guint32 item_id = be_n(p, id_size);
+    guint8 n_associations = p[id_size];
+    p += id_size + 1;
+    if (static_cast<guint64>(end - p) < static_cast<guint64>(n_associations) * index_size) {
+      return;
+    }
+    if (item_id != meta->primary_item) {
+      p += n_associations * index_size;
+      continue;
+    }
+
+    for (guint8 j = 0; j < n_associations; j++, p += index_size) {
+      // The top bit marks the property as essential.
+      guint index = wide_indices ? be16(p) & 0x7FFF : p[0] & 0x7F;
+      if (index == 0 || index > meta->properties->len) {
+        continue;
+      }
+      const Box* property = &g_array_index(meta->properties, Box, index - 1);
+      if (is_box(property, "ispe") && property->length >= 12) {
+        metadata->width = be32(property->data + 4);
+        metadata->height = be32(property->data + 8);
+      } else if (is_box(property, "irot") && property->length >= 1) {
+        // Anticlockwise quarter turns, as the EXIF orientation that asks
+        // for the same turn.
+        static const guint16 kOrientations[] = {1, 8, 3, 6};
+        metadata->orientation = kOrientations[property->data[0] & 3];
+      }
+    }
+    return;
+  }
+}
+
+// Reads what the meta box, held in data without its header, says about the
+// primary image, and returns the location of the EXIF item in meta.
+static void parse_meta_box(const guint8* data, guint64 length, HeifMeta* meta,
+                           MediaMetadata* metadata) {
+  // Skip the version and flags.
+  if (length < 4) {
+    return;
+  }
+  const guint8* children = data + 4;
+  guint64 children_length = length - 4;
+
+  Box ipma = {};
+  BoxIter iter;
+  Box child;
+  box_iter_init(&iter, children, children_length);
+  while (box_iter_next(&iter, &child)) {
+    if (is_box(&child, "pitm") && child.length >= 6) {
+      meta->primary_item = child.data[0] == 0 ? be16(child.data + 4)
+                           : child.length >= 8 ? be32(child.data + 4) : 0;
+    } else if (is_box(&child, "iinf")) {
+      meta->exif_item = find_exif_item(&child);
+    } else if (is_box(&child, "iprp")) {
+      BoxIter iprp_iter;
+      Box iprp_child;
+      box_iter_init(&iprp_iter, child.data, child.length);
+      while (box_iter_next(&iprp_iter, &iprp_child)) {
+        if (is_box(&iprp_child, "ipco")) {
+          BoxIter ipco_iter;
+          Box property;
+          box_iter_init(&ipco_iter, iprp_child.data, iprp_child.length);
+          while (box_iter_next(&ipco_iter, &property)) {
+            g_array_append_val(meta->properties, property);
+          }
+        } else if (is_box(&iprp_child, "ipma") && !meta->associations) {
+          ipma = iprp_child;
+          meta->associations = &ipma;
+        }
+      }
+    }
+  }
+
+  // iloc may come before iinf, so it is looked at once the EXIF item is known.
+  box_iter_init(&iter, children, children_length);
+  while (meta->exif_item && box_iter_next(&iter, &child)) {
+    if (is_box(&child, "iloc")) {
+      find_exif_location(&child, meta);
+    }
+  }
+
+  // Decoders apply irot themselves, so no rotation recorded means none.
+  metadata->orientation = 1;
+  if (meta->associations) {
+    apply_primary_properties(meta, metadata);
+  }
+  meta->associations = nullptr;
+}
+
+static void read_heif(MediaFile* file, MediaMetadata* metadata) {
+  guint64 offset = 0;
+  for (guint i = 0; i < kMaxHeaders && offset < file->size; i++) {
+    guint8 header[16];
+    if (!read_at(file, offset, header, 8)) {
+      return;
+    }
+    guint64 size = be32(header);
+    guint64 header_size = 8;
+    if (size == 1) {
+      if (!read_at(file, offset + 8, header + 8, 8)) {
+        return;
+      }
+      size = be64(header + 8);
+      header_size = 16;
+    } else if (size == 0) {
+      size = file->size - offset;
+    }
+    if (size < header_size) {
+      return;
+    }
+    if (memcmp(header + 4, "meta", 4) != 0) {
+      offset += size;
+      continue;
+    }
+
+    gsize meta_length = 0;
+    g_autofree guint8* data = read_block(file, offset + header_size, size - header_size,
+                                         kMaxMetaBoxSize, &meta_length);
+    if (!data) {
+      return;
+    }
+    HeifMeta meta = {};
+    meta.properties = g_array_new(FALSE, FALSE, sizeof(Box));
+    parse_meta_box(data, meta_length, &meta, metadata);
+    g_array_unref(meta.properties);
+
+    // The EXIF item starts with the offset of its TIFF header, which
+    // orientation is not taken from, as decoders ignore it in favour of irot.
+    guint8 tiff_offset[4];
+    if (meta.exif_length > 4 && read_at(file, meta.exif_offset, tiff_offset, 4) &&
+        be32(tiff_offset) < meta.exif_length - 4) {
+      guint64 skip = 4 + be32(tiff_offset);
+      read_exif_at(file, meta.exif_offset + skip, meta.exif_length - skip, metadata, FALSE);
+    }
+    return;
+  }
+}
+
+// Tells HEIF from AVIF by the brands of the ftyp box, or returns
+// MEDIA_FORMAT_UNKNOWN for other ISOBMFF files such as videos.
+static MediaFormat get_heif_format(MediaFile* file) {
+  guint8 ftyp[64];
+  gsize length = MIN(sizeof(ftyp), file->size);
+  if (length < 16 || !read_at(file, 0, ftyp, length) || memcmp(ftyp + 4, "ftyp", 4) != 0) {
+    return MEDIA_FORMAT_UNKNOWN;
+  }
+  length = MIN(length, static_cast<gsize>(be32(ftyp)));
+  static const gchar* const kHeifBrands[] = {
+    "heic", "heix", "heim", "heis", "hevc", "hevx", "mif1", "msf1",
+  };
+  MediaFormat format = MEDIA_FORMAT_UNKNOWN;
+  // The major brand, then the compatible brands after the minor version.
+  for (gsize offset = 8; offset + 4 <= length; offset += offset == 8 ? 8 : 4) {
+    const gchar* brand = reinterpret_cast<const gchar*>(ftyp + offset);
+    if (strncmp(brand, "avif", 4) == 0 || strncmp(brand, "avis", 4) == 0) {
+      return MEDIA_FORMAT_AVIF;
+    }
+    for (const gchar* heif_brand : kHeifBrands) {
+      if (strncmp(brand, heif_brand, 4) == 0) {
+        format = MEDIA_FORMAT_HEIF;
+      }
+    }
+  }
+  return format;
+}
+
+const gchar* media_format_to_string(MediaFormat format) {
+  switch (format) {
+    case MEDIA_FORMAT_JPEG: return "jpeg";
+    case MEDIA_FORMAT_PNG: return "png";
+    case MEDIA_FORMAT_WEBP: return "webp";
+    case MEDIA_FORMAT_HEIF: return "heif";
+    case MEDIA_FORMAT_AVIF: return "avif";
+    default: return nullptr;
+  }
+}
+
+void media_metadata_free(MediaMetadata* metadata) {
+  if (!metadata) {
+    return;
+  }
+  g_free(metadata->capture_time);
+  g_free(metadata);
+}
+
+MediaMetadata* media_metadata_read(const gchar* path, GError** error) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (fd < 0) {
+    set_file_error_from_errno(error, errno, "open file", path);
+    return nullptr;
+  }
+  struct stat st;
+  int stat_errno = fstat(fd, &st) != 0 ? errno : S_ISREG(st.st_mode) ? 0 : EINVAL;
+  if (stat_errno != 0) {
+    close(fd);
+    set_file_error_from_errno(error, stat_errno, "open file", path);
+    return nullptr;
+  }
+
+  MediaFile file = { fd, static_cast<guint64>(st.st_size), 0 };
+  MediaMetadata* metadata = g_new0(MediaMetadata, 1);
+  guint8 magic[12] = {};
+  if (read_at(&file, 0, magic, MIN(sizeof(magic), file.size))) {
+    if (magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF) {
+      metadata->format = MEDIA_FORMAT_JPEG;
+      read_jpeg(&file, metadata);
+    } else if (memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0) {
+      metadata->format = MEDIA_FORMAT_PNG;
+      read_png(&file, metadata);
+    } else if (memcmp(magic, "RIFF", 4) == 0 && memcmp(magic + 8, "WEBP", 4) == 0) {
+      metadata->format = MEDIA_FORMAT_WEBP;
+      read_webp(&file, metadata);
+    } else if (memcmp(magic + 4, "ftyp", 4) == 0) {
+      metadata->format = get_heif_format(&file);
+      if (metadata->format != MEDIA_FORMAT_UNKNOWN) {
+        read_heif(&file, metadata);
+      }
+    }
+  }
+  close(fd);
+
+  method_stats_add_bytes_read(method_stats_get_current(), file.bytes_read);
+  progress_reporter_advance(progress_reporter_get_current(), 1, file.bytes_read, path);
+  return metadata;
+}
+
+typedef struct {
+  const gchar* const* paths;
+  guint n_paths;
+  // Index of the next path to read, shared by every thread.
+  guint next;
+  MediaMetadata** results;
+  GCancellable* cancellable;
+  // The caller's record and progress, which every thread charges.
+  MethodStats* stats;
+  ProgressReporter* progress;
+} MetadataBatch;
+
+static gpointer read_batch_thread(gpointer user_data) {
+  MetadataBatch* batch = static_cast<MetadataBatch*>(user_data);
+  MethodStats* previous_stats = method_stats_set_current(batch->stats);
+  ProgressReporter* previous_progress = progress_reporter_set_current(batch->progress);
+
+  while (!g_cancellable_is_cancelled(batch->cancellable)) {
+    guint index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+    if (index >= batch->n_paths) {
+      break;
+    }
+    batch->results[index] = media_metadata_read(batch->paths[index], nullptr);
+  }
+
+  progress_reporter_set_current(previous_progress);
+  method_stats_set_current(previous_stats);
+  return nullptr;
+}
+
+// Upper bound on threads reading headers; each mostly waits on a pread().
+static const guint kMaxMetadataThreads = 8;
+
+GPtrArray* media_metadata_read_all(const gchar* const* paths,
+                                   guint n_paths,
+                                   GCancellable* cancellable,
+                                   GError** error) {
+  GPtrArray* results = g_ptr_array_new_full(n_paths,
+      reinterpret_cast<GDestroyNotify>(media_metadata_free));
+  g_ptr_array_set_size(results, n_paths);
+  if (n_paths == 0) {
+    return results;
+  }
+
+  MetadataBatch batch = {};
+  batch.paths = paths;
+  batch.n_paths = n_paths;
+  batch.results = reinterpret_cast<MediaMetadata**>(results->pdata);
+  batch.cancellable = cancellable;
+  batch.stats = method_stats_get_current();
+  batch.progress = progress_reporter_get_current();
+  progress_reporter_add_totals(batch.progress, n_paths, 0);
+
+  // Files are usually in one folder, whose file system decides how many
+  // requests are worth having in flight.
+  g_autofree gchar* directory = g_path_get_dirname(paths[0]);
+  guint n_threads = MIN(MIN(walk_thread_count_for(directory), kMaxMetadataThreads), n_paths);
+
+  // The calling thread reads files as well.
+  GThread* threads[kMaxMetadataThreads];
+  for (guint i = 1; i < n_threads; i++) {
+    threads[i] = g_thread_new("ente-metadata", read_batch_thread, &batch);
+  }
+  read_batch_thread(&batch);
+  for (guint i = 1; i < n_threads; i++) {
+    g_thread_join(threads[i]);
+  }
+
+  if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+    g_ptr_array_unref(results);
+    return nullptr;
+  }
+  return results;
+}
@@ -0,0 +1,52 @@
+#ifndef ENTE_DIRECTORY_PICKER_MEDIA_METADATA_H_
+#define ENTE_DIRECTORY_PICKER_MEDIA_METADATA_H_
+
+#include <gio/gio.h>
+
+typedef enum {
+  MEDIA_FORMAT_UNKNOWN,
+  MEDIA_FORMAT_JPEG,
+  MEDIA_FORMAT_PNG,
+  MEDIA_FORMAT_WEBP,
+  MEDIA_FORMAT_HEIF,
+  MEDIA_FORMAT_AVIF,
+} MediaFormat;
+
+// What an image's headers say about it. Fields the file does not record are
+// left at zero or NULL.
+typedef struct {
+  MediaFormat format;
+  // Size of the image as stored, before orientation is applied.
+  guint32 width;
+  guint32 height;
+  // EXIF orientation, 1 to 8. For HEIF and AVIF this is derived from the
+  // rotation the file asks decoders to apply, as EXIF is ignored there.
+  guint16 orientation;
+  // When the photo was taken, as an ISO 8601 local time with the UTC offset
+  // appended when the camera recorded one, such as "2024-05-01T18:30:05+02:00".
+  gchar* capture_time;
+} MediaMetadata;
+
+// Returns a short lowercase name for format, such as "jpeg", or NULL for
+// MEDIA_FORMAT_UNKNOWN.
+const gchar* media_format_to_string(MediaFormat format);
+
+void media_metadata_free(MediaMetadata* metadata);
+
+// Reads the metadata of the image at path from its headers with pread(),
+// skipping over segments and boxes it has no use for, so that the pixel data
+// is never read. A file in none of the supported formats gives
+// MEDIA_FORMAT_UNKNOWN. Returns NULL and sets error if the file cannot be
+// opened.
+MediaMetadata* media_metadata_read(const gchar* path, GError** error);
+
+// Reads the metadata of each of the n_paths files at paths concurrently.
+// Returns an array of MediaMetadata in the order of paths, holding NULL for
+// files that could not be opened, or NULL with error set if cancellable is
+// cancelled.
+GPtrArray* media_metadata_read_all(const gchar* const* paths,
+                                   guint n_paths,
+                                   GCancellable* cancellable,
+                                   GError** error);
+
+#endif  // ENTE_DIRECTORY_PICKER_MEDIA_METADATA_H_
@@ -0,0 +1,204 @@
+#include "method_stats.h"
+
+#include <string.h>
+
+// Latencies are kept in a log-linear histogram: each power of two of
+// microseconds is split into kSubBuckets equal buckets, so a percentile is
+// never off by more than one bucket, an eighth of its value. Values below
+// kSubBuckets have a bucket each.
+static const guint kSubBuckets = 8;
+static const guint kSubBucketBits = 3;
+// Enough powers of two for about twelve days.
+static const guint kMaxExponent = 40;
+static const guint kBucketCount = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+struct _MethodStats {
+  gchar* method;
+
+  // Guards the call counters, which change once per call.
+  GMutex mutex;
+  guint64 calls;
+  guint64 errors;
+  guint64 max_us;
+  guint64 buckets[kBucketCount];
+
+  // Updated from I/O loops on any thread, so these are atomic instead.
+  guint64 bytes_read;
+  guint64 bytes_written;
+  guint64 entries;
+};
+
+static GMutex registry_mutex;
+// Maps a method name to its MethodStats. Records are never freed.
+static GHashTable* registry;
+
+static GPrivate current_stats;
+
+static guint bucket_for(guint64 us) {
+  if (us < kSubBuckets) {
+    return us;
+  }
+  guint exponent = MIN(g_bit_storage(us) - 1, kMaxExponent);
+  guint sub_bucket = (us >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return MIN((exponent - kSubBucketBits + 1) * kSubBuckets + sub_bucket, kBucketCount - 1);
+}
+
+// Largest value that falls into bucket.
+static guint64 bucket_upper_bound(guint bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  guint exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+  guint64 sub_bucket = bucket % kSubBuckets;
+  return ((kSubBuckets + sub_bucket + 1) << (exponent - kSubBucketBits)) - 1;
+}
+
+static void add_atomic(guint64* counter, guint64 value) {
+  if (value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+  }
+}
+
+static guint64 load_atomic(guint64* counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+MethodStats* method_stats_get(const gchar* method) {
+  g_mutex_lock(&registry_mutex);
+  if (!registry) {
+    registry = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+  MethodStats* stats = static_cast<MethodStats*>(g_hash_table_lookup(registry, method));
+  if (!stats) {
+    stats = g_new0(MethodStats, 1);
+    stats->method = g_strdup(method);
+    g_mutex_init(&stats->mutex);
+    g_hash_table_insert(registry, stats->method, stats);
+  }
+  g_mutex_unlock(&registry_mutex);
+  return stats;
+}
+
+MethodStats* method_stats_get_current() {
+  return static_cast<MethodStats*>(g_private_get(&current_stats));
+}
+
+MethodStats* method_stats_set_current(MethodStats* stats) {
+  MethodStats* previous = method_stats_get_current();
+  g_private_set(&current_stats, stats);
+  return previous;
+}
+
+void method_stats_record_call(MethodStats* stats, gint64 duration_us, gboolean failed) {
+  if (!stats) {
+    return;
+  }
+  guint64 us = MAX(duration_us, 0);
+  g_mutex_lock(&stats->mutex);
+  stats->calls++;
+  if (failed) {
+    stats->errors++;
+  }
+  stats->max_us = MAX(stats->max_us, us);
+  stats->buckets[bucket_for(us)]++;
+  g_mutex_unlock(&stats->mutex);
+}
+
+void method_stats_add_bytes_read(MethodStats* stats, guint64 bytes) {
+  if (stats) {
+    add_atomic(&stats->bytes_read, bytes);
+  }
+}
+
+void method_stats_add_bytes_written(MethodStats* stats, guint64 bytes) {
+  if (stats) {
+    add_atomic(&stats->bytes_written, bytes);
+  }
+}
+
+void method_stats_add_entries(MethodStats* stats, guint64 entries) {
+  if (stats) {
+    add_atomic(&stats->entries, entries);
+  }
+}
+
+// Smallest recorded value that at least fraction of all calls were at or
+// below, rounded up to the top of its bucket but never past the maximum.
+static guint64 percentile(const MethodStats* stats, gdouble fraction) {
+  guint64 rank = MAX(static_cast<guint64>(stats->calls * fraction + 0.999999), 1);
+  guint64 seen = 0;
+  for (guint bucket = 0; bucket < kBucketCount; bucket++) {
+    seen += stats->buckets[bucket];
+    if (seen >= rank) {
+      return MIN(bucket_upper_bound(bucket), stats->max_us);
+    }
+  }
+  return stats->max_us;
+}
+
+static gint compare_snapshots(gconstpointer a, gconstpointer b) {
+  return strcmp(static_cast<const MethodStatsSnapshot*>(a)->method,
+                static_cast<const MethodStatsSnapshot*>(b)->method);
+}
+
+GArray* method_stats_snapshot() {
+  GArray* snapshots = g_array_new(FALSE, TRUE, sizeof(MethodStatsSnapshot));
+
+  g_mutex_lock(&registry_mutex);
+  if (registry) {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, registry);
+    while (g_hash_table_iter_next(&iter, nullptr, &value)) {
+      MethodStats* stats = static_cast<MethodStats*>(value);
+      MethodStatsSnapshot snapshot = {};
+      snapshot.method = stats->method;
+      snapshot.bytes_read = load_atomic(&stats->bytes_read);
+      snapshot.bytes_written = load_atomic(&stats->bytes_written);
+      snapshot.entries = load_atomic(&stats->entries);
+
+      g_mutex_lock(&stats->mutex);
+      snapshot.calls = stats->calls;
+      snapshot.errors = stats->errors;
+      if (stats->calls > 0) {
+        snapshot.p50_us = percentile(stats, 0.50);
+        snapshot.p95_us = percentile(stats, 0.95);
+        snapshot.p99_us = percentile(stats, 0.99);
+        snapshot.max_us = stats->max_us;
+      }
+      g_mutex_unlock(&stats->mutex);
+
+      // Write-behind data can be charged to a method after a reset, before
+      // it is called again.
+      if (snapshot.calls || snapshot.bytes_read || snapshot.bytes_written || snapshot.entries) {
+        g_array_append_val(snapshots, snapshot);
+      }
+    }
+  }
+  g_mutex_unlock(&registry_mutex);
+
+  g_array_sort(snapshots, compare_snapshots);
+  return snapshots;
+}
+
+void method_stats_reset() {
+  g_mutex_lock(&registry_mutex);
+  if (registry) {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, registry);
+    while (g_hash_table_iter_next(&iter, nullptr, &value)) {
+      MethodStats* stats = static_cast<MethodStats*>(value);
+      g_mutex_lock(&stats->mutex);
+      stats->calls = 0;
+      stats->errors = 0;
+      stats->max_us = 0;
+      memset(stats->buckets, 0, sizeof(stats->buckets));
+      g_mutex_unlock(&stats->mutex);
+      __atomic_store_n(&stats->bytes_read, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&stats->bytes_written, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&stats->entries, 0, __ATOMIC_RELAXED);
+    }
+  }
+  g_mutex_unlock(&registry_mutex);
+}
@@ -0,0 +1,56 @@
+#ifndef ENTE_DIRECTORY_PICKER_METHOD_STATS_H_
+#define ENTE_DIRECTORY_PICKER_METHOD_STATS_H_
+
+#include <glib.h>
+
+// Counters for one method of the plugin's channel: how often it was called,
+// how long calls took, and how much I/O they did. Records are created on
+// first use and live for the rest of the process, so pointers to them stay
+// valid; all functions are thread-safe.
+typedef struct _MethodStats MethodStats;
+
+// A copy of a record's counters, as returned by method_stats_snapshot().
+typedef struct {
+  const gchar* method;
+  guint64 calls;
+  guint64 errors;
+  // Latency percentiles, accurate to within an eighth of their value.
+  guint64 p50_us;
+  guint64 p95_us;
+  guint64 p99_us;
+  guint64 max_us;
+  guint64 bytes_read;
+  guint64 bytes_written;
+  // Directory entries read while listing, walking or indexing.
+  guint64 entries;
+} MethodStatsSnapshot;
+
+// Returns the record for method, creating it if needed.
+MethodStats* method_stats_get(const gchar* method);
+
+// Returns the record that I/O done on the calling thread is charged to, or
+// NULL if there is none.
+MethodStats* method_stats_get_current();
+
+// Charges I/O done on the calling thread to stats, which may be NULL, from
+// now on. Returns the previous record so it can be restored. Code that hands
+// work to other threads passes the current record along with it.
+MethodStats* method_stats_set_current(MethodStats* stats);
+
+// Records a completed call.
+void method_stats_record_call(MethodStats* stats, gint64 duration_us, gboolean failed);
+
+// Add to the counters of stats. They do nothing when stats is NULL, so I/O
+// code can charge method_stats_get_current() without checking it.
+void method_stats_add_bytes_read(MethodStats* stats, guint64 bytes);
+void method_stats_add_bytes_written(MethodStats* stats, guint64 bytes);
+void method_stats_add_entries(MethodStats* stats, guint64 entries);
+
+// Returns a MethodStatsSnapshot for every method with activity since the last
+// reset, sorted by method name.
+GArray* method_stats_snapshot();
+
+// Zeroes every record.
+void method_stats_reset();
+
+#endif  // ENTE_DIRECTORY_PICKER_METHOD_STATS_H_
@@ -0,0 +1,61 @@
+#include "page_cache.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "file_writer.h"
+
+// The default readahead window, and so the most a single WILLNEED is sure to
+// read. Devices with a larger window are still advised in these steps.
+static const off_t kPrefetchChunkSize = 128 * 1024;
+
+static int open_regular_file(const gchar* path, struct stat* st, GError** error) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (fd < 0) {
+    set_file_error_from_errno(error, errno, "open file", path);
+    return -1;
+  }
+  int stat_errno = fstat(fd, st) != 0 ? errno : S_ISREG(st->st_mode) ? 0 : EINVAL;
+  if (stat_errno != 0) {
+    close(fd);
+    set_file_error_from_errno(error, stat_errno, "open file", path);
+    return -1;
+  }
+  return fd;
+}
+
+gboolean page_cache_prefetch(const gchar* path, GCancellable* cancellable, GError** error) {
+  struct stat st;
+  int fd = open_regular_file(path, &st, error);
+  if (fd < 0) {
+    return FALSE;
+  }
+  // The kernel reads at most one readahead window per call, however large
+  // the range, so the file is advised a window at a time.
+  for (off_t offset = 0; offset < st.st_size; offset += kPrefetchChunkSize) {
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+      close(fd);
+      return FALSE;
+    }
+    posix_fadvise(fd, offset, kPrefetchChunkSize, POSIX_FADV_WILLNEED);
+  }
+  close(fd);
+  return TRUE;
+}
+
+gboolean page_cache_evict(const gchar* path, GError** error) {
+  struct stat st;
+  int fd = open_regular_file(path, &st, error);
+  if (fd < 0) {
+    return FALSE;
+  }
+  // DONTNEED alone only starts writeback, leaving dirty pages in place.
+  sync_file_range(fd, 0, 0,
+                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                  SYNC_FILE_RANGE_WAIT_AFTER);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return TRUE;
+}
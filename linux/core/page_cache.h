@@ -0,0 +1,20 @@
+#ifndef ENTE_DIRECTORY_PICKER_PAGE_CACHE_H_
+#define ENTE_DIRECTORY_PICKER_PAGE_CACHE_H_
+
+#include <gio/gio.h>
+
+// Starts reading the whole of the regular file at path into the page cache,
+// so a read that comes later is served from memory instead of waiting on the
+// disk. Returns once the reads are queued, which for a large file can mean
+// waiting for some of them, so call it off the main thread. Returns FALSE and
+// sets error if the file cannot be opened, or if cancellable is cancelled
+// before every read was queued.
+gboolean page_cache_prefetch(const gchar* path, GCancellable* cancellable, GError** error);
+
+// Drops the file at path from the page cache, so data that will not be read
+// again stops pushing out data that will. Pages not yet written back are
+// written first, as only clean pages can be dropped. Returns FALSE and sets
+// error if the file cannot be opened.
+gboolean page_cache_evict(const gchar* path, GError** error);
+
+#endif  // ENTE_DIRECTORY_PICKER_PAGE_CACHE_H_
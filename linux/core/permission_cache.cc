@@ -0,0 +1,142 @@
+#include "permission_cache.h"
+
+#include <glib-unix.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// How long an answer is trusted without an inotify event to say otherwise.
+static const gint64 kPermissionCacheLifetimeUs = 2 * G_USEC_PER_SEC;
+
+// Bound on cached directories, and so on inotify watches held.
+static const guint kPermissionCacheMaxEntries = 256;
+
+// Events meaning a directory's type or permissions may have changed.
+static const uint32_t kWatchMask =
+    IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR;
+
+typedef struct {
+  DirectoryAccess access;
+  gint64 expires_at;
+  // inotify watch descriptor, or -1 if the directory is not watched.
+  int watch;
+} CachedAccess;
+
+static GMutex cache_mutex;
+// Maps a directory path to its CachedAccess.
+static GHashTable* cache_entries;
+static int inotify_fd = -1;
+
+static void cached_access_free(gpointer data) {
+  CachedAccess* cached = static_cast<CachedAccess*>(data);
+  // Several paths can share a watch when they name the same directory; the
+  // others then fall back to expiring normally.
+  if (cached->watch >= 0) {
+    inotify_rm_watch(inotify_fd, cached->watch);
+  }
+  g_free(cached);
+}
+
+static gboolean has_watch(gpointer key, gpointer value, gpointer user_data) {
+  return static_cast<CachedAccess*>(value)->watch == GPOINTER_TO_INT(user_data);
+}
+
+static gboolean is_expired(gpointer key, gpointer value, gpointer user_data) {
+  return static_cast<CachedAccess*>(value)->expires_at <= *static_cast<gint64*>(user_data);
+}
+
+static gboolean on_inotify_events(gint fd, GIOCondition condition, gpointer user_data) {
+  alignas(struct inotify_event) gchar buffer[4096];
+  ssize_t length;
+  while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+    g_mutex_lock(&cache_mutex);
+    for (gchar* position = buffer; position < buffer + length;) {
+      struct inotify_event* event = reinterpret_cast<struct inotify_event*>(position);
+      if (event->mask & IN_Q_OVERFLOW) {
+        g_hash_table_remove_all(cache_entries);
+      } else if (!(event->mask & IN_IGNORED)) {
+        g_hash_table_foreach_remove(cache_entries, has_watch, GINT_TO_POINTER(event->wd));
+      }
+      position += sizeof(struct inotify_event) + event->len;
+    }
+    g_mutex_unlock(&cache_mutex);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Must be called with cache_mutex held.
+static void ensure_cache() {
+  if (cache_entries) {
+    return;
+  }
+  cache_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, cached_access_free);
+  // Events are read on the main context, where the plugin runs. Without
+  // inotify the cache still works, relying on expiry alone.
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd >= 0) {
+    g_unix_fd_add(inotify_fd, G_IO_IN, on_inotify_events, nullptr);
+  }
+}
+
+DirectoryAccess permission_cache_check(const gchar* directory_path) {
+  gint64 now = g_get_monotonic_time();
+
+  g_mutex_lock(&cache_mutex);
+  ensure_cache();
+  CachedAccess* cached = static_cast<CachedAccess*>(g_hash_table_lookup(cache_entries, directory_path));
+  if (cached && cached->expires_at > now) {
+    DirectoryAccess access = cached->access;
+    g_mutex_unlock(&cache_mutex);
+    return access;
+  }
+  g_mutex_unlock(&cache_mutex);
+
+  // Watch before probing, so a change that races with the probe still
+  // invalidates the result.
+  int watch = inotify_fd >= 0 ? inotify_add_watch(inotify_fd, directory_path, kWatchMask) : -1;
+
+  struct stat st;
+  if (stat(directory_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    // A missing directory may be created at any moment and cannot be watched,
+    // so negative answers are not cached.
+    if (watch >= 0) {
+      inotify_rm_watch(inotify_fd, watch);
+    }
+    permission_cache_invalidate(directory_path);
+    return DIRECTORY_ACCESS_NONE;
+  }
+
+  DirectoryAccess access = ::access(directory_path, W_OK) == 0
+      ? DIRECTORY_ACCESS_WRITABLE : DIRECTORY_ACCESS_READ_ONLY;
+
+  CachedAccess* entry = g_new0(CachedAccess, 1);
+  entry->access = access;
+  entry->expires_at = now + kPermissionCacheLifetimeUs;
+  entry->watch = watch;
+
+  g_mutex_lock(&cache_mutex);
+  // The same directory keeps the same watch descriptor; removing the old
+  // entry must not remove the watch the new one relies on.
+  CachedAccess* previous = static_cast<CachedAccess*>(g_hash_table_lookup(cache_entries, directory_path));
+  if (previous && previous->watch == watch) {
+    previous->watch = -1;
+  }
+  if (g_hash_table_size(cache_entries) >= kPermissionCacheMaxEntries) {
+    g_hash_table_foreach_remove(cache_entries, is_expired, &now);
+    if (g_hash_table_size(cache_entries) >= kPermissionCacheMaxEntries) {
+      g_hash_table_remove_all(cache_entries);
+    }
+  }
+  g_hash_table_insert(cache_entries, g_strdup(directory_path), entry);
+  g_mutex_unlock(&cache_mutex);
+
+  return access;
+}
+
+void permission_cache_invalidate(const gchar* directory_path) {
+  g_mutex_lock(&cache_mutex);
+  if (cache_entries) {
+    g_hash_table_remove(cache_entries, directory_path);
+  }
+  g_mutex_unlock(&cache_mutex);
+}
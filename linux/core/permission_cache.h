@@ -0,0 +1,26 @@
+#ifndef ENTE_DIRECTORY_PICKER_PERMISSION_CACHE_H_
+#define ENTE_DIRECTORY_PICKER_PERMISSION_CACHE_H_
+
+#include <glib.h>
+
+typedef enum {
+  // Missing, not a directory, or not reachable by this process.
+  DIRECTORY_ACCESS_NONE,
+  DIRECTORY_ACCESS_READ_ONLY,
+  DIRECTORY_ACCESS_WRITABLE,
+} DirectoryAccess;
+
+// Returns whether directory_path is a directory this process can write to.
+// Results for existing directories are remembered for a couple of seconds, so
+// loops writing many files into one directory pay for stat() and access()
+// once. An inotify watch on each cached directory drops its entry as soon as
+// the directory's permissions change or it is removed, renamed or unmounted;
+// the short lifetime covers changes inotify cannot see, such as those to a
+// parent directory. The cache is shared by the whole process.
+DirectoryAccess permission_cache_check(const gchar* directory_path);
+
+// Forgets what is known about directory_path. Called when an operation in it
+// fails, since the failure may mean the cached answer is out of date.
+void permission_cache_invalidate(const gchar* directory_path);
+
+#endif  // ENTE_DIRECTORY_PICKER_PERMISSION_CACHE_H_
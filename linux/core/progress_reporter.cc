@@ -0,0 +1,129 @@
+#include "progress_reporter.h"
+
+struct _ProgressReporter {
+  gint64 interval_us;
+  ProgressFunc func;
+  gpointer user_data;
+
+  // Advanced from I/O loops on any thread, so these are atomic.
+  guint64 items_done;
+  guint64 items_total;
+  guint64 bytes_done;
+  guint64 bytes_total;
+  // Monotonic time before which no update is sent. Whoever moves it on sends
+  // the update, so only one thread pays for each.
+  gint64 next_update_us;
+
+  // Guards current_path and serialises calls to func.
+  GMutex mutex;
+  gchar* current_path;
+};
+
+static GPrivate current_reporter;
+
+static void add_atomic(guint64* counter, guint64 value) {
+  if (value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+  }
+}
+
+static guint64 load_atomic(guint64* counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Calls func with the counters as they are now. Called with mutex held.
+static void send_update(ProgressReporter* reporter, gboolean finished) {
+  ProgressUpdate update;
+  update.items_done = load_atomic(&reporter->items_done);
+  update.items_total = load_atomic(&reporter->items_total);
+  update.bytes_done = load_atomic(&reporter->bytes_done);
+  update.bytes_total = load_atomic(&reporter->bytes_total);
+  update.current_path = reporter->current_path;
+  update.finished = finished;
+  reporter->func(&update, reporter->user_data);
+}
+
+ProgressReporter* progress_reporter_new(gint64 interval_us, ProgressFunc func,
+                                        gpointer user_data) {
+  ProgressReporter* reporter = g_new0(ProgressReporter, 1);
+  reporter->interval_us = interval_us;
+  reporter->func = func;
+  reporter->user_data = user_data;
+  // The first update waits a full interval, so quick operations send only
+  // the final one.
+  reporter->next_update_us = g_get_monotonic_time() + interval_us;
+  g_mutex_init(&reporter->mutex);
+  return reporter;
+}
+
+void progress_reporter_free(ProgressReporter* reporter) {
+  if (!reporter) {
+    return;
+  }
+  g_mutex_clear(&reporter->mutex);
+  g_free(reporter->current_path);
+  g_free(reporter);
+}
+
+ProgressReporter* progress_reporter_get_current() {
+  return static_cast<ProgressReporter*>(g_private_get(&current_reporter));
+}
+
+ProgressReporter* progress_reporter_set_current(ProgressReporter* reporter) {
+  ProgressReporter* previous = progress_reporter_get_current();
+  g_private_set(&current_reporter, reporter);
+  return previous;
+}
+
+void progress_reporter_add_totals(ProgressReporter* reporter, guint64 items, guint64 bytes) {
+  if (!reporter) {
+    return;
+  }
+  add_atomic(&reporter->items_total, items);
+  add_atomic(&reporter->bytes_total, bytes);
+}
+
+void progress_reporter_advance(ProgressReporter* reporter, guint64 items, guint64 bytes,
+                               const gchar* path) {
+  if (!reporter) {
+    return;
+  }
+  add_atomic(&reporter->items_done, items);
+  add_atomic(&reporter->bytes_done, bytes);
+
+  gint64 now = g_get_monotonic_time();
+  gint64 next_update_us = __atomic_load_n(&reporter->next_update_us, __ATOMIC_RELAXED);
+  if (now < next_update_us ||
+      !__atomic_compare_exchange_n(&reporter->next_update_us, &next_update_us,
+                                   now + reporter->interval_us, FALSE,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  g_mutex_lock(&reporter->mutex);
+  if (path) {
+    g_free(reporter->current_path);
+    reporter->current_path = g_strdup(path);
+  }
+  send_update(reporter, FALSE);
+  g_mutex_unlock(&reporter->mutex);
+}
+
+void progress_reporter_set_path(ProgressReporter* reporter, const gchar* path) {
+  if (!reporter) {
+    return;
+  }
+  g_mutex_lock(&reporter->mutex);
+  g_free(reporter->current_path);
+  reporter->current_path = g_strdup(path);
+  g_mutex_unlock(&reporter->mutex);
+}
+
+void progress_reporter_finish(ProgressReporter* reporter) {
+  if (!reporter) {
+    return;
+  }
+  g_mutex_lock(&reporter->mutex);
+  send_update(reporter, TRUE);
+  g_mutex_unlock(&reporter->mutex);
+}
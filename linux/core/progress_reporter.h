@@ -0,0 +1,61 @@
+#ifndef ENTE_DIRECTORY_PICKER_PROGRESS_REPORTER_H_
+#define ENTE_DIRECTORY_PICKER_PROGRESS_REPORTER_H_
+
+#include <glib.h>
+
+// Tracks how far one long-running operation has got and passes it on at a
+// fixed rate, however often the I/O loops advance it. Advancing costs a few
+// atomic additions and a clock read; the path is only copied when an update
+// is actually due. Like method_stats.h, the reporter for an operation is set
+// as current on the threads doing its work, and every function does nothing
+// when given NULL, so loops can advance progress_reporter_get_current()
+// without checking it. All functions are thread-safe.
+typedef struct _ProgressReporter ProgressReporter;
+
+// Where an operation has got to, as passed to a ProgressFunc.
+typedef struct {
+  guint64 items_done;
+  // Zero while the total is not known, such as during a walk of a tree.
+  guint64 items_total;
+  guint64 bytes_done;
+  guint64 bytes_total;
+  // The file or directory being worked on, or NULL if none has been named.
+  const gchar* current_path;
+  // Set only in the update sent by progress_reporter_finish().
+  gboolean finished;
+} ProgressUpdate;
+
+// Receives updates on whichever thread advanced the operation. Calls are
+// never concurrent, and update is only valid during the call.
+typedef void (*ProgressFunc)(const ProgressUpdate* update, gpointer user_data);
+
+// Creates a reporter that calls func at most once every interval_us.
+ProgressReporter* progress_reporter_new(gint64 interval_us, ProgressFunc func,
+                                        gpointer user_data);
+
+void progress_reporter_free(ProgressReporter* reporter);
+
+// Returns the reporter that work on the calling thread advances, or NULL.
+ProgressReporter* progress_reporter_get_current();
+
+// Makes reporter current on the calling thread and returns the previous one
+// so it can be restored. Code that hands work to other threads passes the
+// current reporter along with it.
+ProgressReporter* progress_reporter_set_current(ProgressReporter* reporter);
+
+// Adds to the work expected, as it becomes known.
+void progress_reporter_add_totals(ProgressReporter* reporter, guint64 items, guint64 bytes);
+
+// Records items and bytes as done. path, if not NULL, names what is being
+// worked on and is only kept if this sends an update.
+void progress_reporter_advance(ProgressReporter* reporter, guint64 items, guint64 bytes,
+                               const gchar* path);
+
+// Names what is being worked on until the next call, for loops that then
+// advance without a path.
+void progress_reporter_set_path(ProgressReporter* reporter, const gchar* path);
+
+// Sends a last update with finished set, regardless of the rate limit.
+void progress_reporter_finish(ProgressReporter* reporter);
+
+#endif  // ENTE_DIRECTORY_PICKER_PROGRESS_REPORTER_H_
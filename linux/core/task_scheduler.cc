@@ -0,0 +1,157 @@
+#include "task_scheduler.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From linux/ioprio.h, which older kernel headers do not ship; glibc has no
+// wrapper for ioprio_set() either.
+static const int kIoprioWhoProcess = 1;
+static const int kIoprioClassShift = 13;
+static const int kIoprioClassIdle = 3;
+
+typedef struct {
+  TaskFunc func;
+  gpointer user_data;
+} Task;
+
+struct _TaskScheduler {
+  GMutex mutex;
+  // Signalled when tasks are queued, when a bulk task ends and so frees a
+  // bulk slot, and when the scheduler is stopping.
+  GCond cond;
+
+  GQueue interactive;
+  GQueue bulk;
+
+  guint max_threads;
+  guint max_bulk;
+  guint running_bulk;
+  // Threads waiting for a task they may start.
+  guint idle_threads;
+
+  gboolean stopping;
+  GPtrArray* threads;
+};
+
+// Gets or sets the I/O priority of the calling thread. Failures are ignored:
+// the priority only decides the order of requests, never whether they run.
+static int get_io_priority() {
+  return syscall(SYS_ioprio_get, kIoprioWhoProcess, 0);
+}
+
+static void set_io_priority(int priority) {
+  syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, priority);
+}
+
+// Returns the queue the next task should come from, or NULL if no queued task
+// may start yet.
+static GQueue* next_queue(TaskScheduler* scheduler) {
+  if (!g_queue_is_empty(&scheduler->interactive)) {
+    return &scheduler->interactive;
+  }
+  if (!g_queue_is_empty(&scheduler->bulk) && scheduler->running_bulk < scheduler->max_bulk) {
+    return &scheduler->bulk;
+  }
+  return nullptr;
+}
+
+static gpointer task_thread(gpointer user_data) {
+  TaskScheduler* scheduler = static_cast<TaskScheduler*>(user_data);
+  int default_io_priority = get_io_priority();
+
+  g_mutex_lock(&scheduler->mutex);
+  for (;;) {
+    GQueue* queue = next_queue(scheduler);
+    if (!queue) {
+      if (scheduler->stopping && g_queue_is_empty(&scheduler->interactive) &&
+          g_queue_is_empty(&scheduler->bulk)) {
+        break;
+      }
+      scheduler->idle_threads++;
+      g_cond_wait(&scheduler->cond, &scheduler->mutex);
+      scheduler->idle_threads--;
+      continue;
+    }
+
+    Task* task = static_cast<Task*>(g_queue_pop_head(queue));
+    gboolean is_bulk = queue == &scheduler->bulk;
+    if (is_bulk) {
+      scheduler->running_bulk++;
+    }
+    g_mutex_unlock(&scheduler->mutex);
+
+    // Threads a task starts, such as directory walkers, inherit the class.
+    if (is_bulk) {
+      set_io_priority(kIoprioClassIdle << kIoprioClassShift);
+    }
+    task->func(task->user_data);
+    if (is_bulk) {
+      set_io_priority(default_io_priority);
+    }
+    g_free(task);
+
+    g_mutex_lock(&scheduler->mutex);
+    if (is_bulk) {
+      scheduler->running_bulk--;
+      g_cond_broadcast(&scheduler->cond);
+    }
+  }
+  g_mutex_unlock(&scheduler->mutex);
+
+  return nullptr;
+}
+
+TaskScheduler* task_scheduler_new(guint max_threads, guint max_bulk) {
+  g_return_val_if_fail(max_bulk < max_threads, nullptr);
+
+  TaskScheduler* scheduler = g_new0(TaskScheduler, 1);
+  g_mutex_init(&scheduler->mutex);
+  g_cond_init(&scheduler->cond);
+  g_queue_init(&scheduler->interactive);
+  g_queue_init(&scheduler->bulk);
+  scheduler->max_threads = max_threads;
+  scheduler->max_bulk = max_bulk;
+  scheduler->threads = g_ptr_array_new();
+  return scheduler;
+}
+
+void task_scheduler_push(TaskScheduler* scheduler,
+                         TaskPriority priority,
+                         TaskFunc func,
+                         gpointer user_data) {
+  Task* task = g_new0(Task, 1);
+  task->func = func;
+  task->user_data = user_data;
+
+  g_mutex_lock(&scheduler->mutex);
+  g_queue_push_tail(priority == TASK_PRIORITY_BULK ? &scheduler->bulk : &scheduler->interactive,
+                    task);
+
+  // Start a thread when there are more tasks that may start than threads to
+  // take them. Bulk tasks waiting for a bulk slot need none; the thread that
+  // frees the slot takes the next one.
+  guint bulk_slots = scheduler->max_bulk - MIN(scheduler->running_bulk, scheduler->max_bulk);
+  guint startable = scheduler->interactive.length + MIN(scheduler->bulk.length, bulk_slots);
+  if (startable > scheduler->idle_threads && scheduler->threads->len < scheduler->max_threads) {
+    g_ptr_array_add(scheduler->threads, g_thread_new("ente-task", task_thread, scheduler));
+  }
+  g_cond_broadcast(&scheduler->cond);
+  g_mutex_unlock(&scheduler->mutex);
+}
+
+void task_scheduler_free(TaskScheduler* scheduler) {
+  g_mutex_lock(&scheduler->mutex);
+  scheduler->stopping = TRUE;
+  g_cond_broadcast(&scheduler->cond);
+  g_mutex_unlock(&scheduler->mutex);
+
+  // Nothing may be pushed once freeing has begun, so the threads are final.
+  for (guint i = 0; i < scheduler->threads->len; i++) {
+    g_thread_join(static_cast<GThread*>(g_ptr_array_index(scheduler->threads, i)));
+  }
+  g_ptr_array_unref(scheduler->threads);
+
+  g_cond_clear(&scheduler->cond);
+  g_mutex_clear(&scheduler->mutex);
+  g_free(scheduler);
+}
@@ -0,0 +1,38 @@
+#ifndef ENTE_DIRECTORY_PICKER_TASK_SCHEDULER_H_
+#define ENTE_DIRECTORY_PICKER_TASK_SCHEDULER_H_
+
+#include <glib.h>
+
+// Runs tasks on a pool of worker threads in two priority classes, so that a
+// folder the user is browsing is not read behind thousands of export writes.
+// Queued interactive tasks are always started before queued bulk tasks, and
+// bulk tasks never take the last few threads, so an interactive task starts
+// at once however much bulk work is waiting. Bulk tasks run with the idle I/O
+// class, which leaves the disk to them only while nothing else is using it.
+typedef struct _TaskScheduler TaskScheduler;
+
+typedef enum {
+  // Work the user is waiting on, such as listing a folder.
+  TASK_PRIORITY_INTERACTIVE,
+  // Work that may take a while anyway, such as an export or a full scan.
+  TASK_PRIORITY_BULK,
+} TaskPriority;
+
+typedef void (*TaskFunc)(gpointer user_data);
+
+// Creates a scheduler that runs up to max_threads tasks at once, at most
+// max_bulk of them bulk tasks. max_bulk must be less than max_threads.
+// Threads are started as they are needed and kept until the scheduler is freed.
+TaskScheduler* task_scheduler_new(guint max_threads, guint max_bulk);
+
+// Queues a call to func with user_data on one of the worker threads.
+void task_scheduler_push(TaskScheduler* scheduler,
+                         TaskPriority priority,
+                         TaskFunc func,
+                         gpointer user_data);
+
+// Runs every task queued so far, stops the worker threads and frees the
+// scheduler. Must not be called from one of its own tasks.
+void task_scheduler_free(TaskScheduler* scheduler);
+
+#endif  // ENTE_DIRECTORY_PICKER_TASK_SCHEDULER_H_
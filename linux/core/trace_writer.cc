@@ -0,0 +1,99 @@
+#include "trace_writer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const gchar kTraceCategory[] = "ente_directory_picker";
+
+static GMutex trace_mutex;
+static FILE* trace_file;
+// Read without the lock on every span, so spans cost nothing when off.
+static gint trace_enabled;
+
+// Appends text to buffer as the body of a JSON string.
+static void append_json_string(GString* buffer, const gchar* text) {
+  for (const gchar* c = text; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      g_string_append_c(buffer, '\\');
+      g_string_append_c(buffer, *c);
+    } else if (static_cast<guchar>(*c) < 0x20) {
+      g_string_append_printf(buffer, "\\u%04x", *c);
+    } else {
+      g_string_append_c(buffer, *c);
+    }
+  }
+}
+
+// Appends one event to the array. The process name always comes first, so
+// every later event is preceded by a separator. Must be called with
+// trace_mutex held.
+static void write_event(const gchar* event) {
+  fputs(",\n", trace_file);
+  fputs(event, trace_file);
+}
+
+gboolean trace_start(const gchar* path, GError** error) {
+  trace_stop();
+
+  FILE* file = fopen(path, "we");
+  if (!file) {
+    int saved_errno = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                "Failed to create trace file “%s”: %s", path, g_strerror(saved_errno));
+    return FALSE;
+  }
+
+  g_mutex_lock(&trace_mutex);
+  trace_file = file;
+  fprintf(trace_file,
+          "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+          getpid(), kTraceCategory);
+  g_atomic_int_set(&trace_enabled, TRUE);
+  g_mutex_unlock(&trace_mutex);
+  return TRUE;
+}
+
+void trace_stop() {
+  g_mutex_lock(&trace_mutex);
+  g_atomic_int_set(&trace_enabled, FALSE);
+  if (trace_file) {
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = nullptr;
+  }
+  g_mutex_unlock(&trace_mutex);
+}
+
+gboolean trace_is_enabled() {
+  return g_atomic_int_get(&trace_enabled);
+}
+
+TraceSpan trace_span_begin(const gchar* name) {
+  TraceSpan span = { name, trace_is_enabled() ? g_get_monotonic_time() : 0 };
+  return span;
+}
+
+void trace_span_end(TraceSpan* span) {
+  if (span->start_us == 0) {
+    return;
+  }
+  gint64 end_us = g_get_monotonic_time();
+
+  g_autoptr(GString) event = g_string_new("{\"name\":\"");
+  append_json_string(event, span->name);
+  g_string_append_printf(event,
+                         "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT
+                         ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%ld}",
+                         kTraceCategory, span->start_us, end_us - span->start_us,
+                         getpid(), syscall(SYS_gettid));
+  span->start_us = 0;
+
+  g_mutex_lock(&trace_mutex);
+  // Tracing may have been stopped while the span was open.
+  if (trace_file) {
+    write_event(event->str);
+  }
+  g_mutex_unlock(&trace_mutex);
+}
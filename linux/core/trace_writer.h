@@ -0,0 +1,41 @@
+#ifndef ENTE_DIRECTORY_PICKER_TRACE_WRITER_H_
+#define ENTE_DIRECTORY_PICKER_TRACE_WRITER_H_
+
+#include <glib.h>
+
+// Records spans of plugin work as Chrome trace events (the JSON format that
+// Perfetto and chrome://tracing load). Timestamps come from the monotonic
+// clock, like those of Flutter's timeline, so the two traces line up. Tracing
+// is off until trace_start() is called; spans begun while it is off cost one
+// atomic load. All functions are thread-safe.
+
+// Starts writing events to path, replacing the file. Tracing that is already
+// running is stopped first. Returns FALSE and sets error if path cannot be
+// created.
+gboolean trace_start(const gchar* path, GError** error);
+
+// Finishes the trace file, leaving valid JSON, and turns tracing off.
+void trace_stop();
+
+gboolean trace_is_enabled();
+
+// A span of work on the current thread. Declare one with g_auto() so it is
+// written when it goes out of scope:
+//
+//   g_auto(TraceSpan) span = trace_span_begin("validate");
+typedef struct {
+  // Must outlive the span; string literals and method names do.
+  const gchar* name;
+  // Zero when tracing was off as the span began.
+  gint64 start_us;
+} TraceSpan;
+
+TraceSpan trace_span_begin(const gchar* name);
+
+// Writes the span, if tracing was on when it began, and clears it so a second
+// call does nothing.
+void trace_span_end(TraceSpan* span);
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(TraceSpan, trace_span_end)
+
+#endif  // ENTE_DIRECTORY_PICKER_TRACE_WRITER_H_
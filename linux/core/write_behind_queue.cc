@@ -0,0 +1,345 @@
+#include "write_behind_queue.h"
+
+#include <string.h>
+
+#include "method_stats.h"
+
+typedef struct {
+  gchar* directory_path;
+  gchar* file_name;
+  gchar* data;
+  gsize length;
+  guint64 expected_size;
+  gboolean sparse;
+  WriteDurability durability;
+  // Set when a synchronous write to the same file superseded this one; its
+  // data is gone and the writer skips it.
+  gboolean discarded;
+  // Record of the call that queued the latest data, charged once it is
+  // written; the writer thread itself has no current record.
+  MethodStats* stats;
+} QueuedWrite;
+
+struct _WriteBehindQueue {
+  GMutex mutex;
+  // Signalled whenever writes are queued, written or discarded, or the queue
+  // is stopping.
+  GCond cond;
+
+  // Writes not yet picked up by the writer thread, in arrival order, and the
+  // same writes indexed by target path for coalescing.
+  GQueue pending;
+  GHashTable* pending_by_path;
+  // Target paths of the batch being written, kept for the synchronous writes
+  // that have to wait for it. Swapped with pending_by_path for each batch.
+  GHashTable* writing_by_path;
+
+  // Number of synchronous writes announced but not yet done, by target path.
+  // A pending write to one of these paths was queued after them, as
+  // announcing one discards what was pending, so the writer holds it back.
+  GHashTable* direct_writes_by_path;
+
+  // Bytes held by the queue, including the batch currently being written.
+  gsize pending_bytes;
+  gsize max_pending_bytes;
+
+  // Every push takes a sequence number; a flush waits for the writer to
+  // catch up with the latest one.
+  guint64 queued_seq;
+  guint64 written_seq;
+
+  // First failure since the last flush.
+  GError* error;
+
+  gboolean stopping;
+  GThread* thread;
+};
+
+static void queued_write_free(gpointer data) {
+  QueuedWrite* write = static_cast<QueuedWrite*>(data);
+  g_free(write->directory_path);
+  g_free(write->file_name);
+  g_free(write->data);
+  g_free(write);
+}
+
+// Writes one batch, grouping files that share a directory into a single
+// write_files_durably() call so they also share its flush. Returns the number
+// of bytes the batch held; the first error is kept in error.
+static gsize write_batch(GQueue* batch, GError** error) {
+  gsize batch_bytes = 0;
+  g_autoptr(GHashTable) groups = g_hash_table_new_full(
+      g_str_hash, g_str_equal, nullptr,
+      reinterpret_cast<GDestroyNotify>(g_ptr_array_unref));
+
+  for (GList* link = batch->head; link != nullptr; link = link->next) {
+    QueuedWrite* write = static_cast<QueuedWrite*>(link->data);
+    if (write->discarded) {
+      continue;
+    }
+    GPtrArray* group = static_cast<GPtrArray*>(
+        g_hash_table_lookup(groups, write->directory_path));
+    if (!group) {
+      group = g_ptr_array_new();
+      g_hash_table_insert(groups, write->directory_path, group);
+    }
+    g_ptr_array_add(group, write);
+    batch_bytes += write->length;
+  }
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, groups);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    GPtrArray* group = static_cast<GPtrArray*>(value);
+    g_autofree PendingWrite* writes = g_new0(PendingWrite, group->len);
+    WriteDurability durability = WRITE_DURABILITY_NONE;
+    for (guint i = 0; i < group->len; i++) {
+      QueuedWrite* write = static_cast<QueuedWrite*>(g_ptr_array_index(group, i));
+      writes[i] = { write->file_name, write->data, write->length, write->expected_size,
+                     write->sparse };
+      durability = MAX(durability, write->durability);
+    }
+
+    GError* group_error = nullptr;
+    if (!write_files_durably(static_cast<const gchar*>(key), writes, group->len,
+                             durability, nullptr, &group_error)) {
+      if (*error == nullptr) {
+        g_propagate_error(error, group_error);
+      } else {
+        g_error_free(group_error);
+      }
+    } else {
+      for (guint i = 0; i < group->len; i++) {
+        QueuedWrite* write = static_cast<QueuedWrite*>(g_ptr_array_index(group, i));
+        method_stats_add_bytes_written(write->stats, write->length);
+      }
+    }
+  }
+
+  g_queue_clear_full(batch, queued_write_free);
+  return batch_bytes;
+}
+
+// Returns TRUE if a pending write has to wait for a synchronous write to the
+// same file that was announced before it was queued.
+static gboolean has_held_back_write(WriteBehindQueue* queue) {
+  if (g_hash_table_size(queue->direct_writes_by_path) == 0) {
+    return FALSE;
+  }
+  GHashTableIter iter;
+  gpointer path;
+  g_hash_table_iter_init(&iter, queue->pending_by_path);
+  while (g_hash_table_iter_next(&iter, &path, nullptr)) {
+    if (g_hash_table_contains(queue->direct_writes_by_path, path)) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static gpointer write_behind_thread(gpointer user_data) {
+  WriteBehindQueue* queue = static_cast<WriteBehindQueue*>(user_data);
+
+  g_mutex_lock(&queue->mutex);
+  for (;;) {
+    while (g_queue_is_empty(&queue->pending) && !queue->stopping) {
+      g_cond_wait(&queue->cond, &queue->mutex);
+    }
+    if (g_queue_is_empty(&queue->pending)) {
+      break;
+    }
+    // Writes stay pending meanwhile, so a newer synchronous write can still
+    // discard them.
+    while (has_held_back_write(queue)) {
+      g_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    // Take everything queued so far; later pushes start a new batch.
+    GQueue batch = queue->pending;
+    g_queue_init(&queue->pending);
+    GHashTable* batch_paths = queue->pending_by_path;
+    queue->pending_by_path = queue->writing_by_path;
+    queue->writing_by_path = batch_paths;
+    guint64 batch_seq = queue->queued_seq;
+    g_mutex_unlock(&queue->mutex);
+
+    GError* error = nullptr;
+    gsize batch_bytes = write_batch(&batch, &error);
+
+    g_mutex_lock(&queue->mutex);
+    queue->pending_bytes -= batch_bytes;
+    queue->written_seq = batch_seq;
+    g_hash_table_remove_all(queue->writing_by_path);
+    if (error) {
+      if (queue->error == nullptr) {
+        queue->error = error;
+      } else {
+        g_error_free(error);
+      }
+    }
+    g_cond_broadcast(&queue->cond);
+  }
+  g_mutex_unlock(&queue->mutex);
+
+  return nullptr;
+}
+
+WriteBehindQueue* write_behind_queue_new(gsize max_pending_bytes) {
+  WriteBehindQueue* queue = g_new0(WriteBehindQueue, 1);
+  g_mutex_init(&queue->mutex);
+  g_cond_init(&queue->cond);
+  g_queue_init(&queue->pending);
+  queue->pending_by_path = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, nullptr);
+  queue->writing_by_path = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, nullptr);
+  queue->direct_writes_by_path =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, nullptr);
+  queue->max_pending_bytes = max_pending_bytes;
+  queue->thread = g_thread_new("ente-write-behind", write_behind_thread, queue);
+  return queue;
+}
+
+void write_behind_queue_push(WriteBehindQueue* queue,
+                             const gchar* directory_path,
+                             const gchar* file_name,
+                             const gchar* data,
+                             gsize length,
+                             guint64 expected_size,
+                             gboolean sparse,
+                             WriteDurability durability) {
+  gchar* path = g_build_filename(directory_path, file_name, nullptr);
+  gchar* copy = static_cast<gchar*>(g_memdup2(data, length));
+
+  g_mutex_lock(&queue->mutex);
+
+  QueuedWrite* write = static_cast<QueuedWrite*>(
+      g_hash_table_lookup(queue->pending_by_path, path));
+  if (write) {
+    // Coalesce with the pending write to the same file.
+    queue->pending_bytes -= write->length;
+    g_free(write->data);
+    write->durability = MAX(write->durability, durability);
+    g_free(path);
+  } else {
+    write = g_new0(QueuedWrite, 1);
+    write->directory_path = g_strdup(directory_path);
+    write->file_name = g_strdup(file_name);
+    write->durability = durability;
+    g_queue_push_tail(&queue->pending, write);
+    g_hash_table_insert(queue->pending_by_path, path, write);
+  }
+  write->data = copy;
+  write->length = length;
+  write->expected_size = expected_size;
+  write->sparse = sparse;
+  write->stats = method_stats_get_current();
+  queue->pending_bytes += length;
+  queue->queued_seq++;
+
+  g_cond_broadcast(&queue->cond);
+  g_mutex_unlock(&queue->mutex);
+}
+
+gboolean write_behind_queue_is_full(WriteBehindQueue* queue) {
+  g_mutex_lock(&queue->mutex);
+  gboolean full = queue->pending_bytes > queue->max_pending_bytes;
+  g_mutex_unlock(&queue->mutex);
+  return full;
+}
+
+void write_behind_queue_wait_for_room(WriteBehindQueue* queue) {
+  g_mutex_lock(&queue->mutex);
+  while (queue->pending_bytes > queue->max_pending_bytes) {
+    g_cond_wait(&queue->cond, &queue->mutex);
+  }
+  g_mutex_unlock(&queue->mutex);
+}
+
+void write_behind_queue_begin_direct_write(WriteBehindQueue* queue,
+                                           const gchar* directory_path,
+                                           const gchar* file_name) {
+  gchar* path = g_build_filename(directory_path, file_name, nullptr);
+
+  g_mutex_lock(&queue->mutex);
+  QueuedWrite* write = static_cast<QueuedWrite*>(
+      g_hash_table_lookup(queue->pending_by_path, path));
+  if (write) {
+    // Left in the queue so the writer still accounts for its sequence number.
+    queue->pending_bytes -= write->length;
+    g_clear_pointer(&write->data, g_free);
+    write->length = 0;
+    write->discarded = TRUE;
+    g_hash_table_remove(queue->pending_by_path, path);
+    g_cond_broadcast(&queue->cond);
+  }
+  guint count = GPOINTER_TO_UINT(g_hash_table_lookup(queue->direct_writes_by_path, path));
+  g_hash_table_insert(queue->direct_writes_by_path, path, GUINT_TO_POINTER(count + 1));
+  g_mutex_unlock(&queue->mutex);
+}
+
+void write_behind_queue_wait_for_file(WriteBehindQueue* queue,
+                                      const gchar* directory_path,
+                                      const gchar* file_name) {
+  g_autofree gchar* path = g_build_filename(directory_path, file_name, nullptr);
+
+  g_mutex_lock(&queue->mutex);
+  while (g_hash_table_contains(queue->writing_by_path, path)) {
+    g_cond_wait(&queue->cond, &queue->mutex);
+  }
+  g_mutex_unlock(&queue->mutex);
+}
+
+void write_behind_queue_end_direct_write(WriteBehindQueue* queue,
+                                         const gchar* directory_path,
+                                         const gchar* file_name) {
+  g_autofree gchar* path = g_build_filename(directory_path, file_name, nullptr);
+
+  g_mutex_lock(&queue->mutex);
+  guint count = GPOINTER_TO_UINT(g_hash_table_lookup(queue->direct_writes_by_path, path));
+  if (count > 1) {
+    g_hash_table_insert(queue->direct_writes_by_path, g_strdup(path),
+                        GUINT_TO_POINTER(count - 1));
+  } else {
+    g_hash_table_remove(queue->direct_writes_by_path, path);
+    g_cond_broadcast(&queue->cond);
+  }
+  g_mutex_unlock(&queue->mutex);
+}
+
+gboolean write_behind_queue_flush(WriteBehindQueue* queue, GError** error) {
+  g_mutex_lock(&queue->mutex);
+  guint64 target_seq = queue->queued_seq;
+  while (queue->written_seq < target_seq) {
+    g_cond_wait(&queue->cond, &queue->mutex);
+  }
+  GError* write_error = queue->error;
+  queue->error = nullptr;
+  g_mutex_unlock(&queue->mutex);
+
+  if (write_error) {
+    g_propagate_error(error, write_error);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void write_behind_queue_free(WriteBehindQueue* queue) {
+  g_mutex_lock(&queue->mutex);
+  queue->stopping = TRUE;
+  g_cond_broadcast(&queue->cond);
+  g_mutex_unlock(&queue->mutex);
+
+  // The writer drains everything still queued before it exits.
+  g_thread_join(queue->thread);
+
+  if (queue->error) {
+    g_warning("Write-behind queue: %s", queue->error->message);
+    g_error_free(queue->error);
+  }
+  g_hash_table_unref(queue->pending_by_path);
+  g_hash_table_unref(queue->writing_by_path);
+  g_hash_table_unref(queue->direct_writes_by_path);
+  g_cond_clear(&queue->cond);
+  g_mutex_clear(&queue->mutex);
+  g_free(queue);
+}
@@ -0,0 +1,70 @@
+#ifndef ENTE_DIRECTORY_PICKER_WRITE_BEHIND_QUEUE_H_
+#define ENTE_DIRECTORY_PICKER_WRITE_BEHIND_QUEUE_H_
+
+#include <glib.h>
+
+#include "file_writer.h"
+
+// A bounded queue of file writes that a background thread performs after the
+// caller has moved on. Pending writes to the same file are coalesced so only
+// the latest contents hit the disk, and everything that is waiting when the
+// writer wakes up is written as one batch.
+typedef struct _WriteBehindQueue WriteBehindQueue;
+
+// Creates a queue that counts as full once it holds more than
+// max_pending_bytes of unwritten data.
+WriteBehindQueue* write_behind_queue_new(gsize max_pending_bytes);
+
+// Queues a copy of data to be written to directory_path/file_name, with
+// expected_size and sparse as in PendingWrite. A push coalesced with a pending
+// write to the same file replaces its data, expected size and sparseness.
+// Never blocks, so writes are queued in the order they are pushed even when
+// the queue is over its budget; callers apply back-pressure themselves with
+// write_behind_queue_is_full() and write_behind_queue_wait_for_room().
+void write_behind_queue_push(WriteBehindQueue* queue,
+                             const gchar* directory_path,
+                             const gchar* file_name,
+                             const gchar* data,
+                             gsize length,
+                             guint64 expected_size,
+                             gboolean sparse,
+                             WriteDurability durability);
+
+// Returns TRUE if the queue holds more unwritten data than its budget.
+gboolean write_behind_queue_is_full(WriteBehindQueue* queue);
+
+// Blocks until the queue is back within its budget. A single write larger
+// than the whole budget only has to be performed.
+void write_behind_queue_wait_for_room(WriteBehindQueue* queue);
+
+// Announces a write to directory_path/file_name that the caller performs
+// itself, outside the queue. The pending write to that file, if any, is
+// dropped, and writes to it queued from now on are held back until
+// write_behind_queue_end_direct_write() is called, so neither replaces the
+// other out of order. A write already being performed is not affected; wait
+// for it with write_behind_queue_wait_for_file() before writing.
+void write_behind_queue_begin_direct_write(WriteBehindQueue* queue,
+                                           const gchar* directory_path,
+                                           const gchar* file_name);
+
+// Blocks while the writer thread is performing a write to
+// directory_path/file_name.
+void write_behind_queue_wait_for_file(WriteBehindQueue* queue,
+                                      const gchar* directory_path,
+                                      const gchar* file_name);
+
+// Marks a write announced with write_behind_queue_begin_direct_write() as
+// done, whether or not it succeeded, letting the writes queued after it
+// proceed.
+void write_behind_queue_end_direct_write(WriteBehindQueue* queue,
+                                         const gchar* directory_path,
+                                         const gchar* file_name);
+
+// Waits until every write queued so far has been performed. Returns FALSE and
+// sets error if any of them failed since the previous flush.
+gboolean write_behind_queue_flush(WriteBehindQueue* queue, GError** error);
+
+// Drains the queue, stops the writer thread and frees the queue.
+void write_behind_queue_free(WriteBehindQueue* queue);
+
+#endif  // ENTE_DIRECTORY_PICKER_WRITE_BEHIND_QUEUE_H_
@@ -6,6 +6,7 @@
 #include <glib.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fstream>
@@ -14,46 +15,560 @@
 #include <memory>
 
 #include "ente_directory_picker_plugin_private.h"
+#include "append_file_cache.h"
+#include "collation_cache.h"
+#include "content_search.h"
+#include "details_query.h"
+#include "directory_tree.h"
+#include "export_manifest.h"
+#include "file_finder.h"
+#include "file_index.h"
+#include "file_operations.h"
+#include "file_writer.h"
+#include "fs_capabilities.h"
+#include "media_metadata.h"
+#include "method_stats.h"
+#include "page_cache.h"
+#include "permission_cache.h"
+#include "portal_file_chooser.h"
+#include "progress_reporter.h"
+#include "task_scheduler.h"
+#include "trace_writer.h"
+#include "write_behind_queue.h"
 
 #define ENTE_DIRECTORY_PICKER_PLUGIN(obj) \
   (G_TYPE_CHECK_INSTANCE_CAST((obj), ente_directory_picker_plugin_get_type(), \
                               EnteDirectoryPickerPlugin))
 
+// Unwritten data the write-behind queue holds before callers are held back.
+static const gsize kWriteBehindMaxPendingBytes = 32 * 1024 * 1024;
+
+// Number of files kept open for appending.
+static const guint kMaxAppendFiles = 16;
+
+// Matches returned by searchContent when the caller sets no limit.
+static const guint kDefaultMaxSearchResults = 1000;
+
+// Entries returned by queryIndex when the caller sets no limit.
+static const guint kDefaultIndexQueryLimit = 100;
+
+// Data key under which an asynchronous call keeps its start time until it is
+// answered.
+static const gchar kCallStartTimeKey[] = "ente-directory-picker-call-start-time";
+
+// Progress events are sent at most this often for each call.
+static const gint64 kProgressIntervalUs = 100 * 1000;
+
+// Calls run on worker threads at once, and how many of them may be bulk
+// calls; the rest are kept for calls the user is waiting on.
+static const guint kMaxWorkerCalls = 8;
+static const guint kMaxBulkCalls = 2;
+
+// When set, names the file a trace is written to from the moment the plugin
+// is registered, so startup can be traced too.
+static const gchar kTraceEnvironmentVariable[] = "ENTE_DIRECTORY_PICKER_TRACE";
+
 struct _EnteDirectoryPickerPlugin {
   GObject parent_instance;
+
+  // Performs writeFile calls made with writeBehind set.
+  WriteBehindQueue* write_queue;
+
+  // Descriptors kept open for appendToFile and appendRecords.
+  AppendFileCache* append_cache;
+
+  // Session bus connection and portal probe shared by selectDirectory calls.
+  PortalFileChooser* portal_chooser;
+
+  // Runs the calls that are performed on worker threads.
+  TaskScheduler* scheduler;
+
+  // Runs appendToFile and appendRecords calls on a single thread, so records
+  // land in the order the calls were made.
+  TaskScheduler* append_scheduler;
+
+  // Runs writeFile calls without writeBehind on a single thread, so the last
+  // of several calls writing the same file is the one that sticks.
+  TaskScheduler* write_scheduler;
+
+  // Runs the calls that wait for write_queue to drain, writeBehind calls made
+  // while it is full and flush calls, on a single thread, so a burst of them
+  // never ties up the threads that interactive calls run on.
+  TaskScheduler* write_queue_scheduler;
+
+  // Maps the coalescing key of each running read-only call to its
+  // CancellableCall, so identical calls made meanwhile share its result.
+  // Only touched on the main thread.
+  GHashTable* coalesced_calls;
+
+  // Maps the requestId of each running cancellable call to its GCancellable.
+  // Only touched on the main thread.
+  GHashTable* pending_calls;
+
+  // Carries progress events for calls made with a requestId, which are only
+  // tracked while Dart is listening.
+  FlEventChannel* progress_channel;
+  gboolean progress_listening;
 };
 
 G_DEFINE_TYPE(EnteDirectoryPickerPlugin, ente_directory_picker_plugin, g_object_get_type())
 
+// Returns TRUE if a writeFile call asked to be performed in the background.
+static gboolean is_write_behind(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FALSE;
+  }
+  FlValue* write_behind_value = fl_value_lookup_string(args, "writeBehind");
+  return write_behind_value && fl_value_get_type(write_behind_value) == FL_VALUE_TYPE_BOOL &&
+         fl_value_get_bool(write_behind_value);
+}
+
+// Looks up the file a writeFile call writes to. Returns FALSE if the call
+// names none; such calls fail when they are handled.
+static gboolean get_write_target(FlValue* args,
+                                 const gchar** directory_path,
+                                 const gchar** file_name) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FALSE;
+  }
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  FlValue* file_name_value = fl_value_lookup_string(args, "fileName");
+  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING ||
+      !file_name_value || fl_value_get_type(file_name_value) != FL_VALUE_TYPE_STRING) {
+    return FALSE;
+  }
+  *directory_path = fl_value_get_string(directory_path_value);
+  *file_name = fl_value_get_string(file_name_value);
+  return TRUE;
+}
+
+// Returns TRUE if a getTreeNodes or expandTreeNode call asked for the total
+// size of each directory.
+static gboolean wants_aggregate_sizes(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FALSE;
+  }
+  FlValue* aggregate_sizes_value = fl_value_lookup_string(args, "aggregateSizes");
+  return aggregate_sizes_value && fl_value_get_type(aggregate_sizes_value) == FL_VALUE_TYPE_BOOL &&
+         fl_value_get_bool(aggregate_sizes_value);
+}
+
+// A method call that runs on a worker thread so the main thread stays free
+// to answer others, including the cancel call that stops it.
+typedef FlMethodResponse* (*CancellableHandler)(FlValue* args);
+
+// A handler for a call that also needs the plugin's own state.
+typedef FlMethodResponse* (*PluginHandler)(EnteDirectoryPickerPlugin* self, FlValue* args);
+
+typedef struct {
+  // Held until the call is answered, so the plugin outlives its workers.
+  EnteDirectoryPickerPlugin* self;
+  FlMethodCall* method_call;
+  CancellableHandler handler;
+  // Set instead of handler for calls that need the plugin's state.
+  PluginHandler plugin_handler;
+  GCancellable* cancellable;
+  MethodStats* stats;
+  // Set when the caller can cancel the call by this id.
+  gchar* request_id;
+  gint64 start_time;
+  // Set when identical calls may join this one, and then the calls that did,
+  // each carrying its start time under kCallStartTimeKey.
+  GBytes* coalescing_key;
+  GPtrArray* waiters;
+  FlMethodResponse* response;
+  // Set when the call's progress is sent to progress_channel.
+  ProgressReporter* progress;
+  FlEventChannel* progress_channel;
+} CancellableCall;
+
+static void cancellable_call_free(gpointer data) {
+  CancellableCall* call = static_cast<CancellableCall*>(data);
+  g_object_unref(call->method_call);
+  g_object_unref(call->cancellable);
+  g_free(call->request_id);
+  g_clear_pointer(&call->coalescing_key, g_bytes_unref);
+  g_clear_pointer(&call->waiters, g_ptr_array_unref);
+  g_clear_object(&call->response);
+  g_clear_pointer(&call->progress, progress_reporter_free);
+  g_clear_object(&call->progress_channel);
+  g_object_unref(call->self);
+  g_free(call);
+}
+
+typedef struct {
+  FlEventChannel* channel;
+  FlValue* event;
+} ProgressEvent;
+
+static gboolean send_progress_event(gpointer user_data) {
+  ProgressEvent* progress_event = static_cast<ProgressEvent*>(user_data);
+  fl_event_channel_send(progress_event->channel, progress_event->event, nullptr, nullptr);
+  g_object_unref(progress_event->channel);
+  fl_value_unref(progress_event->event);
+  g_free(progress_event);
+  return G_SOURCE_REMOVE;
+}
+
+// Sends an update from a call's ProgressReporter. Updates come from worker
+// threads, and event channels may only be used on the main thread.
+static void on_call_progress(const ProgressUpdate* update, gpointer user_data) {
+  CancellableCall* call = static_cast<CancellableCall*>(user_data);
+  FlValue* event = fl_value_new_map();
+  fl_value_set_string_take(event, "requestId", fl_value_new_string(call->request_id));
+  fl_value_set_string_take(event, "method",
+                           fl_value_new_string(fl_method_call_get_name(call->method_call)));
+  fl_value_set_string_take(event, "itemsDone", fl_value_new_int(update->items_done));
+  fl_value_set_string_take(event, "itemsTotal", fl_value_new_int(update->items_total));
+  fl_value_set_string_take(event, "bytesDone", fl_value_new_int(update->bytes_done));
+  fl_value_set_string_take(event, "bytesTotal", fl_value_new_int(update->bytes_total));
+  fl_value_set_string_take(event, "currentPath",
+                           update->current_path ? fl_value_new_string(update->current_path)
+                                                : fl_value_new_null());
+  fl_value_set_string_take(event, "done", fl_value_new_bool(update->finished));
+
+  ProgressEvent* progress_event = g_new0(ProgressEvent, 1);
+  progress_event->channel = FL_EVENT_CHANNEL(g_object_ref(call->progress_channel));
+  progress_event->event = event;
+  // Runs at once when called on the main thread, as for the final update, and
+  // otherwise is queued ahead of the call's response.
+  g_main_context_invoke(nullptr, send_progress_event, progress_event);
+}
+
+// Returns the requestId a call was made with, or NULL if it has none.
+static const gchar* get_request_id(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* request_id_value = fl_value_lookup_string(args, "requestId");
+  return request_id_value && fl_value_get_type(request_id_value) == FL_VALUE_TYPE_STRING
+      ? fl_value_get_string(request_id_value)
+      : nullptr;
+}
+
+// Returns TRUE for calls that change files, after which a read-only call may
+// no longer share the result of one that started earlier.
+static gboolean changes_files(const gchar* method) {
+  static const gchar* const kWriteMethods[] = {
+    "writeFile", "writeFileBytes", "writeFiles", "appendToFile", "appendRecords", "copyFile",
+    "exportFiles", "flush",
+  };
+  for (const gchar* write_method : kWriteMethods) {
+    if (strcmp(method, write_method) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Stops running read-only calls from being joined, so that calls made from
+// now on see the files as they are now.
+static void forget_coalesced_calls(EnteDirectoryPickerPlugin* self) {
+  g_hash_table_remove_all(self->coalesced_calls);
+}
+
+// Responds to a call run by run_cancellable_call(), back on the main thread.
+static gboolean on_cancellable_call_done(gpointer user_data) {
+  CancellableCall* call = static_cast<CancellableCall*>(user_data);
+  EnteDirectoryPickerPlugin* self = call->self;
+
+  // A later call may have reused the id, in which case the entry is its own.
+  if (call->request_id &&
+      g_hash_table_lookup(self->pending_calls, call->request_id) == call->cancellable) {
+    g_hash_table_remove(self->pending_calls, call->request_id);
+  }
+  if (call->coalescing_key &&
+      g_hash_table_lookup(self->coalesced_calls, call->coalescing_key) == call) {
+    g_hash_table_remove(self->coalesced_calls, call->coalescing_key);
+  }
+  if (changes_files(fl_method_call_get_name(call->method_call))) {
+    forget_coalesced_calls(self);
+  }
+
+  FlMethodResponse* response = call->response;
+  g_autoptr(FlMethodResponse) cancelled_response = nullptr;
+  if (FL_IS_METHOD_ERROR_RESPONSE(response) && g_cancellable_is_cancelled(call->cancellable)) {
+    cancelled_response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "CANCELLED", "The call was cancelled", nullptr));
+    response = cancelled_response;
+  }
+
+  method_stats_record_call(call->stats, g_get_monotonic_time() - call->start_time,
+                           FL_IS_METHOD_ERROR_RESPONSE(response));
+  progress_reporter_finish(call->progress);
+  {
+    g_auto(TraceSpan) respond_span = trace_span_begin("respond");
+    fl_method_call_respond(call->method_call, response, nullptr);
+    for (guint i = 0; call->waiters && i < call->waiters->len; i++) {
+      FlMethodCall* waiter = FL_METHOD_CALL(g_ptr_array_index(call->waiters, i));
+      gint64 waiter_start_time =
+          *static_cast<gint64*>(g_object_get_data(G_OBJECT(waiter), kCallStartTimeKey));
+      method_stats_record_call(call->stats, g_get_monotonic_time() - waiter_start_time,
+                               FL_IS_METHOD_ERROR_RESPONSE(response));
+      fl_method_call_respond(waiter, response, nullptr);
+    }
+  }
+  cancellable_call_free(call);
+  return G_SOURCE_REMOVE;
+}
+
+static void run_cancellable_call(gpointer user_data) {
+  CancellableCall* call = static_cast<CancellableCall*>(user_data);
+  MethodStats* previous_stats = method_stats_set_current(call->stats);
+  ProgressReporter* previous_progress = progress_reporter_set_current(call->progress);
+  // Handlers find the cancellable with g_cancellable_get_current(), which
+  // leaves their signatures the same whether they are run here or directly.
+  g_cancellable_push_current(call->cancellable);
+  {
+    g_auto(TraceSpan) call_span = trace_span_begin(fl_method_call_get_name(call->method_call));
+    FlValue* args = fl_method_call_get_args(call->method_call);
+    call->response = call->plugin_handler ? call->plugin_handler(call->self, args)
+                                          : call->handler(args);
+  }
+  g_cancellable_pop_current(call->cancellable);
+  progress_reporter_set_current(previous_progress);
+  method_stats_set_current(previous_stats);
+  // Queued behind any progress events the call sent.
+  g_main_context_invoke(nullptr, on_cancellable_call_done, call);
+}
+
+static void start_cancellable_call(EnteDirectoryPickerPlugin* self,
+                                   TaskScheduler* scheduler,
+                                   FlMethodCall* method_call,
+                                   CancellableHandler handler,
+                                   PluginHandler plugin_handler,
+                                   TaskPriority priority,
+                                   MethodStats* stats,
+                                   gint64 start_time) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  g_autoptr(GBytes) coalescing_key =
+      get_coalescing_key(fl_method_call_get_name(method_call), args);
+  CancellableCall* running = coalescing_key
+      ? static_cast<CancellableCall*>(g_hash_table_lookup(self->coalesced_calls, coalescing_key))
+      : nullptr;
+  if (running) {
+    // Answered along with the running call; no work of its own is done.
+    g_object_set_data_full(G_OBJECT(method_call), kCallStartTimeKey,
+                           g_memdup2(&start_time, sizeof(start_time)), g_free);
+    if (!running->waiters) {
+      running->waiters = g_ptr_array_new_with_free_func(g_object_unref);
+    }
+    g_ptr_array_add(running->waiters, g_object_ref(method_call));
+    return;
+  }
+
+  CancellableCall* call = g_new0(CancellableCall, 1);
+  call->self = ENTE_DIRECTORY_PICKER_PLUGIN(g_object_ref(self));
+  call->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+  call->handler = handler;
+  call->plugin_handler = plugin_handler;
+  call->cancellable = g_cancellable_new();
+  call->stats = stats;
+  call->request_id = g_strdup(get_request_id(args));
+  call->start_time = start_time;
+  if (coalescing_key) {
+    call->coalescing_key = g_bytes_ref(coalescing_key);
+    g_hash_table_insert(self->coalesced_calls, g_bytes_ref(coalescing_key), call);
+  }
+
+  if (call->request_id) {
+    g_hash_table_insert(self->pending_calls, g_strdup(call->request_id),
+                        g_object_ref(call->cancellable));
+  }
+  if (call->request_id && self->progress_listening) {
+    call->progress = progress_reporter_new(kProgressIntervalUs, on_call_progress, call);
+    call->progress_channel = FL_EVENT_CHANNEL(g_object_ref(self->progress_channel));
+  }
+
+  task_scheduler_push(scheduler, priority, run_cancellable_call, call);
+}
+
+// Answers a writeFile call with writeBehind set whose write was queued while
+// the queue was over its budget, once it is back within it.
+static FlMethodResponse* wait_for_write_queue_room(EnteDirectoryPickerPlugin* self,
+                                                   FlValue* args) {
+  write_behind_queue_wait_for_room(self->write_queue);
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Performs a writeFile call without writeBehind. A queued write to the same
+// file was discarded when the call arrived, but one the writer thread has
+// already started would land after this write and has to finish first, and
+// writes queued since then are held back until this one is done.
+static FlMethodResponse* write_file_after_queued_write(EnteDirectoryPickerPlugin* self,
+                                                       FlValue* args) {
+  const gchar* directory_path;
+  const gchar* file_name;
+  if (!get_write_target(args, &directory_path, &file_name)) {
+    return write_file(args);
+  }
+  write_behind_queue_wait_for_file(self->write_queue, directory_path, file_name);
+  FlMethodResponse* response = write_file(args);
+  write_behind_queue_end_direct_write(self->write_queue, directory_path, file_name);
+  return response;
+}
+
+static FlMethodResponse* flush_queued_writes(EnteDirectoryPickerPlugin* self, FlValue* args) {
+  return flush_writes(self->write_queue);
+}
+
+static FlMethodResponse* append_to_cached_file(EnteDirectoryPickerPlugin* self, FlValue* args) {
+  return append_to_file(self->append_cache, args);
+}
+
+static FlMethodResponse* append_records_to_cached_file(EnteDirectoryPickerPlugin* self,
+                                                       FlValue* args) {
+  return append_records(self->append_cache, args);
+}
+
 // Called when a method call is received from Flutter.
 static void ente_directory_picker_plugin_handle_method_call(
     EnteDirectoryPickerPlugin* self,
     FlMethodCall* method_call) {
   g_autoptr(FlMethodResponse) response = nullptr;
+  // Set instead of response for calls that run on a worker thread, the latter
+  // for calls that need the plugin's state. Calls that work through many
+  // files are bulk calls, which wait for the others.
+  CancellableHandler handler = nullptr;
+  PluginHandler plugin_handler = nullptr;
+  TaskPriority priority = TASK_PRIORITY_INTERACTIVE;
+  TaskScheduler* scheduler = self->scheduler;
 
   const gchar* method = fl_method_call_get_name(method_call);
   FlValue* args = fl_method_call_get_args(method_call);
 
+  // Every call is timed, and the I/O it does is charged to its method, except
+  // for the calls that read and reset those counters.
+  gboolean is_stats_call = strcmp(method, "getStats") == 0 || strcmp(method, "resetStats") == 0;
+  MethodStats* stats = is_stats_call ? nullptr : method_stats_get(method);
+  MethodStats* previous_stats = method_stats_set_current(stats);
+  gint64 start_time = g_get_monotonic_time();
+  g_auto(TraceSpan) call_span = trace_span_begin(method);
+
   if (strcmp(method, "getPlatformVersion") == 0) {
     response = get_platform_version();
   } else if (strcmp(method, "selectDirectory") == 0) {
-    response = select_directory();
+    // Responds, and is recorded, once the user has chosen.
+    g_object_set_data_full(G_OBJECT(method_call), kCallStartTimeKey,
+                           g_memdup2(&start_time, sizeof(start_time)), g_free);
+    select_directory(self->portal_chooser, method_call);
+    method_stats_set_current(previous_stats);
+    return;
   } else if (strcmp(method, "hasPermission") == 0) {
     response = has_permission(args);
+  } else if (strcmp(method, "hasPermissions") == 0) {
+    response = has_permissions(args);
   } else if (strcmp(method, "requestPermission") == 0) {
     response = request_permission(args);
-  } else if (strcmp(method, "writeFile") == 0) {
-    response = write_file(args);
+  } else if (strcmp(method, "writeFile") == 0 || strcmp(method, "writeFileBytes") == 0) {
+    if (is_write_behind(args)) {
+      response = write_file_behind(self->write_queue, args);
+      // The write is queued either way, so later writes stay in order, but
+      // the caller is held back until the queue has drained.
+      if (!FL_IS_METHOD_ERROR_RESPONSE(response) && write_behind_queue_is_full(self->write_queue)) {
+        g_clear_object(&response);
+        plugin_handler = wait_for_write_queue_room;
+        scheduler = self->write_queue_scheduler;
+      }
+    } else {
+      // Older queued contents must not replace what this call writes, and
+      // contents queued after it must not be replaced by it.
+      const gchar* directory_path;
+      const gchar* file_name;
+      if (get_write_target(args, &directory_path, &file_name)) {
+        write_behind_queue_begin_direct_write(self->write_queue, directory_path, file_name);
+      }
+      plugin_handler = write_file_after_queued_write;
+      scheduler = self->write_scheduler;
+    }
+  } else if (strcmp(method, "writeFiles") == 0) {
+    handler = write_files;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "appendToFile") == 0) {
+    plugin_handler = append_to_cached_file;
+    scheduler = self->append_scheduler;
+  } else if (strcmp(method, "appendRecords") == 0) {
+    plugin_handler = append_records_to_cached_file;
+    scheduler = self->append_scheduler;
+  } else if (strcmp(method, "copyFile") == 0) {
+    handler = copy_file;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "exportFiles") == 0) {
+    handler = export_files;
+    priority = TASK_PRIORITY_BULK;
   } else if (strcmp(method, "listDirectory") == 0) {
-    response = list_directory(args);
+    handler = list_directory;
+  } else if (strcmp(method, "findFiles") == 0) {
+    handler = find_files;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "searchContent") == 0) {
+    handler = search_content;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "indexDirectory") == 0) {
+    handler = index_directory;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "queryIndex") == 0) {
+    // Maps the index and, for substring queries, scans every name in it.
+    handler = query_index;
   } else if (strcmp(method, "readFile") == 0) {
-    response = read_file(args);
+    handler = read_file;
   } else if (strcmp(method, "getDirectoryDetails") == 0) {
-    response = get_directory_details(args);
+    handler = get_directory_details;
+  } else if (strcmp(method, "getTreeNodes") == 0) {
+    handler = get_tree_nodes;
+    // Totalling sizes walks the whole subtree, which is bulk work.
+    if (wants_aggregate_sizes(args)) {
+      priority = TASK_PRIORITY_BULK;
+    }
+  } else if (strcmp(method, "expandTreeNode") == 0) {
+    handler = expand_tree_node;
+    if (wants_aggregate_sizes(args)) {
+      priority = TASK_PRIORITY_BULK;
+    }
+  } else if (strcmp(method, "prefetchFiles") == 0) {
+    handler = prefetch_files;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "evictFiles") == 0) {
+    handler = evict_files;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "getMediaMetadata") == 0) {
+    handler = get_media_metadata;
+    priority = TASK_PRIORITY_BULK;
+  } else if (strcmp(method, "getFilesystemCapabilities") == 0) {
+    // The first call on a mount probes it with scratch files, which can take
+    // seconds on a network or FUSE file system.
+    handler = get_filesystem_capabilities;
+  } else if (strcmp(method, "cancel") == 0) {
+    response = cancel_call(self->pending_calls, args);
+  } else if (strcmp(method, "flush") == 0) {
+    plugin_handler = flush_queued_writes;
+    scheduler = self->write_queue_scheduler;
+  } else if (strcmp(method, "getStats") == 0) {
+    response = get_stats();
+  } else if (strcmp(method, "resetStats") == 0) {
+    response = reset_stats();
+  } else if (strcmp(method, "startTracing") == 0) {
+    response = start_tracing(args);
+  } else if (strcmp(method, "stopTracing") == 0) {
+    response = stop_tracing();
   } else {
     response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
   }
 
+  method_stats_set_current(previous_stats);
+  if (handler || plugin_handler) {
+    // Responds, and is recorded, once the worker is done.
+    start_cancellable_call(self, scheduler, method_call, handler, plugin_handler, priority,
+                           stats, start_time);
+    return;
+  }
+  if (changes_files(method)) {
+    forget_coalesced_calls(self);
+  }
+  method_stats_record_call(stats, g_get_monotonic_time() - start_time,
+                           FL_IS_METHOD_ERROR_RESPONSE(response));
+  g_auto(TraceSpan) respond_span = trace_span_begin("respond");
   fl_method_call_respond(method_call, response, nullptr);
 }
 
@@ -65,112 +580,91 @@ FlMethodResponse* get_platform_version() {
   return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
-// Helper function to check if running in Flatpak
-static gboolean is_running_in_flatpak() {
-  // Check if /run/flatpak-info exists
-  return g_file_test("/run/flatpak-info", G_FILE_TEST_EXISTS);
+// Completes a selectDirectory call with path, or null if it is NULL.
+static void respond_with_directory(FlMethodCall* method_call, const gchar* path) {
+  const gint64* start_time = static_cast<const gint64*>(
+      g_object_get_data(G_OBJECT(method_call), kCallStartTimeKey));
+  if (start_time) {
+    method_stats_record_call(method_stats_get("selectDirectory"),
+                             g_get_monotonic_time() - *start_time, FALSE);
+  }
+
+  g_autoptr(FlValue) result = path ? fl_value_new_string(path) : fl_value_new_null();
+  g_autoptr(FlMethodResponse) response =
+      FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  fl_method_call_respond(method_call, response, nullptr);
 }
 
-// Helper function to check if running in Snap
-static gboolean is_running_in_snap() {
-  // Check if SNAP environment variable is set
-  const char* snap = g_getenv("SNAP");
-  return snap != nullptr && strlen(snap) > 0;
+static void on_native_chooser_response(GtkNativeDialog* dialog, gint response_id,
+                                       gpointer user_data) {
+  FlMethodCall* method_call = FL_METHOD_CALL(user_data);
+  g_autofree gchar* selected_path = response_id == GTK_RESPONSE_ACCEPT
+      ? gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog))
+      : nullptr;
+  respond_with_directory(method_call, selected_path);
+  g_object_unref(dialog);
+  g_object_unref(method_call);
 }
 
-// Helper function to check if xdg-desktop-portal is available
-static gboolean is_xdg_portal_available() {
-  GDBusConnection* connection = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
-  if (!connection) {
-    return FALSE;
-  }
-  
-  GDBusProxy* proxy = g_dbus_proxy_new_sync(
-    connection,
-    G_DBUS_PROXY_FLAGS_NONE,
-    nullptr,
-    "org.freedesktop.portal.Desktop",
-    "/org/freedesktop/portal/desktop",
-    "org.freedesktop.portal.FileChooser",
-    nullptr,
-    nullptr
-  );
-  
-  gboolean available = (proxy != nullptr);
-  if (proxy) {
-    g_object_unref(proxy);
-  }
-  g_object_unref(connection);
-  return available;
+// Shows GTK's directory chooser without running a nested main loop.
+static void select_directory_via_gtk(FlMethodCall* method_call) {
+  GtkFileChooserNative* chooser = gtk_file_chooser_native_new(
+      "Select Directory", nullptr, GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+      "_Select", "_Cancel");
+  gtk_native_dialog_set_modal(GTK_NATIVE_DIALOG(chooser), TRUE);
+  g_signal_connect(chooser, "response", G_CALLBACK(on_native_chooser_response),
+                   g_object_ref(method_call));
+  gtk_native_dialog_show(GTK_NATIVE_DIALOG(chooser));
 }
 
-// Helper function to select directory using xdg-desktop-portal
-static gchar* select_directory_via_portal() {
-  // Note: Portal implementation requires async handling which is complex.
-  // For now, we detect if we're in a sandboxed environment and inform the user.
-  // A full portal implementation would require:
-  // 1. Creating a portal request
-  // 2. Handling async response via DBus signals
-  // 3. Extracting the selected path from the response
+static void on_portal_directory_selected(GObject* source, GAsyncResult* result,
+                                         gpointer user_data) {
+  FlMethodCall* method_call = FL_METHOD_CALL(user_data);
+  g_autoptr(GError) error = nullptr;
+  g_autofree gchar* selected_path = portal_file_chooser_select_directory_finish(result, &error);
 
-  if (is_running_in_flatpak()) {
-    g_print("Running in Flatpak - using GTK dialog with portal permissions\n");
-  } else if (is_running_in_snap()) {
-    g_print("Running in Snap - using GTK dialog with snap permissions\n");
+  if (!error || g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    respond_with_directory(method_call, selected_path);
+  } else {
+    // No portal, or a broken one: let the user choose through GTK instead.
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+      g_warning("File chooser portal failed: %s", error->message);
+    }
+    select_directory_via_gtk(method_call);
   }
-
-  // Return nullptr to fall back to GTK dialog
-  // In sandboxed environments, the GTK dialog will use portal internally
-  return nullptr;
+  g_object_unref(method_call);
 }
 
-// Helper function to select directory using GTK
-static gchar* select_directory_via_gtk() {
-  GtkWidget* dialog = gtk_file_chooser_dialog_new(
-    "Select Directory",
-    nullptr,
-    GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
-    "_Cancel", GTK_RESPONSE_CANCEL,
-    "_Select", GTK_RESPONSE_ACCEPT,
-    nullptr
-  );
-  
-  gchar* selected_path = nullptr;
-  gint result = gtk_dialog_run(GTK_DIALOG(dialog));
-  
-  if (result == GTK_RESPONSE_ACCEPT) {
-    selected_path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-  }
-  
-  gtk_widget_destroy(dialog);
-  return selected_path;
+void select_directory(PortalFileChooser* portal_chooser, FlMethodCall* method_call) {
+  // The portal shows the desktop's own chooser and, in a Flatpak or Snap
+  // sandbox, grants access to the chosen directory.
+  portal_file_chooser_select_directory(portal_chooser, "", "Select Directory",
+                                       on_portal_directory_selected,
+                                       g_object_ref(method_call));
 }
 
-FlMethodResponse* select_directory() {
-  gchar* selected_path = nullptr;
-
-  // Check if we're in a sandboxed environment
-  gboolean is_sandboxed = is_running_in_flatpak() || is_running_in_snap();
-
-  // Try xdg-desktop-portal first if available and sandboxed
-  if (is_sandboxed && is_xdg_portal_available()) {
-    selected_path = select_directory_via_portal();
+// Collects a list of strings into a NULL-terminated array that borrows the
+// strings from value. An absent or null value gives an empty array. Returns
+// nullptr if value is not a list of strings; free the result with g_free().
+static const gchar** get_string_list(FlValue* value) {
+  if (!value || fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+    return g_new0(const gchar*, 1);
   }
-
-  // Use GTK dialog (will use portal internally if sandboxed)
-  if (!selected_path) {
-    selected_path = select_directory_via_gtk();
+  if (fl_value_get_type(value) != FL_VALUE_TYPE_LIST) {
+    return nullptr;
   }
-  
-  if (selected_path) {
-    g_autoptr(FlValue) result = fl_value_new_string(selected_path);
-    g_free(selected_path);
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
-  } else {
-    // Return null if user cancelled or error occurred
-    g_autoptr(FlValue) result = fl_value_new_null();
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+
+  size_t length = fl_value_get_length(value);
+  const gchar** strings = g_new0(const gchar*, length + 1);
+  for (size_t i = 0; i < length; i++) {
+    FlValue* item = fl_value_get_list_value(value, i);
+    if (fl_value_get_type(item) != FL_VALUE_TYPE_STRING) {
+      g_free(strings);
+      return nullptr;
+    }
+    strings[i] = fl_value_get_string(item);
   }
+  return strings;
 }
 
 FlMethodResponse* has_permission(FlValue* args) {
@@ -186,29 +680,30 @@ FlMethodResponse* has_permission(FlValue* args) {
   }
 
   const gchar* directory_path = fl_value_get_string(directory_path_value);
-  
-  // Check if directory exists and is accessible
-  struct stat st;
-  if (stat(directory_path, &st) != 0) {
-    // Directory doesn't exist or is not accessible
-    g_autoptr(FlValue) result = fl_value_new_bool(FALSE);
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  g_autoptr(FlValue) result = fl_value_new_bool(
+      permission_cache_check(directory_path) == DIRECTORY_ACCESS_WRITABLE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* has_permissions(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
   }
-  
-  // Check if it's actually a directory
-  if (!S_ISDIR(st.st_mode)) {
-    g_autoptr(FlValue) result = fl_value_new_bool(FALSE);
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+
+  g_autofree const gchar** directory_paths =
+      get_string_list(fl_value_lookup_string(args, "directoryPaths"));
+  if (!directory_paths) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "directoryPaths must be a list of strings", nullptr));
   }
-  
-  // Check if we have write permission
-  if (access(directory_path, W_OK) == 0) {
-    g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
-  } else {
-    g_autoptr(FlValue) result = fl_value_new_bool(FALSE);
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+
+  g_autoptr(FlValue) result = fl_value_new_map();
+  for (const gchar** path = directory_paths; *path; path++) {
+    fl_value_set_string_take(result, *path, fl_value_new_bool(
+        permission_cache_check(*path) == DIRECTORY_ACCESS_WRITABLE));
   }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
 FlMethodResponse* request_permission(FlValue* args) {
@@ -218,7 +713,86 @@ FlMethodResponse* request_permission(FlValue* args) {
   return has_permission(args);
 }
 
-FlMethodResponse* write_file(FlValue* args) {
+// Parses the optional "durability" argument. Defaults to data durability,
+// which matches what g_file_set_contents did for existing files.
+static gboolean parse_durability(FlValue* args, WriteDurability* durability) {
+  *durability = WRITE_DURABILITY_DATA;
+  FlValue* durability_value = fl_value_lookup_string(args, "durability");
+  if (!durability_value || fl_value_get_type(durability_value) == FL_VALUE_TYPE_NULL) {
+    return TRUE;
+  }
+  if (fl_value_get_type(durability_value) != FL_VALUE_TYPE_STRING) {
+    return FALSE;
+  }
+
+  const gchar* name = fl_value_get_string(durability_value);
+  if (strcmp(name, "none") == 0) {
+    *durability = WRITE_DURABILITY_NONE;
+  } else if (strcmp(name, "data") == 0) {
+    *durability = WRITE_DURABILITY_DATA;
+  } else if (strcmp(name, "full") == 0) {
+    *durability = WRITE_DURABILITY_FULL;
+  } else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Checks that directory_path is an existing, writable directory. Returns an
+// error response, or nullptr if the directory can be written to.
+static FlMethodResponse* validate_target_directory(const gchar* directory_path) {
+  DirectoryAccess access = permission_cache_check(directory_path);
+  if (access == DIRECTORY_ACCESS_NONE) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_DIRECTORY", "Directory does not exist or is not accessible", nullptr));
+  }
+
+  if (access != DIRECTORY_ACCESS_WRITABLE) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "PERMISSION_DENIED", "No write permission for directory", nullptr));
+  }
+  return nullptr;
+}
+
+// Gets the bytes of file content passed either as a String or a Uint8List.
+static gboolean get_content_bytes(FlValue* value, const gchar** data, gsize* length) {
+  if (!value) {
+    return FALSE;
+  }
+  if (fl_value_get_type(value) == FL_VALUE_TYPE_STRING) {
+    *data = fl_value_get_string(value);
+    *length = strlen(*data);
+    return TRUE;
+  }
+  if (fl_value_get_type(value) == FL_VALUE_TYPE_UINT8_LIST) {
+    *data = reinterpret_cast<const gchar*>(fl_value_get_uint8_list(value));
+    *length = fl_value_get_length(value);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Converts a write failure into an error response, reporting a full disk
+// separately so callers can tell it apart from other failures.
+static FlMethodResponse* write_error_response(const gchar* directory_path,
+                                              GError* error,
+                                              const gchar* fallback) {
+  // The directory may have gone or changed permissions since it was checked.
+  if (directory_path) {
+    permission_cache_invalidate(directory_path);
+  }
+  const gchar* code = error && g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOSPC)
+      ? "INSUFFICIENT_SPACE" : "FILE_WRITE_ERROR";
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+    code, error ? error->message : fallback, nullptr));
+}
+
+// Decodes and validates the arguments shared by the writeFile variants.
+// Returns an error response, or nullptr once the outputs are set.
+static FlMethodResponse* parse_write_file_args(FlValue* args,
+                                               const gchar** directory_path,
+                                               PendingWrite* pending,
+                                               WriteDurability* durability) {
   if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
       "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
@@ -228,49 +802,70 @@ FlMethodResponse* write_file(FlValue* args) {
   FlValue* file_name_value = fl_value_lookup_string(args, "fileName");
   FlValue* content_value = fl_value_lookup_string(args, "content");
   
+  *pending = {};
   if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING ||
       !file_name_value || fl_value_get_type(file_name_value) != FL_VALUE_TYPE_STRING ||
-      !content_value || fl_value_get_type(content_value) != FL_VALUE_TYPE_STRING) {
+      !get_content_bytes(content_value, &pending->data, &pending->length)) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "INVALID_ARGUMENT", "directoryPath, fileName, and content must be strings", nullptr));
+      "INVALID_ARGUMENT", "directoryPath and fileName must be strings, content a string or bytes", nullptr));
   }
-  
-  const gchar* directory_path = fl_value_get_string(directory_path_value);
-  const gchar* file_name = fl_value_get_string(file_name_value);
-  const gchar* content = fl_value_get_string(content_value);
-  
-  // Validate directory path
-  struct stat st;
-  if (stat(directory_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+
+  if (!parse_durability(args, durability)) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "INVALID_DIRECTORY", "Directory does not exist or is not accessible", nullptr));
+      "INVALID_ARGUMENT", "durability must be one of none, data or full", nullptr));
   }
-  
-  // Check write permission
-  if (access(directory_path, W_OK) != 0) {
-    return FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "PERMISSION_DENIED", "No write permission for directory", nullptr));
+
+  FlValue* expected_size_value = fl_value_lookup_string(args, "expectedSize");
+  if (expected_size_value && fl_value_get_type(expected_size_value) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(expected_size_value) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(expected_size_value) < 0) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "expectedSize must be a non-negative integer", nullptr));
+    }
+    pending->expected_size = fl_value_get_int(expected_size_value);
   }
+
+  FlValue* sparse_value = fl_value_lookup_string(args, "sparse");
+  pending->sparse = sparse_value && fl_value_get_type(sparse_value) == FL_VALUE_TYPE_BOOL &&
+                    fl_value_get_bool(sparse_value);
   
-  // Build full file path
-  g_autofree gchar* file_path = g_build_filename(directory_path, file_name, nullptr);
+  *directory_path = fl_value_get_string(directory_path_value);
+  pending->file_name = fl_value_get_string(file_name_value);
+  
+  FlMethodResponse* invalid = validate_target_directory(*directory_path);
+  if (invalid) {
+    return invalid;
+  }
   
-  // Validate file name (basic security check)
-  if (strstr(file_name, "..") || strstr(file_name, "/") || strstr(file_name, "\\")) {
+  if (!file_operations_is_valid_file_name(pending->file_name)) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
       "INVALID_FILENAME", "File name contains invalid characters", nullptr));
   }
+  return nullptr;
+}
+
+FlMethodResponse* write_file(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  const gchar* directory_path;
+  PendingWrite pending;
+  WriteDurability durability;
+  FlMethodResponse* invalid = parse_write_file_args(args, &directory_path, &pending, &durability);
+  if (invalid) {
+    return invalid;
+  }
   
-  // Write file using GLib for better UTF-8 handling
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
   GError* error = nullptr;
-  gboolean success = g_file_set_contents(file_path, content, -1, &error);
+  gboolean success = write_files_durably(directory_path, &pending, 1, durability,
+                                         g_cancellable_get_current(), &error);
+  trace_span_end(&filesystem_span);
   
   if (success) {
     g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   } else {
-    FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "FILE_WRITE_ERROR", error ? error->message : "Failed to write file", nullptr));
+    FlMethodResponse* response = write_error_response(directory_path, error, "Failed to write file");
     if (error) {
       g_error_free(error);
     }
@@ -278,138 +873,1174 @@ FlMethodResponse* write_file(FlValue* args) {
   }
 }
 
-FlMethodResponse* list_directory(FlValue* args) {
-  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
-    return FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
-  }
-
-  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
-  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING) {
-    return FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "INVALID_ARGUMENT", "directoryPath must be a string", nullptr));
+FlMethodResponse* write_file_behind(WriteBehindQueue* queue, FlValue* args) {
+  const gchar* directory_path;
+  PendingWrite pending;
+  WriteDurability durability;
+  FlMethodResponse* invalid = parse_write_file_args(args, &directory_path, &pending, &durability);
+  if (invalid) {
+    return invalid;
   }
 
-  const gchar* directory_path = fl_value_get_string(directory_path_value);
-
-  // Check if directory exists
-  if (!g_file_test(directory_path, G_FILE_TEST_IS_DIR)) {
-    g_autoptr(FlValue) result = fl_value_new_null();
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
-  }
+  // Failures surface from the next flush().
+  write_behind_queue_push(queue, directory_path, pending.file_name, pending.data,
+                          pending.length, pending.expected_size, pending.sparse, durability);
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
 
+FlMethodResponse* flush_writes(WriteBehindQueue* queue) {
   GError* error = nullptr;
-  GDir* dir = g_dir_open(directory_path, 0, &error);
-
-  if (!dir) {
+  if (!write_behind_queue_flush(queue, &error)) {
     FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "DIR_READ_ERROR", error ? error->message : "Failed to read directory", nullptr));
-    if (error) g_error_free(error);
+      "FILE_WRITE_ERROR", error->message, nullptr));
+    g_error_free(error);
     return response;
   }
 
-  g_autoptr(FlValue) file_list = fl_value_new_list();
-  const gchar* filename;
-
-  while ((filename = g_dir_read_name(dir)) != nullptr) {
-    fl_value_append_take(file_list, fl_value_new_string(filename));
-  }
-
-  g_dir_close(dir);
-  return FL_METHOD_RESPONSE(fl_method_success_response_new(file_list));
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
-FlMethodResponse* read_file(FlValue* args) {
+FlMethodResponse* write_files(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
   if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
       "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
   }
 
-  FlValue* file_path_value = fl_value_lookup_string(args, "filePath");
-  if (!file_path_value || fl_value_get_type(file_path_value) != FL_VALUE_TYPE_STRING) {
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  FlValue* files_value = fl_value_lookup_string(args, "files");
+  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING ||
+      !files_value || fl_value_get_type(files_value) != FL_VALUE_TYPE_MAP) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "INVALID_ARGUMENT", "filePath must be a string", nullptr));
+      "INVALID_ARGUMENT", "directoryPath must be a string and files a map", nullptr));
   }
 
-  const gchar* file_path = fl_value_get_string(file_path_value);
+  WriteDurability durability;
+  if (!parse_durability(args, &durability)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "durability must be one of none, data or full", nullptr));
+  }
 
-  // Check if file exists
-  if (!g_file_test(file_path, G_FILE_TEST_EXISTS)) {
-    g_autoptr(FlValue) result = fl_value_new_null();
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  const gchar* directory_path = fl_value_get_string(directory_path_value);
+  FlMethodResponse* invalid = validate_target_directory(directory_path);
+  if (invalid) {
+    return invalid;
   }
 
-  GError* error = nullptr;
-  gchar* content = nullptr;
-  gsize length = 0;
+  size_t n_files = fl_value_get_length(files_value);
+  g_autofree PendingWrite* writes = g_new0(PendingWrite, n_files);
+  for (size_t i = 0; i < n_files; i++) {
+    FlValue* name_value = fl_value_get_map_key(files_value, i);
+    FlValue* content_value = fl_value_get_map_value(files_value, i);
+    if (fl_value_get_type(name_value) != FL_VALUE_TYPE_STRING ||
+        !get_content_bytes(content_value, &writes[i].data, &writes[i].length)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "files must map file names to string or byte contents", nullptr));
+    }
 
-  if (g_file_get_contents(file_path, &content, &length, &error)) {
-    g_autoptr(FlValue) result = fl_value_new_string(content);
-    g_free(content);
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
-  } else {
-    FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "FILE_READ_ERROR", error ? error->message : "Failed to read file", nullptr));
+    writes[i].file_name = fl_value_get_string(name_value);
+    if (!file_operations_is_valid_file_name(writes[i].file_name)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_FILENAME", "File name contains invalid characters", nullptr));
+    }
+  }
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  if (!write_files_durably(directory_path, writes, n_files, durability,
+                           g_cancellable_get_current(), &error)) {
+    FlMethodResponse* response = write_error_response(directory_path, error, "Failed to write files");
     if (error) g_error_free(error);
     return response;
   }
+
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
-FlMethodResponse* get_directory_details(FlValue* args) {
-  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+// Validates the directoryPath/fileName target shared by the append methods
+// and appends records to it.
+static FlMethodResponse* append_to_target(AppendFileCache* cache, FlValue* args,
+                                          const struct iovec* records, gsize n_records) {
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  FlValue* file_name_value = fl_value_lookup_string(args, "fileName");
+  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING ||
+      !file_name_value || fl_value_get_type(file_name_value) != FL_VALUE_TYPE_STRING) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
-      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+      "INVALID_ARGUMENT", "directoryPath and fileName must be strings", nullptr));
   }
 
-  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
-  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING) {
+  WriteDurability durability;
+  if (!parse_durability(args, &durability)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "durability must be one of none, data or full", nullptr));
+  }
+
+  guint64 expected_size = 0;
+  FlValue* expected_size_value = fl_value_lookup_string(args, "expectedSize");
+  if (expected_size_value && fl_value_get_type(expected_size_value) == FL_VALUE_TYPE_INT &&
+      fl_value_get_int(expected_size_value) > 0) {
+    expected_size = fl_value_get_int(expected_size_value);
+  }
+
+  const gchar* directory_path = fl_value_get_string(directory_path_value);
+  const gchar* file_name = fl_value_get_string(file_name_value);
+  FlMethodResponse* invalid = validate_target_directory(directory_path);
+  if (invalid) {
+    return invalid;
+  }
+  if (!file_operations_is_valid_file_name(file_name)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_FILENAME", "File name contains invalid characters", nullptr));
+  }
+
+  g_autofree gchar* file_path = g_build_filename(directory_path, file_name, nullptr);
+  GError* error = nullptr;
+  if (!append_file_cache_append(cache, file_path, records, n_records, durability,
+                                expected_size, &error)) {
+    FlMethodResponse* response = write_error_response(directory_path, error, "Failed to append to file");
+    if (error) g_error_free(error);
+    return response;
+  }
+
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* append_to_file(AppendFileCache* cache, FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  const gchar* data;
+  gsize length;
+  if (!get_content_bytes(fl_value_lookup_string(args, "data"), &data, &length)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "data must be a string or bytes", nullptr));
+  }
+
+  struct iovec record = { const_cast<gchar*>(data), length };
+  return append_to_target(cache, args, &record, 1);
+}
+
+FlMethodResponse* append_records(AppendFileCache* cache, FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* records_value = fl_value_lookup_string(args, "records");
+  if (!records_value || fl_value_get_type(records_value) != FL_VALUE_TYPE_LIST) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "records must be a list", nullptr));
+  }
+
+  size_t n_records = fl_value_get_length(records_value);
+  g_autofree struct iovec* records = g_new0(struct iovec, n_records);
+  for (size_t i = 0; i < n_records; i++) {
+    const gchar* data;
+    gsize length;
+    if (!get_content_bytes(fl_value_get_list_value(records_value, i), &data, &length)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "records must be strings or bytes", nullptr));
+    }
+    records[i] = { const_cast<gchar*>(data), length };
+  }
+
+  return append_to_target(cache, args, records, n_records);
+}
+
+FlMethodResponse* copy_file(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* source_path_value = fl_value_lookup_string(args, "sourcePath");
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  FlValue* file_name_value = fl_value_lookup_string(args, "fileName");
+  if (!source_path_value || fl_value_get_type(source_path_value) != FL_VALUE_TYPE_STRING ||
+      !directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING ||
+      !file_name_value || fl_value_get_type(file_name_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "sourcePath, directoryPath and fileName must be strings", nullptr));
+  }
+
+  WriteDurability durability;
+  if (!parse_durability(args, &durability)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "durability must be one of none, data or full", nullptr));
+  }
+
+  const gchar* source_path = fl_value_get_string(source_path_value);
+  const gchar* directory_path = fl_value_get_string(directory_path_value);
+  const gchar* file_name = fl_value_get_string(file_name_value);
+  FlMethodResponse* invalid = validate_target_directory(directory_path);
+  if (invalid) {
+    return invalid;
+  }
+  if (!file_operations_is_valid_file_name(file_name)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_FILENAME", "File name contains invalid characters", nullptr));
+  }
+  if (!g_file_test(source_path, G_FILE_TEST_IS_REGULAR)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "FILE_READ_ERROR", "Source file does not exist or is not a regular file", nullptr));
+  }
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  if (!copy_file_durably(source_path, directory_path, file_name, durability,
+                         g_cancellable_get_current(), &error)) {
+    FlMethodResponse* response = write_error_response(directory_path, error, "Failed to copy file");
+    if (error) {
+      g_error_free(error);
+    }
+    return response;
+  }
+
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* export_files(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  FlValue* files_value = fl_value_lookup_string(args, "files");
+  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING ||
+      !files_value || fl_value_get_type(files_value) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "directoryPath must be a string and files a map", nullptr));
+  }
+
+  WriteDurability durability;
+  if (!parse_durability(args, &durability)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "durability must be one of none, data or full", nullptr));
+  }
+
+  const gchar* directory_path = fl_value_get_string(directory_path_value);
+  FlMethodResponse* invalid = validate_target_directory(directory_path);
+  if (invalid) {
+    return invalid;
+  }
+
+  size_t n_files = fl_value_get_length(files_value);
+  g_autofree ExportItem* items = g_new0(ExportItem, n_files);
+  for (size_t i = 0; i < n_files; i++) {
+    FlValue* name_value = fl_value_get_map_key(files_value, i);
+    FlValue* source_value = fl_value_get_map_value(files_value, i);
+    if (fl_value_get_type(name_value) != FL_VALUE_TYPE_STRING ||
+        fl_value_get_type(source_value) != FL_VALUE_TYPE_STRING) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "files must map file names to source paths", nullptr));
+    }
+
+    items[i].file_name = fl_value_get_string(name_value);
+    items[i].source_path = fl_value_get_string(source_value);
+    // The manifest's name is taken as well.
+    if (!file_operations_is_valid_file_name(items[i].file_name) ||
+        export_manifest_is_reserved_name(items[i].file_name)) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_FILENAME", "File name contains invalid characters", nullptr));
+    }
+  }
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  ExportStats stats = {};
+  if (!export_files_incrementally(directory_path, items, n_files, durability, &stats,
+                                  g_cancellable_get_current(), &error)) {
+    FlMethodResponse* response = write_error_response(directory_path, error,
+                                                      "Failed to export files");
+    if (error) g_error_free(error);
+    return response;
+  }
+  trace_span_end(&filesystem_span);
+
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "copied", fl_value_new_int(stats.copied));
+  fl_value_set_string_take(result, "skipped", fl_value_new_int(stats.skipped));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Converts the result of a failed directory read into a response: null when
+// there is no directory, as callers check for that, and an error otherwise.
+static FlMethodResponse* directory_read_error_response(GError* error) {
+  if (!error) {
+    g_autoptr(FlValue) result = fl_value_new_null();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+    "DIR_READ_ERROR", error->message, nullptr));
+  g_error_free(error);
+  return response;
+}
+
+FlMethodResponse* list_directory(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING) {
     return FL_METHOD_RESPONSE(fl_method_error_response_new(
       "INVALID_ARGUMENT", "directoryPath must be a string", nullptr));
   }
 
   const gchar* directory_path = fl_value_get_string(directory_path_value);
 
-  // Check if directory exists
-  if (!g_file_test(directory_path, G_FILE_TEST_IS_DIR)) {
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  g_autoptr(GPtrArray) names =
+      file_operations_list_directory(io_backend_get_default(), directory_path,
+                                     g_cancellable_get_current(), &error);
+  trace_span_end(&filesystem_span);
+
+  if (!names) {
+    return directory_read_error_response(error);
+  }
+
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) file_list = fl_value_new_list();
+  for (guint i = 0; i < names->len; i++) {
+    fl_value_append_take(file_list,
+                         fl_value_new_string(static_cast<gchar*>(g_ptr_array_index(names, i))));
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(file_list));
+}
+
+// Reads the optional "maxDepth" argument; a missing value means no limit.
+static gboolean parse_max_depth(FlValue* args, gint* max_depth) {
+  *max_depth = -1;
+  FlValue* max_depth_value = fl_value_lookup_string(args, "maxDepth");
+  if (!max_depth_value || fl_value_get_type(max_depth_value) == FL_VALUE_TYPE_NULL) {
+    return TRUE;
+  }
+  if (fl_value_get_type(max_depth_value) != FL_VALUE_TYPE_INT ||
+      fl_value_get_int(max_depth_value) < 0) {
+    return FALSE;
+  }
+  *max_depth = static_cast<gint>(MIN(fl_value_get_int(max_depth_value), (int64_t)G_MAXINT));
+  return TRUE;
+}
+
+FlMethodResponse* find_files(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* root_value = fl_value_lookup_string(args, "root");
+  if (!root_value || fl_value_get_type(root_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "root must be a string", nullptr));
+  }
+
+  g_autofree const gchar** patterns = get_string_list(fl_value_lookup_string(args, "patterns"));
+  g_autofree const gchar** excludes = get_string_list(fl_value_lookup_string(args, "excludes"));
+  if (!patterns || !excludes) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "patterns and excludes must be lists of strings", nullptr));
+  }
+
+  gint max_depth;
+  if (!parse_max_depth(args, &max_depth)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "maxDepth must be a non-negative integer", nullptr));
+  }
+
+  FlValue* include_directories_value = fl_value_lookup_string(args, "includeDirectories");
+  gboolean include_directories = include_directories_value &&
+      fl_value_get_type(include_directories_value) == FL_VALUE_TYPE_BOOL &&
+      fl_value_get_bool(include_directories_value);
+
+  const gchar* root = fl_value_get_string(root_value);
+  if (!g_file_test(root, G_FILE_TEST_IS_DIR)) {
     g_autoptr(FlValue) result = fl_value_new_null();
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   }
 
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GlobSet* pattern_set = glob_set_new(patterns);
+  GlobSet* exclude_set = glob_set_new(excludes);
   GError* error = nullptr;
-  GDir* dir = g_dir_open(directory_path, 0, &error);
+  GPtrArray* matches = find_matching_files(root, pattern_set, exclude_set, max_depth,
+                                           include_directories, g_cancellable_get_current(),
+                                           &error);
+  glob_set_free(pattern_set);
+  glob_set_free(exclude_set);
+  trace_span_end(&filesystem_span);
 
-  if (!dir) {
+  if (!matches) {
     FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
       "DIR_READ_ERROR", error ? error->message : "Failed to read directory", nullptr));
     if (error) g_error_free(error);
     return response;
   }
 
-  g_autoptr(FlValue) details_list = fl_value_new_list();
-  const gchar* filename;
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (guint i = 0; i < matches->len; i++) {
+    fl_value_append_take(result, fl_value_new_string(
+        static_cast<const gchar*>(g_ptr_array_index(matches, i))));
+  }
+  g_ptr_array_unref(matches);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* search_content(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* root_value = fl_value_lookup_string(args, "root");
+  FlValue* query_value = fl_value_lookup_string(args, "query");
+  if (!root_value || fl_value_get_type(root_value) != FL_VALUE_TYPE_STRING ||
+      !query_value || fl_value_get_type(query_value) != FL_VALUE_TYPE_STRING ||
+      fl_value_get_string(query_value)[0] == '\0') {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "root and a non-empty query are required", nullptr));
+  }
+
+  g_autofree const gchar** patterns = get_string_list(fl_value_lookup_string(args, "patterns"));
+  g_autofree const gchar** excludes = get_string_list(fl_value_lookup_string(args, "excludes"));
+  if (!patterns || !excludes) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "patterns and excludes must be lists of strings", nullptr));
+  }
+
+  gint max_depth;
+  if (!parse_max_depth(args, &max_depth)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "maxDepth must be a non-negative integer", nullptr));
+  }
+
+  guint max_results = kDefaultMaxSearchResults;
+  FlValue* max_results_value = fl_value_lookup_string(args, "maxResults");
+  if (max_results_value && fl_value_get_type(max_results_value) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(max_results_value) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(max_results_value) < 0) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "maxResults must be a non-negative integer", nullptr));
+    }
+    max_results = static_cast<guint>(MIN(fl_value_get_int(max_results_value), (int64_t)G_MAXUINT));
+  }
+
+  const gchar* root = fl_value_get_string(root_value);
+  if (!g_file_test(root, G_FILE_TEST_IS_DIR)) {
+    g_autoptr(FlValue) result = fl_value_new_null();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GlobSet* pattern_set = glob_set_new(patterns);
+  GlobSet* exclude_set = glob_set_new(excludes);
+  GError* error = nullptr;
+  GPtrArray* matches = search_file_contents(root, fl_value_get_string(query_value),
+                                            pattern_set, exclude_set, max_depth,
+                                            max_results, g_cancellable_get_current(), &error);
+  glob_set_free(pattern_set);
+  glob_set_free(exclude_set);
+  trace_span_end(&filesystem_span);
+
+  if (!matches) {
+    FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "DIR_READ_ERROR", error ? error->message : "Failed to read directory", nullptr));
+    if (error) g_error_free(error);
+    return response;
+  }
+
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (guint i = 0; i < matches->len; i++) {
+    ContentMatch* match = static_cast<ContentMatch*>(g_ptr_array_index(matches, i));
+    FlValue* item = fl_value_new_map();
+    fl_value_set_string_take(item, "path", fl_value_new_string(match->path));
+    fl_value_set_string_take(item, "line", fl_value_new_int(match->line));
+    fl_value_set_string_take(item, "offset", fl_value_new_int(match->offset));
+    fl_value_set_string_take(item, "text", fl_value_new_string(match->text));
+    fl_value_append_take(result, item);
+  }
+  g_ptr_array_unref(matches);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Reads the root argument of the index methods, normalised so equivalent
+// spellings share an index, and where its index lives.
+static gboolean parse_index_location(FlValue* args, gchar** root, gchar** index_path) {
+  FlValue* root_value = fl_value_lookup_string(args, "root");
+  FlValue* index_path_value = fl_value_lookup_string(args, "indexPath");
+  if (!root_value || fl_value_get_type(root_value) != FL_VALUE_TYPE_STRING ||
+      (index_path_value && fl_value_get_type(index_path_value) != FL_VALUE_TYPE_NULL &&
+       fl_value_get_type(index_path_value) != FL_VALUE_TYPE_STRING)) {
+    return FALSE;
+  }
+
+  *root = g_canonicalize_filename(fl_value_get_string(root_value), nullptr);
+  *index_path = index_path_value && fl_value_get_type(index_path_value) == FL_VALUE_TYPE_STRING
+      ? g_strdup(fl_value_get_string(index_path_value))
+      : file_index_default_path(*root);
+  return TRUE;
+}
+
+FlMethodResponse* index_directory(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  g_autofree gchar* root = nullptr;
+  g_autofree gchar* index_path = nullptr;
+  if (!parse_index_location(args, &root, &index_path)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "root must be a string", nullptr));
+  }
+
+  if (!g_file_test(root, G_FILE_TEST_IS_DIR)) {
+    g_autoptr(FlValue) result = fl_value_new_null();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  FileIndexStats stats = {};
+  GError* error = nullptr;
+  if (!file_index_build(root, index_path, &stats, g_cancellable_get_current(), &error)) {
+    FlMethodResponse* response = write_error_response(nullptr, error, "Failed to write index");
+    g_error_free(error);
+    return response;
+  }
+
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "indexPath", fl_value_new_string(index_path));
+  fl_value_set_string_take(result, "entries", fl_value_new_int(stats.entries));
+  fl_value_set_string_take(result, "directories", fl_value_new_int(stats.directories));
+  fl_value_set_string_take(result, "reusedDirectories", fl_value_new_int(stats.reused_directories));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* query_index(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  g_autofree gchar* root = nullptr;
+  g_autofree gchar* index_path = nullptr;
+  FlValue* query_value = fl_value_lookup_string(args, "query");
+  if (!parse_index_location(args, &root, &index_path) ||
+      !query_value || fl_value_get_type(query_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "root and query must be strings", nullptr));
+  }
+
+  FlValue* substring_value = fl_value_lookup_string(args, "substring");
+  FileIndexMatch mode = substring_value &&
+      fl_value_get_type(substring_value) == FL_VALUE_TYPE_BOOL &&
+      fl_value_get_bool(substring_value) ? FILE_INDEX_MATCH_SUBSTRING : FILE_INDEX_MATCH_PREFIX;
+
+  guint limit = kDefaultIndexQueryLimit;
+  FlValue* limit_value = fl_value_lookup_string(args, "limit");
+  if (limit_value && fl_value_get_type(limit_value) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(limit_value) != FL_VALUE_TYPE_INT || fl_value_get_int(limit_value) < 0) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "limit must be a non-negative integer", nullptr));
+    }
+    limit = static_cast<guint>(MIN(fl_value_get_int(limit_value), (int64_t)G_MAXUINT));
+  }
+
+  // No index yet, or one left over from a different root, reads as null so
+  // callers know to run indexDirectory first.
+  FileIndex* index = file_index_open(index_path, nullptr);
+  if (!index || strcmp(file_index_get_root(index), root) != 0) {
+    g_clear_pointer(&index, file_index_close);
+    g_autoptr(FlValue) result = fl_value_new_null();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  GArray* matches = g_array_new(FALSE, FALSE, sizeof(guint));
+  file_index_lookup(index, fl_value_get_string(query_value), mode, limit, matches);
 
-  while ((filename = g_dir_read_name(dir)) != nullptr) {
-    g_autofree gchar* full_path = g_build_filename(directory_path, filename, nullptr);
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (guint i = 0; i < matches->len; i++) {
+    FileIndexEntry entry;
+    file_index_get_entry(index, g_array_index(matches, guint, i), &entry);
+    g_autofree gchar* path = g_build_filename(root, entry.relative_path, nullptr);
+    FlValue* item = fl_value_new_map();
+    fl_value_set_string_take(item, "name", fl_value_new_string(entry.name));
+    fl_value_set_string_take(item, "path", fl_value_new_string(path));
+    fl_value_set_string_take(item, "isDirectory", fl_value_new_bool(entry.is_directory));
+    fl_value_set_string_take(item, "size", fl_value_new_int(entry.size));
+    fl_value_set_string_take(item, "lastModified", fl_value_new_int(entry.mtime_ns / 1000000));
+    fl_value_append_take(result, item);
+  }
+  g_array_unref(matches);
+  file_index_close(index);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* read_file(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* file_path_value = fl_value_lookup_string(args, "filePath");
+  if (!file_path_value || fl_value_get_type(file_path_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "filePath must be a string", nullptr));
+  }
+
+  const gchar* file_path = fl_value_get_string(file_path_value);
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  g_autofree gchar* content = nullptr;
+  gsize length = 0;
+  gboolean read = file_operations_read_file(io_backend_get_default(), file_path, &content,
+                                            &length, g_cancellable_get_current(), &error);
+  trace_span_end(&filesystem_span);
+
+  if (!read && error) {
+    FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "FILE_READ_ERROR", error->message, nullptr));
+    g_error_free(error);
+    return response;
+  }
+
+  // A missing file reads as null.
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) result = read ? fl_value_new_string(content) : fl_value_new_null();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Prefetches or evicts each of the "paths" in args, stopping early if the
+// call is cancelled, and responds with the number of files it succeeded on.
+// Files that cannot be opened are skipped, since either is only a hint.
+static FlMethodResponse* advise_files(FlValue* args, gboolean prefetch) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  g_autofree const gchar** paths = get_string_list(fl_value_lookup_string(args, "paths"));
+  if (!paths) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "paths must be a list of strings", nullptr));
+  }
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GCancellable* cancellable = g_cancellable_get_current();
+  gint64 n_advised = 0;
+  for (const gchar** path = paths; *path && !g_cancellable_is_cancelled(cancellable); path++) {
+    gboolean advised = prefetch ? page_cache_prefetch(*path, cancellable, nullptr)
+                                : page_cache_evict(*path, nullptr);
+    if (advised) {
+      n_advised++;
+    }
+  }
+  trace_span_end(&filesystem_span);
+
+  g_autoptr(FlValue) result = fl_value_new_int(n_advised);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* prefetch_files(FlValue* args) {
+  return advise_files(args, TRUE);
+}
+
+FlMethodResponse* evict_files(FlValue* args) {
+  return advise_files(args, FALSE);
+}
+
+FlMethodResponse* get_media_metadata(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  g_autofree const gchar** paths = get_string_list(fl_value_lookup_string(args, "paths"));
+  if (!paths) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "paths must be a list of strings", nullptr));
+  }
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  guint n_paths = g_strv_length(const_cast<gchar**>(paths));
+  g_autoptr(GPtrArray) all_metadata =
+      media_metadata_read_all(paths, n_paths, g_cancellable_get_current(), &error);
+  trace_span_end(&filesystem_span);
+
+  if (!all_metadata) {
+    FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "FILE_READ_ERROR", error ? error->message : "Failed to read files", nullptr));
+    if (error) g_error_free(error);
+    return response;
+  }
+
+  // Files that could not be opened, or are not images, are left out; fields
+  // a file does not record are null.
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) result = fl_value_new_map();
+  for (guint i = 0; i < n_paths; i++) {
+    MediaMetadata* metadata = static_cast<MediaMetadata*>(g_ptr_array_index(all_metadata, i));
+    if (!metadata || metadata->format == MEDIA_FORMAT_UNKNOWN) {
+      continue;
+    }
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "format",
+                             fl_value_new_string(media_format_to_string(metadata->format)));
+    fl_value_set_string_take(entry, "width", metadata->width
+                             ? fl_value_new_int(metadata->width) : fl_value_new_null());
+    fl_value_set_string_take(entry, "height", metadata->height
+                             ? fl_value_new_int(metadata->height) : fl_value_new_null());
+    fl_value_set_string_take(entry, "orientation", metadata->orientation
+                             ? fl_value_new_int(metadata->orientation) : fl_value_new_null());
+    fl_value_set_string_take(entry, "captureTime", metadata->capture_time
+                             ? fl_value_new_string(metadata->capture_time) : fl_value_new_null());
+    fl_value_set_string_take(result, paths[i], entry);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static FlValue* tree_node_to_value(const TreeNode* node, gboolean aggregate_sizes) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "name", fl_value_new_string(node->name));
+  fl_value_set_string_take(value, "path", fl_value_new_string(node->path));
+  fl_value_set_string_take(value, "isDirectory", fl_value_new_bool(node->is_directory));
+  fl_value_set_string_take(value, "size", !node->is_directory || aggregate_sizes
+                               ? fl_value_new_int(static_cast<int64_t>(node->size))
+                               : fl_value_new_null());
+  if (node->is_directory) {
+    g_autofree gchar* handle = directory_tree_get_handle(node);
+    fl_value_set_string_take(value, "childCount",
+                             fl_value_new_int(static_cast<int64_t>(node->child_count)));
+    fl_value_set_string_take(value, "handle", fl_value_new_string(handle));
+  } else {
+    fl_value_set_string_take(value, "childCount", fl_value_new_null());
+    fl_value_set_string_take(value, "handle", fl_value_new_null());
+  }
+
+  if (node->children) {
+    FlValue* children = fl_value_new_list();
+    for (guint i = 0; i < node->children->len; i++) {
+      const TreeNode* child = static_cast<const TreeNode*>(g_ptr_array_index(node->children, i));
+      fl_value_append_take(children, tree_node_to_value(child, aggregate_sizes));
+    }
+    fl_value_set_string_take(value, "children", children);
+  } else {
+    fl_value_set_string_take(value, "children", fl_value_new_null());
+  }
+  return value;
+}
+
+// Reads the tree under directory_path for getTreeNodes and expandTreeNode,
+// taking the depth and aggregateSizes arguments from args.
+static FlMethodResponse* read_tree_nodes(const gchar* directory_path, FlValue* args,
+                                         TraceSpan* validate_span) {
+  gint64 depth = 1;
+  FlValue* depth_value = fl_value_lookup_string(args, "depth");
+  if (depth_value && fl_value_get_type(depth_value) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(depth_value) != FL_VALUE_TYPE_INT || fl_value_get_int(depth_value) < 0) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "depth must be a non-negative integer", nullptr));
+    }
+    depth = MIN(fl_value_get_int(depth_value), (int64_t)G_MAXINT);
+  }
+  gboolean aggregate_sizes = wants_aggregate_sizes(args);
+
+  if (!g_file_test(directory_path, G_FILE_TEST_IS_DIR)) {
+    g_autoptr(FlValue) result = fl_value_new_null();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  trace_span_end(validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  TreeNode* root = directory_tree_read(directory_path, static_cast<guint>(depth), aggregate_sizes,
+                                       g_cancellable_get_current(), &error);
+  trace_span_end(&filesystem_span);
+
+  if (!root) {
+    return directory_read_error_response(error);
+  }
+
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) result = tree_node_to_value(root, aggregate_sizes);
+  tree_node_free(root);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* get_tree_nodes(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "directoryPath must be a string", nullptr));
+  }
+
+  return read_tree_nodes(fl_value_get_string(directory_path_value), args, &validate_span);
+}
+
+FlMethodResponse* expand_tree_node(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* handle_value = fl_value_lookup_string(args, "handle");
+  if (!handle_value || fl_value_get_type(handle_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "handle must be a string", nullptr));
+  }
+
+  // A handle whose directory is gone or was replaced expands to nothing.
+  g_autofree gchar* directory_path = directory_tree_resolve_handle(fl_value_get_string(handle_value));
+  if (!directory_path) {
+    g_autoptr(FlValue) result = fl_value_new_null();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
 
-    struct stat st;
-    if (stat(full_path, &st) == 0) {
-      g_autoptr(FlValue) item = fl_value_new_map();
+  return read_tree_nodes(directory_path, args, &validate_span);
+}
+
+// Reads an optional integer argument into value, leaving it as is when the
+// argument is absent or null. Returns FALSE if it is not an integer.
+static gboolean parse_optional_int(FlValue* args, const gchar* key, gint64* value) {
+  FlValue* int_value = fl_value_lookup_string(args, key);
+  if (!int_value || fl_value_get_type(int_value) == FL_VALUE_TYPE_NULL) {
+    return TRUE;
+  }
+  if (fl_value_get_type(int_value) != FL_VALUE_TYPE_INT) {
+    return FALSE;
+  }
+  *value = fl_value_get_int(int_value);
+  return TRUE;
+}
 
-      fl_value_set_string_take(item, "name", fl_value_new_string(filename));
-      fl_value_set_string_take(item, "path", fl_value_new_string(full_path));
-      fl_value_set_string_take(item, "isDirectory", fl_value_new_bool(S_ISDIR(st.st_mode)));
-      fl_value_set_string_take(item, "size", fl_value_new_int(st.st_size));
-      fl_value_set_string_take(item, "lastModified", fl_value_new_int(st.st_mtime * 1000)); // Convert to milliseconds
+// Fills query from the sort, filter and limit arguments of a
+// getDirectoryDetails call, other than extensions. Returns an error
+// response, or nullptr if the arguments are valid.
+static FlMethodResponse* parse_details_query(FlValue* args, DetailsQuery* query) {
+  details_query_init(query);
 
-      fl_value_append(details_list, item);
+  FlValue* sort_by_value = fl_value_lookup_string(args, "sortBy");
+  if (sort_by_value && fl_value_get_type(sort_by_value) != FL_VALUE_TYPE_NULL) {
+    const gchar* sort_by = fl_value_get_type(sort_by_value) == FL_VALUE_TYPE_STRING
+        ? fl_value_get_string(sort_by_value) : "";
+    if (strcmp(sort_by, "name") == 0) {
+      query->sort_by = DETAILS_SORT_NAME;
+    } else if (strcmp(sort_by, "naturalName") == 0) {
+      query->sort_by = DETAILS_SORT_NATURAL_NAME;
+    } else if (strcmp(sort_by, "size") == 0) {
+      query->sort_by = DETAILS_SORT_SIZE;
+    } else if (strcmp(sort_by, "lastModified") == 0) {
+      query->sort_by = DETAILS_SORT_MODIFIED;
+    } else {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "sortBy must be one of name, naturalName, size or lastModified", nullptr));
     }
   }
+  FlValue* descending_value = fl_value_lookup_string(args, "descending");
+  query->descending = descending_value &&
+      fl_value_get_type(descending_value) == FL_VALUE_TYPE_BOOL &&
+      fl_value_get_bool(descending_value);
 
-  g_dir_close(dir);
+  FlValue* entry_type_value = fl_value_lookup_string(args, "entryType");
+  if (entry_type_value && fl_value_get_type(entry_type_value) != FL_VALUE_TYPE_NULL) {
+    const gchar* entry_type = fl_value_get_type(entry_type_value) == FL_VALUE_TYPE_STRING
+        ? fl_value_get_string(entry_type_value) : "";
+    if (strcmp(entry_type, "file") == 0) {
+      query->entry_type = DETAILS_TYPE_FILE;
+    } else if (strcmp(entry_type, "directory") == 0) {
+      query->entry_type = DETAILS_TYPE_DIRECTORY;
+    } else {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "INVALID_ARGUMENT", "entryType must be file or directory", nullptr));
+    }
+  }
+
+  gint64 limit = 0;
+  if (!parse_optional_int(args, "minSize", &query->min_size) ||
+      !parse_optional_int(args, "maxSize", &query->max_size) ||
+      !parse_optional_int(args, "modifiedAfter", &query->min_modified_ms) ||
+      !parse_optional_int(args, "modifiedBefore", &query->max_modified_ms) ||
+      !parse_optional_int(args, "limit", &limit) || limit < 0) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT",
+      "minSize, maxSize, modifiedAfter and modifiedBefore must be integers, "
+      "and limit a non-negative integer", nullptr));
+  }
+  query->limit = static_cast<guint>(MIN(limit, (int64_t)G_MAXUINT));
+  return nullptr;
+}
+
+FlMethodResponse* get_directory_details(FlValue* args) {
+  g_auto(TraceSpan) validate_span = trace_span_begin("validate");
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* directory_path_value = fl_value_lookup_string(args, "directoryPath");
+  if (!directory_path_value || fl_value_get_type(directory_path_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "directoryPath must be a string", nullptr));
+  }
+
+  const gchar* directory_path = fl_value_get_string(directory_path_value);
+
+  DetailsQuery query;
+  FlMethodResponse* query_error = parse_details_query(args, &query);
+  if (query_error) {
+    return query_error;
+  }
+  g_autofree const gchar** extensions =
+      get_string_list(fl_value_lookup_string(args, "extensions"));
+  if (!extensions) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "extensions must be a list of strings", nullptr));
+  }
+  query.extensions = extensions;
+
+  FlValue* sort_keys_value = fl_value_lookup_string(args, "sortKeys");
+  gboolean sort_keys = sort_keys_value && fl_value_get_type(sort_keys_value) == FL_VALUE_TYPE_BOOL &&
+                       fl_value_get_bool(sort_keys_value);
+
+  trace_span_end(&validate_span);
+  g_auto(TraceSpan) filesystem_span = trace_span_begin("filesystem");
+  GError* error = nullptr;
+  g_autoptr(GArray) entries =
+      file_operations_get_details(io_backend_get_default(), directory_path,
+                                  g_cancellable_get_current(), &error);
+  trace_span_end(&filesystem_span);
+
+  if (!entries) {
+    return directory_read_error_response(error);
+  }
+
+  // Only what the caller will show is encoded and sent back.
+  g_auto(TraceSpan) query_span = trace_span_begin("sort");
+  // The whole listing is ranked, so the snapshot cached for the directory
+  // serves any later filter.
+  if (sort_keys || query.sort_by == DETAILS_SORT_NATURAL_NAME) {
+    collation_cache_rank_details(directory_path, entries);
+  }
+  details_query_apply(&query, entries);
+  trace_span_end(&query_span);
+
+  g_auto(TraceSpan) build_span = trace_span_begin("build result");
+  g_autoptr(FlValue) details_list = fl_value_new_list();
+  for (guint i = 0; i < entries->len; i++) {
+    const FileDetails* details = &g_array_index(entries, FileDetails, i);
+    g_autoptr(FlValue) item = fl_value_new_map();
+    fl_value_set_string_take(item, "name", fl_value_new_string(details->name));
+    fl_value_set_string_take(item, "path", fl_value_new_string(details->path));
+    fl_value_set_string_take(item, "isDirectory", fl_value_new_bool(details->info.is_directory));
+    fl_value_set_string_take(item, "size", fl_value_new_int(details->info.size));
+    fl_value_set_string_take(item, "lastModified", fl_value_new_int(details->info.modified_ms));
+    if (sort_keys) {
+      fl_value_set_string_take(item, "sortKey", fl_value_new_int(details->name_rank));
+    }
+    fl_value_append(details_list, item);
+  }
   return FL_METHOD_RESPONSE(fl_method_success_response_new(details_list));
 }
 
+FlMethodResponse* get_filesystem_capabilities(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* path_value = fl_value_lookup_string(args, "path");
+  if (!path_value || fl_value_get_type(path_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "path must be a string", nullptr));
+  }
+
+  const gchar* path = fl_value_get_string(path_value);
+  FsCapabilities capabilities;
+  struct statvfs fs;
+  if (!fs_capabilities_get(path, &capabilities, nullptr) || statvfs(path, &fs) != 0) {
+    g_autoptr(FlValue) result = fl_value_new_null();
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  // Space changes all the time, so unlike the rest it is read on every call.
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "fileSystem", fl_value_new_string(capabilities.type_name));
+  fl_value_set_string_take(result, "isNetwork", fl_value_new_bool(capabilities.is_network));
+  fl_value_set_string_take(result, "isFuse", fl_value_new_bool(capabilities.is_fuse));
+  fl_value_set_string_take(result, "supportsTmpfile",
+                           fl_value_new_bool(capabilities.supports_tmpfile));
+  fl_value_set_string_take(result, "supportsReflink",
+                           fl_value_new_bool(capabilities.supports_reflink));
+  fl_value_set_string_take(result, "supportsCopyFileRange",
+                           fl_value_new_bool(capabilities.supports_copy_file_range));
+  fl_value_set_string_take(result, "supportsFallocate",
+                           fl_value_new_bool(capabilities.supports_fallocate));
+  fl_value_set_string_take(result, "supportsIoUring",
+                           fl_value_new_bool(capabilities.supports_io_uring));
+  fl_value_set_string_take(result, "freeBytes",
+                           fl_value_new_int(static_cast<int64_t>(fs.f_bavail) * fs.f_frsize));
+  fl_value_set_string_take(result, "totalBytes",
+                           fl_value_new_int(static_cast<int64_t>(fs.f_blocks) * fs.f_frsize));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+GBytes* get_coalescing_key(const gchar* method, FlValue* args) {
+  static const gchar* const kCoalescedMethods[] = {
+    "listDirectory", "getDirectoryDetails", "readFile",
+  };
+  // Calls made with a requestId can be cancelled and report progress on
+  // their own, so they always run by themselves.
+  if (get_request_id(args)) {
+    return nullptr;
+  }
+  for (const gchar* coalesced_method : kCoalescedMethods) {
+    if (strcmp(method, coalesced_method) == 0) {
+      // The encoded call, which unlike its string form cannot be the same for
+      // different arguments.
+      g_autoptr(FlValue) call = fl_value_new_list();
+      fl_value_append_take(call, fl_value_new_string(method));
+      fl_value_append(call, args);
+      g_autoptr(FlStandardMessageCodec) codec = fl_standard_message_codec_new();
+      return fl_message_codec_encode_message(FL_MESSAGE_CODEC(codec), call, nullptr);
+    }
+  }
+  return nullptr;
+}
+
+FlMethodResponse* cancel_call(GHashTable* pending_calls, FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+  const gchar* request_id = get_request_id(args);
+  if (!request_id) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "requestId must be a string", nullptr));
+  }
+
+  // The call stays registered until it responds, which it does promptly with
+  // a CANCELLED error unless it was about to succeed anyway.
+  GCancellable* cancellable =
+      static_cast<GCancellable*>(g_hash_table_lookup(pending_calls, request_id));
+  if (cancellable) {
+    g_cancellable_cancel(cancellable);
+  }
+  g_autoptr(FlValue) result = fl_value_new_bool(cancellable != nullptr);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* get_stats() {
+  g_autoptr(GArray) snapshots = method_stats_snapshot();
+  g_autoptr(FlValue) result = fl_value_new_map();
+  for (guint i = 0; i < snapshots->len; i++) {
+    const MethodStatsSnapshot* snapshot = &g_array_index(snapshots, MethodStatsSnapshot, i);
+    g_autoptr(FlValue) method = fl_value_new_map();
+    fl_value_set_string_take(method, "calls", fl_value_new_int(snapshot->calls));
+    fl_value_set_string_take(method, "errors", fl_value_new_int(snapshot->errors));
+    fl_value_set_string_take(method, "p50Us", fl_value_new_int(snapshot->p50_us));
+    fl_value_set_string_take(method, "p95Us", fl_value_new_int(snapshot->p95_us));
+    fl_value_set_string_take(method, "p99Us", fl_value_new_int(snapshot->p99_us));
+    fl_value_set_string_take(method, "maxUs", fl_value_new_int(snapshot->max_us));
+    fl_value_set_string_take(method, "bytesRead", fl_value_new_int(snapshot->bytes_read));
+    fl_value_set_string_take(method, "bytesWritten", fl_value_new_int(snapshot->bytes_written));
+    fl_value_set_string_take(method, "entries", fl_value_new_int(snapshot->entries));
+    fl_value_set_string(result, snapshot->method, method);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* reset_stats() {
+  method_stats_reset();
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* start_tracing(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "Arguments must be a map", nullptr));
+  }
+
+  FlValue* path_value = fl_value_lookup_string(args, "path");
+  if (!path_value || fl_value_get_type(path_value) != FL_VALUE_TYPE_STRING) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENT", "path must be a string", nullptr));
+  }
+
+  GError* error = nullptr;
+  if (!trace_start(fl_value_get_string(path_value), &error)) {
+    FlMethodResponse* response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "FILE_WRITE_ERROR", error->message, nullptr));
+    g_error_free(error);
+    return response;
+  }
+
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* stop_tracing() {
+  trace_stop();
+  g_autoptr(FlValue) result = fl_value_new_bool(TRUE);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
 static void ente_directory_picker_plugin_dispose(GObject* object) {
+  EnteDirectoryPickerPlugin* self = ENTE_DIRECTORY_PICKER_PLUGIN(object);
+
+  // Drain queued writes so shutting down never loses data.
+  g_clear_pointer(&self->write_queue, write_behind_queue_free);
+  g_clear_pointer(&self->append_cache, append_file_cache_free);
+  g_clear_pointer(&self->portal_chooser, portal_file_chooser_free);
+  // No call is still running, as each holds a reference to the plugin.
+  g_clear_pointer(&self->scheduler, task_scheduler_free);
+  g_clear_pointer(&self->append_scheduler, task_scheduler_free);
+  g_clear_pointer(&self->write_scheduler, task_scheduler_free);
+  g_clear_pointer(&self->write_queue_scheduler, task_scheduler_free);
+  g_clear_pointer(&self->coalesced_calls, g_hash_table_unref);
+  g_clear_pointer(&self->pending_calls, g_hash_table_unref);
+  g_clear_object(&self->progress_channel);
+  // Leave a complete trace file behind.
+  trace_stop();
+
   G_OBJECT_CLASS(ente_directory_picker_plugin_parent_class)->dispose(object);
 }
 
@@ -417,7 +2048,30 @@ static void ente_directory_picker_plugin_class_init(EnteDirectoryPickerPluginCla
   G_OBJECT_CLASS(klass)->dispose = ente_directory_picker_plugin_dispose;
 }
 
-static void ente_directory_picker_plugin_init(EnteDirectoryPickerPlugin* self) {}
+static void ente_directory_picker_plugin_init(EnteDirectoryPickerPlugin* self) {
+  self->write_queue = write_behind_queue_new(kWriteBehindMaxPendingBytes);
+  self->append_cache = append_file_cache_new(kMaxAppendFiles);
+  self->portal_chooser = portal_file_chooser_new();
+  self->scheduler = task_scheduler_new(kMaxWorkerCalls, kMaxBulkCalls);
+  self->append_scheduler = task_scheduler_new(1, 0);
+  self->write_scheduler = task_scheduler_new(1, 0);
+  self->write_queue_scheduler = task_scheduler_new(1, 0);
+  self->coalesced_calls = g_hash_table_new_full(
+      g_bytes_hash, g_bytes_equal, reinterpret_cast<GDestroyNotify>(g_bytes_unref), nullptr);
+  self->pending_calls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+}
+
+static FlMethodErrorResponse* progress_listen_cb(FlEventChannel* channel, FlValue* args,
+                                                 gpointer user_data) {
+  ENTE_DIRECTORY_PICKER_PLUGIN(user_data)->progress_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* progress_cancel_cb(FlEventChannel* channel, FlValue* args,
+                                                 gpointer user_data) {
+  ENTE_DIRECTORY_PICKER_PLUGIN(user_data)->progress_listening = FALSE;
+  return nullptr;
+}
 
 static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
                            gpointer user_data) {
@@ -426,6 +2080,14 @@ static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
 }
 
 void ente_directory_picker_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
+  const gchar* trace_path = g_getenv(kTraceEnvironmentVariable);
+  if (trace_path && *trace_path) {
+    g_autoptr(GError) error = nullptr;
+    if (!trace_start(trace_path, &error)) {
+      g_warning("%s", error->message);
+    }
+  }
+
   EnteDirectoryPickerPlugin* plugin = ENTE_DIRECTORY_PICKER_PLUGIN(
       g_object_new(ente_directory_picker_plugin_get_type(), nullptr));
 
@@ -438,5 +2100,14 @@ void ente_directory_picker_plugin_register_with_registrar(FlPluginRegistrar* reg
                                             g_object_ref(plugin),
                                             g_object_unref);
 
+  // The plugin owns the event channel, so the handlers do not hold a
+  // reference to it.
+  plugin->progress_channel =
+      fl_event_channel_new(fl_plugin_registrar_get_messenger(registrar),
+                           "ente_directory_picker/progress",
+                           FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->progress_channel, progress_listen_cb,
+                                       progress_cancel_cb, plugin, nullptr);
+
   g_object_unref(plugin);
 }
@@ -1,6 +1,9 @@
 #include <flutter_linux/flutter_linux.h>
 
 #include "include/ente_directory_picker/ente_directory_picker_plugin.h"
+#include "append_file_cache.h"
+#include "portal_file_chooser.h"
+#include "write_behind_queue.h"
 
 // This file exposes some plugin internals for unit testing. See
 // https://github.com/flutter/flutter/issues/88724 for current limitations
@@ -9,23 +12,102 @@
 // Handles the getPlatformVersion method call.
 FlMethodResponse *get_platform_version();
 
-// Handles the selectDirectory method call.
-FlMethodResponse *select_directory();
+// Handles the selectDirectory method call, responding to method_call once the
+// user has chosen. Uses the file chooser portal when it is available and
+// GTK's chooser otherwise.
+void select_directory(PortalFileChooser* portal_chooser, FlMethodCall* method_call);
 
 // Handles the hasPermission method call.
 FlMethodResponse *has_permission(FlValue* args);
 
+// Handles the hasPermissions method call.
+FlMethodResponse *has_permissions(FlValue* args);
+
 // Handles the requestPermission method call.
 FlMethodResponse *request_permission(FlValue* args);
 
 // Handles the writeFile method call.
 FlMethodResponse *write_file(FlValue* args);
 
+// Handles a writeFile method call with writeBehind set by queueing the write.
+FlMethodResponse *write_file_behind(WriteBehindQueue* queue, FlValue* args);
+
+// Handles the flush method call. Blocks until the queue has caught up, so it
+// is run on a worker thread.
+FlMethodResponse *flush_writes(WriteBehindQueue* queue);
+
+// Handles the writeFiles method call.
+FlMethodResponse *write_files(FlValue* args);
+
+// Handles the appendToFile method call.
+FlMethodResponse *append_to_file(AppendFileCache* cache, FlValue* args);
+
+// Handles the appendRecords method call.
+FlMethodResponse *append_records(AppendFileCache* cache, FlValue* args);
+
+// Handles the copyFile method call.
+FlMethodResponse *copy_file(FlValue* args);
+
+// Handles the exportFiles method call.
+FlMethodResponse *export_files(FlValue* args);
+
 // Handles the listDirectory method call.
 FlMethodResponse *list_directory(FlValue* args);
 
+// Handles the findFiles method call.
+FlMethodResponse *find_files(FlValue* args);
+
+// Handles the searchContent method call.
+FlMethodResponse *search_content(FlValue* args);
+
+// Handles the indexDirectory method call.
+FlMethodResponse *index_directory(FlValue* args);
+
+// Handles the queryIndex method call.
+FlMethodResponse *query_index(FlValue* args);
+
 // Handles the readFile method call.
 FlMethodResponse *read_file(FlValue* args);
 
+// Handles the prefetchFiles method call.
+FlMethodResponse *prefetch_files(FlValue* args);
+
+// Handles the evictFiles method call.
+FlMethodResponse *evict_files(FlValue* args);
+
+// Handles the getMediaMetadata method call.
+FlMethodResponse *get_media_metadata(FlValue* args);
+
 // Handles the getDirectoryDetails method call.
 FlMethodResponse *get_directory_details(FlValue* args);
+
+// Handles the getTreeNodes method call.
+FlMethodResponse *get_tree_nodes(FlValue* args);
+
+// Handles the expandTreeNode method call.
+FlMethodResponse *expand_tree_node(FlValue* args);
+
+// Handles the getFilesystemCapabilities method call.
+FlMethodResponse *get_filesystem_capabilities(FlValue* args);
+
+// Returns the key under which a call shares the work of an identical call
+// that is still running, or NULL if it always runs by itself. Only
+// listDirectory, getDirectoryDetails and readFile calls made without a
+// requestId are shared. Free the key with g_bytes_unref().
+GBytes* get_coalescing_key(const gchar* method, FlValue* args);
+
+// Handles the cancel method call by cancelling the running call registered
+// under its requestId in pending_calls, a table of GCancellables.
+FlMethodResponse *cancel_call(GHashTable* pending_calls, FlValue* args);
+
+// Handles the getStats method call.
+FlMethodResponse *get_stats();
+
+// Handles the resetStats method call.
+FlMethodResponse *reset_stats();
+
+// Handles the startTracing method call.
+FlMethodResponse *start_tracing(FlValue* args);
+
+// Handles the stopTracing method call.
+FlMethodResponse *stop_tracing();
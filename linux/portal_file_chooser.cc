@@ -0,0 +1,268 @@
+#include "portal_file_chooser.h"
+
+#include <string.h>
+
+static const gchar kPortalBusName[] = "org.freedesktop.portal.Desktop";
+static const gchar kPortalObjectPath[] = "/org/freedesktop/portal/desktop";
+static const gchar kFileChooserInterface[] = "org.freedesktop.portal.FileChooser";
+static const gchar kRequestInterface[] = "org.freedesktop.portal.Request";
+
+// OpenFile gained the "directory" option in version 3 of the interface.
+static const guint32 kMinimumPortalVersion = 3;
+
+// Response codes of org.freedesktop.portal.Request.Response.
+static const guint32 kResponseSuccess = 0;
+static const guint32 kResponseCancelled = 1;
+
+typedef enum {
+  PORTAL_PROBING,
+  PORTAL_AVAILABLE,
+  PORTAL_UNAVAILABLE,
+} PortalState;
+
+struct _PortalFileChooser {
+  PortalState state;
+  GDBusConnection* connection;
+  // Cancelled when the chooser is freed, so probe callbacks that arrive
+  // afterwards know not to touch it.
+  GCancellable* cancellable;
+  // Tasks waiting for the probe to finish.
+  GQueue pending;
+  guint request_count;
+};
+
+typedef struct {
+  GDBusConnection* connection;
+  gchar* parent_window;
+  gchar* title;
+  gchar* request_path;
+  guint response_subscription;
+} OpenFileRequest;
+
+static void open_file_request_free(gpointer data) {
+  OpenFileRequest* request = static_cast<OpenFileRequest*>(data);
+  g_clear_object(&request->connection);
+  g_free(request->parent_window);
+  g_free(request->title);
+  g_free(request->request_path);
+  g_free(request);
+}
+
+// The subscription holds a reference to the task, so it must be dropped
+// before the task can complete and be freed.
+static void open_file_request_unsubscribe(OpenFileRequest* request) {
+  if (request->response_subscription) {
+    g_dbus_connection_signal_unsubscribe(request->connection, request->response_subscription);
+    request->response_subscription = 0;
+  }
+}
+
+static void on_response(GDBusConnection* connection,
+                        const gchar* sender_name,
+                        const gchar* object_path,
+                        const gchar* interface_name,
+                        const gchar* signal_name,
+                        GVariant* parameters,
+                        gpointer user_data) {
+  GTask* task = G_TASK(user_data);
+  OpenFileRequest* request = static_cast<OpenFileRequest*>(g_task_get_task_data(task));
+  if (!request->response_subscription ||
+      !g_variant_is_of_type(parameters, G_VARIANT_TYPE("(ua{sv})"))) {
+    return;
+  }
+
+  guint32 response;
+  g_autoptr(GVariant) results = nullptr;
+  g_variant_get(parameters, "(u@a{sv})", &response, &results);
+
+  // Keep the task alive past the unsubscribe, which drops the subscription's
+  // reference.
+  g_object_ref(task);
+  open_file_request_unsubscribe(request);
+
+  const gchar** uris = nullptr;
+  if (response == kResponseCancelled) {
+    g_task_return_pointer(task, nullptr, nullptr);
+  } else if (response != kResponseSuccess) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            "The file chooser portal failed (response %u)", response);
+  } else if (!g_variant_lookup(results, "uris", "^a&s", &uris) || !uris[0]) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            "The file chooser portal returned no directory");
+  } else {
+    GError* error = nullptr;
+    gchar* path = g_filename_from_uri(uris[0], nullptr, &error);
+    if (path) {
+      g_task_return_pointer(task, path, g_free);
+    } else {
+      g_task_return_error(task, error);
+    }
+  }
+  g_free(uris);
+  g_object_unref(task);
+}
+
+static void subscribe_to_response(GTask* task, const gchar* request_path) {
+  OpenFileRequest* request = static_cast<OpenFileRequest*>(g_task_get_task_data(task));
+  open_file_request_unsubscribe(request);
+  g_free(request->request_path);
+  request->request_path = g_strdup(request_path);
+  request->response_subscription = g_dbus_connection_signal_subscribe(
+      request->connection, kPortalBusName, kRequestInterface, "Response", request_path,
+      nullptr, G_DBUS_SIGNAL_FLAGS_NONE, on_response, g_object_ref(task), g_object_unref);
+}
+
+static void on_open_file_ready(GObject* source, GAsyncResult* result, gpointer user_data) {
+  GTask* task = G_TASK(user_data);
+  OpenFileRequest* request = static_cast<OpenFileRequest*>(g_task_get_task_data(task));
+
+  GError* error = nullptr;
+  g_autoptr(GVariant) reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+  if (!reply) {
+    open_file_request_unsubscribe(request);
+    g_task_return_error(task, error);
+    g_object_unref(task);
+    return;
+  }
+
+  // Portals older than version 0.9 ignore handle_token and pick their own
+  // request path; follow it. A response sent before this point is lost, as
+  // with every client of such portals.
+  const gchar* handle;
+  g_variant_get(reply, "(&o)", &handle);
+  if (request->response_subscription && strcmp(handle, request->request_path) != 0) {
+    subscribe_to_response(task, handle);
+  }
+  g_object_unref(task);
+}
+
+static void start_open_file(PortalFileChooser* chooser, GTask* task) {
+  OpenFileRequest* request = static_cast<OpenFileRequest*>(g_task_get_task_data(task));
+  request->connection = G_DBUS_CONNECTION(g_object_ref(chooser->connection));
+
+  // The portal derives the request object path from our unique name and the
+  // token, so subscribing before the call cannot miss the response.
+  g_autofree gchar* token = g_strdup_printf("ente_directory_picker_%u", ++chooser->request_count);
+  g_autofree gchar* sender = g_strdup(g_dbus_connection_get_unique_name(chooser->connection) + 1);
+  g_strdelimit(sender, ".", '_');
+  g_autofree gchar* request_path = g_strdup_printf(
+      "/org/freedesktop/portal/desktop/request/%s/%s", sender, token);
+  subscribe_to_response(task, request_path);
+
+  GVariantBuilder options;
+  g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(&options, "{sv}", "handle_token", g_variant_new_string(token));
+  g_variant_builder_add(&options, "{sv}", "directory", g_variant_new_boolean(TRUE));
+  g_variant_builder_add(&options, "{sv}", "modal", g_variant_new_boolean(TRUE));
+
+  g_dbus_connection_call(
+      chooser->connection, kPortalBusName, kPortalObjectPath, kFileChooserInterface, "OpenFile",
+      g_variant_new("(ssa{sv})", request->parent_window, request->title, &options),
+      G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr,
+      on_open_file_ready, g_object_ref(task));
+}
+
+// Starts or fails a task according to the probe result, consuming it.
+static void dispatch_task(PortalFileChooser* chooser, GTask* task) {
+  if (chooser->state == PORTAL_AVAILABLE) {
+    start_open_file(chooser, task);
+  } else {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                            "No file chooser portal supporting directories is available");
+  }
+  g_object_unref(task);
+}
+
+static void finish_probe(PortalFileChooser* chooser, PortalState state) {
+  chooser->state = state;
+  GTask* task;
+  while ((task = static_cast<GTask*>(g_queue_pop_head(&chooser->pending)))) {
+    dispatch_task(chooser, task);
+  }
+}
+
+static void on_version_ready(GObject* source, GAsyncResult* result, gpointer user_data) {
+  g_autoptr(GError) error = nullptr;
+  g_autoptr(GVariant) reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    return;
+  }
+
+  PortalFileChooser* chooser = static_cast<PortalFileChooser*>(user_data);
+  guint32 version = 0;
+  if (reply) {
+    g_autoptr(GVariant) value = nullptr;
+    g_variant_get(reply, "(v)", &value);
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32)) {
+      version = g_variant_get_uint32(value);
+    }
+  }
+  finish_probe(chooser, version >= kMinimumPortalVersion ? PORTAL_AVAILABLE : PORTAL_UNAVAILABLE);
+}
+
+static void on_bus_ready(GObject* source, GAsyncResult* result, gpointer user_data) {
+  g_autoptr(GError) error = nullptr;
+  GDBusConnection* connection = g_bus_get_finish(result, &error);
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    return;
+  }
+
+  PortalFileChooser* chooser = static_cast<PortalFileChooser*>(user_data);
+  if (!connection) {
+    finish_probe(chooser, PORTAL_UNAVAILABLE);
+    return;
+  }
+
+  // Reading the version both checks that the portal exists (starting it if
+  // it is activatable) and that it is new enough.
+  chooser->connection = connection;
+  g_dbus_connection_call(connection, kPortalBusName, kPortalObjectPath,
+                         "org.freedesktop.DBus.Properties", "Get",
+                         g_variant_new("(ss)", kFileChooserInterface, "version"),
+                         G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                         chooser->cancellable, on_version_ready, chooser);
+}
+
+PortalFileChooser* portal_file_chooser_new() {
+  PortalFileChooser* chooser = g_new0(PortalFileChooser, 1);
+  chooser->state = PORTAL_PROBING;
+  chooser->cancellable = g_cancellable_new();
+  g_queue_init(&chooser->pending);
+  g_bus_get(G_BUS_TYPE_SESSION, chooser->cancellable, on_bus_ready, chooser);
+  return chooser;
+}
+
+void portal_file_chooser_select_directory(PortalFileChooser* chooser,
+                                          const gchar* parent_window,
+                                          const gchar* title,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data) {
+  GTask* task = g_task_new(nullptr, nullptr, callback, user_data);
+  OpenFileRequest* request = g_new0(OpenFileRequest, 1);
+  request->parent_window = g_strdup(parent_window);
+  request->title = g_strdup(title);
+  g_task_set_task_data(task, request, open_file_request_free);
+
+  if (chooser->state == PORTAL_PROBING) {
+    g_queue_push_tail(&chooser->pending, task);
+  } else {
+    dispatch_task(chooser, task);
+  }
+}
+
+gchar* portal_file_chooser_select_directory_finish(GAsyncResult* result, GError** error) {
+  return static_cast<gchar*>(g_task_propagate_pointer(G_TASK(result), error));
+}
+
+void portal_file_chooser_free(PortalFileChooser* chooser) {
+  g_cancellable_cancel(chooser->cancellable);
+  GTask* task;
+  while ((task = static_cast<GTask*>(g_queue_pop_head(&chooser->pending)))) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                            "The file chooser was destroyed");
+    g_object_unref(task);
+  }
+  g_clear_object(&chooser->cancellable);
+  g_clear_object(&chooser->connection);
+  g_free(chooser);
+}
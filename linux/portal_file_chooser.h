@@ -0,0 +1,36 @@
+#ifndef ENTE_DIRECTORY_PICKER_PORTAL_FILE_CHOOSER_H_
+#define ENTE_DIRECTORY_PICKER_PORTAL_FILE_CHOOSER_H_
+
+#include <gio/gio.h>
+
+// Picks directories through the org.freedesktop.portal.FileChooser interface
+// of xdg-desktop-portal. The session bus connection and the portal version
+// are looked up once, asynchronously, when the chooser is created, and every
+// later request reuses them; nothing here blocks the main loop.
+typedef struct _PortalFileChooser PortalFileChooser;
+
+// Starts connecting to the session bus and probing for the portal.
+PortalFileChooser* portal_file_chooser_new();
+
+// Asks the portal to show a directory chooser. parent_window identifies the
+// window to attach the dialog to, in the portal's "x11:XID" or
+// "wayland:HANDLE" form, or is empty. Requests made while the probe is still
+// running are started once it finishes. callback is invoked on the calling
+// thread's default main context when the user has answered.
+void portal_file_chooser_select_directory(PortalFileChooser* chooser,
+                                          const gchar* parent_window,
+                                          const gchar* title,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data);
+
+// Returns the chosen directory, or NULL if the user cancelled. Returns NULL
+// with error set if the request could not be completed through the portal:
+// G_IO_ERROR_NOT_SUPPORTED when no suitable portal is running, or another
+// error if the portal failed.
+gchar* portal_file_chooser_select_directory_finish(GAsyncResult* result, GError** error);
+
+// Frees the chooser. Requests still waiting for the probe fail with
+// G_IO_ERROR_CANCELLED; dialogs already shown complete normally.
+void portal_file_chooser_free(PortalFileChooser* chooser);
+
+#endif  // ENTE_DIRECTORY_PICKER_PORTAL_FILE_CHOOSER_H_
@@ -1,9 +1,17 @@
 #include <flutter_linux/flutter_linux.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "include/ente_directory_picker/ente_directory_picker_plugin.h"
 #include "ente_directory_picker_plugin_private.h"
+#include "file_finder.h"
+#include "file_operations.h"
+#include "file_writer.h"
+#include "method_stats.h"
+#include "progress_reporter.h"
+#include "task_scheduler.h"
 
 // This demonstrates a simple unit test of the C portion of this plugin's
 // implementation.
@@ -16,6 +24,64 @@
 namespace ente_directory_picker {
 namespace test {
 
+static const gchar kMockPortalXml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.portal.FileChooser'>"
+    "    <method name='OpenFile'>"
+    "      <arg type='s' name='parent_window' direction='in'/>"
+    "      <arg type='s' name='title' direction='in'/>"
+    "      <arg type='a{sv}' name='options' direction='in'/>"
+    "      <arg type='o' name='handle' direction='out'/>"
+    "    </method>"
+    "    <property name='version' type='u' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+typedef struct {
+  gboolean directory_requested;
+  gboolean done;
+  gchar* selected_path;
+} MockPortalState;
+
+// Answers OpenFile the way xdg-desktop-portal does: replies with the request
+// handle derived from the caller and the token, then emits Response on it.
+static void mock_portal_method_call(GDBusConnection* connection, const gchar* sender,
+                                    const gchar* object_path, const gchar* interface_name,
+                                    const gchar* method_name, GVariant* parameters,
+                                    GDBusMethodInvocation* invocation, gpointer user_data) {
+  MockPortalState* state = static_cast<MockPortalState*>(user_data);
+  g_autoptr(GVariant) options = g_variant_get_child_value(parameters, 2);
+  const gchar* token = "";
+  g_variant_lookup(options, "handle_token", "&s", &token);
+  g_variant_lookup(options, "directory", "b", &state->directory_requested);
+
+  g_autofree gchar* caller = g_strdup(sender + 1);
+  g_strdelimit(caller, ".", '_');
+  g_autofree gchar* handle = g_strdup_printf(
+      "/org/freedesktop/portal/desktop/request/%s/%s", caller, token);
+  g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", handle));
+
+  const gchar* uris[] = {"file:///tmp/Chosen%20Folder", nullptr};
+  GVariantBuilder results;
+  g_variant_builder_init(&results, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(&results, "{sv}", "uris", g_variant_new_strv(uris, -1));
+  g_dbus_connection_emit_signal(connection, sender, handle, "org.freedesktop.portal.Request",
+                                "Response", g_variant_new("(ua{sv})", 0, &results), nullptr);
+}
+
+static GVariant* mock_portal_get_property(GDBusConnection* connection, const gchar* sender,
+                                          const gchar* object_path, const gchar* interface_name,
+                                          const gchar* property_name, GError** error,
+                                          gpointer user_data) {
+  return g_variant_new_uint32(4);
+}
+
+static void on_directory_selected(GObject* source, GAsyncResult* result, gpointer user_data) {
+  MockPortalState* state = static_cast<MockPortalState*>(user_data);
+  state->selected_path = portal_file_chooser_select_directory_finish(result, nullptr);
+  state->done = TRUE;
+}
+
 TEST(EnteDirectoryPickerPlugin, GetPlatformVersion) {
   g_autoptr(FlMethodResponse) response = get_platform_version();
   ASSERT_NE(response, nullptr);
@@ -27,5 +93,1204 @@ TEST(EnteDirectoryPickerPlugin, GetPlatformVersion) {
   EXPECT_THAT(fl_value_get_string(result), testing::StartsWith("Linux "));
 }
 
+TEST(EnteDirectoryPickerPlugin, WriteFilesWithFullDurability) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+
+  g_autoptr(FlValue) files = fl_value_new_map();
+  fl_value_set_string_take(files, "a.txt", fl_value_new_string("first"));
+  fl_value_set_string_take(files, "b.txt", fl_value_new_string("second"));
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string(args, "files", files);
+  fl_value_set_string_take(args, "durability", fl_value_new_string("full"));
+
+  g_autoptr(FlMethodResponse) response = write_files(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+
+  g_autofree gchar* path = g_build_filename(directory, "b.txt", nullptr);
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(path, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "second");
+
+  // No temporary files may be left behind next to the written ones.
+  g_autoptr(FlValue) list_args = fl_value_new_map();
+  fl_value_set_string_take(list_args, "directoryPath", fl_value_new_string(directory));
+  g_autoptr(FlMethodResponse) listing = list_directory(list_args);
+  FlValue* names = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(listing));
+  EXPECT_EQ(fl_value_get_length(names), 2u);
+}
+
+TEST(EnteDirectoryPickerPlugin, QueuedWriteNeverReplacesLaterSynchronousWrite) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  WriteBehindQueue* queue = write_behind_queue_new(4);
+
+  // Queued even though it is over the budget; pushing never blocks.
+  write_behind_queue_push(queue, directory, "a.txt", "queued", 6, 0, FALSE,
+                          WRITE_DURABILITY_NONE);
+
+  // What the dispatcher and worker do for a writeFile call without
+  // writeBehind, whether or not the writer has picked up the queued write.
+  write_behind_queue_begin_direct_write(queue, directory, "a.txt");
+  write_behind_queue_wait_for_file(queue, directory, "a.txt");
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "fileName", fl_value_new_string("a.txt"));
+  fl_value_set_string_take(args, "content", fl_value_new_string("written"));
+  g_autoptr(FlMethodResponse) written = write_file(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(written));
+  write_behind_queue_end_direct_write(queue, directory, "a.txt");
+
+  g_autoptr(FlMethodResponse) flushed = flush_writes(queue);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(flushed));
+  write_behind_queue_wait_for_room(queue);
+  EXPECT_FALSE(write_behind_queue_is_full(queue));
+
+  g_autofree gchar* path = g_build_filename(directory, "a.txt", nullptr);
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(path, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "written");
+
+  write_behind_queue_free(queue);
+}
+
+TEST(EnteDirectoryPickerPlugin, SynchronousWriteNeverReplacesLaterQueuedWrite) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  WriteBehindQueue* queue = write_behind_queue_new(1024);
+
+  // A writeFile call without writeBehind is dispatched, and a writeBehind
+  // call to the same file arrives before the worker has performed the first.
+  write_behind_queue_begin_direct_write(queue, directory, "a.txt");
+  write_behind_queue_push(queue, directory, "a.txt", "queued", 6, 0, FALSE,
+                          WRITE_DURABILITY_NONE);
+
+  // Give the writer thread the chance to get ahead of the worker.
+  g_usleep(50 * 1000);
+  write_behind_queue_wait_for_file(queue, directory, "a.txt");
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "fileName", fl_value_new_string("a.txt"));
+  fl_value_set_string_take(args, "content", fl_value_new_string("written"));
+  g_autoptr(FlMethodResponse) written = write_file(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(written));
+  write_behind_queue_end_direct_write(queue, directory, "a.txt");
+
+  g_autoptr(FlMethodResponse) flushed = flush_writes(queue);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(flushed));
+
+  g_autofree gchar* path = g_build_filename(directory, "a.txt", nullptr);
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(path, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "queued");
+
+  write_behind_queue_free(queue);
+}
+
+static void run_write_file_task(gpointer user_data) {
+  g_autoptr(FlMethodResponse) written = write_file(static_cast<FlValue*>(user_data));
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(written));
+}
+
+TEST(EnteDirectoryPickerPlugin, OverlappingWritesToSameFileLandInCallOrder) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+
+  // The first write is far larger, so it would finish last if the two ran
+  // side by side.
+  g_autofree gchar* large_content = g_strnfill(16 * 1024 * 1024, 'x');
+  g_autoptr(FlValue) first = fl_value_new_map();
+  fl_value_set_string_take(first, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(first, "fileName", fl_value_new_string("a.txt"));
+  fl_value_set_string_take(first, "content", fl_value_new_string(large_content));
+  g_autoptr(FlValue) second = fl_value_new_map();
+  fl_value_set_string_take(second, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(second, "fileName", fl_value_new_string("a.txt"));
+  fl_value_set_string_take(second, "content", fl_value_new_string("second"));
+
+  // The dispatcher hands writeFile calls to a lane like this one as they
+  // arrive, without waiting for the previous call to be answered.
+  TaskScheduler* lane = task_scheduler_new(1, 0);
+  task_scheduler_push(lane, TASK_PRIORITY_INTERACTIVE, run_write_file_task, first);
+  task_scheduler_push(lane, TASK_PRIORITY_INTERACTIVE, run_write_file_task, second);
+  task_scheduler_free(lane);
+
+  g_autofree gchar* path = g_build_filename(directory, "a.txt", nullptr);
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(path, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "second");
+}
+
+TEST(EnteDirectoryPickerPlugin, AppendRecordsFollowsReplacedFile) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  AppendFileCache* cache = append_file_cache_new(4);
+
+  g_autoptr(FlValue) records = fl_value_new_list();
+  fl_value_append_take(records, fl_value_new_string("one\n"));
+  fl_value_append_take(records, fl_value_new_string("two\n"));
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "fileName", fl_value_new_string("log.txt"));
+  fl_value_set_string(args, "records", records);
+  fl_value_set_string_take(args, "durability", fl_value_new_string("none"));
+
+  g_autoptr(FlMethodResponse) appended = append_records(cache, args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(appended));
+
+  // Replacing the file must not leave the cached descriptor appending to the
+  // old, unlinked copy.
+  g_autoptr(FlValue) write_args = fl_value_new_map();
+  fl_value_set_string_take(write_args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(write_args, "fileName", fl_value_new_string("log.txt"));
+  fl_value_set_string_take(write_args, "content", fl_value_new_string("reset\n"));
+  g_autoptr(FlMethodResponse) written = write_file(write_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(written));
+
+  g_autoptr(FlMethodResponse) appended_again = append_records(cache, args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(appended_again));
+
+  g_autofree gchar* path = g_build_filename(directory, "log.txt", nullptr);
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(path, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "reset\none\ntwo\n");
+
+  append_file_cache_free(cache);
+}
+
+TEST(EnteDirectoryPickerPlugin, AppendToFileFollowsRotatedFile) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  AppendFileCache* cache = append_file_cache_new(4);
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "fileName", fl_value_new_string("log.txt"));
+  fl_value_set_string_take(args, "data", fl_value_new_string("old\n"));
+  fl_value_set_string_take(args, "durability", fl_value_new_string("none"));
+  g_autoptr(FlMethodResponse) appended = append_to_file(cache, args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(appended));
+
+  // Rotating the log by renaming it keeps the cached descriptor's file
+  // linked, but later appends belong in the new file under the old name.
+  g_autofree gchar* path = g_build_filename(directory, "log.txt", nullptr);
+  g_autofree gchar* rotated_path = g_build_filename(directory, "log.txt.1", nullptr);
+  ASSERT_EQ(rename(path, rotated_path), 0);
+
+  fl_value_set_string_take(args, "data", fl_value_new_string("new\n"));
+  g_autoptr(FlMethodResponse) appended_again = append_to_file(cache, args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(appended_again));
+
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(path, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "new\n");
+  g_autofree gchar* rotated_contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(rotated_path, &rotated_contents, nullptr, nullptr));
+  EXPECT_STREQ(rotated_contents, "old\n");
+
+  append_file_cache_free(cache);
+}
+
+TEST(EnteDirectoryPickerPlugin, FindFilesPrunesExcludedDirectories) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* photos = g_build_filename(directory, "photos", nullptr);
+  g_autofree gchar* thumbnails = g_build_filename(photos, ".thumbnails", nullptr);
+  ASSERT_EQ(g_mkdir_with_parents(thumbnails, 0700), 0);
+  g_autofree gchar* photo = g_build_filename(photos, "a.jpg", nullptr);
+  g_autofree gchar* thumbnail = g_build_filename(thumbnails, "a.jpg", nullptr);
+  g_autofree gchar* note = g_build_filename(photos, "notes.txt", nullptr);
+  ASSERT_TRUE(g_file_set_contents(photo, "jpg", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(thumbnail, "jpg", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(note, "txt", -1, nullptr));
+
+  g_autoptr(FlValue) patterns = fl_value_new_list();
+  fl_value_append_take(patterns, fl_value_new_string("*.jpg"));
+  g_autoptr(FlValue) excludes = fl_value_new_list();
+  fl_value_append_take(excludes, fl_value_new_string(".thumbnails"));
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "root", fl_value_new_string(directory));
+  fl_value_set_string(args, "patterns", patterns);
+  fl_value_set_string(args, "excludes", excludes);
+
+  g_autoptr(FlMethodResponse) response = find_files(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* matches = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_length(matches), 1u);
+  EXPECT_STREQ(fl_value_get_string(fl_value_get_list_value(matches, 0)), photo);
+}
+
+TEST(EnteDirectoryPickerPlugin, SearchContentReportsLinesAndSkipsBinaryFiles) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* notes = g_build_filename(directory, "notes.txt", nullptr);
+  g_autofree gchar* binary = g_build_filename(directory, "image.bin", nullptr);
+  ASSERT_TRUE(g_file_set_contents(notes, "first line\nsecond needle needle\r\nthird\n", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(binary, "needle\0needle", 13, nullptr));
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "root", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "query", fl_value_new_string("needle"));
+
+  g_autoptr(FlMethodResponse) response = search_content(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* matches = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_length(matches), 1u);
+  FlValue* match = fl_value_get_list_value(matches, 0);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(match, "path")), notes);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(match, "line")), 2);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(match, "offset")), 18);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(match, "text")),
+               "second needle needle");
+}
+
+TEST(EnteDirectoryPickerPlugin, SearchContentStopsWithinFileAndFollowsLinesAcrossChunks) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  // Several read chunks of matching lines, and one line longer than a chunk
+  // that only matches at its end.
+  g_autoptr(GString) lines = g_string_new(nullptr);
+  for (int i = 0; i < 400000; i++) {
+    g_string_append(lines, "needle\n");
+  }
+  g_autoptr(GString) long_line = g_string_new(nullptr);
+  for (int i = 0; i < 1500000; i++) {
+    g_string_append_c(long_line, 'x');
+  }
+  g_string_append(long_line, "tail\n");
+  g_autofree gchar* lines_path = g_build_filename(directory, "lines.txt", nullptr);
+  g_autofree gchar* long_path = g_build_filename(directory, "long.txt", nullptr);
+  ASSERT_TRUE(g_file_set_contents(lines_path, lines->str, lines->len, nullptr));
+  ASSERT_TRUE(g_file_set_contents(long_path, long_line->str, long_line->len, nullptr));
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "root", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "query", fl_value_new_string("needle"));
+  fl_value_set_string_take(args, "maxResults", fl_value_new_int(5));
+  g_autoptr(FlMethodResponse) response = search_content(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* matches = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_length(matches), 5u);
+  FlValue* last = fl_value_get_list_value(matches, 4);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(last, "line")), 5);
+
+  fl_value_set_string_take(args, "query", fl_value_new_string("tail"));
+  g_autoptr(FlMethodResponse) tail_response = search_content(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(tail_response));
+  FlValue* tail_matches = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(tail_response));
+  ASSERT_EQ(fl_value_get_length(tail_matches), 1u);
+  FlValue* tail = fl_value_get_list_value(tail_matches, 0);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(tail, "line")), 1);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(tail, "offset")), 1500000);
+  // The text is the start of the line, which was read chunks earlier.
+  EXPECT_EQ(strlen(fl_value_get_string(fl_value_lookup_string(tail, "text"))), 512u);
+}
+
+TEST(EnteDirectoryPickerPlugin, IndexDirectoryAnswersQueriesAndReusesUnchangedDirectories) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* photos = g_build_filename(directory, "photos", nullptr);
+  ASSERT_EQ(g_mkdir_with_parents(photos, 0700), 0);
+  g_autofree gchar* photo = g_build_filename(photos, "IMG_0001.jpg", nullptr);
+  ASSERT_TRUE(g_file_set_contents(photo, "jpg", -1, nullptr));
+  g_autofree gchar* index_path = g_build_filename(directory, "files.index", nullptr);
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "root", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "indexPath", fl_value_new_string(index_path));
+
+  g_autoptr(FlMethodResponse) first = index_directory(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(first));
+  FlValue* first_stats = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(first));
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(first_stats, "reusedDirectories")), 0);
+
+  // Only the root changed (the index file was added to it), so photos is
+  // taken from the previous index.
+  g_autoptr(FlMethodResponse) second = index_directory(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(second));
+  FlValue* second_stats = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(second));
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(second_stats, "reusedDirectories")), 1);
+
+  fl_value_set_string_take(args, "query", fl_value_new_string("img_"));
+  g_autoptr(FlMethodResponse) response = query_index(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* matches = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_length(matches), 1u);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(fl_value_get_list_value(matches, 0), "path")),
+               photo);
+}
+
+TEST(EnteDirectoryPickerPlugin, HasPermissionsForgetsDirectoryAfterFailedWrite) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* missing = g_build_filename(directory, "missing", nullptr);
+
+  g_autoptr(FlValue) paths = fl_value_new_list();
+  fl_value_append_take(paths, fl_value_new_string(directory));
+  fl_value_append_take(paths, fl_value_new_string(missing));
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string(args, "directoryPaths", paths);
+
+  g_autoptr(FlMethodResponse) before = has_permissions(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(before));
+  FlValue* before_result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(before));
+  EXPECT_TRUE(fl_value_get_bool(fl_value_lookup_string(before_result, directory)));
+  EXPECT_FALSE(fl_value_get_bool(fl_value_lookup_string(before_result, missing)));
+
+  // No main loop runs here to deliver the inotify event, so the cached answer
+  // survives the removal until the failed write drops it.
+  ASSERT_EQ(g_rmdir(directory), 0);
+  g_autoptr(FlValue) write_args = fl_value_new_map();
+  fl_value_set_string_take(write_args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(write_args, "fileName", fl_value_new_string("a.txt"));
+  fl_value_set_string_take(write_args, "content", fl_value_new_string("a"));
+  g_autoptr(FlMethodResponse) write_response = write_file(write_args);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(write_response));
+
+  g_autoptr(FlMethodResponse) after = has_permissions(args);
+  FlValue* after_result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(after));
+  EXPECT_FALSE(fl_value_get_bool(fl_value_lookup_string(after_result, directory)));
+}
+
+TEST(EnteDirectoryPickerPlugin, CopyFileMatchesSourceOnProbedFileSystem) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* source = g_build_filename(directory, "source.bin", nullptr);
+  g_autofree gchar* copy = g_build_filename(directory, "copy.bin", nullptr);
+  // Larger than the preallocation threshold, so the full copy path runs.
+  gsize length = 3 * 1024 * 1024 + 17;
+  g_autofree gchar* data = static_cast<gchar*>(g_malloc(length));
+  for (gsize i = 0; i < length; i++) {
+    data[i] = static_cast<gchar>(i * 31);
+  }
+  ASSERT_TRUE(g_file_set_contents(source, data, length, nullptr));
+
+  g_autoptr(FlValue) capabilities_args = fl_value_new_map();
+  fl_value_set_string_take(capabilities_args, "path", fl_value_new_string(directory));
+  g_autoptr(FlMethodResponse) capabilities_response = get_filesystem_capabilities(capabilities_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(capabilities_response));
+  FlValue* capabilities = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(capabilities_response));
+  EXPECT_EQ(fl_value_get_type(fl_value_lookup_string(capabilities, "fileSystem")),
+            FL_VALUE_TYPE_STRING);
+  EXPECT_GT(fl_value_get_int(fl_value_lookup_string(capabilities, "totalBytes")), 0);
+
+  g_autoptr(FlValue) copy_args = fl_value_new_map();
+  fl_value_set_string_take(copy_args, "sourcePath", fl_value_new_string(source));
+  fl_value_set_string_take(copy_args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(copy_args, "fileName", fl_value_new_string("copy.bin"));
+  g_autoptr(FlMethodResponse) copy_response = copy_file(copy_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(copy_response));
+
+  g_autofree gchar* copied = nullptr;
+  gsize copied_length = 0;
+  ASSERT_TRUE(g_file_get_contents(copy, &copied, &copied_length, nullptr));
+  ASSERT_EQ(copied_length, length);
+  EXPECT_EQ(memcmp(copied, data, length), 0);
+
+  g_autoptr(FlValue) missing_args = fl_value_new_map();
+  fl_value_set_string_take(missing_args, "path",
+                           fl_value_new_string("/nonexistent/ente_directory_picker"));
+  g_autoptr(FlMethodResponse) missing_response = get_filesystem_capabilities(missing_args);
+  EXPECT_EQ(fl_value_get_type(fl_method_success_response_get_result(
+                FL_METHOD_SUCCESS_RESPONSE(missing_response))),
+            FL_VALUE_TYPE_NULL);
+
+  g_unlink(copy);
+  g_unlink(source);
+  g_rmdir(directory);
+}
+
+// Runs exportFiles with args and checks how many files it copied and skipped.
+static void expect_export_counts(FlValue* args, int64_t copied, int64_t skipped) {
+  g_autoptr(FlMethodResponse) response = export_files(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(result, "copied")), copied);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(result, "skipped")), skipped);
+}
+
+TEST(EnteDirectoryPickerPlugin, ExportFilesSkipsFilesAlreadyExported) {
+  g_autofree gchar* library = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  g_autofree gchar* target = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(library, nullptr);
+  ASSERT_NE(target, nullptr);
+  g_autofree gchar* first = g_build_filename(library, "first.jpg", nullptr);
+  g_autofree gchar* second = g_build_filename(library, "second.jpg", nullptr);
+  ASSERT_TRUE(g_file_set_contents(first, "first photo", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(second, "second photo", -1, nullptr));
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(target));
+  g_autoptr(FlValue) files = fl_value_new_map();
+  fl_value_set_string_take(files, "first.jpg", fl_value_new_string(first));
+  fl_value_set_string_take(files, "second.jpg", fl_value_new_string(second));
+  fl_value_set_string(args, "files", files);
+
+  expect_export_counts(args, 2, 0);
+  expect_export_counts(args, 0, 2);
+
+  // A touched source is hashed and still skipped; a changed one is copied.
+  struct timespec times[2] = {{0, UTIME_OMIT}, {1000000000, 0}};
+  ASSERT_EQ(utimensat(AT_FDCWD, first, times, 0), 0);
+  ASSERT_TRUE(g_file_set_contents(second, "second photo, edited", -1, nullptr));
+  expect_export_counts(args, 1, 1);
+
+  g_autofree gchar* exported = g_build_filename(target, "second.jpg", nullptr);
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(exported, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "second photo, edited");
+
+  // An exported file that was deleted is copied again.
+  g_unlink(exported);
+  expect_export_counts(args, 1, 1);
+
+  g_autoptr(FlValue) reserved_args = fl_value_new_map();
+  fl_value_set_string_take(reserved_args, "directoryPath", fl_value_new_string(target));
+  g_autoptr(FlValue) reserved_files = fl_value_new_map();
+  fl_value_set_string_take(reserved_files, ".ente_export_manifest", fl_value_new_string(first));
+  fl_value_set_string(reserved_args, "files", reserved_files);
+  g_autoptr(FlMethodResponse) reserved = export_files(reserved_args);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(reserved));
+
+  for (const gchar* name : {"first.jpg", "second.jpg", ".ente_export_manifest"}) {
+    g_autofree gchar* path = g_build_filename(target, name, nullptr);
+    g_unlink(path);
+  }
+  g_unlink(first);
+  g_unlink(second);
+  g_rmdir(target);
+  g_rmdir(library);
+}
+
+TEST(EnteDirectoryPickerPlugin, GetStatsReportsCallsErrorsAndBytesWritten) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autoptr(FlMethodResponse) reset_response = reset_stats();
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(reset_response));
+
+  // Stands in for the method call handler, which times each call and charges
+  // its I/O to the method's record.
+  MethodStats* stats = method_stats_get("writeFile");
+  const gchar* directories[] = {directory, "/nonexistent/ente_directory_picker"};
+  for (const gchar* target : directories) {
+    g_autoptr(FlValue) args = fl_value_new_map();
+    fl_value_set_string_take(args, "directoryPath", fl_value_new_string(target));
+    fl_value_set_string_take(args, "fileName", fl_value_new_string("a.txt"));
+    fl_value_set_string_take(args, "content", fl_value_new_string("hello"));
+    MethodStats* previous = method_stats_set_current(stats);
+    g_autoptr(FlMethodResponse) response = write_file(args);
+    method_stats_set_current(previous);
+    method_stats_record_call(stats, 100, FL_IS_METHOD_ERROR_RESPONSE(response));
+  }
+
+  g_autoptr(FlMethodResponse) response = get_stats();
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* write_stats = fl_value_lookup_string(result, "writeFile");
+  ASSERT_NE(write_stats, nullptr);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(write_stats, "calls")), 2);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(write_stats, "errors")), 1);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(write_stats, "bytesWritten")), 5);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(write_stats, "p50Us")), 100);
+
+  g_autofree gchar* file = g_build_filename(directory, "a.txt", nullptr);
+  g_unlink(file);
+  g_rmdir(directory);
+}
+
+TEST(EnteDirectoryPickerPlugin, TracingWritesPhasesOfEachCall) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* trace_path = g_build_filename(directory, "trace.json", nullptr);
+
+  g_autoptr(FlValue) start_args = fl_value_new_map();
+  fl_value_set_string_take(start_args, "path", fl_value_new_string(trace_path));
+  g_autoptr(FlMethodResponse) start_response = start_tracing(start_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(start_response));
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "fileName", fl_value_new_string("a.txt"));
+  fl_value_set_string_take(args, "content", fl_value_new_string("hello"));
+  g_autoptr(FlMethodResponse) write_response = write_file(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(write_response));
+
+  g_autoptr(FlMethodResponse) stop_response = stop_tracing();
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(stop_response));
+
+  g_autofree gchar* trace = nullptr;
+  ASSERT_TRUE(g_file_get_contents(trace_path, &trace, nullptr, nullptr));
+  EXPECT_THAT(trace, ::testing::StartsWith("["));
+  EXPECT_THAT(trace, ::testing::EndsWith("]\n"));
+  EXPECT_THAT(trace, ::testing::HasSubstr("\"name\":\"validate\",\"cat\":\"ente_directory_picker\",\"ph\":\"X\""));
+  EXPECT_THAT(trace, ::testing::HasSubstr("\"name\":\"filesystem\""));
+  EXPECT_THAT(trace, ::testing::HasSubstr("\"tid\":"));
+
+  g_autofree gchar* file = g_build_filename(directory, "a.txt", nullptr);
+  g_unlink(file);
+  g_unlink(trace_path);
+  g_rmdir(directory);
+}
+
+// A backend serving one directory, "/memory", holding "a.txt" and a
+// subdirectory "sub", without touching the disk.
+static GPtrArray* memory_list_directory(const IoBackend* backend, const gchar* path,
+                                        GCancellable* cancellable, GError** error) {
+  if (strcmp(path, "/memory") != 0) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT, "No directory %s", path);
+    return nullptr;
+  }
+  GPtrArray* names = g_ptr_array_new_with_free_func(g_free);
+  g_ptr_array_add(names, g_strdup("a.txt"));
+  g_ptr_array_add(names, g_strdup("sub"));
+  return names;
+}
+
+static gboolean memory_query_info(const IoBackend* backend, const gchar* path,
+                                  IoFileInfo* info, GError** error) {
+  info->is_directory = g_str_has_suffix(path, "/sub");
+  info->size = info->is_directory ? 0 : strlen(static_cast<const gchar*>(backend->user_data));
+  info->modified_ms = 1000;
+  return TRUE;
+}
+
+static gboolean memory_read_file(const IoBackend* backend, const gchar* path, gchar** contents,
+                                 gsize* length, GCancellable* cancellable, GError** error) {
+  if (strcmp(path, "/memory/a.txt") != 0) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT, "No file %s", path);
+    return FALSE;
+  }
+  *contents = g_strdup(static_cast<const gchar*>(backend->user_data));
+  *length = strlen(*contents);
+  return TRUE;
+}
+
+TEST(EnteDirectoryPickerPlugin, FileOperationsRunOnPluggableBackend) {
+  const IoBackend backend = {memory_list_directory, memory_query_info, memory_read_file,
+                             const_cast<gchar*>("hello")};
+
+  g_autoptr(GArray) entries = file_operations_get_details(&backend, "/memory", nullptr, nullptr);
+  ASSERT_NE(entries, nullptr);
+  ASSERT_EQ(entries->len, 2u);
+  const FileDetails* file = &g_array_index(entries, FileDetails, 0);
+  EXPECT_STREQ(file->name, "a.txt");
+  EXPECT_STREQ(file->path, "/memory/a.txt");
+  EXPECT_FALSE(file->info.is_directory);
+  EXPECT_EQ(file->info.size, 5);
+  EXPECT_TRUE(g_array_index(entries, FileDetails, 1).info.is_directory);
+
+  g_autofree gchar* contents = nullptr;
+  gsize length = 0;
+  ASSERT_TRUE(file_operations_read_file(&backend, "/memory/a.txt", &contents, &length, nullptr,
+                                        nullptr));
+  EXPECT_STREQ(contents, "hello");
+
+  // Missing paths are not errors.
+  GError* error = nullptr;
+  EXPECT_EQ(file_operations_list_directory(&backend, "/elsewhere", nullptr, &error), nullptr);
+  EXPECT_EQ(error, nullptr);
+  gchar* missing = nullptr;
+  EXPECT_FALSE(file_operations_read_file(&backend, "/memory/b.txt", &missing, &length, nullptr,
+                                         &error));
+  EXPECT_EQ(error, nullptr);
+}
+
+TEST(EnteDirectoryPickerPlugin, CancelStopsRunningCalls) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* file = g_build_filename(directory, "a.txt", nullptr);
+  ASSERT_TRUE(g_file_set_contents(file, "old", -1, nullptr));
+
+  g_autoptr(GHashTable) pending_calls =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+  GCancellable* cancellable = g_cancellable_new();
+  g_hash_table_insert(pending_calls, g_strdup("read-1"), cancellable);
+
+  g_autoptr(FlValue) unknown_args = fl_value_new_map();
+  fl_value_set_string_take(unknown_args, "requestId", fl_value_new_string("read-2"));
+  g_autoptr(FlMethodResponse) unknown = cancel_call(pending_calls, unknown_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(unknown));
+  EXPECT_FALSE(fl_value_get_bool(
+      fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(unknown))));
+  EXPECT_FALSE(g_cancellable_is_cancelled(cancellable));
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "requestId", fl_value_new_string("read-1"));
+  g_autoptr(FlMethodResponse) cancelled = cancel_call(pending_calls, args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(cancelled));
+  EXPECT_TRUE(fl_value_get_bool(
+      fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(cancelled))));
+  EXPECT_TRUE(g_cancellable_is_cancelled(cancellable));
+
+  // Every long-running operation gives up once its cancellable is cancelled.
+  g_autoptr(GError) read_error = nullptr;
+  g_autofree gchar* contents = nullptr;
+  gsize length = 0;
+  EXPECT_FALSE(file_operations_read_file(io_backend_get_default(), file, &contents, &length,
+                                         cancellable, &read_error));
+  EXPECT_TRUE(g_error_matches(read_error, G_IO_ERROR, G_IO_ERROR_CANCELLED));
+
+  g_autoptr(GError) details_error = nullptr;
+  g_autoptr(GArray) entries = file_operations_get_details(io_backend_get_default(), directory,
+                                                          cancellable, &details_error);
+  EXPECT_EQ(entries, nullptr);
+  EXPECT_TRUE(g_error_matches(details_error, G_IO_ERROR, G_IO_ERROR_CANCELLED));
+
+  g_autoptr(GError) find_error = nullptr;
+  GlobSet* patterns = glob_set_new(nullptr);
+  GPtrArray* matches = find_matching_files(directory, patterns, patterns, -1, FALSE,
+                                           cancellable, &find_error);
+  glob_set_free(patterns);
+  EXPECT_EQ(matches, nullptr);
+  EXPECT_TRUE(g_error_matches(find_error, G_IO_ERROR, G_IO_ERROR_CANCELLED));
+
+  // A cancelled write leaves the target as it was.
+  g_autoptr(GError) write_error = nullptr;
+  PendingWrite write = {};
+  write.file_name = "a.txt";
+  write.data = "new";
+  write.length = 3;
+  EXPECT_FALSE(write_files_durably(directory, &write, 1, WRITE_DURABILITY_NONE, cancellable,
+                                   &write_error));
+  EXPECT_TRUE(g_error_matches(write_error, G_IO_ERROR, G_IO_ERROR_CANCELLED));
+  g_autofree gchar* kept = nullptr;
+  ASSERT_TRUE(g_file_get_contents(file, &kept, nullptr, nullptr));
+  EXPECT_STREQ(kept, "old");
+
+  g_unlink(file);
+  g_rmdir(directory);
+}
+
+TEST(EnteDirectoryPickerPlugin, PrefetchAndEvictFilesSkipMissingFiles) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* file = g_build_filename(directory, "photo.jpg", nullptr);
+  ASSERT_TRUE(g_file_set_contents(file, "jpeg data", -1, nullptr));
+  g_autofree gchar* missing = g_build_filename(directory, "missing.jpg", nullptr);
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  g_autoptr(FlValue) paths = fl_value_new_list();
+  fl_value_append_take(paths, fl_value_new_string(file));
+  fl_value_append_take(paths, fl_value_new_string(missing));
+  fl_value_append_take(paths, fl_value_new_string(directory));
+  fl_value_set_string(args, "paths", paths);
+
+  for (FlMethodResponse* (*handler)(FlValue*) : {prefetch_files, evict_files}) {
+    g_autoptr(FlMethodResponse) response = handler(args);
+    ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+    EXPECT_EQ(fl_value_get_int(
+        fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response))), 1);
+  }
+
+  g_autoptr(FlValue) bad_args = fl_value_new_map();
+  fl_value_set_string_take(bad_args, "paths", fl_value_new_string(file));
+  g_autoptr(FlMethodResponse) bad = prefetch_files(bad_args);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(bad));
+
+  // Contents are untouched by either.
+  g_autofree gchar* contents = nullptr;
+  ASSERT_TRUE(g_file_get_contents(file, &contents, nullptr, nullptr));
+  EXPECT_STREQ(contents, "jpeg data");
+
+  g_unlink(file);
+  g_rmdir(directory);
+}
+
+TEST(EnteDirectoryPickerPlugin, GetMediaMetadataReadsImageHeaders) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+
+  // A JPEG whose EXIF block, in little-endian TIFF, records a quarter turn and
+  // the capture time with its offset, followed by a 640x480 frame header.
+  static const guint8 kJpeg[] = {
+    0xFF, 0xD8,
+    // APP1, "Exif\0\0", then the TIFF header pointing at IFD0.
+    0xFF, 0xE1, 0x00, 0x67, 'E', 'x', 'i', 'f', 0x00, 0x00,
+    'I', 'I', 0x2A, 0x00, 0x08, 0x00, 0x00, 0x00,
+    // IFD0: orientation 6 and the offset of the EXIF IFD.
+    0x02, 0x00,
+    0x12, 0x01, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00,
+    0x69, 0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00, 0x26, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    // EXIF IFD: DateTimeOriginal and OffsetTimeOriginal, stored after it.
+    0x02, 0x00,
+    0x03, 0x90, 0x02, 0x00, 0x14, 0x00, 0x00, 0x00, 0x44, 0x00, 0x00, 0x00,
+    0x11, 0x90, 0x02, 0x00, 0x07, 0x00, 0x00, 0x00, 0x58, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    '2', '0', '2', '4', ':', '0', '5', ':', '0', '1', ' ',
+    '1', '8', ':', '3', '0', ':', '0', '5', 0x00,
+    '+', '0', '2', ':', '0', '0', 0x00,
+    // SOF0: precision, height, width and one component.
+    0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x01, 0xE0, 0x02, 0x80, 0x01, 0x01, 0x11, 0x00,
+    0xFF, 0xDA,
+  };
+  // A PNG holding nothing but the IHDR of a 16x9 image.
+  static const guint8 kPng[] = {
+    0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A,
+    0x00, 0x00, 0x00, 0x0D, 'I', 'H', 'D', 'R',
+    0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x09, 0x08, 0x02, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+  };
+
+  g_autofree gchar* jpeg = g_build_filename(directory, "photo.jpg", nullptr);
+  g_autofree gchar* png = g_build_filename(directory, "screenshot.png", nullptr);
+  g_autofree gchar* text = g_build_filename(directory, "notes.txt", nullptr);
+  g_autofree gchar* missing = g_build_filename(directory, "missing.jpg", nullptr);
+  ASSERT_TRUE(g_file_set_contents(jpeg, reinterpret_cast<const gchar*>(kJpeg), sizeof(kJpeg),
+                                  nullptr));
+  ASSERT_TRUE(g_file_set_contents(png, reinterpret_cast<const gchar*>(kPng), sizeof(kPng),
+                                  nullptr));
+  ASSERT_TRUE(g_file_set_contents(text, "not an image", -1, nullptr));
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  g_autoptr(FlValue) paths = fl_value_new_list();
+  for (const gchar* path : {jpeg, png, text, missing}) {
+    fl_value_append_take(paths, fl_value_new_string(path));
+  }
+  fl_value_set_string(args, "paths", paths);
+
+  g_autoptr(FlMethodResponse) response = get_media_metadata(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_length(result), 2u);
+
+  FlValue* photo = fl_value_lookup_string(result, jpeg);
+  ASSERT_NE(photo, nullptr);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(photo, "format")), "jpeg");
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(photo, "width")), 640);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(photo, "height")), 480);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(photo, "orientation")), 6);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(photo, "captureTime")),
+               "2024-05-01T18:30:05+02:00");
+
+  FlValue* screenshot = fl_value_lookup_string(result, png);
+  ASSERT_NE(screenshot, nullptr);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(screenshot, "format")), "png");
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(screenshot, "width")), 16);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(screenshot, "height")), 9);
+  EXPECT_EQ(fl_value_get_type(fl_value_lookup_string(screenshot, "orientation")),
+            FL_VALUE_TYPE_NULL);
+  EXPECT_EQ(fl_value_get_type(fl_value_lookup_string(screenshot, "captureTime")),
+            FL_VALUE_TYPE_NULL);
+
+  g_unlink(jpeg);
+  g_unlink(png);
+  g_unlink(text);
+  g_rmdir(directory);
+}
+
+// Calls getDirectoryDetails with args and checks the names it returns, in
+// order, against expected_names, a comma-separated list.
+static void expect_detail_names(FlValue* args, const gchar* expected_names) {
+  g_autoptr(FlMethodResponse) response = get_directory_details(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  g_autoptr(GPtrArray) names = g_ptr_array_new();
+  for (size_t i = 0; i < fl_value_get_length(result); i++) {
+    FlValue* name = fl_value_lookup_string(fl_value_get_list_value(result, i), "name");
+    g_ptr_array_add(names, const_cast<gchar*>(fl_value_get_string(name)));
+  }
+  g_ptr_array_add(names, nullptr);
+  g_autofree gchar* joined = g_strjoinv(",", reinterpret_cast<gchar**>(names->pdata));
+  EXPECT_STREQ(joined, expected_names);
+}
+
+TEST(EnteDirectoryPickerPlugin, DirectoryDetailsAreFilteredAndSortedNatively) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* large = g_build_filename(directory, "large.jpg", nullptr);
+  g_autofree gchar* small = g_build_filename(directory, "small.JPG", nullptr);
+  g_autofree gchar* notes = g_build_filename(directory, "notes.txt", nullptr);
+  g_autofree gchar* album = g_build_filename(directory, "album", nullptr);
+  ASSERT_TRUE(g_file_set_contents(large, "0123456789012345678901234567890", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(small, "0123456789", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(notes, "01234567890123456789", -1, nullptr));
+  ASSERT_EQ(g_mkdir(album, 0755), 0);
+
+  // The two largest files.
+  g_autoptr(FlValue) largest_args = fl_value_new_map();
+  fl_value_set_string_take(largest_args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(largest_args, "sortBy", fl_value_new_string("size"));
+  fl_value_set_string_take(largest_args, "descending", fl_value_new_bool(TRUE));
+  fl_value_set_string_take(largest_args, "entryType", fl_value_new_string("file"));
+  fl_value_set_string_take(largest_args, "limit", fl_value_new_int(2));
+  expect_detail_names(largest_args, "large.jpg,notes.txt");
+
+  // Extensions match whatever their case, and directories are kept.
+  g_autoptr(FlValue) photo_args = fl_value_new_map();
+  fl_value_set_string_take(photo_args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(photo_args, "sortBy", fl_value_new_string("name"));
+  g_autoptr(FlValue) extensions = fl_value_new_list();
+  fl_value_append_take(extensions, fl_value_new_string("jpg"));
+  fl_value_set_string(photo_args, "extensions", extensions);
+  expect_detail_names(photo_args, "album,large.jpg,small.JPG");
+  fl_value_set_string_take(photo_args, "maxSize", fl_value_new_int(20));
+  expect_detail_names(photo_args, "album,small.JPG");
+
+  fl_value_set_string_take(photo_args, "sortBy", fl_value_new_string("type"));
+  g_autoptr(FlMethodResponse) invalid_response = get_directory_details(photo_args);
+  ASSERT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(invalid_response));
+  EXPECT_STREQ(fl_method_error_response_get_code(FL_METHOD_ERROR_RESPONSE(invalid_response)),
+               "INVALID_ARGUMENT");
+
+  g_unlink(large);
+  g_unlink(small);
+  g_unlink(notes);
+  g_rmdir(album);
+  g_rmdir(directory);
+}
+
+TEST(EnteDirectoryPickerPlugin, DirectoryDetailsSortNaturallyWithCachedKeys) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  const gchar* names[] = {"IMG_10.jpg", "IMG_2.jpg", "IMG_1.jpg"};
+  for (const gchar* name : names) {
+    g_autofree gchar* path = g_build_filename(directory, name, nullptr);
+    ASSERT_TRUE(g_file_set_contents(path, "", 0, nullptr));
+  }
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "sortBy", fl_value_new_string("name"));
+  expect_detail_names(args, "IMG_1.jpg,IMG_10.jpg,IMG_2.jpg");
+  fl_value_set_string_take(args, "sortBy", fl_value_new_string("naturalName"));
+  expect_detail_names(args, "IMG_1.jpg,IMG_2.jpg,IMG_10.jpg");
+
+  // A file added since the ranks were cached is ranked with the others.
+  g_autofree gchar* added = g_build_filename(directory, "IMG_3.jpg", nullptr);
+  ASSERT_TRUE(g_file_set_contents(added, "", 0, nullptr));
+  fl_value_set_string_take(args, "descending", fl_value_new_bool(TRUE));
+  expect_detail_names(args, "IMG_10.jpg,IMG_3.jpg,IMG_2.jpg,IMG_1.jpg");
+
+  // Keys for sorting elsewhere, without sorting here.
+  g_autoptr(FlValue) key_args = fl_value_new_map();
+  fl_value_set_string_take(key_args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(key_args, "sortKeys", fl_value_new_bool(TRUE));
+  g_autoptr(FlMethodResponse) response = get_directory_details(key_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_length(result), 4u);
+  for (size_t i = 0; i < fl_value_get_length(result); i++) {
+    FlValue* item = fl_value_get_list_value(result, i);
+    const gchar* name = fl_value_get_string(fl_value_lookup_string(item, "name"));
+    int64_t expected_key = strcmp(name, "IMG_1.jpg") == 0 ? 0
+        : strcmp(name, "IMG_2.jpg") == 0 ? 1
+        : strcmp(name, "IMG_3.jpg") == 0 ? 2 : 3;
+    EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(item, "sortKey")), expected_key) << name;
+  }
+
+  for (const gchar* name : names) {
+    g_autofree gchar* path = g_build_filename(directory, name, nullptr);
+    g_unlink(path);
+  }
+  g_unlink(added);
+  g_rmdir(directory);
+}
+
+TEST(EnteDirectoryPickerPlugin, TreeNodesExpandFromHandles) {
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  g_autofree gchar* album = g_build_filename(directory, "album", nullptr);
+  g_autofree gchar* nested = g_build_filename(album, "nested", nullptr);
+  g_autofree gchar* notes = g_build_filename(directory, "notes.txt", nullptr);
+  g_autofree gchar* photo = g_build_filename(album, "photo.jpg", nullptr);
+  g_autofree gchar* raw = g_build_filename(nested, "photo.raw", nullptr);
+  ASSERT_EQ(g_mkdir_with_parents(nested, 0755), 0);
+  ASSERT_TRUE(g_file_set_contents(notes, "abc", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(photo, "12345", -1, nullptr));
+  ASSERT_TRUE(g_file_set_contents(raw, "1234567", -1, nullptr));
+
+  // One level, with the sizes of everything below each directory.
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  fl_value_set_string_take(args, "depth", fl_value_new_int(1));
+  fl_value_set_string_take(args, "aggregateSizes", fl_value_new_bool(TRUE));
+  g_autoptr(FlMethodResponse) response = get_tree_nodes(args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* root = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(root, "size")), 15);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(root, "childCount")), 2);
+  FlValue* children = fl_value_lookup_string(root, "children");
+  ASSERT_EQ(fl_value_get_length(children), 2u);
+
+  FlValue* album_node = fl_value_get_list_value(children, 0);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(album_node, "name")), "album");
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(album_node, "size")), 12);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(album_node, "childCount")), 2);
+  EXPECT_EQ(fl_value_get_type(fl_value_lookup_string(album_node, "children")),
+            FL_VALUE_TYPE_NULL);
+  FlValue* notes_node = fl_value_get_list_value(children, 1);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(notes_node, "path")), notes);
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(notes_node, "size")), 3);
+  EXPECT_EQ(fl_value_get_type(fl_value_lookup_string(notes_node, "handle")), FL_VALUE_TYPE_NULL);
+
+  // The album expands from its handle without reading the root again.
+  g_autoptr(FlValue) expand_args = fl_value_new_map();
+  fl_value_set_string(expand_args, "handle", fl_value_lookup_string(album_node, "handle"));
+  g_autoptr(FlMethodResponse) expand_response = expand_tree_node(expand_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(expand_response));
+  FlValue* expanded =
+      fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(expand_response));
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(expanded, "path")), album);
+  EXPECT_EQ(fl_value_get_type(fl_value_lookup_string(expanded, "size")), FL_VALUE_TYPE_NULL);
+  FlValue* album_children = fl_value_lookup_string(expanded, "children");
+  ASSERT_EQ(fl_value_get_length(album_children), 2u);
+  FlValue* nested_node = fl_value_get_list_value(album_children, 0);
+  EXPECT_STREQ(fl_value_get_string(fl_value_lookup_string(nested_node, "name")), "nested");
+  EXPECT_EQ(fl_value_get_int(fl_value_lookup_string(nested_node, "childCount")), 1);
+  EXPECT_EQ(fl_value_get_int(
+                fl_value_lookup_string(fl_value_get_list_value(album_children, 1), "size")), 5);
+
+  // Once another directory takes the album's place, its handle is stale.
+  g_autofree gchar* moved = g_build_filename(directory, "moved", nullptr);
+  ASSERT_EQ(g_rename(album, moved), 0);
+  ASSERT_EQ(g_mkdir(album, 0755), 0);
+  g_autoptr(FlMethodResponse) stale_response = expand_tree_node(expand_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(stale_response));
+  EXPECT_EQ(fl_value_get_type(fl_method_success_response_get_result(
+                FL_METHOD_SUCCESS_RESPONSE(stale_response))),
+            FL_VALUE_TYPE_NULL);
+
+  g_autofree gchar* moved_nested = g_build_filename(moved, "nested", nullptr);
+  g_autofree gchar* moved_raw = g_build_filename(moved_nested, "photo.raw", nullptr);
+  g_autofree gchar* moved_photo = g_build_filename(moved, "photo.jpg", nullptr);
+  g_unlink(moved_raw);
+  g_rmdir(moved_nested);
+  g_unlink(moved_photo);
+  g_rmdir(moved);
+  g_rmdir(album);
+  g_unlink(notes);
+  g_rmdir(directory);
+}
+
+TEST(EnteDirectoryPickerPlugin, CoalescingKeyMatchesOnlyIdenticalReadOnlyCalls) {
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string("/photos"));
+  fl_value_set_string_take(args, "recursive", fl_value_new_bool(FALSE));
+  g_autoptr(FlValue) same_args = fl_value_new_map();
+  fl_value_set_string_take(same_args, "directoryPath", fl_value_new_string("/photos"));
+  fl_value_set_string_take(same_args, "recursive", fl_value_new_bool(FALSE));
+  g_autoptr(FlValue) recursive_args = fl_value_new_map();
+  fl_value_set_string_take(recursive_args, "directoryPath", fl_value_new_string("/photos"));
+  fl_value_set_string_take(recursive_args, "recursive", fl_value_new_bool(TRUE));
+
+  g_autoptr(GBytes) key = get_coalescing_key("getDirectoryDetails", args);
+  g_autoptr(GBytes) same_key = get_coalescing_key("getDirectoryDetails", same_args);
+  g_autoptr(GBytes) recursive_key = get_coalescing_key("getDirectoryDetails", recursive_args);
+  g_autoptr(GBytes) list_key = get_coalescing_key("listDirectory", args);
+  ASSERT_NE(key, nullptr);
+  ASSERT_NE(recursive_key, nullptr);
+  ASSERT_NE(list_key, nullptr);
+  EXPECT_TRUE(g_bytes_equal(key, same_key));
+  EXPECT_FALSE(g_bytes_equal(key, recursive_key));
+  EXPECT_FALSE(g_bytes_equal(key, list_key));
+
+  // Writes, and calls that can be cancelled on their own, are never shared.
+  EXPECT_EQ(get_coalescing_key("writeFiles", args), nullptr);
+  fl_value_set_string_take(same_args, "requestId", fl_value_new_string("details-1"));
+  EXPECT_EQ(get_coalescing_key("getDirectoryDetails", same_args), nullptr);
+}
+
+typedef struct {
+  guint updates;
+  ProgressUpdate last;
+  gchar* last_path;
+} RecordedProgress;
+
+static void record_progress(const ProgressUpdate* update, gpointer user_data) {
+  RecordedProgress* recorded = static_cast<RecordedProgress*>(user_data);
+  recorded->updates++;
+  recorded->last = *update;
+  g_free(recorded->last_path);
+  recorded->last_path = g_strdup(update->current_path);
+}
+
+TEST(EnteDirectoryPickerPlugin, ProgressReporterThrottlesUpdates) {
+  // Nothing is sent between finishes when the interval is never reached.
+  RecordedProgress throttled = {};
+  ProgressReporter* reporter = progress_reporter_new(G_TIME_SPAN_HOUR, record_progress,
+                                                     &throttled);
+  progress_reporter_add_totals(reporter, 1000, 0);
+  for (int i = 0; i < 1000; i++) {
+    progress_reporter_advance(reporter, 1, 10, "/some/path");
+  }
+  EXPECT_EQ(throttled.updates, 0u);
+  progress_reporter_finish(reporter);
+  EXPECT_EQ(throttled.updates, 1u);
+  EXPECT_TRUE(throttled.last.finished);
+  EXPECT_EQ(throttled.last.items_done, 1000u);
+  EXPECT_EQ(throttled.last.items_total, 1000u);
+  EXPECT_EQ(throttled.last.bytes_done, 10000u);
+  progress_reporter_free(reporter);
+  g_free(throttled.last_path);
+
+  // Writes advance the reporter current on their thread.
+  g_autofree gchar* directory = g_dir_make_tmp("ente_directory_picker_XXXXXX", nullptr);
+  ASSERT_NE(directory, nullptr);
+  RecordedProgress every = {};
+  reporter = progress_reporter_new(0, record_progress, &every);
+  ProgressReporter* previous = progress_reporter_set_current(reporter);
+  PendingWrite writes[2] = {};
+  writes[0].file_name = "a.txt";
+  writes[0].data = "hello";
+  writes[0].length = 5;
+  writes[1].file_name = "b.txt";
+  writes[1].data = "world!";
+  writes[1].length = 6;
+  ASSERT_TRUE(write_files_durably(directory, writes, 2, WRITE_DURABILITY_NONE, nullptr, nullptr));
+  progress_reporter_set_current(previous);
+  progress_reporter_finish(reporter);
+
+  EXPECT_GT(every.updates, 2u);
+  EXPECT_EQ(every.last.items_done, 2u);
+  EXPECT_EQ(every.last.items_total, 2u);
+  EXPECT_EQ(every.last.bytes_done, 11u);
+  EXPECT_EQ(every.last.bytes_total, 11u);
+  EXPECT_THAT(every.last_path, ::testing::EndsWith("/b.txt"));
+  progress_reporter_free(reporter);
+  g_free(every.last_path);
+
+  for (const PendingWrite& write : writes) {
+    g_autofree gchar* file = g_build_filename(directory, write.file_name, nullptr);
+    g_unlink(file);
+  }
+  g_rmdir(directory);
+}
+
+typedef struct {
+  GMutex mutex;
+  GCond cond;
+  gboolean released;
+  guint running_bulk;
+  guint max_running_bulk;
+  // Names of the tasks in the order they finished.
+  GPtrArray* finished;
+} SchedulerRecord;
+
+typedef struct {
+  SchedulerRecord* record;
+  const gchar* name;
+} RecordedTask;
+
+// Holds its bulk slot until the record is released.
+static void run_bulk_task(gpointer user_data) {
+  RecordedTask* task = static_cast<RecordedTask*>(user_data);
+  SchedulerRecord* record = task->record;
+  g_mutex_lock(&record->mutex);
+  record->running_bulk++;
+  record->max_running_bulk = MAX(record->max_running_bulk, record->running_bulk);
+  while (!record->released) {
+    g_cond_wait(&record->cond, &record->mutex);
+  }
+  record->running_bulk--;
+  g_ptr_array_add(record->finished, const_cast<gchar*>(task->name));
+  g_mutex_unlock(&record->mutex);
+}
+
+static void run_interactive_task(gpointer user_data) {
+  RecordedTask* task = static_cast<RecordedTask*>(user_data);
+  SchedulerRecord* record = task->record;
+  g_mutex_lock(&record->mutex);
+  g_ptr_array_add(record->finished, const_cast<gchar*>(task->name));
+  g_cond_broadcast(&record->cond);
+  g_mutex_unlock(&record->mutex);
+}
+
+TEST(EnteDirectoryPickerPlugin, TaskSchedulerRunsInteractiveTasksAheadOfBulkWork) {
+  SchedulerRecord record = {};
+  g_mutex_init(&record.mutex);
+  g_cond_init(&record.cond);
+  record.finished = g_ptr_array_new();
+  RecordedTask bulk[3] = { { &record, "bulk-1" }, { &record, "bulk-2" }, { &record, "bulk-3" } };
+  RecordedTask interactive = { &record, "interactive" };
+
+  TaskScheduler* scheduler = task_scheduler_new(2, 1);
+  for (RecordedTask& task : bulk) {
+    task_scheduler_push(scheduler, TASK_PRIORITY_BULK, run_bulk_task, &task);
+  }
+  task_scheduler_push(scheduler, TASK_PRIORITY_INTERACTIVE, run_interactive_task, &interactive);
+
+  // The interactive task finishes while bulk work is still blocked.
+  g_mutex_lock(&record.mutex);
+  gint64 deadline = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+  while (record.finished->len == 0 && g_cond_wait_until(&record.cond, &record.mutex, deadline)) {
+  }
+  EXPECT_EQ(record.finished->len, 1u);
+  EXPECT_EQ(record.running_bulk, 1u);
+  record.released = TRUE;
+  g_cond_broadcast(&record.cond);
+  g_mutex_unlock(&record.mutex);
+
+  // Freeing runs the rest of the queue, one bulk task at a time and in order.
+  task_scheduler_free(scheduler);
+  ASSERT_EQ(record.finished->len, 4u);
+  EXPECT_STREQ(static_cast<const gchar*>(g_ptr_array_index(record.finished, 0)), "interactive");
+  for (guint i = 0; i < 3; i++) {
+    EXPECT_STREQ(static_cast<const gchar*>(g_ptr_array_index(record.finished, i + 1)),
+                 bulk[i].name);
+  }
+  EXPECT_EQ(record.max_running_bulk, 1u);
+
+  g_ptr_array_unref(record.finished);
+  g_cond_clear(&record.cond);
+  g_mutex_clear(&record.mutex);
+}
+
+TEST(EnteDirectoryPickerPlugin, PortalChooserSelectsDirectoryThroughMockPortal) {
+  g_autofree gchar* dbus_daemon = g_find_program_in_path("dbus-daemon");
+  if (!dbus_daemon) {
+    GTEST_SKIP() << "dbus-daemon is needed to run a private session bus";
+  }
+
+  // Owns the portal's name on a private bus from a separate connection, as
+  // xdg-desktop-portal would. The chooser finds the bus through
+  // DBUS_SESSION_BUS_ADDRESS, which g_test_dbus_up() sets.
+  g_autoptr(GTestDBus) bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+  g_test_dbus_up(bus);
+  g_autoptr(GDBusConnection) portal = g_dbus_connection_new_for_address_sync(
+      g_test_dbus_get_bus_address(bus),
+      static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+      nullptr, nullptr, nullptr);
+  ASSERT_NE(portal, nullptr);
+
+  MockPortalState state = {};
+  g_autoptr(GDBusNodeInfo) node = g_dbus_node_info_new_for_xml(kMockPortalXml, nullptr);
+  GDBusInterfaceVTable vtable = {mock_portal_method_call, mock_portal_get_property, nullptr, {}};
+  guint registration = g_dbus_connection_register_object(
+      portal, "/org/freedesktop/portal/desktop", node->interfaces[0], &vtable, &state,
+      nullptr, nullptr);
+  ASSERT_NE(registration, 0u);
+  g_autoptr(GVariant) owner = g_dbus_connection_call_sync(
+      portal, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+      "RequestName", g_variant_new("(su)", "org.freedesktop.portal.Desktop", 4),
+      G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+  ASSERT_NE(owner, nullptr);
+
+  // The request is made before the probe has finished and waits for it.
+  PortalFileChooser* chooser = portal_file_chooser_new();
+  portal_file_chooser_select_directory(chooser, "", "Select Directory",
+                                       on_directory_selected, &state);
+  while (!state.done) {
+    g_main_context_iteration(nullptr, TRUE);
+  }
+
+  EXPECT_TRUE(state.directory_requested);
+  EXPECT_STREQ(state.selected_path, "/tmp/Chosen Folder");
+  g_free(state.selected_path);
+
+  portal_file_chooser_free(chooser);
+  g_dbus_connection_unregister_object(portal, registration);
+  g_dbus_connection_close_sync(portal, nullptr, nullptr);
+  g_test_dbus_down(bus);
+}
+
 }  // namespace test
 }  // namespace ente_directory_picker
@@ -0,0 +1,247 @@
+#include <flutter_linux/flutter_linux.h>
+#include <glib/gstdio.h>
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include "ente_directory_picker_plugin_private.h"
+#include "method_stats.h"
+
+// Fires interleaved method calls at the handlers from many threads at once,
+// as overlapping calls from several isolates would, and checks that every one
+// succeeds and sees consistent data. Build it with
+// -Dente_directory_picker_sanitizer=thread or =address to run it under a
+// sanitizer. Throughput and per-method latency percentiles are printed at the
+// end so runs can be compared. Tracing is on throughout, so its writer is
+// exercised as well.
+
+namespace ente_directory_picker {
+namespace test {
+
+static const guint kCallsPerThread = 500;
+static const guint kSharedFiles = 8;
+static const guint kSubdirectories = 4;
+static const guint kFilesPerSubdirectory = 64;
+
+// Every write replaces a shared file with one of these, whole.
+static const gchar* const kContents[] = {
+    "",
+    "short",
+    "a somewhat longer line of text that spans more than a few words\n",
+    "line one\nline two\nline three\nline four\nline five\nline six\n",
+};
+
+typedef struct {
+  gchar* shared_directory;
+  gchar* subdirectories[kSubdirectories];
+  guint thread_index;
+  // Failures are counted rather than asserted, since gtest assertions are
+  // only reliable on the main thread.
+  guint failures;
+  gchar* first_failure;
+} StressWorker;
+
+static void record_failure(StressWorker* worker, const gchar* method, const gchar* message) {
+  if (worker->failures++ == 0) {
+    worker->first_failure = g_strdup_printf("%s: %s", method, message);
+  }
+}
+
+static gboolean is_known_content(const gchar* content) {
+  for (const gchar* known : kContents) {
+    if (strcmp(content, known) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Calls handler as the method call handler would, charging the call to
+// method's counters, and returns its result or NULL after recording a
+// failure.
+static FlValue* call(StressWorker* worker, const gchar* method,
+                     FlMethodResponse* (*handler)(FlValue*), FlValue* args) {
+  MethodStats* stats = method_stats_get(method);
+  MethodStats* previous = method_stats_set_current(stats);
+  gint64 start_time = g_get_monotonic_time();
+  g_autoptr(FlMethodResponse) response = handler(args);
+  method_stats_set_current(previous);
+  method_stats_record_call(stats, g_get_monotonic_time() - start_time,
+                           FL_IS_METHOD_ERROR_RESPONSE(response));
+
+  if (FL_IS_METHOD_ERROR_RESPONSE(response)) {
+    record_failure(worker, method,
+                   fl_method_error_response_get_message(FL_METHOD_ERROR_RESPONSE(response)));
+    return nullptr;
+  }
+  FlValue* result =
+      fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+  return fl_value_ref(result);
+}
+
+static void call_write_file(StressWorker* worker, GRand* rand) {
+  g_autofree gchar* file_name = g_strdup_printf("shared_%u.txt", g_rand_int_range(rand, 0, kSharedFiles));
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(worker->shared_directory));
+  fl_value_set_string_take(args, "fileName", fl_value_new_string(file_name));
+  fl_value_set_string_take(
+      args, "content", fl_value_new_string(kContents[g_rand_int_range(rand, 0, G_N_ELEMENTS(kContents))]));
+  fl_value_set_string_take(args, "durability", fl_value_new_string("none"));
+  g_autoptr(FlValue) result = call(worker, "writeFile", write_file, args);
+  if (result && (fl_value_get_type(result) != FL_VALUE_TYPE_BOOL || !fl_value_get_bool(result))) {
+    record_failure(worker, "writeFile", "did not report success");
+  }
+}
+
+static void call_read_file(StressWorker* worker, GRand* rand) {
+  g_autofree gchar* file_name = g_strdup_printf("shared_%u.txt", g_rand_int_range(rand, 0, kSharedFiles));
+  g_autofree gchar* file_path = g_build_filename(worker->shared_directory, file_name, nullptr);
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "filePath", fl_value_new_string(file_path));
+  g_autoptr(FlValue) result = call(worker, "readFile", read_file, args);
+  // Writes replace files atomically, so a read sees one whole version.
+  if (result && (fl_value_get_type(result) != FL_VALUE_TYPE_STRING ||
+                 !is_known_content(fl_value_get_string(result)))) {
+    record_failure(worker, "readFile", "read a partially written file");
+  }
+}
+
+static void call_list_directory(StressWorker* worker, GRand* rand) {
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(
+      args, "directoryPath",
+      fl_value_new_string(worker->subdirectories[g_rand_int_range(rand, 0, kSubdirectories)]));
+  g_autoptr(FlValue) result = call(worker, "listDirectory", list_directory, args);
+  if (result && fl_value_get_length(result) != kFilesPerSubdirectory) {
+    record_failure(worker, "listDirectory", "listed the wrong number of entries");
+  }
+}
+
+static void call_get_directory_details(StressWorker* worker, GRand* rand) {
+  // The shared directory also holds temporary files while writes are in
+  // flight, so only the stable subdirectories have a known size.
+  gboolean shared = g_rand_boolean(rand);
+  const gchar* directory = shared ? worker->shared_directory
+                                  : worker->subdirectories[g_rand_int_range(rand, 0, kSubdirectories)];
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "directoryPath", fl_value_new_string(directory));
+  g_autoptr(FlValue) result = call(worker, "getDirectoryDetails", get_directory_details, args);
+  if (result && !shared && fl_value_get_length(result) != kFilesPerSubdirectory) {
+    record_failure(worker, "getDirectoryDetails", "described the wrong number of entries");
+  }
+}
+
+static gpointer stress_thread(gpointer data) {
+  StressWorker* worker = static_cast<StressWorker*>(data);
+  // Seeded per thread so a failing interleaving of calls can be replayed.
+  GRand* rand = g_rand_new_with_seed(worker->thread_index);
+  for (guint i = 0; i < kCallsPerThread; i++) {
+    switch (g_rand_int_range(rand, 0, 4)) {
+      case 0:
+        call_write_file(worker, rand);
+        break;
+      case 1:
+        call_read_file(worker, rand);
+        break;
+      case 2:
+        call_list_directory(worker, rand);
+        break;
+      default:
+        call_get_directory_details(worker, rand);
+        break;
+    }
+  }
+  g_rand_free(rand);
+  return nullptr;
+}
+
+static void remove_tree(const gchar* path) {
+  GDir* dir = g_dir_open(path, 0, nullptr);
+  if (dir) {
+    const gchar* name;
+    while ((name = g_dir_read_name(dir)) != nullptr) {
+      g_autofree gchar* child = g_build_filename(path, name, nullptr);
+      remove_tree(child);
+    }
+    g_dir_close(dir);
+    g_rmdir(path);
+  } else {
+    g_unlink(path);
+  }
+}
+
+TEST(EnteDirectoryPickerStress, InterleavedCallsFromManyThreadsAllSucceed) {
+  g_autofree gchar* root = g_dir_make_tmp("ente_directory_picker_stress_XXXXXX", nullptr);
+  ASSERT_NE(root, nullptr);
+  g_autofree gchar* shared_directory = g_build_filename(root, "shared", nullptr);
+  ASSERT_EQ(g_mkdir(shared_directory, 0755), 0);
+  for (guint i = 0; i < kSharedFiles; i++) {
+    g_autofree gchar* file_name = g_strdup_printf("shared_%u.txt", i);
+    g_autofree gchar* file_path = g_build_filename(shared_directory, file_name, nullptr);
+    ASSERT_TRUE(g_file_set_contents(file_path, kContents[0], -1, nullptr));
+  }
+  gchar* subdirectories[kSubdirectories];
+  for (guint i = 0; i < kSubdirectories; i++) {
+    g_autofree gchar* name = g_strdup_printf("tree_%u", i);
+    subdirectories[i] = g_build_filename(root, name, nullptr);
+    ASSERT_EQ(g_mkdir(subdirectories[i], 0755), 0);
+    for (guint j = 0; j < kFilesPerSubdirectory; j++) {
+      g_autofree gchar* file_name = g_strdup_printf("file_%u.txt", j);
+      g_autofree gchar* file_path = g_build_filename(subdirectories[i], file_name, nullptr);
+      ASSERT_TRUE(g_file_set_contents(file_path, "content", -1, nullptr));
+    }
+  }
+
+  g_autoptr(FlMethodResponse) reset_response = reset_stats();
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(reset_response));
+  g_autofree gchar* trace_path = g_build_filename(root, "trace.json", nullptr);
+  g_autoptr(FlValue) trace_args = fl_value_new_map();
+  fl_value_set_string_take(trace_args, "path", fl_value_new_string(trace_path));
+  g_autoptr(FlMethodResponse) start_response = start_tracing(trace_args);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(start_response));
+  guint n_threads = MAX(g_get_num_processors() * 2, 8u);
+  g_autofree StressWorker* workers = g_new0(StressWorker, n_threads);
+  g_autofree GThread** threads = g_new0(GThread*, n_threads);
+
+  gint64 start_time = g_get_monotonic_time();
+  for (guint i = 0; i < n_threads; i++) {
+    workers[i].shared_directory = shared_directory;
+    memcpy(workers[i].subdirectories, subdirectories, sizeof(subdirectories));
+    workers[i].thread_index = i;
+    threads[i] = g_thread_new("ente-stress", stress_thread, &workers[i]);
+  }
+  for (guint i = 0; i < n_threads; i++) {
+    g_thread_join(threads[i]);
+  }
+  gint64 elapsed_us = MAX(g_get_monotonic_time() - start_time, 1);
+  g_autoptr(FlMethodResponse) stop_response = stop_tracing();
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(stop_response));
+
+  for (guint i = 0; i < n_threads; i++) {
+    EXPECT_EQ(workers[i].failures, 0u)
+        << "thread " << i << " first failed with " << workers[i].first_failure;
+    g_free(workers[i].first_failure);
+  }
+
+  guint64 total_calls = static_cast<guint64>(n_threads) * kCallsPerThread;
+  g_print("%u threads made %" G_GUINT64_FORMAT " calls in %.2f s (%.0f calls/s)\n", n_threads,
+          total_calls, elapsed_us / 1e6, total_calls * 1e6 / elapsed_us);
+  g_autoptr(GArray) snapshots = method_stats_snapshot();
+  guint64 recorded_calls = 0;
+  for (guint i = 0; i < snapshots->len; i++) {
+    const MethodStatsSnapshot* snapshot = &g_array_index(snapshots, MethodStatsSnapshot, i);
+    g_print("  %-20s %6" G_GUINT64_FORMAT " calls  p50 %6" G_GUINT64_FORMAT " us  p99 %6" G_GUINT64_FORMAT
+            " us  max %6" G_GUINT64_FORMAT " us\n",
+            snapshot->method, snapshot->calls, snapshot->p50_us, snapshot->p99_us, snapshot->max_us);
+    recorded_calls += snapshot->calls;
+  }
+  EXPECT_EQ(recorded_calls, total_calls);
+
+  for (gchar* subdirectory : subdirectories) {
+    g_free(subdirectory);
+  }
+  remove_tree(root);
+}
+
+}  // namespace test
+}  // namespace ente_directory_picker
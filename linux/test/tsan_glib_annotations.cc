@@ -0,0 +1,75 @@
+#include <dlfcn.h>
+#include <glib.h>
+#include <sanitizer/tsan_interface.h>
+
+// GLib's mutexes, condition variables and one-time initialization are built
+// on futexes, which ThreadSanitizer cannot see, so every access they guard
+// would be reported as a race. Linked into sanitized test binaries only, these
+// wrappers replace the GLib functions the plugin calls and tell
+// ThreadSanitizer about the ordering each one provides.
+
+template <typename Function>
+static Function next_symbol(const char* name) {
+  void* symbol = dlsym(RTLD_NEXT, name);
+  if (!symbol) {
+    g_error("ThreadSanitizer annotations could not find %s", name);
+  }
+  return reinterpret_cast<Function>(symbol);
+}
+
+extern "C" {
+
+void g_mutex_lock(GMutex* mutex) {
+  static auto real = next_symbol<void (*)(GMutex*)>("g_mutex_lock");
+  real(mutex);
+  __tsan_acquire(mutex);
+}
+
+gboolean g_mutex_trylock(GMutex* mutex) {
+  static auto real = next_symbol<gboolean (*)(GMutex*)>("g_mutex_trylock");
+  if (!real(mutex)) {
+    return FALSE;
+  }
+  __tsan_acquire(mutex);
+  return TRUE;
+}
+
+void g_mutex_unlock(GMutex* mutex) {
+  static auto real = next_symbol<void (*)(GMutex*)>("g_mutex_unlock");
+  __tsan_release(mutex);
+  real(mutex);
+}
+
+void g_cond_wait(GCond* cond, GMutex* mutex) {
+  static auto real = next_symbol<void (*)(GCond*, GMutex*)>("g_cond_wait");
+  __tsan_release(mutex);
+  real(cond, mutex);
+  __tsan_acquire(mutex);
+}
+
+gboolean g_cond_wait_until(GCond* cond, GMutex* mutex, gint64 end_time) {
+  static auto real = next_symbol<gboolean (*)(GCond*, GMutex*, gint64)>("g_cond_wait_until");
+  __tsan_release(mutex);
+  gboolean signalled = real(cond, mutex, end_time);
+  __tsan_acquire(mutex);
+  return signalled;
+}
+
+// The fast path of g_once_init_enter() is an atomic load inlined into the
+// caller, which ThreadSanitizer does see; only the slow path needs help.
+gboolean (g_once_init_enter)(volatile void* location) {
+  static auto real = next_symbol<gboolean (*)(volatile void*)>("g_once_init_enter");
+  gboolean initialize = real(location);
+  if (!initialize) {
+    __tsan_acquire(const_cast<void*>(location));
+  }
+  return initialize;
+}
+
+void (g_once_init_leave)(volatile void* location, gsize result) {
+  static auto real = next_symbol<void (*)(volatile void*, gsize)>("g_once_init_leave");
+  __tsan_release(const_cast<void*>(location));
+  real(location, result);
+}
+
+}  // extern "C"
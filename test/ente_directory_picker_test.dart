@@ -1,3 +1,5 @@
+import 'dart:typed_data';
+
 import 'package:flutter_test/flutter_test.dart';
 import 'package:ente_directory_picker/ente_directory_picker.dart';
 import 'package:ente_directory_picker/ente_directory_picker_platform_interface.dart';
@@ -17,25 +19,210 @@ class MockEnteDirectoryPickerPlatform
   @override
   Future<bool> hasPermission(String directoryPath) => Future.value(true);
 
+  @override
+  Future<Map<String, bool>> hasPermissions(List<String> directoryPaths) =>
+    Future.value({for (final path in directoryPaths) path: !path.endsWith('missing')});
+
   @override
   Future<bool> requestPermission(String directoryPath) => Future.value(true);
 
   @override
-  Future<bool> writeFile(String directoryPath, String fileName, String content) => Future.value(true);
+  Future<bool> writeFile(String directoryPath, String fileName, String content,
+      {WriteDurability durability = WriteDurability.data,
+      bool writeBehind = false,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) => Future.value(true);
+
+  @override
+  Future<bool> writeFileBytes(String directoryPath, String fileName, Uint8List bytes,
+      {WriteDurability durability = WriteDurability.data,
+      int? expectedSize,
+      bool sparse = false,
+      String? requestId}) => Future.value(bytes.isNotEmpty);
+
+  @override
+  Future<bool> appendToFile(String directoryPath, String fileName, String data,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) => Future.value(true);
+
+  @override
+  Future<bool> appendRecords(String directoryPath, String fileName, List<String> records,
+      {WriteDurability durability = WriteDurability.data, int? expectedSize}) =>
+    Future.value(records.isNotEmpty);
+
+  @override
+  Future<bool> flush() => Future.value(true);
 
   @override
-  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false}) => 
+  Future<bool> writeFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) =>
+    Future.value(files.isNotEmpty);
+
+  @override
+  Future<bool> copyFile(String sourcePath, String directoryPath, String fileName,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) =>
+    Future.value(sourcePath != '$directoryPath/$fileName');
+
+  final Set<String> _exported = {};
+
+  @override
+  Future<Map<String, int>> exportFiles(String directoryPath, Map<String, String> files,
+      {WriteDurability durability = WriteDurability.data, String? requestId}) {
+    final copied = files.keys.where((name) => !_exported.contains('$directoryPath/$name')).length;
+    _exported.addAll(files.keys.map((name) => '$directoryPath/$name'));
+    return Future.value({'copied': copied, 'skipped': files.length - copied});
+  }
+
+  @override
+  Future<List<String>?> listDirectory(String directoryPath, {bool recursive = false, String? requestId}) => 
     Future.value(['file1.txt', 'file2.txt', 'subfolder']);
 
   @override
-  Future<String?> readFile(String filePath) => Future.value('Mock file content');
+  Future<List<String>?> findFiles(String root, List<String> patterns,
+      {List<String> excludes = const [], int? maxDepth, bool includeDirectories = false,
+      String? requestId}) =>
+    Future.value(['$root/photos/a.jpg', '$root/photos/b.jpg']);
 
   @override
-  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath, {bool recursive = false}) =>
+  Future<List<Map<String, dynamic>>?> searchContent(String root, String query,
+      {List<String> patterns = const [], List<String> excludes = const [], int? maxDepth,
+      int maxResults = 1000, String? requestId}) =>
     Future.value([
+      {'path': '$root/notes.txt', 'line': 3, 'offset': 42, 'text': 'found $query here'}
+    ]);
+
+  @override
+  Future<Map<String, dynamic>?> indexDirectory(String root, {String? indexPath, String? requestId}) =>
+    Future.value({'indexPath': '/mock/cache/index', 'entries': 3, 'directories': 2, 'reusedDirectories': 1});
+
+  @override
+  Future<List<Map<String, dynamic>>?> queryIndex(String root, String query,
+      {bool substring = false, int limit = 100, String? indexPath}) =>
+    Future.value([
+      {'name': 'IMG_0001.jpg', 'path': '$root/photos/IMG_0001.jpg', 'isDirectory': false, 'size': 2048, 'lastModified': 1234567890}
+    ]);
+
+  @override
+  final Set<String> _runningRequests = {};
+
+  @override
+  Future<String?> readFile(String filePath, {String? requestId}) {
+    if (requestId != null) {
+      _runningRequests.add(requestId);
+    }
+    return Future.value('Mock file content');
+  }
+
+  @override
+  Future<List<Map<String, dynamic>>?> getDirectoryDetails(String directoryPath,
+      {bool recursive = false,
+      String? requestId,
+      DirectorySortKey? sortBy,
+      bool descending = false,
+      DirectoryEntryType? entryType,
+      List<String>? extensions,
+      int? minSize,
+      int? maxSize,
+      DateTime? modifiedAfter,
+      DateTime? modifiedBefore,
+      int? limit,
+      bool sortKeys = false}) {
+    final details = [
       {'name': 'file1.txt', 'path': '/mock/path/file1.txt', 'isDirectory': false, 'size': 1024, 'lastModified': 1234567890},
       {'name': 'subfolder', 'path': '/mock/path/subfolder', 'isDirectory': true, 'size': 0, 'lastModified': 1234567890}
-    ]);
+    ].where((item) => entryType == null ||
+        item['isDirectory'] == (entryType == DirectoryEntryType.directory)).toList();
+    if (sortKeys) {
+      for (var i = 0; i < details.length; i++) {
+        details[i]['sortKey'] = i;
+      }
+    }
+    return Future.value(limit == null ? details : details.take(limit).toList());
+  }
+
+  @override
+  Future<Map<String, dynamic>?> getTreeNodes(String directoryPath,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) =>
+    Future.value({
+      'name': 'path', 'path': directoryPath, 'isDirectory': true,
+      'size': aggregateSizes ? 3072 : null, 'childCount': 2, 'handle': 'root-handle',
+      'children': depth == 0 ? null : [
+        {'name': 'file1.txt', 'path': '$directoryPath/file1.txt', 'isDirectory': false,
+         'size': 1024, 'childCount': null, 'handle': null, 'children': null},
+        {'name': 'subfolder', 'path': '$directoryPath/subfolder', 'isDirectory': true,
+         'size': aggregateSizes ? 2048 : null, 'childCount': 1, 'handle': 'subfolder-handle',
+         'children': null},
+      ],
+    });
+
+  @override
+  Future<Map<String, dynamic>?> expandTreeNode(String handle,
+      {int depth = 1, bool aggregateSizes = false, String? requestId}) =>
+    handle == 'subfolder-handle'
+        ? getTreeNodes('/test/path/subfolder', depth: depth, aggregateSizes: aggregateSizes)
+        : Future.value(null);
+
+  @override
+  Future<int> prefetchFiles(List<String> paths) =>
+    Future.value(paths.where((path) => path.startsWith('/test/')).length);
+
+  @override
+  Future<int> evictFiles(List<String> paths) =>
+    Future.value(paths.where((path) => path.startsWith('/test/')).length);
+
+  @override
+  Future<Map<String, Map<String, dynamic>>> getMediaMetadata(List<String> paths,
+      {String? requestId}) =>
+    Future.value({
+      for (final path in paths.where((path) => path.endsWith('.jpg')))
+        path: {'format': 'jpeg', 'width': 4000, 'height': 3000, 'orientation': 6,
+               'captureTime': '2024-05-01T18:30:05+02:00'},
+    });
+
+  @override
+  Future<Map<String, dynamic>?> getFilesystemCapabilities(String path) =>
+    Future.value({
+      'fileSystem': 'btrfs', 'isNetwork': false, 'isFuse': false, 'supportsTmpfile': true,
+      'supportsReflink': true, 'supportsCopyFileRange': true, 'supportsFallocate': true,
+      'supportsIoUring': false, 'freeBytes': 1024, 'totalBytes': 4096
+    });
+
+  int _statsResets = 0;
+
+  @override
+  Future<Map<String, Map<String, int>>> getStats() =>
+    Future.value(_statsResets > 0 ? {} : {
+      'writeFile': {'calls': 2, 'errors': 1, 'p50Us': 120, 'p95Us': 480, 'p99Us': 480,
+          'maxUs': 480, 'bytesRead': 0, 'bytesWritten': 5, 'entries': 0}
+    });
+
+  @override
+  Future<bool> resetStats() {
+    _statsResets++;
+    return Future.value(true);
+  }
+
+  String? _tracePath;
+
+  @override
+  Future<bool> startTracing(String path) {
+    _tracePath = path;
+    return Future.value(true);
+  }
+
+  @override
+  Future<bool> stopTracing() => Future.value(_tracePath != null);
+
+  @override
+  Future<bool> cancel(String requestId) => Future.value(_runningRequests.remove(requestId));
+
+  @override
+  Stream<Map<String, dynamic>> get progress => Stream.fromIterable([
+    {'requestId': 'export-1', 'method': 'writeFiles', 'itemsDone': 1, 'itemsTotal': 2,
+        'bytesDone': 512, 'bytesTotal': 1024, 'currentPath': '/test/path/a.txt', 'done': false},
+    {'requestId': 'export-1', 'method': 'writeFiles', 'itemsDone': 2, 'itemsTotal': 2,
+        'bytesDone': 1024, 'bytesTotal': 1024, 'currentPath': '/test/path/b.txt', 'done': true},
+  ]);
 }
 
 void main() {
@@ -69,6 +256,15 @@ void main() {
     expect(await directoryPicker.hasPermission('/test/path'), true);
   });
 
+  test('hasPermissions', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    expect(await directoryPicker.hasPermissions(['/test/path', '/test/missing']),
+        {'/test/path': true, '/test/missing': false});
+  });
+
   test('writeFile', () async {
     EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
     MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
@@ -77,6 +273,62 @@ void main() {
     expect(await directoryPicker.writeFile('/test/path', 'test.txt', 'content'), true);
   });
 
+  test('writeFileBytes', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    expect(await directoryPicker.writeFileBytes('/test/path', 'video.mp4', Uint8List(16),
+        expectedSize: 1 << 30, sparse: true), true);
+  });
+
+  test('writeFiles', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    expect(await directoryPicker.writeFiles('/test/path', {'a.txt': 'a', 'b.txt': 'b'},
+        durability: WriteDurability.full), true);
+  });
+
+  test('copyFile', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    expect(await directoryPicker.copyFile('/test/source.jpg', '/test/path', 'copy.jpg'), true);
+  });
+
+  test('exportFiles skips files already exported', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final files = {'a.jpg': '/library/a.jpg', 'b.jpg': '/library/b.jpg'};
+    expect(await directoryPicker.exportFiles('/test/export', files), {'copied': 2, 'skipped': 0});
+    files['c.jpg'] = '/library/c.jpg';
+    expect(await directoryPicker.exportFiles('/test/export', files), {'copied': 1, 'skipped': 2});
+  });
+
+  test('writeTimestampFile with writeBehind and flush', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    expect(await directoryPicker.writeTimestampFile('/test/path', writeBehind: true), true);
+    expect(await directoryPicker.flush(), true);
+  });
+
+  test('appendRecords', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    expect(await directoryPicker.appendToFile('/test/path', 'activity.log', 'line\n'), true);
+    expect(await directoryPicker.appendRecords('/test/path', 'activity.log', ['a\n', 'b\n'],
+        durability: WriteDurability.none), true);
+  });
+
   test('generateTimestampFilename', () {
     EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
     final filename = directoryPicker.generateTimestampFilename();
@@ -102,6 +354,41 @@ void main() {
     expect(files, ['file1.txt', 'file2.txt', 'subfolder']);
   });
 
+  test('findFiles', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final files = await directoryPicker.findFiles('/test/path', ['*.jpg'], excludes: ['.thumbnails']);
+    expect(files, ['/test/path/photos/a.jpg', '/test/path/photos/b.jpg']);
+  });
+
+  test('searchContent', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final matches = await directoryPicker.searchContent('/test/path', 'needle', patterns: ['*.txt']);
+    expect(matches?.length, 1);
+    expect(matches?[0]['path'], '/test/path/notes.txt');
+    expect(matches?[0]['line'], 3);
+    expect(matches?[0]['text'], 'found needle here');
+  });
+
+  test('indexDirectory and queryIndex', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final stats = await directoryPicker.indexDirectory('/test/path');
+    expect(stats?['entries'], 3);
+    expect(stats?['reusedDirectories'], 1);
+
+    final entries = await directoryPicker.queryIndex('/test/path', 'img_');
+    expect(entries?.length, 1);
+    expect(entries?[0]['path'], '/test/path/photos/IMG_0001.jpg');
+  });
+
   test('readFile', () async {
     EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
     MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
@@ -122,5 +409,108 @@ void main() {
     expect(details?[0]['isDirectory'], false);
     expect(details?[1]['name'], 'subfolder');
     expect(details?[1]['isDirectory'], true);
+
+    final directories = await directoryPicker.getDirectoryDetails('/test/path',
+        entryType: DirectoryEntryType.directory, sortBy: DirectorySortKey.name, limit: 10);
+    expect(directories?.map((item) => item['name']), ['subfolder']);
+
+    final keyed = await directoryPicker.getDirectoryDetails('/test/path',
+        sortBy: DirectorySortKey.naturalName, sortKeys: true);
+    expect(keyed?.map((item) => item['sortKey']), [0, 1]);
+  });
+
+  test('prefetchFiles and evictFiles', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final paths = ['/test/path/1.jpg', '/test/path/2.jpg', '/missing/3.jpg'];
+    expect(await directoryPicker.prefetchFiles(paths), 2);
+    expect(await directoryPicker.evictFiles(paths), 2);
+  });
+
+  test('getTreeNodes and expandTreeNode', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final root = await directoryPicker.getTreeNodes('/test/path', aggregateSizes: true);
+    expect(root?['size'], 3072);
+    expect(root?['childCount'], 2);
+    final subfolder = (root?['children'] as List)[1] as Map<String, dynamic>;
+    expect(subfolder['children'], isNull);
+
+    final expanded = await directoryPicker.expandTreeNode(subfolder['handle'] as String);
+    expect(expanded?['path'], '/test/path/subfolder');
+    expect(expanded?['children'], isNotNull);
+    expect(await directoryPicker.expandTreeNode('stale-handle'), isNull);
+  });
+
+  test('getMediaMetadata', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final metadata = await directoryPicker.getMediaMetadata(['/test/1.jpg', '/test/notes.txt']);
+    expect(metadata.keys, ['/test/1.jpg']);
+    expect(metadata['/test/1.jpg']?['format'], 'jpeg');
+    expect(metadata['/test/1.jpg']?['orientation'], 6);
+    expect(metadata['/test/1.jpg']?['captureTime'], '2024-05-01T18:30:05+02:00');
+  });
+
+  test('getFilesystemCapabilities', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final capabilities = await directoryPicker.getFilesystemCapabilities('/test/path');
+    expect(capabilities?['fileSystem'], 'btrfs');
+    expect(capabilities?['supportsReflink'], true);
+    expect(capabilities?['freeBytes'], 1024);
+  });
+
+  test('getStats and resetStats', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final stats = await directoryPicker.getStats();
+    expect(stats['writeFile']?['calls'], 2);
+    expect(stats['writeFile']?['bytesWritten'], 5);
+
+    expect(await directoryPicker.resetStats(), true);
+    expect(await directoryPicker.getStats(), isEmpty);
+  });
+
+  test('startTracing and stopTracing', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    expect(await directoryPicker.startTracing('/test/trace.json'), true);
+    expect(await directoryPicker.stopTracing(), true);
+  });
+
+  test('cancel', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    await directoryPicker.readFile('/test/path/large.bin', requestId: 'read-1');
+    expect(await directoryPicker.cancel('read-1'), true);
+    expect(await directoryPicker.cancel('read-2'), false);
+  });
+
+  test('progress', () async {
+    EnteDirectoryPicker directoryPicker = EnteDirectoryPicker();
+    MockEnteDirectoryPickerPlatform fakePlatform = MockEnteDirectoryPickerPlatform();
+    EnteDirectoryPickerPlatform.instance = fakePlatform;
+
+    final events = await directoryPicker.progress
+        .where((event) => event['requestId'] == 'export-1')
+        .toList();
+    expect(events.length, 2);
+    expect(events.first['bytesDone'], 512);
+    expect(events.last['done'], true);
   });
 }